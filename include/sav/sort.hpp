@@ -13,37 +13,69 @@
 #include <shrinkwrap/zstd.hpp>
 
 #include <string>
+#include <cstdint>
 #include <random>
 #include <unordered_map>
 
-class less_than_comparator
+/**
+ * Sort position and contig rank of a record, computed once so that comparisons do not look up contigs or scan
+ * alleles. Contig rank is stored in the upper 24 bits of packed and the sort point in the lower 40 bits.
+ */
+struct sort_key
+{
+  static const std::uint64_t unknown_contig_rank = 0xFFFFFF;
+
+  std::uint64_t packed;
+  const std::string* contig; // Only compared when both contigs are missing from headers.
+  std::size_t index; // Input order, which breaks ties so that sorting is stable.
+
+  std::uint64_t contig_rank() const { return packed >> 40u; }
+};
+
+class sort_key_builder
 {
 public:
-  less_than_comparator(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map);
-  bool operator()(const savvy::site_info& a, const savvy::site_info& b) const;
-private:
-  bool contig_compare(const std::string& a, const std::string& b) const;
-  bool left(const savvy::site_info& a, const savvy::site_info& b) const;
-  bool right(const savvy::site_info& a, const savvy::site_info& b) const;
-  bool mid(const savvy::site_info& a, const savvy::site_info& b) const;
+  sort_key_builder(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map);
+  sort_key operator()(const savvy::site_info& site, std::size_t index) const;
 private:
   std::unordered_map<std::string, std::size_t> contig_order_map_;
   savvy::s1r::sort_point sort_type_;
 };
 
+/**
+ * Orders keys by contig rank (contigs missing from headers go last, by name) and then by sort point.
+ */
+class less_than_comparator
+{
+public:
+  bool operator()(const sort_key& a, const sort_key& b) const
+  {
+    if (a.contig_rank() != b.contig_rank())
+      return a.contig_rank() < b.contig_rank();
+    if (a.contig_rank() == sort_key::unknown_contig_rank && *a.contig != *b.contig)
+      return *a.contig < *b.contig;
+    if (a.packed != b.packed)
+      return a.packed < b.packed;
+    return a.index < b.index;
+  }
+};
+
+/**
+ * Reverse of less_than_comparator, except that ties remain in input order.
+ */
 class greater_than_comparator
 {
 public:
-  greater_than_comparator(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map);
-  bool operator()(const savvy::site_info& a, const savvy::site_info& b) const;
-private:
-  bool contig_compare(const std::string& a, const std::string& b) const;
-  bool left(const savvy::site_info& a, const savvy::site_info& b) const;
-  bool right(const savvy::site_info& a, const savvy::site_info& b) const;
-  bool mid(const savvy::site_info& a, const savvy::site_info& b) const;
-private:
-  std::unordered_map<std::string, std::size_t> contig_order_map_;
-  savvy::s1r::sort_point sort_type_;
+  bool operator()(const sort_key& a, const sort_key& b) const
+  {
+    if (a.contig_rank() != b.contig_rank())
+      return a.contig_rank() > b.contig_rank();
+    if (a.contig_rank() == sort_key::unknown_contig_rank && *a.contig != *b.contig)
+      return *a.contig > *b.contig;
+    if (a.packed != b.packed)
+      return a.packed > b.packed;
+    return a.index < b.index;
+  }
 };
 
 class random_string_generator
@@ -12,6 +12,7 @@
 #include <string>
 #include <vector>
 #include <unordered_set>
+#include <utility>
 
 savvy::genomic_region string_to_region(const std::string& s);
 std::string join_vector_to_string(const std::vector<std::string>& vec, std::string delim);
@@ -20,4 +21,11 @@ std::unordered_set<std::string> split_string_to_set(const char* in, char delim);
 std::unordered_set<std::string> split_file_to_set(const char* in);
 std::vector<std::string> split_file_to_vector(const char* in, std::size_t size_hint = 0);
 
+/**
+ * Appends contig, FILTER, INFO and FORMAT headers from src that are missing from dest. Other headers are only
+ * taken from dest.
+ * @return False if a field is defined with a different Number or Type
+ */
+bool merge_headers(std::vector<std::pair<std::string, std::string>>& dest, const std::vector<std::pair<std::string, std::string>>& src);
+
 #endif //SAVVY_SAV_UTILITY_HPP
@@ -0,0 +1,313 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_BGZF_HPP
+#define LIBSAVVY_BGZF_HPP
+
+#include "thread_pool.hpp"
+#include "parallel_obuf.hpp"
+
+#include <zlib.h>
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Inflates the compressed data of one BGZF block and verifies its checksum.
+     * @param cdata Raw deflate data
+     * @param csize Size of raw deflate data
+     * @param isize Uncompressed size from block footer
+     * @param crc CRC32 from block footer
+     * @param dest Destination buffer (resized to isize)
+     * @return False if data is corrupt
+     */
+    inline bool inflate_bgzf_block(const char* cdata, std::size_t csize, std::uint32_t isize, std::uint32_t crc, std::vector<char>& dest)
+    {
+      dest.resize(isize);
+      if (isize == 0)
+        return true; // EOF marker
+
+      z_stream zs;
+      std::memset(&zs, 0, sizeof(zs));
+      if (inflateInit2(&zs, -15) != Z_OK)
+        return false;
+
+      zs.next_in = (Bytef*)cdata;
+      zs.avail_in = uInt(csize);
+      zs.next_out = (Bytef*)dest.data();
+      zs.avail_out = uInt(isize);
+      int res = inflate(&zs, Z_FINISH);
+      inflateEnd(&zs);
+
+      return res == Z_STREAM_END && zs.total_out == isize && crc32(crc32(0L, Z_NULL, 0), (const Bytef*)dest.data(), isize) == crc;
+    }
+
+    /// Maximum uncompressed size of a written BGZF block (same as htslib), so that compressed blocks fit in 64 KiB.
+    static const std::size_t bgzf_max_block_size = 0xFF00;
+
+    /**
+     * Compresses data as a single BGZF block. Data that does not fit in a block after compression is stored.
+     * @param data Uncompressed data (at most bgzf_max_block_size bytes)
+     * @param sz Size of uncompressed data
+     * @param dest Destination buffer (resized to size of block)
+     * @param level Deflate compression level (capped at 9)
+     * @return False if compression fails
+     */
+    inline bool deflate_bgzf_block(const char* data, std::size_t sz, std::vector<char>& dest, int level)
+    {
+      const std::size_t header_size = 18;
+      const std::size_t footer_size = 8;
+      if (sz > bgzf_max_block_size)
+        return false;
+
+      for (int lvl = std::max(0, std::min(level, 9)); ; lvl = 0)
+      {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, lvl, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+          return false;
+
+        dest.resize(header_size + deflateBound(&zs, uLong(sz)) + footer_size);
+        zs.next_in = (Bytef*)data;
+        zs.avail_in = uInt(sz);
+        zs.next_out = (Bytef*)(dest.data() + header_size);
+        zs.avail_out = uInt(dest.size() - header_size - footer_size);
+        int res = deflate(&zs, Z_FINISH);
+        deflateEnd(&zs);
+        if (res != Z_STREAM_END)
+          return false;
+
+        std::size_t block_size = header_size + zs.total_out + footer_size;
+        if (block_size > 0x10000u)
+        {
+          if (lvl == 0)
+            return false;
+          continue;
+        }
+
+        static const unsigned char header[header_size - 2] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+        std::memcpy(dest.data(), header, sizeof(header));
+        std::uint32_t footer[2] = {std::uint32_t(crc32(crc32(0L, Z_NULL, 0), (const Bytef*)data, uInt(sz))), std::uint32_t(sz)};
+        unsigned char* p = (unsigned char*)dest.data();
+        p[16] = (unsigned char)((block_size - 1) & 0xFFu);
+        p[17] = (unsigned char)((block_size - 1) >> 8u);
+        p += block_size - footer_size;
+        for (std::size_t i = 0; i < footer_size; ++i)
+          p[i] = (unsigned char)(footer[i / 4] >> (8u * (i % 4)));
+        dest.resize(block_size);
+        return true;
+      }
+    }
+
+    /**
+     * Output stream buffer that writes BGZF blocks compressed on worker threads. tellp() returns a virtual
+     * offset but waits for pending blocks, so block_index(), block_fill() and block_offset() should be used to
+     * compute virtual offsets without stalling.
+     */
+    class parallel_bgzf_obuf : public parallel_obuf
+    {
+    public:
+      /**
+       * @param file_path Path to output file
+       * @param compression_level Deflate compression level (capped at 9)
+       * @param num_threads Number of worker threads
+       */
+      parallel_bgzf_obuf(const std::string& file_path, int compression_level, std::size_t num_threads) :
+        parallel_obuf(file_path, deflate_bgzf_block, compression_level, num_threads, bgzf_max_block_size, eof_block())
+      {
+      }
+    protected:
+      pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which)
+      {
+        if (off != 0 || way != std::ios_base::cur || !(which & std::ios_base::out) || !drain())
+          return pos_type(off_type(-1));
+
+        return pos_type(off_type(file_position() << 16u | block_fill()));
+      }
+    private:
+      static std::vector<char> eof_block()
+      {
+        static const unsigned char eof[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+        return std::vector<char>(eof, eof + sizeof(eof));
+      }
+    };
+
+    /**
+     * Reads a BGZF file from a virtual offset and inflates batches of blocks on the shared thread pool. Blocks
+     * are independent, so decompression scales with the pool while data is still returned in file order.
+     */
+    class bgzf_block_reader
+    {
+    public:
+      /**
+       * @param file_path Path to BGZF file
+       * @param virtual_offset Offset of first block shifted left by 16 bits plus offset into its uncompressed data
+       */
+      bgzf_block_reader(const std::string& file_path, std::uint64_t virtual_offset) :
+        fp_(std::fopen(file_path.c_str(), "rb")),
+        skip_(virtual_offset & 0xFFFFu)
+      {
+        good_ = fp_ && std::fseek(fp_, long(virtual_offset >> 16u), SEEK_SET) == 0;
+      }
+
+      ~bgzf_block_reader()
+      {
+        if (fp_)
+          std::fclose(fp_);
+      }
+
+      bgzf_block_reader(const bgzf_block_reader&) = delete;
+      bgzf_block_reader& operator=(const bgzf_block_reader&) = delete;
+
+      bool good() const { return good_; }
+
+      /**
+       * Checks whether the next block has a valid BGZF header without consuming it.
+       * @return False if file is not BGZF (e.g., plain gzip)
+       */
+      bool peek_header()
+      {
+        if (!good_)
+          return false;
+        long pos = std::ftell(fp_);
+        raw_block b;
+        bool ret = read_raw_block(b) || (good_ && b.eof);
+        good_ = std::fseek(fp_, pos, SEEK_SET) == 0 && ret;
+        return good_;
+      }
+
+      /**
+       * Inflates up to max_blocks blocks and appends the uncompressed data to dest.
+       * @param dest Destination buffer
+       * @param max_blocks Maximum number of blocks to read
+       * @return False at end of file or if file is corrupt (check good())
+       */
+      bool read(std::vector<char>& dest, std::size_t max_blocks)
+      {
+        if (raw_.size() < max_blocks)
+          raw_.resize(max_blocks);
+
+        std::size_t n = 0;
+        while (n < max_blocks && read_raw_block(raw_[n]))
+          ++n;
+
+        if (!good_ || n == 0)
+          return false;
+
+        std::atomic<bool> ok(true);
+        shared_thread_pool().run(n, [this, &ok](std::size_t i)
+        {
+          raw_block& b = raw_[i];
+          if (!inflate_bgzf_block(b.cdata.data(), b.cdata.size(), b.isize, b.crc, b.data))
+            ok = false;
+        });
+
+        if (!ok)
+        {
+          std::fprintf(stderr, "Error: corrupt BGZF block\n");
+          good_ = false;
+          return false;
+        }
+
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          std::size_t skip = std::min(skip_, raw_[i].data.size());
+          skip_ -= skip;
+          dest.insert(dest.end(), raw_[i].data.begin() + skip, raw_[i].data.end());
+        }
+
+        return true;
+      }
+    private:
+      struct raw_block
+      {
+        std::vector<char> cdata;
+        std::vector<char> data;
+        std::uint32_t isize = 0;
+        std::uint32_t crc = 0;
+        bool eof = false;
+      };
+
+      static std::uint32_t le32(const unsigned char* p)
+      {
+        return std::uint32_t(p[0]) | std::uint32_t(p[1]) << 8u | std::uint32_t(p[2]) << 16u | std::uint32_t(p[3]) << 24u;
+      }
+
+      bool read_raw_block(raw_block& b)
+      {
+        unsigned char hdr[12];
+        std::size_t sz = std::fread(hdr, 1, sizeof(hdr), fp_);
+        if (sz == 0 && std::feof(fp_))
+        {
+          b.eof = true;
+          return false;
+        }
+
+        if (sz != sizeof(hdr) || hdr[0] != 31 || hdr[1] != 139 || hdr[2] != 8 || !(hdr[3] & 4u))
+        {
+          good_ = false;
+          return false;
+        }
+
+        std::size_t xlen = std::size_t(hdr[10]) | std::size_t(hdr[11]) << 8u;
+        std::vector<unsigned char> extra(xlen);
+        if (std::fread(extra.data(), 1, xlen, fp_) != xlen)
+        {
+          good_ = false;
+          return false;
+        }
+
+        // Find BSIZE in the "BC" subfield.
+        std::size_t block_size = 0;
+        for (std::size_t i = 0; i + 4 <= xlen; )
+        {
+          std::size_t slen = std::size_t(extra[i + 2]) | std::size_t(extra[i + 3]) << 8u;
+          if (extra[i] == 'B' && extra[i + 1] == 'C' && slen == 2 && i + 6 <= xlen)
+          {
+            block_size = (std::size_t(extra[i + 4]) | std::size_t(extra[i + 5]) << 8u) + 1;
+            break;
+          }
+          i += 4 + slen;
+        }
+
+        if (block_size < sizeof(hdr) + xlen + 8)
+        {
+          good_ = false;
+          return false;
+        }
+
+        b.cdata.resize(block_size - sizeof(hdr) - xlen - 8);
+        unsigned char footer[8];
+        if (std::fread(b.cdata.data(), 1, b.cdata.size(), fp_) != b.cdata.size() || std::fread(footer, 1, sizeof(footer), fp_) != sizeof(footer))
+        {
+          good_ = false;
+          return false;
+        }
+
+        b.crc = le32(footer);
+        b.isize = le32(footer + 4);
+        b.eof = false;
+        return true;
+      }
+    private:
+      std::FILE* fp_;
+      std::vector<raw_block> raw_;
+      std::size_t skip_;
+      bool good_ = false;
+    };
+  }
+}
+
+#endif // LIBSAVVY_BGZF_HPP
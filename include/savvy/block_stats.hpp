@@ -0,0 +1,471 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_BLOCK_STATS_HPP
+#define LIBSAVVY_BLOCK_STATS_HPP
+
+#include "portable_endian.hpp"
+#include "site_info.hpp"
+#include "s1r.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <array>
+#include <fstream>
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+namespace savvy
+{
+  /**
+   * Summary of the records in one zstd block of a SAV file. Allele frequencies are computed from GT when present
+   * and from INFO AC and AN otherwise. Records with neither are counted in unknown_af_count and excluded from the
+   * frequency ranges and histogram.
+   */
+  struct block_statistics
+  {
+    /// Bucket 0 holds AC == 0 and bucket i > 0 holds 2^(i-1) <= AC < 2^i (the last bucket is unbounded).
+    static const std::size_t ac_bucket_count = 32;
+
+    std::uint64_t file_pos = 0; ///< File offset of block (same as S1R entry value >> 16)
+    std::uint32_t record_count = 0;
+    std::uint32_t unknown_af_count = 0;
+    float min_af = 1.f; ///< Ranges are empty (min > max) if no record has a known frequency
+    float max_af = 0.f;
+    float min_maf = 0.5f;
+    float max_maf = 0.f;
+    std::array<std::uint32_t, ac_bucket_count> ac_histogram = {{}};
+    std::vector<std::uint64_t> format_non_zero; ///< Indexed like block_statistics_index::format_keys()
+
+    /**
+     * @param ac Number of non-reference alleles
+     * @return Histogram bucket of allele count
+     */
+    static std::size_t ac_bucket(std::uint64_t ac)
+    {
+      std::size_t ret = 0;
+      for ( ; ac && ret + 1 < ac_bucket_count; ac >>= 1u)
+        ++ret;
+      return ret;
+    }
+
+    /**
+     * Counts alleles of a record the same way they are counted for block statistics.
+     * @param v Record
+     * @param ac Number of non-reference alleles
+     * @param an Number of non-missing alleles
+     * @return False if record has neither GT nor INFO AC and AN
+     */
+    static bool allele_counts(const variant& v, std::uint64_t& ac, std::uint64_t& an);
+
+    /**
+     * Computes frequency with the same rounding as the stored ranges, so that comparisons with decoded records
+     * agree with comparisons with block ranges.
+     * @param ac Number of non-reference alleles
+     * @param an Number of non-missing alleles (must be non-zero)
+     * @return Non-reference allele frequency
+     */
+    static float allele_frequency(std::uint64_t ac, std::uint64_t an) { return float(double(ac) / double(an)); }
+
+    /**
+     * Combines statistics of another block. File position is left unchanged.
+     * @param other Block with format_non_zero indexed the same way
+     * @return *this
+     */
+    block_statistics& operator+=(const block_statistics& other);
+  private:
+    struct allele_count_fn
+    {
+      template <typename T>
+      void operator()(const T* p, const T* p_end, std::uint64_t& ac, std::uint64_t& an)
+      {
+        for ( ; p != p_end; ++p)
+        {
+          ac += (*p > T());
+          an += (*p >= T());
+        }
+      }
+
+      // Sparse values are non-zero, so the caller starts AN at the vector size and missing values are subtracted.
+      template <typename T, typename OffT>
+      void operator()(const T* p, const T* p_end, const OffT* /*off*/, std::uint64_t& ac, std::uint64_t& an)
+      {
+        for ( ; p != p_end; ++p)
+        {
+          ac += (*p > T());
+          an -= (*p < T());
+        }
+      }
+    };
+  };
+
+  /**
+   * Per-block statistics of a SAV file, which are optionally written (see writer::set_block_statistics()) to a
+   * skippable zstd frame located immediately before the S1R index. Queries can use these to summarize or skip
+   * whole blocks without decompressing them.
+   *
+   * Frame content (little-endian):
+   *   u32 key count, then u32 length and characters of each FORMAT key
+   *   u32 AC bucket count, u64 block count
+   *   per block: u64 file position, u32 record count, u32 unknown AF count, f32 min AF, max AF, min MAF, max MAF,
+   *              u32 per AC bucket, u64 per FORMAT key
+   *   u32 frame size (including 8-byte frame header), 8-byte magic
+   */
+  class block_statistics_index
+  {
+  public:
+    /**
+     * Updates statistics of a block with a record. FORMAT keys that are new to this index are appended to
+     * format_keys().
+     * @param dest Block statistics
+     * @param v Record
+     */
+    void add_record(block_statistics& dest, const variant& v);
+
+    /**
+     * Appends statistics of a completed block. Blocks must be pushed in file order.
+     * @param b Block statistics
+     */
+    void push_back(block_statistics b) { blocks_.push_back(std::move(b)); }
+
+    /**
+     * Gets index of FORMAT key, appending it if necessary.
+     * @param key FORMAT key
+     * @return Offset into format_keys() and block_statistics::format_non_zero
+     */
+    std::size_t format_key_index(const std::string& key);
+
+    const std::vector<std::string>& format_keys() const { return format_keys_; }
+    const std::vector<block_statistics>& blocks() const { return blocks_; }
+    std::vector<block_statistics>& blocks() { return blocks_; }
+
+    /**
+     * @param file_pos File offset of block
+     * @return Statistics of block or nullptr if block has none
+     */
+    const block_statistics* find(std::uint64_t file_pos) const;
+
+    /**
+     * Writes statistics as a skippable zstd frame.
+     * @param os Output stream positioned at end of SAV data (before S1R index frame)
+     * @return False if write fails or frame is too big
+     */
+    bool write(std::ostream& os) const;
+
+    /**
+     * Loads statistics frame from SAV file. The frame is expected to end where the embedded S1R index frame
+     * begins, or at the end of file if the index is stored separately.
+     * @param file_path Path to SAV file
+     * @return False if file has no statistics frame or it is corrupt
+     */
+    bool load(const std::string& file_path);
+
+    /// Offset of statistics frame in loaded file (0 if not loaded).
+    std::uint64_t frame_offset() const { return frame_offset_; }
+  private:
+    static const char* magic() { return "sbs\x00\x01\x00\x00\x00"; }
+    static const std::size_t magic_size = 8;
+    static const std::size_t trailer_size = 4 + magic_size;
+
+    template <typename T>
+    static void put_le(std::string& dest, T v)
+    {
+      for (std::size_t i = 0; i < sizeof(T); ++i, v >>= 8u)
+        dest.push_back(char(std::uint8_t(v & 0xFFu)));
+    }
+
+    static void put_float(std::string& dest, float v)
+    {
+      std::uint32_t u;
+      std::memcpy(&u, &v, sizeof(u));
+      put_le(dest, u);
+    }
+
+    template <typename T>
+    static bool get_le(const char*& p, const char* end, T& dest)
+    {
+      if (std::size_t(end - p) < sizeof(T))
+        return false;
+      dest = 0;
+      for (std::size_t i = 0; i < sizeof(T); ++i)
+        dest |= T(std::uint8_t(p[i])) << (8u * i);
+      p += sizeof(T);
+      return true;
+    }
+
+    static bool get_float(const char*& p, const char* end, float& dest)
+    {
+      std::uint32_t u;
+      if (!get_le(p, end, u))
+        return false;
+      std::memcpy(&dest, &u, sizeof(dest));
+      return true;
+    }
+
+    bool parse(const char* p, const char* end);
+  private:
+    std::vector<std::string> format_keys_;
+    std::unordered_map<std::string, std::size_t> format_key_ids_;
+    std::vector<block_statistics> blocks_;
+    std::uint64_t frame_offset_ = 0;
+  };
+
+  //================================================================//
+  inline
+  bool block_statistics::allele_counts(const variant& v, std::uint64_t& ac, std::uint64_t& an)
+  {
+    ac = 0;
+    an = 0;
+    for (auto it = v.format_fields().begin(); it != v.format_fields().end(); ++it)
+    {
+      if (it->first == "GT")
+      {
+        if (!it->second.is_sparse())
+          return it->second.capply_dense(allele_count_fn(), std::ref(ac), std::ref(an));
+
+        an = it->second.size();
+        return it->second.non_zero_size() == 0 || it->second.capply_sparse(allele_count_fn(), std::ref(ac), std::ref(an)); // Offsets are not allocated when every value is zero.
+      }
+    }
+
+    std::vector<std::int64_t> info_ac;
+    std::int64_t info_an = -1;
+    if (!v.get_info("AC", info_ac) || !v.get_info("AN", info_an) || info_an < 0)
+      return false;
+
+    for (auto it = info_ac.begin(); it != info_ac.end(); ++it)
+    {
+      if (*it < 0)
+        return false;
+      ac += std::uint64_t(*it);
+    }
+    an = std::uint64_t(info_an);
+    return true;
+  }
+
+  inline
+  block_statistics& block_statistics::operator+=(const block_statistics& other)
+  {
+    record_count += other.record_count;
+    unknown_af_count += other.unknown_af_count;
+    min_af = std::min(min_af, other.min_af);
+    max_af = std::max(max_af, other.max_af);
+    min_maf = std::min(min_maf, other.min_maf);
+    max_maf = std::max(max_maf, other.max_maf);
+    for (std::size_t i = 0; i < ac_bucket_count; ++i)
+      ac_histogram[i] += other.ac_histogram[i];
+    if (format_non_zero.size() < other.format_non_zero.size())
+      format_non_zero.resize(other.format_non_zero.size());
+    for (std::size_t i = 0; i < other.format_non_zero.size(); ++i)
+      format_non_zero[i] += other.format_non_zero[i];
+    return *this;
+  }
+
+  inline
+  std::size_t block_statistics_index::format_key_index(const std::string& key)
+  {
+    auto res = format_key_ids_.insert(std::make_pair(key, format_keys_.size()));
+    if (res.second)
+      format_keys_.push_back(key);
+    return res.first->second;
+  }
+
+  inline
+  void block_statistics_index::add_record(block_statistics& dest, const variant& v)
+  {
+    ++dest.record_count;
+
+    std::uint64_t ac, an;
+    if (!block_statistics::allele_counts(v, ac, an) || an == 0 || ac > an)
+    {
+      ++dest.unknown_af_count;
+    }
+    else
+    {
+      float af = block_statistics::allele_frequency(ac, an);
+      float maf = std::min(af, 1.f - af);
+      dest.min_af = std::min(dest.min_af, af);
+      dest.max_af = std::max(dest.max_af, af);
+      dest.min_maf = std::min(dest.min_maf, maf);
+      dest.max_maf = std::max(dest.max_maf, maf);
+      ++dest.ac_histogram[block_statistics::ac_bucket(ac)];
+    }
+
+    for (auto it = v.format_fields().begin(); it != v.format_fields().end(); ++it)
+    {
+      std::size_t idx = format_key_index(it->first);
+      if (dest.format_non_zero.size() <= idx)
+        dest.format_non_zero.resize(idx + 1);
+      dest.format_non_zero[idx] += it->second.count_non_zero();
+    }
+  }
+
+  inline
+  const block_statistics* block_statistics_index::find(std::uint64_t file_pos) const
+  {
+    auto res = std::lower_bound(blocks_.begin(), blocks_.end(), file_pos, [](const block_statistics& b, std::uint64_t pos) { return b.file_pos < pos; });
+    if (res == blocks_.end() || res->file_pos != file_pos)
+      return nullptr;
+    return &(*res);
+  }
+
+  inline
+  bool block_statistics_index::write(std::ostream& os) const
+  {
+    std::string buf;
+    buf.reserve(8 + 16 + blocks_.size() * (32 + 4 * block_statistics::ac_bucket_count + 8 * format_keys_.size()) + trailer_size);
+    buf.append("\x51\x2A\x4D\x18", 4);
+    put_le(buf, std::uint32_t(0)); // Content size is set below.
+
+    put_le(buf, std::uint32_t(format_keys_.size()));
+    for (auto it = format_keys_.begin(); it != format_keys_.end(); ++it)
+    {
+      put_le(buf, std::uint32_t(it->size()));
+      buf.append(*it);
+    }
+
+    put_le(buf, std::uint32_t(block_statistics::ac_bucket_count));
+    put_le(buf, std::uint64_t(blocks_.size()));
+    for (auto it = blocks_.begin(); it != blocks_.end(); ++it)
+    {
+      put_le(buf, it->file_pos);
+      put_le(buf, it->record_count);
+      put_le(buf, it->unknown_af_count);
+      put_float(buf, it->min_af);
+      put_float(buf, it->max_af);
+      put_float(buf, it->min_maf);
+      put_float(buf, it->max_maf);
+      for (std::size_t i = 0; i < block_statistics::ac_bucket_count; ++i)
+        put_le(buf, it->ac_histogram[i]);
+      for (std::size_t i = 0; i < format_keys_.size(); ++i)
+        put_le(buf, i < it->format_non_zero.size() ? it->format_non_zero[i] : std::uint64_t(0));
+    }
+
+    if (buf.size() + trailer_size > std::numeric_limits<std::uint32_t>::max())
+      return false;
+
+    put_le(buf, std::uint32_t(buf.size() + trailer_size));
+    buf.append(magic(), magic_size);
+
+    std::uint32_t content_size_le = htole32(std::uint32_t(buf.size() - 8));
+    std::memcpy(&buf[4], &content_size_le, 4);
+
+    os.write(buf.data(), buf.size());
+    return os.good();
+  }
+
+  inline
+  bool block_statistics_index::load(const std::string& file_path)
+  {
+    format_keys_.clear();
+    format_key_ids_.clear();
+    blocks_.clear();
+    frame_offset_ = 0;
+
+    std::int64_t frame_end = 0;
+    {
+      s1r::reader idx(file_path);
+      frame_end = idx.good() ? std::int64_t(idx.file_offset()) - 8 : 0;
+    }
+
+    std::ifstream ifs(file_path, std::ios::binary);
+    if (frame_end <= 0)
+    {
+      ifs.seekg(0, std::ios::end);
+      frame_end = ifs.tellg();
+    }
+
+    std::array<char, trailer_size> trailer;
+    if (!ifs || frame_end < std::int64_t(8 + trailer_size) || !ifs.seekg(frame_end - std::int64_t(trailer_size)).read(trailer.data(), trailer.size()))
+      return false;
+
+    const char* p = trailer.data();
+    std::uint32_t frame_size = 0;
+    get_le(p, trailer.data() + trailer.size(), frame_size);
+    if (std::memcmp(p, magic(), magic_size) != 0 || frame_size < 8 + trailer_size || frame_size > frame_end)
+      return false;
+
+    std::vector<char> frame(frame_size);
+    std::int64_t frame_beg = frame_end - std::int64_t(frame_size);
+    if (!ifs.seekg(frame_beg).read(frame.data(), frame.size()))
+      return false;
+
+    std::uint32_t content_size_le;
+    std::memcpy(&content_size_le, frame.data() + 4, 4);
+    if (std::memcmp(frame.data(), "\x51\x2A\x4D\x18", 4) != 0 || le32toh(content_size_le) != frame_size - 8 || !parse(frame.data() + 8, frame.data() + frame.size() - trailer_size))
+    {
+      std::fprintf(stderr, "Error: corrupt block statistics frame (%s)\n", file_path.c_str());
+      format_keys_.clear();
+      format_key_ids_.clear();
+      blocks_.clear();
+      return false;
+    }
+
+    frame_offset_ = std::uint64_t(frame_beg);
+    return true;
+  }
+
+  inline
+  bool block_statistics_index::parse(const char* p, const char* end)
+  {
+    std::uint32_t key_count = 0;
+    if (!get_le(p, end, key_count))
+      return false;
+
+    for (std::uint32_t i = 0; i < key_count; ++i)
+    {
+      std::uint32_t len = 0;
+      if (!get_le(p, end, len) || std::size_t(end - p) < len)
+        return false;
+      format_key_index(std::string(p, p + len));
+      p += len;
+    }
+
+    if (format_keys_.size() != key_count)
+      return false;
+
+    std::uint32_t bucket_count = 0;
+    std::uint64_t block_count = 0;
+    if (!get_le(p, end, bucket_count) || bucket_count == 0 || !get_le(p, end, block_count))
+      return false;
+
+    std::size_t entry_size = 32 + 4 * std::size_t(bucket_count) + 8 * std::size_t(key_count);
+    if (std::uint64_t(end - p) != block_count * entry_size)
+      return false;
+
+    blocks_.resize(block_count);
+    for (auto it = blocks_.begin(); it != blocks_.end(); ++it)
+    {
+      get_le(p, end, it->file_pos);
+      get_le(p, end, it->record_count);
+      get_le(p, end, it->unknown_af_count);
+      get_float(p, end, it->min_af);
+      get_float(p, end, it->max_af);
+      get_float(p, end, it->min_maf);
+      get_float(p, end, it->max_maf);
+      for (std::uint32_t i = 0; i < bucket_count; ++i)
+      {
+        std::uint32_t cnt = 0;
+        get_le(p, end, cnt);
+        it->ac_histogram[std::min<std::size_t>(i, block_statistics::ac_bucket_count - 1)] += cnt; // Buckets beyond this version's are folded into the last.
+      }
+      it->format_non_zero.resize(key_count);
+      for (std::uint32_t i = 0; i < key_count; ++i)
+        get_le(p, end, it->format_non_zero[i]);
+
+      if (it != blocks_.begin() && (it - 1)->file_pos >= it->file_pos)
+        return false;
+    }
+
+    return true;
+  }
+}
+
+#endif // LIBSAVVY_BLOCK_STATS_HPP
@@ -7,12 +7,22 @@
 #ifndef LIBSAVVY_CSI_HPP
 #define LIBSAVVY_CSI_HPP
 
+#include "bgzf.hpp"
+#include "portable_endian.hpp"
+
 #include <shrinkwrap/gz.hpp>
 
 #include <array>
 #include <unordered_map>
+#include <map>
+#include <deque>
 #include <vector>
+#include <string>
+#include <ostream>
+#include <cstdio>
 #include <cstdint>
+#include <limits>
+#include <algorithm>
 
 namespace  savvy
 {
@@ -434,6 +444,319 @@ namespace  savvy
     std::vector<std::string> aux_contigs_;
     std::vector<std::unordered_map<std::uint32_t, bin_t>> indices_;
   };
+
+  /**
+   * Builds a CSI index from records in file order, like htslib's hts_idx_push(). Offsets only need to be
+   * monotonic while building (e.g., BGZF block indices in place of file positions) since they are mapped to
+   * virtual offsets when the index is written.
+   */
+  class csi_writer
+  {
+  public:
+    /**
+     * @param contigs Contig names in header order (BCF). If empty, contigs are numbered in order of appearance and their names are stored in the index (VCF).
+     * @param max_contig_length Longest contig, which determines the depth of the binning index
+     * @param min_shift Size of smallest bins (log2)
+     */
+    csi_writer(const std::vector<std::string>& contigs, std::uint64_t max_contig_length, std::int32_t min_shift = 14) :
+      store_names_(contigs.empty()),
+      min_shift_(min_shift)
+    {
+      for (std::uint64_t s = std::uint64_t(1) << min_shift_; max_contig_length + 256 > s; s <<= 3u)
+        ++depth_;
+
+      for (auto it = contigs.begin(); it != contigs.end(); ++it)
+      {
+        contig_ids_.emplace(*it, std::uint32_t(contigs_.size()));
+        contigs_.emplace_back();
+        contigs_.back().name = *it;
+      }
+    }
+
+    bool good() const { return good_; }
+
+    /**
+     * Adds a record.
+     * @param chrom Contig of record
+     * @param beg 0-based start of record
+     * @param end 0-based, exclusive end of record
+     * @param beg_off Offset of record in file
+     * @param end_off Offset of following record in file
+     * @return False if records are not sorted or do not fit in index (index is discarded)
+     */
+    bool push(const std::string& chrom, std::int64_t beg, std::int64_t end, std::uint64_t beg_off, std::uint64_t end_off)
+    {
+      if (!good_)
+        return false;
+
+      beg = std::max<std::int64_t>(0, beg);
+      end = std::max<std::int64_t>(beg + 1, end);
+      if (end > (std::int64_t(1) << (min_shift_ + 3 * depth_)))
+        return fail("Error: record position exceeds range of CSI index (contig length in header may be too small)");
+
+      if (!current_ || chrom != current_->name)
+      {
+        save_chunk();
+        auto res = contig_ids_.emplace(chrom, std::uint32_t(contigs_.size()));
+        if (res.second)
+        {
+          if (!store_names_)
+            return fail("Error: contig missing from header cannot be indexed");
+          contigs_.emplace_back();
+          contigs_.back().name = chrom;
+        }
+
+        current_ = &contigs_[res.first->second];
+        if (current_->n_records)
+          return fail("Error: records are not sorted, so CSI index cannot be created");
+        current_->off_beg = beg_off;
+        last_beg_ = beg;
+      }
+      else if (beg < last_beg_)
+      {
+        return fail("Error: records are not sorted, so CSI index cannot be created");
+      }
+
+      std::uint32_t bin = reg2bin(beg, end);
+      if (bin != save_bin_ || save_contig_ != current_)
+      {
+        save_chunk();
+        save_bin_ = bin;
+        save_contig_ = current_;
+        save_off_ = beg_off;
+      }
+
+      // Linear index holds the offset of the first record overlapping each window.
+      std::size_t last_window = std::size_t((end - 1) >> min_shift_);
+      if (current_->linear.size() <= last_window)
+        current_->linear.resize(last_window + 1, no_offset());
+      for (std::size_t w = std::size_t(beg >> min_shift_); w <= last_window; ++w)
+      {
+        if (current_->linear[w] == no_offset())
+          current_->linear[w] = beg_off;
+      }
+
+      last_beg_ = beg;
+      last_off_ = end_off;
+      current_->off_end = end_off;
+      ++current_->n_records;
+      return true;
+    }
+
+    /**
+     * Writes BGZF-compressed index.
+     * @param file_path Path to index file
+     * @param resolve_offset Function that converts offsets passed to push() into virtual offsets
+     * @return False on write error or if index is not good()
+     */
+    template <typename Fn>
+    bool write(const std::string& file_path, Fn resolve_offset)
+    {
+      save_chunk();
+      if (!good_)
+        return false;
+
+      ::savvy::detail::parallel_bgzf_obuf buf(file_path, Z_DEFAULT_COMPRESSION, 1);
+      std::ostream os(&buf);
+
+      std::string aux;
+      if (store_names_)
+      {
+        // Same as tabix configuration for VCF: preset, seq/beg/end columns, meta character, lines to skip, and names.
+        std::int32_t conf[7] = {2, 1, 2, 0, '#', 0, 0};
+        for (auto it = contigs_.begin(); it != contigs_.end(); ++it)
+          conf[6] += std::int32_t(it->name.size() + 1);
+        for (std::size_t i = 0; i < 7; ++i)
+        {
+          std::uint32_t le = htole32(std::uint32_t(conf[i]));
+          aux.append((const char*)&le, sizeof(le));
+        }
+        for (auto it = contigs_.begin(); it != contigs_.end(); ++it)
+          aux.append(it->name.c_str(), it->name.size() + 1);
+      }
+
+      os.write("CSI\x01", 4);
+      write_int(os, min_shift_);
+      write_int(os, depth_);
+      write_int(os, std::int32_t(aux.size()));
+      os.write(aux.data(), aux.size());
+      write_int(os, std::int32_t(contigs_.size()));
+
+      const std::uint32_t bin_limit = ((1u << (depth_ + 1) * 3) - 1) / 7;
+      for (auto it = contigs_.begin(); it != contigs_.end(); ++it)
+      {
+        // Leading windows without records point to the first record, and later gaps to the previous window.
+        for (std::size_t w = 0; w < it->linear.size(); ++w)
+        {
+          if (it->linear[w] == no_offset())
+            it->linear[w] = w ? it->linear[w - 1] : it->off_beg;
+        }
+
+        for (auto o = it->linear.begin(); o != it->linear.end(); ++o)
+          *o = resolve_offset(*o);
+
+        for (auto bin_it = it->bins.begin(); bin_it != it->bins.end(); ++bin_it)
+        {
+          for (auto c = bin_it->second.begin(); c != bin_it->second.end(); ++c)
+            *c = std::make_pair(resolve_offset(c->first), resolve_offset(c->second));
+        }
+
+        compress_bins(it->bins);
+
+        write_int(os, std::int32_t(it->bins.size() + (it->n_records ? 1 : 0)));
+        for (auto bin_it = it->bins.begin(); bin_it != it->bins.end(); ++bin_it)
+        {
+          std::size_t bot = bin_bot(bin_it->first);
+          write_int(os, bin_it->first);
+          write_int(os, bot < it->linear.size() ? it->linear[bot] : std::uint64_t(0));
+          write_int(os, std::int32_t(bin_it->second.size()));
+          for (auto c = bin_it->second.begin(); c != bin_it->second.end(); ++c)
+          {
+            write_int(os, c->first);
+            write_int(os, c->second);
+          }
+        }
+
+        if (it->n_records)
+        {
+          // Pseudo-bin with contig span and record counts (mapped, unmapped).
+          write_int(os, bin_limit + 1);
+          write_int(os, std::uint64_t(0));
+          write_int(os, std::int32_t(2));
+          write_int(os, resolve_offset(it->off_beg));
+          write_int(os, resolve_offset(it->off_end));
+          write_int(os, it->n_records);
+          write_int(os, std::uint64_t(0));
+        }
+      }
+
+      write_int(os, std::uint64_t(0)); // Records without coordinates
+      os.flush();
+      return os.good() && buf.drain();
+    }
+  private:
+    static std::uint64_t no_offset() { return std::numeric_limits<std::uint64_t>::max(); }
+
+    struct contig_data
+    {
+      std::string name;
+      std::map<std::uint32_t, std::vector<std::pair<std::uint64_t, std::uint64_t>>> bins;
+      std::vector<std::uint64_t> linear;
+      std::uint64_t off_beg = 0;
+      std::uint64_t off_end = 0;
+      std::uint64_t n_records = 0;
+    };
+
+    // CSI integers are little-endian.
+    static void write_int(std::ostream& os, std::uint32_t v)
+    {
+      v = htole32(v);
+      os.write((const char*)&v, sizeof(v));
+    }
+
+    static void write_int(std::ostream& os, std::int32_t v)
+    {
+      write_int(os, std::uint32_t(v));
+    }
+
+    static void write_int(std::ostream& os, std::uint64_t v)
+    {
+      v = htole64(v);
+      os.write((const char*)&v, sizeof(v));
+    }
+
+    bool fail(const char* msg)
+    {
+      std::fprintf(stderr, "%s\n", msg);
+      good_ = false;
+      current_ = save_contig_ = nullptr;
+      contigs_.clear();
+      return false;
+    }
+
+    void save_chunk()
+    {
+      if (save_contig_)
+        save_contig_->bins[save_bin_].emplace_back(save_off_, last_off_);
+      save_contig_ = nullptr;
+    }
+
+    /**
+     * Same as htslib's compress_binning(). Bins whose chunks span less than 64 KiB of compressed data are moved
+     * into their parent (if it exists), and then chunks that overlap or start in the same block are merged.
+     */
+    void compress_bins(std::map<std::uint32_t, std::vector<std::pair<std::uint64_t, std::uint64_t>>>& bins) const
+    {
+      const std::uint64_t min_marker_dist = 0x10000;
+      for (int l = depth_; l > 0; --l)
+      {
+        const std::uint32_t first = ((1u << (3 * l)) - 1) / 7;
+        const std::uint32_t last = ((1u << (3 * (l + 1))) - 1) / 7;
+        for (auto it = bins.lower_bound(first); it != bins.end() && it->first < last; )
+        {
+          auto& chunks = it->second;
+          std::sort(chunks.begin(), chunks.end());
+          auto parent = bins.find((it->first - 1) >> 3u);
+          if (parent != bins.end() && (chunks.back().second >> 16u) - (chunks.front().first >> 16u) < min_marker_dist)
+          {
+            parent->second.insert(parent->second.end(), chunks.begin(), chunks.end());
+            it = bins.erase(it);
+          }
+          else
+          {
+            ++it;
+          }
+        }
+      }
+
+      for (auto it = bins.begin(); it != bins.end(); ++it)
+      {
+        auto& chunks = it->second;
+        std::sort(chunks.begin(), chunks.end());
+        std::size_t m = 0;
+        for (std::size_t i = 1; i < chunks.size(); ++i)
+        {
+          if (chunks[m].second >> 16u >= chunks[i].first >> 16u)
+            chunks[m].second = std::max(chunks[m].second, chunks[i].second);
+          else
+            chunks[++m] = chunks[i];
+        }
+        chunks.resize(m + 1);
+      }
+    }
+
+    std::uint32_t reg2bin(std::int64_t beg, std::int64_t end) const
+    {
+      int l, s = min_shift_, t = ((1 << ((depth_ << 1) + depth_)) - 1) / 7;
+      for (--end, l = depth_; l > 0; --l, s += 3, t -= 1 << ((l << 1) + l))
+      {
+        if (beg >> s == end >> s)
+          return std::uint32_t(t + (beg >> s));
+      }
+      return 0;
+    }
+
+    std::size_t bin_bot(std::uint32_t bin) const
+    {
+      int l = 0;
+      for (std::uint32_t b = bin; b; b = (b - 1) >> 3u)
+        ++l;
+      return std::size_t(bin - ((1u << (3 * l)) - 1) / 7) << (3 * (depth_ - l));
+    }
+  private:
+    std::deque<contig_data> contigs_; // Stable references for current_ and save_contig_
+    std::unordered_map<std::string, std::uint32_t> contig_ids_;
+    contig_data* current_ = nullptr;
+    contig_data* save_contig_ = nullptr;
+    std::uint32_t save_bin_ = 0;
+    std::uint64_t save_off_ = 0;
+    std::uint64_t last_off_ = 0;
+    std::int64_t last_beg_ = 0;
+    bool store_names_;
+    bool good_ = true;
+    std::int32_t min_shift_;
+    std::int32_t depth_ = 0;
+  };
 }
 
 #endif // LIBSAVVY_CSI_HPP
\ No newline at end of file
@@ -0,0 +1,291 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_MATRIX_HPP
+#define LIBSAVVY_MATRIX_HPP
+
+#include "typed_value.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+namespace savvy
+{
+  /// Storage order of matrices filled by reader::read_matrix(). Rows are records and columns are samples (or haplotypes).
+  enum class matrix_layout : std::uint8_t
+  {
+    row_major = 0, ///< Dense: record values are contiguous. Sparse: CSR.
+    column_major ///< Dense: sample values are contiguous. Sparse: CSC.
+  };
+
+  struct matrix_options
+  {
+    std::size_t stride = 1; ///< Number of consecutive values summed into each column (e.g., ploidy to convert GT to per-sample dosages)
+    bool mean_impute = false; ///< Replaces missing values with the mean of non-missing values of the same record (rounded for integer matrices)
+  };
+
+  /**
+   * Compressed sparse matrix. The vectors are cleared but not deallocated between reads so that buffers are reused.
+   */
+  template <typename T>
+  struct sparse_matrix
+  {
+    std::vector<T> values; ///< Non-zero (or missing) values
+    std::vector<std::size_t> indices; ///< Column index (CSR) or row index (CSC) of each value
+    std::vector<std::size_t> offsets; ///< Start of each row (CSR) or column (CSC) in values, followed by values.size()
+  };
+
+  namespace detail
+  {
+    template <typename T>
+    bool is_matrix_end_of_vector(const T& v) { return typed_value::is_end_of_vector(v); }
+
+    inline bool is_matrix_end_of_vector(const float& v)
+    {
+      // End-of-vector is a NaN, so it cannot be compared with ==.
+      std::uint32_t bits;
+      std::memcpy(&bits, &v, sizeof(bits));
+      return bits == 0x7F800002u;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value, T>::type round_matrix_value(double v) { return T(v); }
+
+    template <typename T>
+    typename std::enable_if<!std::is_floating_point<T>::value, T>::type round_matrix_value(double v) { return T(std::round(v)); }
+
+    template <typename T>
+    T round_matrix_value(std::int64_t v) { return T(v); }
+
+    /// Sums are accumulated in double if either the source or the matrix is floating point, so that float sources are only rounded once.
+    template <typename T, typename SrcT>
+    struct matrix_acc_type
+    {
+      typedef typename std::conditional<std::is_floating_point<T>::value || std::is_floating_point<SrcT>::value, double, std::int64_t>::type type;
+    };
+
+    /**
+     * Writes one record into a row (or column) of a dense matrix. Every column is written, so the destination
+     * does not need to be zeroed.
+     */
+    template <typename T>
+    struct dense_matrix_sink
+    {
+      T* dest;
+      std::size_t step;
+      std::vector<std::size_t>* missing;
+      double sum;
+
+      void begin(std::size_t num_columns)
+      {
+        if (step == 1)
+          std::fill_n(dest, num_columns, T());
+        else
+          for (std::size_t i = 0; i < num_columns; ++i)
+            dest[i * step] = T();
+      }
+
+      void set_value(std::size_t col, T v) { dest[col * step] = v; sum += v; }
+      void set_missing(std::size_t col) { dest[col * step] = typed_value::missing_value<T>(); missing->push_back(col); }
+
+      void impute(T mean)
+      {
+        for (auto it = missing->begin(); it != missing->end(); ++it)
+          dest[*it * step] = mean;
+      }
+    };
+
+    /**
+     * Appends one record to a compressed sparse row.
+     */
+    template <typename T>
+    struct sparse_matrix_sink
+    {
+      sparse_matrix<T>* dest;
+      std::vector<std::size_t>* missing;
+      double sum;
+
+      void begin(std::size_t /*num_columns*/) {}
+
+      void set_value(std::size_t col, T v)
+      {
+        dest->indices.push_back(col);
+        dest->values.push_back(v);
+        sum += v;
+      }
+
+      void set_missing(std::size_t col)
+      {
+        missing->push_back(dest->values.size());
+        dest->indices.push_back(col);
+        dest->values.push_back(typed_value::missing_value<T>());
+      }
+
+      void impute(T mean)
+      {
+        for (auto it = missing->begin(); it != missing->end(); ++it)
+          dest->values[*it] = mean;
+      }
+    };
+
+    /**
+     * Sums every `stride` values of a dense or sparse typed_value and passes non-zero and missing sums to a sink.
+     * A sum is missing if any of its values is missing, and end-of-vector values (i.e., lower ploidy) are skipped.
+     */
+    template <typename T, typename Sink>
+    struct matrix_row_reducer
+    {
+      Sink* sink;
+      std::size_t stride;
+      std::size_t num_columns;
+      bool* supported;
+
+      template <typename SrcT>
+      void operator()(const SrcT* p, const SrcT* /*p_end*/)
+      {
+        typedef typename matrix_acc_type<T, SrcT>::type acc_type;
+        for (std::size_t c = 0; c < num_columns; ++c)
+        {
+          acc_type acc = acc_type();
+          bool missing = false;
+          for (const SrcT* v = p + c * stride; v != p + (c + 1) * stride; ++v)
+          {
+            if (is_matrix_end_of_vector(*v))
+              continue;
+            if (typed_value::is_missing(*v))
+              missing = true;
+            else
+              acc += *v;
+          }
+
+          flush(c, acc, missing);
+        }
+      }
+
+      template <typename SrcT, typename OffT>
+      void operator()(const SrcT* p, const SrcT* p_end, const OffT* off)
+      {
+        typedef typename matrix_acc_type<T, SrcT>::type acc_type;
+        std::size_t idx = 0;
+        std::size_t col = 0;
+        acc_type acc = acc_type();
+        bool missing = false;
+        bool pending = false;
+        for ( ; p != p_end; ++p, ++off)
+        {
+          idx += *off;
+          std::size_t c = idx++ / stride;
+          if (pending && c != col)
+          {
+            flush(col, acc, missing);
+            acc = acc_type();
+            missing = false;
+          }
+
+          col = c;
+          pending = true;
+          if (is_matrix_end_of_vector(*p))
+            continue;
+          if (typed_value::is_missing(*p))
+            missing = true;
+          else
+            acc += *p;
+        }
+
+        if (pending)
+          flush(col, acc, missing);
+      }
+
+      // String fields cannot be converted to a matrix.
+      void operator()(const char*, const char*) { *supported = false; }
+      template <typename OffT>
+      void operator()(const char*, const char*, const OffT*) { *supported = false; }
+    private:
+      template <typename AccT>
+      void flush(std::size_t col, AccT acc, bool missing)
+      {
+        if (missing)
+        {
+          sink->set_missing(col);
+        }
+        else
+        {
+          T v = round_matrix_value<T>(acc);
+          if (v)
+            sink->set_value(col, v);
+        }
+      }
+    };
+
+    /**
+     * Reduces a FORMAT value into a matrix sink and applies mean imputation. A null value (i.e., field not present
+     * in record) is treated as all missing.
+     * @return False if value size is not num_columns * opts.stride or value is a string
+     */
+    template <typename T, typename Sink>
+    bool reduce_matrix_row(const typed_value* val, std::size_t num_columns, const matrix_options& opts, Sink& sink)
+    {
+      const std::size_t stride = std::max<std::size_t>(1, opts.stride);
+      sink.missing->clear();
+      sink.sum = 0.;
+      sink.begin(num_columns);
+
+      if (!val)
+      {
+        for (std::size_t c = 0; c < num_columns; ++c)
+          sink.set_missing(c);
+      }
+      else
+      {
+        if (val->size() != num_columns * stride)
+          return false;
+
+        // Sparse values without non-zeros have no offset buffer, so capply() would treat them as dense.
+        bool supported = true;
+        if (!(val->is_sparse() && val->non_zero_size() == 0) && (!val->capply(matrix_row_reducer<T, Sink>{&sink, stride, num_columns, &supported}) || !supported))
+          return false;
+      }
+
+      if (opts.mean_impute && sink.missing->size() && sink.missing->size() < num_columns)
+        sink.impute(round_matrix_value<T>(sink.sum / double(num_columns - sink.missing->size())));
+
+      return true;
+    }
+
+    /**
+     * Converts CSR to CSC (or vice versa) using a counting sort, which keeps indices sorted within each column.
+     */
+    template <typename T>
+    void transpose_sparse_matrix(const sparse_matrix<T>& src, std::size_t num_minor, sparse_matrix<T>& dest)
+    {
+      dest.offsets.assign(num_minor + 1, 0);
+      for (auto it = src.indices.begin(); it != src.indices.end(); ++it)
+        ++dest.offsets[*it + 1];
+      for (std::size_t i = 0; i < num_minor; ++i)
+        dest.offsets[i + 1] += dest.offsets[i];
+
+      dest.values.resize(src.values.size());
+      dest.indices.resize(src.indices.size());
+      std::vector<std::size_t> pos(dest.offsets.begin(), dest.offsets.end() - 1);
+      for (std::size_t major = 0; major + 1 < src.offsets.size(); ++major)
+      {
+        for (std::size_t i = src.offsets[major]; i < src.offsets[major + 1]; ++i)
+        {
+          std::size_t& p = pos[src.indices[i]];
+          dest.indices[p] = major;
+          dest.values[p] = src.values[i];
+          ++p;
+        }
+      }
+    }
+  }
+}
+
+#endif // LIBSAVVY_MATRIX_HPP
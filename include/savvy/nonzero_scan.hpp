@@ -0,0 +1,308 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_NONZERO_SCAN_HPP
+#define LIBSAVVY_NONZERO_SCAN_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SAVVY_NONZERO_SCAN_SIMD 1
+#include <immintrin.h>
+#define SAVVY_TARGET_SSE2 __attribute__((target("sse2")))
+#define SAVVY_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace savvy
+{
+  namespace detail
+  {
+    template <typename T>
+    std::size_t count_nonzero_scalar(const T* p, std::size_t sz)
+    {
+      std::size_t ret = 0;
+      for (std::size_t i = 0; i < sz; ++i)
+        ret += p[i] ? 1 : 0;
+      return ret;
+    }
+
+    template <typename T, typename Fn>
+    void for_each_nonzero_scalar(const T* p, std::size_t sz, std::size_t base, Fn& fn)
+    {
+      for (std::size_t i = 0; i < sz; ++i)
+      {
+        if (p[i])
+          fn(base + i);
+      }
+    }
+
+#ifdef SAVVY_NONZERO_SCAN_SIMD
+    /**
+     * Produces a byte mask for one vector register worth of elements. Every byte of a
+     * non-zero element has its bit set, so each element contributes sizeof(T) bits.
+     * Zero and negative zero floats are treated as zero (matching `if (val)`), while
+     * NaN (i.e., missing/end_of_vector) is treated as non-zero.
+     *
+     * Kernels are compiled with target attributes and selected at runtime by
+     * nonzero_scan_isa(), so every translation unit sees the same definitions
+     * regardless of its -m flags.
+     */
+    template <typename T>
+    struct nonzero_mask_sse2;
+
+    template <typename T>
+    struct nonzero_mask_avx2;
+
+    template <> struct nonzero_mask_sse2<std::int8_t>
+    {
+      static const std::size_t bytes = 16;
+      SAVVY_TARGET_SSE2 static std::uint32_t get(const std::int8_t* p)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        return ~static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()))) & 0xFFFFu;
+      }
+    };
+
+    template <> struct nonzero_mask_sse2<std::int16_t>
+    {
+      static const std::size_t bytes = 16;
+      SAVVY_TARGET_SSE2 static std::uint32_t get(const std::int16_t* p)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        return ~static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi16(v, _mm_setzero_si128()))) & 0xFFFFu;
+      }
+    };
+
+    template <> struct nonzero_mask_sse2<std::int32_t>
+    {
+      static const std::size_t bytes = 16;
+      SAVVY_TARGET_SSE2 static std::uint32_t get(const std::int32_t* p)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        return ~static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi32(v, _mm_setzero_si128()))) & 0xFFFFu;
+      }
+    };
+
+    template <> struct nonzero_mask_sse2<float>
+    {
+      static const std::size_t bytes = 16;
+      SAVVY_TARGET_SSE2 static std::uint32_t get(const float* p)
+      {
+        __m128 v = _mm_loadu_ps(p);
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_castps_si128(_mm_cmpneq_ps(v, _mm_setzero_ps()))));
+      }
+    };
+
+    template <> struct nonzero_mask_avx2<std::int8_t>
+    {
+      static const std::size_t bytes = 32;
+      SAVVY_TARGET_AVX2 static std::uint32_t get(const std::int8_t* p)
+      {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        return ~static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+      }
+    };
+
+    template <> struct nonzero_mask_avx2<std::int16_t>
+    {
+      static const std::size_t bytes = 32;
+      SAVVY_TARGET_AVX2 static std::uint32_t get(const std::int16_t* p)
+      {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        return ~static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi16(v, _mm256_setzero_si256())));
+      }
+    };
+
+    template <> struct nonzero_mask_avx2<std::int32_t>
+    {
+      static const std::size_t bytes = 32;
+      SAVVY_TARGET_AVX2 static std::uint32_t get(const std::int32_t* p)
+      {
+        __m256i v = _mm256_loadu_si256((const __m256i*)p);
+        return ~static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi32(v, _mm256_setzero_si256())));
+      }
+    };
+
+    template <> struct nonzero_mask_avx2<float>
+    {
+      static const std::size_t bytes = 32;
+      SAVVY_TARGET_AVX2 static std::uint32_t get(const float* p)
+      {
+        __m256 v = _mm256_loadu_ps(p);
+        return static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_castps_si256(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_NEQ_UQ))));
+      }
+    };
+
+    template <typename T>
+    struct has_nonzero_mask
+    {
+      static const bool value = false;
+    };
+
+    template <> struct has_nonzero_mask<std::int8_t> { static const bool value = true; };
+    template <> struct has_nonzero_mask<std::int16_t> { static const bool value = true; };
+    template <> struct has_nonzero_mask<std::int32_t> { static const bool value = true; };
+    template <> struct has_nonzero_mask<float> { static const bool value = true; };
+
+    enum class nonzero_isa { scalar, sse2, avx2 };
+
+    /**
+     * Detects the widest instruction set supported by the running CPU.
+     * @return Instruction set used by count_nonzero() and for_each_nonzero()
+     */
+    inline nonzero_isa nonzero_scan_isa()
+    {
+      static const nonzero_isa isa = []()
+      {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+          return nonzero_isa::avx2;
+        if (__builtin_cpu_supports("sse2"))
+          return nonzero_isa::sse2;
+        return nonzero_isa::scalar;
+      }();
+      return isa;
+    }
+
+    // The loops are repeated per instruction set since a mask kernel can only be inlined into a caller with the same target.
+    template <typename T>
+    SAVVY_TARGET_SSE2 std::size_t count_nonzero_sse2(const T* p, std::size_t sz)
+    {
+      const std::size_t step = nonzero_mask_sse2<T>::bytes / sizeof(T);
+      std::size_t bits = 0;
+      std::size_t i = 0;
+      for ( ; i + step <= sz; i += step)
+        bits += __builtin_popcount(nonzero_mask_sse2<T>::get(p + i));
+
+      return bits / sizeof(T) + count_nonzero_scalar(p + i, sz - i);
+    }
+
+    template <typename T>
+    SAVVY_TARGET_AVX2 std::size_t count_nonzero_avx2(const T* p, std::size_t sz)
+    {
+      const std::size_t step = nonzero_mask_avx2<T>::bytes / sizeof(T);
+      std::size_t bits = 0;
+      std::size_t i = 0;
+      for ( ; i + step <= sz; i += step)
+        bits += __builtin_popcount(nonzero_mask_avx2<T>::get(p + i));
+
+      return bits / sizeof(T) + count_nonzero_scalar(p + i, sz - i);
+    }
+
+    template <typename T, typename Fn>
+    SAVVY_TARGET_SSE2 void for_each_nonzero_sse2(const T* p, std::size_t sz, Fn& fn)
+    {
+      const std::size_t step = nonzero_mask_sse2<T>::bytes / sizeof(T);
+      const std::uint32_t elem_bits = (1u << sizeof(T)) - 1u;
+      std::size_t i = 0;
+      for ( ; i + step <= sz; i += step)
+      {
+        std::uint32_t m = nonzero_mask_sse2<T>::get(p + i);
+        while (m)
+        {
+          std::size_t bit = __builtin_ctz(m);
+          fn(i + bit / sizeof(T));
+          m &= ~(elem_bits << bit);
+        }
+      }
+
+      for_each_nonzero_scalar(p + i, sz - i, i, fn);
+    }
+
+    template <typename T, typename Fn>
+    SAVVY_TARGET_AVX2 void for_each_nonzero_avx2(const T* p, std::size_t sz, Fn& fn)
+    {
+      const std::size_t step = nonzero_mask_avx2<T>::bytes / sizeof(T);
+      const std::uint32_t elem_bits = (1u << sizeof(T)) - 1u;
+      std::size_t i = 0;
+      for ( ; i + step <= sz; i += step)
+      {
+        std::uint32_t m = nonzero_mask_avx2<T>::get(p + i);
+        while (m)
+        {
+          std::size_t bit = __builtin_ctz(m);
+          fn(i + bit / sizeof(T));
+          m &= ~(elem_bits << bit);
+        }
+      }
+
+      for_each_nonzero_scalar(p + i, sz - i, i, fn);
+    }
+
+    /**
+     * Counts non-zero elements of a dense array.
+     * @param p Pointer to first element
+     * @param sz Number of elements
+     * @return Number of non-zero elements
+     */
+    template <typename T>
+    typename std::enable_if<has_nonzero_mask<T>::value, std::size_t>::type
+    count_nonzero(const T* p, std::size_t sz)
+    {
+      switch (nonzero_scan_isa())
+      {
+      case nonzero_isa::avx2:
+        return count_nonzero_avx2(p, sz);
+      case nonzero_isa::sse2:
+        return count_nonzero_sse2(p, sz);
+      default:
+        return count_nonzero_scalar(p, sz);
+      }
+    }
+
+    template <typename T>
+    typename std::enable_if<!has_nonzero_mask<T>::value, std::size_t>::type
+    count_nonzero(const T* p, std::size_t sz)
+    {
+      return count_nonzero_scalar(p, sz);
+    }
+
+    /**
+     * Calls fn(i) for the index of every non-zero element of a dense array, in increasing order.
+     * @param p Pointer to first element
+     * @param sz Number of elements
+     * @param fn Callback taking element index
+     */
+    template <typename T, typename Fn>
+    typename std::enable_if<has_nonzero_mask<T>::value, void>::type
+    for_each_nonzero(const T* p, std::size_t sz, Fn fn)
+    {
+      switch (nonzero_scan_isa())
+      {
+      case nonzero_isa::avx2:
+        return for_each_nonzero_avx2(p, sz, fn);
+      case nonzero_isa::sse2:
+        return for_each_nonzero_sse2(p, sz, fn);
+      default:
+        return for_each_nonzero_scalar(p, sz, 0, fn);
+      }
+    }
+
+    template <typename T, typename Fn>
+    typename std::enable_if<!has_nonzero_mask<T>::value, void>::type
+    for_each_nonzero(const T* p, std::size_t sz, Fn fn)
+    {
+      for_each_nonzero_scalar(p, sz, 0, fn);
+    }
+#else
+    template <typename T>
+    std::size_t count_nonzero(const T* p, std::size_t sz)
+    {
+      return count_nonzero_scalar(p, sz);
+    }
+
+    template <typename T, typename Fn>
+    void for_each_nonzero(const T* p, std::size_t sz, Fn fn)
+    {
+      for_each_nonzero_scalar(p, sz, 0, fn);
+    }
+#endif
+  }
+}
+
+#endif // LIBSAVVY_NONZERO_SCAN_HPP
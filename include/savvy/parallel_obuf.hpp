@@ -0,0 +1,302 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_PARALLEL_OBUF_HPP
+#define LIBSAVVY_PARALLEL_OBUF_HPP
+
+#include <zstd.h>
+
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Compresses data as a single zstd frame.
+     * @param data Uncompressed data
+     * @param sz Size of uncompressed data
+     * @param dest Destination buffer (resized to size of compressed frame)
+     * @param level Compression level
+     * @return False if compression fails
+     */
+    inline bool compress_zstd_frame(const char* data, std::size_t sz, std::vector<char>& dest, int level)
+    {
+      static thread_local std::unique_ptr<ZSTD_CCtx, std::size_t(*)(ZSTD_CCtx*)> ctx(ZSTD_createCCtx(), ZSTD_freeCCtx);
+      if (!ctx)
+        return false;
+
+      dest.resize(ZSTD_compressBound(sz));
+      std::size_t res = ZSTD_compressCCtx(ctx.get(), dest.data(), dest.size(), data, sz, level);
+      if (ZSTD_isError(res))
+        return false;
+
+      dest.resize(res);
+      return true;
+    }
+
+    /**
+     * Output stream buffer that compresses each flushed block on a pool of worker threads.
+     * Every call to pubsync() (i.e., ostream::flush()) ends the current block, as does reaching
+     * the maximum block size if one is given. Blocks are written to the file in the order they
+     * were flushed.
+     */
+    class parallel_obuf : public std::streambuf
+    {
+    public:
+      typedef bool (*compress_fn)(const char* data, std::size_t sz, std::vector<char>& dest, int level);
+
+      /**
+       * @param file_path Path to output file
+       * @param fn Function that compresses a block
+       * @param compression_level Level passed to fn
+       * @param num_threads Number of worker threads
+       * @param max_block_size Size at which blocks are ended automatically (0 for no limit)
+       * @param trailer Data written after the last block (e.g., BGZF EOF marker)
+       */
+      parallel_obuf(const std::string& file_path, compress_fn fn, int compression_level, std::size_t num_threads, std::size_t max_block_size = 0, std::vector<char> trailer = {}) :
+        fp_(std::fopen(file_path.c_str(), "wb")),
+        compress_(fn),
+        level_(compression_level),
+        max_in_flight_(2 * std::max<std::size_t>(1, num_threads)),
+        max_block_size_(max_block_size),
+        trailer_(std::move(trailer))
+      {
+        if (fp_)
+        {
+          for (std::size_t i = 0; i < std::max<std::size_t>(1, num_threads); ++i)
+            workers_.emplace_back(&parallel_obuf::compress_blocks, this);
+        }
+      }
+
+      ~parallel_obuf()
+      {
+        sync();
+        drain();
+
+        {
+          std::lock_guard<std::mutex> lock(mtx_);
+          stop_ = true;
+        }
+        worker_cv_.notify_all();
+        for (auto it = workers_.begin(); it != workers_.end(); ++it)
+          it->join();
+
+        if (fp_)
+        {
+          if (!error_ && trailer_.size())
+            std::fwrite(trailer_.data(), 1, trailer_.size(), fp_);
+          std::fclose(fp_);
+        }
+      }
+
+      parallel_obuf(const parallel_obuf&) = delete;
+      parallel_obuf& operator=(const parallel_obuf&) = delete;
+
+      /**
+       * Gets index of block currently being filled.
+       * @return Block index
+       */
+      std::size_t block_index() const { return submitted_; }
+
+      /**
+       * Gets number of bytes written to block currently being filled.
+       * @return Uncompressed size of current block
+       */
+      std::size_t block_fill() const { return current_.size(); }
+
+      /**
+       * Gets file offset of block if it has been written.
+       * @param idx Block index
+       * @param dest Destination for file offset
+       * @return False if block has not yet been written
+       */
+      bool block_offset(std::size_t idx, std::uint64_t& dest)
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        if (idx >= block_offsets_.size())
+          return false;
+        dest = block_offsets_[idx];
+        return true;
+      }
+
+      /**
+       * Blocks until all submitted blocks have been written to file.
+       * @return False if a compression or write error has occurred
+       */
+      bool drain()
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        space_cv_.wait(lock, [this]() { return (jobs_.empty() && !writing_) || error_; });
+        if (fp_ && std::fflush(fp_) != 0)
+          error_ = true;
+        return fp_ && !error_;
+      }
+    protected:
+      int_type overflow(int_type ch)
+      {
+        if (!fp_ || error_)
+          return traits_type::eof();
+
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+          current_.push_back(traits_type::to_char_type(ch));
+          if (current_.size() == max_block_size_ && sync() < 0)
+            return traits_type::eof();
+        }
+        return traits_type::not_eof(ch);
+      }
+
+      std::streamsize xsputn(const char_type* s, std::streamsize n)
+      {
+        if (!fp_ || error_)
+          return 0;
+
+        std::streamsize remaining = n;
+        while (max_block_size_ && current_.size() + std::size_t(remaining) >= max_block_size_)
+        {
+          std::size_t sz = max_block_size_ - current_.size();
+          current_.insert(current_.end(), s, s + sz);
+          s += sz;
+          remaining -= sz;
+          if (sync() < 0)
+            return n - remaining;
+        }
+
+        current_.insert(current_.end(), s, s + remaining);
+        return n;
+      }
+
+      int sync()
+      {
+        if (!fp_)
+          return -1;
+
+        if (current_.size())
+        {
+          std::unique_lock<std::mutex> lock(mtx_);
+          space_cv_.wait(lock, [this]() { return jobs_.size() < max_in_flight_ || error_; });
+          jobs_.emplace_back();
+          jobs_.back().input.swap(current_);
+          if (free_buffers_.size())
+          {
+            current_.swap(free_buffers_.back());
+            free_buffers_.pop_back();
+          }
+          ++submitted_;
+          lock.unlock();
+          worker_cv_.notify_one();
+        }
+
+        return error_ ? -1 : 0;
+      }
+
+      pos_type seekoff(off_type off, std::ios_base::seekdir way, std::ios_base::openmode which)
+      {
+        // Only tellp() is supported. Returns the file position at which the current block will begin.
+        if (off != 0 || way != std::ios_base::cur || !(which & std::ios_base::out) || !drain())
+          return pos_type(off_type(-1));
+
+        return pos_type(off_type(file_position()));
+      }
+
+      /**
+       * Gets file position at which the next written block will begin, which includes all submitted blocks only after drain().
+       */
+      std::uint64_t file_position()
+      {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return file_pos_;
+      }
+    private:
+      struct job
+      {
+        std::vector<char> input;
+        std::vector<char> output;
+        bool done = false;
+        bool ok = false;
+      };
+
+      void compress_blocks()
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (true)
+        {
+          worker_cv_.wait(lock, [this]() { return stop_ || dispatched_ < submitted_; });
+          if (dispatched_ >= submitted_)
+            break;
+
+          job& j = jobs_[dispatched_++ - written_];
+          lock.unlock();
+          bool ok = compress_(j.input.data(), j.input.size(), j.output, level_);
+          lock.lock();
+          j.ok = ok;
+          j.done = true;
+
+          // Only one thread writes at a time, and it writes every completed block at the front of the queue.
+          if (!writing_)
+          {
+            writing_ = true;
+            while (jobs_.size() && jobs_.front().done)
+            {
+              job front = std::move(jobs_.front());
+              jobs_.pop_front();
+              ++written_;
+              block_offsets_.push_back(file_pos_);
+              lock.unlock();
+
+              bool write_ok = front.ok && std::fwrite(front.output.data(), 1, front.output.size(), fp_) == front.output.size();
+              front.input.clear();
+
+              lock.lock();
+              if (!write_ok)
+                error_ = true;
+              file_pos_ += front.output.size();
+              free_buffers_.emplace_back(std::move(front.input));
+              space_cv_.notify_all();
+            }
+            writing_ = false;
+            space_cv_.notify_all();
+          }
+        }
+      }
+    private:
+      std::FILE* fp_;
+      compress_fn compress_;
+      int level_;
+      std::size_t max_in_flight_;
+      std::size_t max_block_size_;
+      std::vector<char> trailer_;
+      std::vector<char> current_;
+      std::deque<job> jobs_;
+      std::vector<std::vector<char>> free_buffers_;
+      std::vector<std::uint64_t> block_offsets_;
+      std::uint64_t file_pos_ = 0;
+      std::size_t submitted_ = 0;
+      std::size_t dispatched_ = 0;
+      std::size_t written_ = 0;
+      bool writing_ = false;
+      bool stop_ = false;
+      std::atomic<bool> error_{false};
+      std::mutex mtx_;
+      std::condition_variable worker_cv_;
+      std::condition_variable space_cv_;
+      std::vector<std::thread> workers_;
+    };
+  }
+}
+
+#endif // LIBSAVVY_PARALLEL_OBUF_HPP
@@ -0,0 +1,254 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_PARALLEL_SCAN_HPP
+#define LIBSAVVY_PARALLEL_SCAN_HPP
+
+#include "reader.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+
+namespace savvy
+{
+  struct parallel_scan_options
+  {
+    std::size_t shards_per_thread = 4; ///< More shards than threads balances load when records vary in cost.
+    std::function<void(reader&)> init; ///< Called on each worker's reader before reading (e.g., to subset samples or project fields).
+  };
+
+  namespace detail
+  {
+    /**
+     * Runs fn(shard, rdr) for every shard on num_workers new threads, each with its own reader. If the file cannot
+     * be sharded (i.e., it is not an indexed SAV file), the whole file is read as shard 0 by a single worker.
+     */
+    class shard_scan
+    {
+    public:
+      shard_scan(const std::string& file_path, std::size_t num_shards, const parallel_scan_options& opts) :
+        file_path_(file_path),
+        opts_(opts)
+      {
+        reader rdr(file_path_);
+        good_ = rdr.good();
+        if (good_)
+          shards_ = rdr.make_shards(num_shards);
+
+        whole_file_ = shards_.empty();
+        if (whole_file_)
+          shards_.resize(1);
+      }
+
+      bool good() const { return good_; }
+      std::size_t size() const { return shards_.size(); }
+
+      /**
+       * Starts worker threads. Each worker calls exit_fn() once it has no more shards to process.
+       * @return Number of workers started
+       */
+      template <typename ShardFn, typename ExitFn>
+      std::size_t start(std::size_t num_workers, ShardFn fn, ExitFn exit_fn)
+      {
+        num_workers = std::max<std::size_t>(1, std::min(num_workers, shards_.size()));
+        for (std::size_t i = 0; i < num_workers; ++i)
+          workers_.emplace_back(&shard_scan::work<ShardFn, ExitFn>, this, fn, exit_fn);
+        return num_workers;
+      }
+
+      template <typename ShardFn>
+      std::size_t start(std::size_t num_workers, ShardFn fn)
+      {
+        return start(num_workers, fn, []() {});
+      }
+
+      bool join()
+      {
+        for (auto it = workers_.begin(); it != workers_.end(); ++it)
+          it->join();
+        workers_.clear();
+        return good_ && !failed_;
+      }
+
+      bool failed() const { return failed_; }
+    private:
+      template <typename ShardFn, typename ExitFn>
+      void work(ShardFn fn, ExitFn exit_fn)
+      {
+        reader rdr(file_path_);
+        if (opts_.init)
+          opts_.init(rdr);
+
+        std::size_t i;
+        while (!failed_ && (i = next_++) < shards_.size())
+        {
+          if (!whole_file_ && !rdr.reset_bounds(shards_[i]).good())
+          {
+            failed_ = true;
+            break;
+          }
+
+          fn(shards_[i], rdr);
+          if (rdr.bad())
+            failed_ = true;
+        }
+
+        exit_fn();
+      }
+    private:
+      std::string file_path_;
+      parallel_scan_options opts_;
+      std::vector<scan_shard> shards_;
+      std::vector<std::thread> workers_;
+      std::atomic<std::size_t> next_{0};
+      std::atomic<bool> failed_{false};
+      bool whole_file_ = false;
+      bool good_ = false;
+    };
+  }
+
+  /**
+   * Splits an indexed SAV file into shards along zstd block boundaries and calls fn(shard, rdr) for each shard
+   * on a pool of threads. Each thread opens its own reader, so rdr has already been bounded to the shard and
+   * fn reads the shard's records with rdr.read(). Shards may be processed in any order.
+   *
+   * @param file_path Path to SAV file (other formats are read as a single shard)
+   * @param num_threads Number of threads
+   * @param fn Callable taking (const scan_shard&, reader&)
+   * @param opts Options
+   * @return False if file could not be read
+   */
+  template <typename ShardFn>
+  bool parallel_for_each_shard(const std::string& file_path, std::size_t num_threads, ShardFn fn, const parallel_scan_options& opts = parallel_scan_options())
+  {
+    num_threads = std::max<std::size_t>(1, num_threads);
+    detail::shard_scan scan(file_path, num_threads * std::max<std::size_t>(1, opts.shards_per_thread), opts);
+    if (!scan.good())
+      return false;
+
+    scan.start(num_threads, fn);
+    return scan.join();
+  }
+
+  /**
+   * Calls fn(shard_id, var) for every record of a file on a pool of threads (see parallel_for_each_shard()).
+   * Calls sharing a shard ID are made sequentially by the same thread in file order, so per-shard results can
+   * be accumulated without locking and combined by shard ID afterward.
+   *
+   * @param file_path Path to SAV file
+   * @param num_threads Number of threads
+   * @param fn Callable taking (std::size_t, variant&)
+   * @param opts Options
+   * @return False if file could not be read
+   */
+  template <typename RecordFn>
+  bool parallel_for_each_variant(const std::string& file_path, std::size_t num_threads, RecordFn fn, const parallel_scan_options& opts = parallel_scan_options())
+  {
+    return parallel_for_each_shard(file_path, num_threads, [&fn](const scan_shard& shard, reader& rdr)
+    {
+      variant var;
+      while (rdr.read(var))
+        fn(shard.id, var);
+    }, opts);
+  }
+
+  /**
+   * Calls map_fn(shard_id, var) for every record of a file on a pool of threads and passes each result to
+   * consume_fn on the calling thread in file order, which is genomic order for sorted files. Results of at most
+   * opts.shards_per_thread shards per thread are buffered at once.
+   *
+   * @param file_path Path to SAV file
+   * @param num_threads Number of threads
+   * @param map_fn Callable taking (std::size_t, variant&) and returning a result
+   * @param consume_fn Callable taking result
+   * @param opts Options
+   * @return False if file could not be read
+   */
+  template <typename MapFn, typename ConsumeFn>
+  bool parallel_transform_variants(const std::string& file_path, std::size_t num_threads, MapFn map_fn, ConsumeFn consume_fn, const parallel_scan_options& opts = parallel_scan_options())
+  {
+    typedef typename std::decay<decltype(map_fn(std::size_t(), std::declval<variant&>()))>::type result_type;
+
+    num_threads = std::max<std::size_t>(1, num_threads);
+    const std::size_t window = num_threads * std::max<std::size_t>(1, opts.shards_per_thread);
+    detail::shard_scan scan(file_path, 16 * window, opts); // Smaller shards so that only a fraction of results is buffered.
+    if (!scan.good())
+      return false;
+
+    struct shard_results
+    {
+      std::vector<result_type> values;
+      bool done = false;
+    };
+
+    std::vector<shard_results> results(scan.size());
+    std::size_t consumed = 0;
+    std::size_t exited = 0;
+    std::mutex mtx;
+    std::condition_variable producer_cv;
+    std::condition_variable consumer_cv;
+
+    std::size_t num_workers = scan.start(num_threads, [&](const scan_shard& shard, reader& rdr)
+    {
+      {
+        // Bound memory by not starting a shard until it is within the window of the consumer.
+        std::unique_lock<std::mutex> lock(mtx);
+        producer_cv.wait(lock, [&]() { return shard.id < consumed + window || scan.failed(); });
+        if (scan.failed())
+          return;
+      }
+
+      std::vector<result_type> values;
+      values.reserve(shard.record_count);
+      variant var;
+      while (rdr.read(var))
+        values.emplace_back(map_fn(shard.id, var));
+
+      std::lock_guard<std::mutex> lock(mtx);
+      results[shard.id].values = std::move(values);
+      results[shard.id].done = true;
+      consumer_cv.notify_all();
+    },
+    [&]()
+    {
+      // A failed worker exits early, so waiting threads must be woken to avoid waiting for its shards.
+      std::lock_guard<std::mutex> lock(mtx);
+      ++exited;
+      consumer_cv.notify_all();
+      producer_cv.notify_all();
+    });
+
+    for (std::size_t i = 0; i < results.size(); ++i)
+    {
+      std::vector<result_type> values;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        consumer_cv.wait(lock, [&]() { return results[i].done || exited == num_workers; });
+        if (!results[i].done)
+          break;
+        values = std::move(results[i].values);
+        consumed = i + 1;
+      }
+      producer_cv.notify_all();
+
+      for (auto it = values.begin(); it != values.end(); ++it)
+        consume_fn(std::move(*it));
+    }
+
+    return scan.join();
+  }
+}
+
+#endif // LIBSAVVY_PARALLEL_SCAN_HPP
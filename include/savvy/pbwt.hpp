@@ -7,10 +7,18 @@
 #ifndef LIBSAVVY_PBWT_HPP
 #define LIBSAVVY_PBWT_HPP
 
+#include "thread_pool.hpp"
+
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
 
 namespace savvy
 {
@@ -18,14 +26,23 @@ namespace savvy
   {
     // PBWT
 
+    // Permutations are stored as 32-bit indices to halve memory traffic. Vector sizes are bounded by the
+    // 24-bit sample count times ploidy, so this always suffices in practice (larger vectors are rejected).
+    typedef std::uint32_t pbwt_index;
+    typedef std::vector<pbwt_index> pbwt_sort_map;
+    typedef std::vector<std::uint32_t> pbwt_counts;
 
-    typedef std::vector<std::size_t> pbwt_sort_map;
+    // Vectors with at least this many elements are sorted/unsorted on the shared thread pool.
+    static const std::size_t default_pbwt_parallel_threshold = 1u << 20u;
 
     struct pbwt_sort_context
     {
-      std::vector<std::size_t> prev_sort_mapping;
-      std::vector<std::size_t> counts;
+      pbwt_sort_map prev_sort_mapping;
+      pbwt_counts counts;
       std::unordered_map<std::string, std::unordered_map<std::size_t, pbwt_sort_map>> format_contexts;
+      std::size_t parallel_threshold = default_pbwt_parallel_threshold;
+      std::vector<pbwt_counts> chunk_counts; // Scratch for multi-threaded passes.
+      std::vector<char> gathered; // Scratch for multi-threaded sort.
 
       void reset()
       {
@@ -34,12 +51,223 @@ namespace savvy
           for (auto jt = it->second.begin(); jt != it->second.end(); ++jt)
           {
             for (std::size_t i = 0; i < jt->second.size(); ++i)
-              jt->second[i] = i;
+              jt->second[i] = pbwt_index(i);
           }
         }
       }
     };
+
+    inline void pbwt_prefetch(const void* p)
+    {
+#if defined(__GNUC__)
+      __builtin_prefetch(p);
+#endif
+    }
+
+    // Distance (in elements) ahead of the current position at which random accesses are prefetched.
+    static const std::size_t pbwt_prefetch_distance = 16;
+
+    /**
+     * Makes the current field mapping the previous mapping and prepares the destination mapping. Buffers
+     * are swapped rather than copied, so after the first record no allocations occur.
+     */
+    inline void pbwt_swap_mappings(pbwt_sort_map& sort_mapping, pbwt_sort_map& prev_sort_mapping, std::size_t sz)
+    {
+      if (sz > std::numeric_limits<pbwt_index>::max())
+      {
+        std::fprintf(stderr, "Error: PBWT vectors cannot have more than %u elements\n", std::numeric_limits<pbwt_index>::max());
+        std::exit(-1);
+      }
+
+      std::swap(sort_mapping, prev_sort_mapping);
+      if (prev_sort_mapping.empty())
+      {
+        prev_sort_mapping.resize(sz);
+        for (std::size_t i = 0; i < sz; ++i)
+          prev_sort_mapping[i] = pbwt_index(i);
+      }
+
+      sort_mapping.resize(sz);
+
+      if (prev_sort_mapping.size() != sz)
+      {
+        std::fprintf(stderr, "Variable-sized data vectors not allowed with PBWT\n"); // TODO: handle better
+        std::exit(-1);
+      }
+    }
+
+    /**
+     * Sets counts[d] to the number of elements with (unsigned) value less than d.
+     */
+    template <typename UT>
+    void pbwt_bucket_offsets(const UT* src, std::size_t sz, pbwt_counts& counts)
+    {
+      counts.assign(std::size_t(std::numeric_limits<UT>::max()) + 1, 0);
+      for (std::size_t i = 0; i < sz; ++i)
+        ++counts[src[i]];
+
+      std::uint32_t total = 0;
+      for (std::size_t d = 0; d < counts.size(); ++d)
+      {
+        std::uint32_t c = counts[d];
+        counts[d] = total;
+        total += c;
+      }
+    }
+
+    inline void pbwt_bucket_offsets(const std::uint8_t* src, std::size_t sz, pbwt_counts& counts)
+    {
+      // Genotypes are dominated by one or two values, so a single table would serialize on increments to
+      // the same counter. Four interleaved tables break that dependency and fit in L1.
+      std::uint32_t tables[4][256] = {};
+      std::size_t i = 0;
+      for ( ; i + 4 <= sz; i += 4)
+      {
+        ++tables[0][src[i]];
+        ++tables[1][src[i + 1]];
+        ++tables[2][src[i + 2]];
+        ++tables[3][src[i + 3]];
+      }
+
+      for ( ; i < sz; ++i)
+        ++tables[0][src[i]];
+
+      counts.resize(256);
+      std::uint32_t total = 0;
+      for (std::size_t d = 0; d < 256; ++d)
+      {
+        counts[d] = total;
+        total += tables[0][d] + tables[1][d] + tables[2][d] + tables[3][d];
+      }
+    }
+
+    struct pbwt_identity_index
+    {
+      std::size_t operator()(std::size_t i) const { return i; }
+    };
+
+    struct pbwt_subset_index
+    {
+      const std::vector<std::size_t>& subset_map;
+      std::size_t stride;
+
+      std::size_t operator()(std::size_t i) const
+      {
+        std::size_t s = subset_map[i / stride];
+        return s == std::numeric_limits<std::size_t>::max() ? s : s * stride + i % stride;
+      }
+    };
+
+    /**
+     * Determines how many chunks a PBWT pass should be split into. Returns 1 if the pass should be run
+     * on the calling thread.
+     */
+    inline std::size_t pbwt_chunk_count(std::size_t sz, std::size_t parallel_threshold)
+    {
+      const std::size_t min_chunk_size = 1u << 16u;
+      if (sz < parallel_threshold || sz < 2 * min_chunk_size)
+        return 1;
+      return std::min(detail::shared_thread_pool().size() + 1, sz / min_chunk_size);
+    }
+
+    /**
+     * Multi-threaded version of pbwt_bucket_offsets(). Each chunk gets its own offsets, which are laid out
+     * so that scattering chunks independently produces the same stable order as a single-threaded pass.
+     */
+    template <typename UT>
+    void pbwt_chunk_bucket_offsets(const UT* src, std::size_t sz, std::size_t n_chunks, std::vector<pbwt_counts>& chunk_counts)
+    {
+      const std::size_t n_buckets = std::size_t(std::numeric_limits<UT>::max()) + 1;
+      const std::size_t chunk_size = (sz + n_chunks - 1) / n_chunks;
+      chunk_counts.resize(n_chunks);
+      detail::shared_thread_pool().run(n_chunks, [&](std::size_t c)
+      {
+        pbwt_counts& cnt = chunk_counts[c];
+        cnt.assign(n_buckets, 0);
+        const UT* end = src + std::min(sz, (c + 1) * chunk_size);
+        for (const UT* p = src + c * chunk_size; p < end; ++p)
+          ++cnt[*p];
+      });
+
+      std::uint32_t total = 0;
+      for (std::size_t d = 0; d < n_buckets; ++d)
+      {
+        for (std::size_t c = 0; c < n_chunks; ++c)
+        {
+          std::uint32_t tmp = chunk_counts[c][d];
+          chunk_counts[c][d] = total;
+          total += tmp;
+        }
+      }
+    }
+
+    /**
+     * Unsorts src[beg, end) into dest and appends the corresponding indices to the next sort mapping.
+     */
+    template <typename SrcT, typename DestT, typename IndexFn>
+    void pbwt_unsort_range(const SrcT* src_ptr, std::size_t beg, std::size_t end, DestT* dest_ptr, const pbwt_index* prev_ptr, pbwt_index* sort_ptr, std::uint32_t* counts_ptr, const IndexFn& dest_index)
+    {
+      typedef typename std::make_unsigned<SrcT>::type utype;
+      const bool prefetch_dest = std::is_same<IndexFn, pbwt_identity_index>::value;
+      for (std::size_t i = beg; i < end; ++i)
+      {
+        // Reads of src and prev are sequential, but writes to dest are scattered by the previous permutation.
+        if (prefetch_dest && i + pbwt_prefetch_distance < end)
+          pbwt_prefetch(&dest_ptr[prev_ptr[i + pbwt_prefetch_distance]]);
+
+        const pbwt_index unsorted_index = prev_ptr[i];
+        const std::size_t dest_idx = dest_index(unsorted_index);
+        if (dest_idx != std::numeric_limits<std::size_t>::max())
+          dest_ptr[dest_idx] = src_ptr[i];
+        sort_ptr[counts_ptr[utype(src_ptr[i])]++] = unsorted_index;
+      }
+    }
+
+    /**
+     * Gathers in_data[prev[beg, end)] in sorted order, passing each value to out(i, value), and appends
+     * the corresponding indices to the next sort mapping.
+     */
+    template <typename ValT, typename OutFn>
+    void pbwt_sort_range(const ValT* in_data, std::size_t beg, std::size_t end, const pbwt_index* prev_ptr, pbwt_index* sort_ptr, std::uint32_t* counts_ptr, OutFn& out)
+    {
+      typedef typename std::make_unsigned<ValT>::type utype;
+      for (std::size_t i = beg; i < end; ++i)
+      {
+        if (i + pbwt_prefetch_distance < end)
+          pbwt_prefetch(&in_data[prev_ptr[i + pbwt_prefetch_distance]]);
+
+        const pbwt_index unsorted_index = prev_ptr[i];
+        const ValT val = in_data[unsorted_index];
+        sort_ptr[counts_ptr[utype(val)]++] = unsorted_index;
+        out(i, val);
+      }
+    }
+
+    /**
+     * Copies in_data[prev[beg, end)] to dest[beg, end).
+     */
+    template <typename ValT>
+    void pbwt_gather_range(const ValT* in_data, std::size_t beg, std::size_t end, const pbwt_index* prev_ptr, ValT* dest)
+    {
+      for (std::size_t i = beg; i < end; ++i)
+      {
+        if (i + pbwt_prefetch_distance < end)
+          pbwt_prefetch(&in_data[prev_ptr[i + pbwt_prefetch_distance]]);
+        dest[i] = in_data[prev_ptr[i]];
+      }
+    }
+
+    /**
+     * Appends prev[beg, end) to the next sort mapping according to the already gathered values.
+     */
+    template <typename ValT>
+    void pbwt_bucket_range(const ValT* gathered, std::size_t beg, std::size_t end, const pbwt_index* prev_ptr, pbwt_index* sort_ptr, std::uint32_t* counts_ptr)
+    {
+      typedef typename std::make_unsigned<ValT>::type utype;
+      for (std::size_t i = beg; i < end; ++i)
+        sort_ptr[counts_ptr[utype(gathered[i])]++] = prev_ptr[i];
+    }
   }
 }
 
-#endif // LIBSAVVY_PBWT_HPP
\ No newline at end of file
+#endif // LIBSAVVY_PBWT_HPP
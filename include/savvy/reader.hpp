@@ -12,6 +12,9 @@
 #include "file.hpp"
 #include "csi.hpp"
 #include "s1r.hpp"
+#include "region.hpp"
+#include "matrix.hpp"
+#include "bgzf.hpp"
 
 #include <shrinkwrap/zstd.hpp>
 #include <shrinkwrap/gz.hpp>
@@ -21,11 +24,27 @@
 #include <string>
 #include <memory>
 #include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <algorithm>
 
 namespace savvy
 {
   //namespace v2
   //{
+    /**
+     * Contiguous run of zstd blocks in an indexed SAV file. Shards never split a block, so each one can be read
+     * independently with reader::reset_bounds(const scan_shard&). See parallel_scan.hpp.
+     */
+    struct scan_shard
+    {
+      std::size_t id = 0; ///< Position of shard in file order
+      std::vector<std::pair<std::uint64_t, std::uint32_t>> blocks; ///< File offset and record count of each block
+      std::uint64_t record_count = 0; ///< Total number of records in shard
+    };
+
     class reader : public file
     {
     private:
@@ -35,14 +54,17 @@ namespace savvy
       std::vector<std::pair<std::string, std::string>> headers_;
       std::vector<std::string> ids_;
       typed_value temp_val_;
+      ::savvy::detail::vcf_line_buffer vcf_lines_; // VCF records are parsed in place from raw lines.
 
       std::vector<std::size_t> subset_map_;
+      std::vector<std::size_t> subset_indices_;
       std::size_t subset_size_;
 
       // Random access
       struct index_data
       {
-        s1r::reader file;
+        std::shared_ptr<s1r::reader> file_ptr;
+        s1r::reader& file;
         genomic_region reg;
         s1r::reader::query query;
         s1r::reader::query::iterator iter;
@@ -52,8 +74,14 @@ namespace savvy
         std::uint64_t total_records_read;
         std::uint64_t max_records_to_read;
 
-        index_data(const std::string& file_path, genomic_region bounds, bounding_point bound_type = bounding_point::beg) :
-          file(file_path),
+        // Multi-region queries precompute the union of blocks instead of using query.
+        std::unique_ptr<::savvy::detail::region_lookup> regions;
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> blocks;
+        std::size_t next_block;
+
+        index_data(std::shared_ptr<s1r::reader> index_file, genomic_region bounds, bounding_point bound_type = bounding_point::beg) :
+          file_ptr(std::move(index_file)),
+          file(*file_ptr),
           reg(bounds),
           query(file.create_query(bounds)),
           iter(query.begin()),
@@ -61,8 +89,90 @@ namespace savvy
           current_offset_in_block(0),
           total_in_block(0),
           total_records_read(0),
-          max_records_to_read(std::numeric_limits<std::uint64_t>::max())
+          max_records_to_read(std::numeric_limits<std::uint64_t>::max()),
+          next_block(0)
+        {
+        }
+
+        index_data(std::shared_ptr<s1r::reader> index_file, std::vector<std::pair<std::uint64_t, std::uint32_t>> shard_blocks) :
+          file_ptr(std::move(index_file)),
+          file(*file_ptr),
+          reg(""),
+          query(file.create_query(std::vector<genomic_region>())),
+          iter(query.begin()),
+          bounding_type(bounding_point::any),
+          current_offset_in_block(0),
+          total_in_block(0),
+          total_records_read(0),
+          max_records_to_read(std::numeric_limits<std::uint64_t>::max()),
+          regions(::savvy::detail::make_unique<::savvy::detail::region_lookup>(std::vector<genomic_region>{genomic_region("")}, bounding_point::any)),
+          blocks(std::move(shard_blocks)),
+          next_block(0)
+        {
+        }
+
+        index_data(std::shared_ptr<s1r::reader> index_file, const std::vector<genomic_region>& bounds, bounding_point bound_type = bounding_point::beg) :
+          file_ptr(std::move(index_file)),
+          file(*file_ptr),
+          reg(""),
+          query(file.create_query(std::vector<genomic_region>())),
+          iter(query.begin()),
+          bounding_type(bound_type),
+          current_offset_in_block(0),
+          total_in_block(0),
+          total_records_read(0),
+          max_records_to_read(std::numeric_limits<std::uint64_t>::max()),
+          regions(::savvy::detail::make_unique<::savvy::detail::region_lookup>(bounds, bound_type)),
+          next_block(0)
+        {
+          // Blocks are ordered by the first region that needs them, which is file order when regions are
+          // sorted. A block shared by several regions is only listed (and decompressed) once.
+          std::unordered_set<std::uint64_t> visited;
+          for (auto it = bounds.begin(); it != bounds.end(); ++it)
+          {
+            auto q = file.create_query(*it);
+            for (auto jt = q.begin(); jt != q.end(); ++jt)
+            {
+              std::uint64_t file_pos = (jt->value() >> 16) & 0x0000FFFFFFFFFFFF;
+              if (visited.insert(file_pos).second)
+                blocks.emplace_back(file_pos, std::uint32_t(0x000000000000FFFF & jt->value()) + 1);
+            }
+          }
+        }
+
+        /**
+         * Gets file offset and record count of next block to read.
+         * @return False if there are no more blocks
+         */
+        bool pop_block(std::pair<std::uint64_t, std::uint32_t>& dest)
+        {
+          if (regions)
+          {
+            if (next_block >= blocks.size())
+              return false;
+            dest = blocks[next_block++];
+            return true;
+          }
+
+          if (iter == query.end())
+            return false;
+          dest = std::make_pair((iter->value() >> 16) & 0x0000FFFFFFFFFFFF, std::uint32_t(0x000000000000FFFF & iter->value()) + 1);
+          ++iter;
+          return true;
+        }
+
+        /**
+         * Checks whether record is within query bounds.
+         * @return Index of matching region or std::numeric_limits<std::size_t>::max() if record is out of bounds
+         */
+        std::size_t match(const site_info& r) const
         {
+          if (regions)
+          {
+            std::size_t ret = regions->find(r);
+            return ret < regions->regions().size() ? ret : std::numeric_limits<std::size_t>::max();
+          }
+          return region_compare(bounding_type, r, reg) ? 0 : std::numeric_limits<std::size_t>::max();
         }
       };
 
@@ -73,6 +183,7 @@ namespace savvy
         std::list<std::pair<std::uint64_t, std::uint64_t>> intervals;
         std::size_t interval_off;
         bounding_point bounding_type;
+        std::unique_ptr<::savvy::detail::region_lookup> regions; // Set for multi-region queries.
 
         csi_index_data(const std::string& file_path, const std::unordered_map<std::string, std::uint32_t>& contig_map, genomic_region bounds, bounding_point bound_type = bounding_point::beg) :
           file(file_path),
@@ -83,10 +194,178 @@ namespace savvy
           auto tmp = file.query_intervals(reg.chromosome(), contig_map, reg.from(), std::min<std::uint64_t>(reg.to(), std::numeric_limits<std::int64_t>::max())); // TODO: have this return list instead of vector
           intervals.assign(tmp.begin(), tmp.end());
         }
+
+        csi_index_data(const std::string& file_path, const std::unordered_map<std::string, std::uint32_t>& contig_map, const std::vector<genomic_region>& bounds, bounding_point bound_type = bounding_point::beg) :
+          file(file_path),
+          reg(""),
+          interval_off(0),
+          bounding_type(bound_type),
+          regions(::savvy::detail::make_unique<::savvy::detail::region_lookup>(bounds, bound_type))
+        {
+          // Intervals of all regions are merged in file order so that overlapping chunks are only read once.
+          std::vector<std::pair<std::uint64_t, std::uint64_t>> tmp;
+          for (auto it = bounds.begin(); it != bounds.end(); ++it)
+          {
+            auto res = file.query_intervals(it->chromosome(), contig_map, it->from(), std::min<std::uint64_t>(it->to(), std::numeric_limits<std::int64_t>::max()));
+            tmp.insert(tmp.end(), res.begin(), res.end());
+          }
+
+          std::sort(tmp.begin(), tmp.end());
+          for (auto it = tmp.begin(); it != tmp.end(); ++it)
+          {
+            if (intervals.size() && it->first <= intervals.back().second)
+              intervals.back().second = std::max(intervals.back().second, it->second);
+            else
+              intervals.push_back(*it);
+          }
+        }
+
+        /**
+         * Checks whether record is within query bounds.
+         * @return Index of matching region or std::numeric_limits<std::size_t>::max() if record is out of bounds
+         */
+        std::size_t match(const site_info& r) const
+        {
+          if (regions)
+          {
+            std::size_t ret = regions->find(r);
+            return ret < regions->regions().size() ? ret : std::numeric_limits<std::size_t>::max();
+          }
+          return region_compare(bounding_type, r, reg) ? 0 : std::numeric_limits<std::size_t>::max();
+        }
       };
 
+      std::shared_ptr<s1r::reader> s1r_file_; // Opened once and shared by every query, since reset_bounds() may be called frequently.
       std::unique_ptr<index_data> s1r_index_;
       std::unique_ptr<csi_index_data> csi_index_;
+
+      // Multi-threaded block decompression
+      struct block_pipeline
+      {
+        struct block
+        {
+          std::vector<variant> records;
+          std::size_t size = 0;
+          bool ready = false;
+          bool failed = false;
+        };
+
+        // Copies of reader state so that worker threads never touch the reader object.
+        std::string file_path;
+        ::savvy::dictionary dict;
+        std::size_t sample_size;
+        std::vector<std::size_t> subset_map;
+        std::vector<std::size_t> subset_indices;
+        std::size_t subset_size;
+        phasing phased;
+        internal::field_projection projection;
+        std::size_t pbwt_parallel_threshold;
+
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> entries; // (file offset, record count) of each zstd block
+        std::vector<block> window;
+        std::size_t next_block = 0;
+        std::size_t current_block = 0;
+        std::size_t current_offset = 0;
+        bool current_acquired = false;
+        bool stop = false;
+
+        std::mutex mtx;
+        std::condition_variable worker_cv;
+        std::condition_variable consumer_cv;
+        std::vector<std::thread> workers;
+
+        ~block_pipeline()
+        {
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+          }
+          worker_cv.notify_all();
+          for (auto it = workers.begin(); it != workers.end(); ++it)
+            it->join();
+        }
+      };
+
+      std::unique_ptr<block_pipeline> pipeline_;
+
+      // Multi-threaded VCF parsing
+      struct vcf_pipeline
+      {
+        struct batch
+        {
+          std::vector<char> text; // Complete lines
+          std::vector<std::size_t> line_offsets; // Offset of each record's line in text
+          std::vector<variant> records;
+          std::size_t size = 0;
+          bool ready = false;
+          bool failed = false;
+        };
+
+        // Copies of reader state so that worker threads never touch the reader object.
+        ::savvy::dictionary dict;
+        std::size_t sample_size;
+        std::vector<std::size_t> subset_map;
+        std::size_t subset_size;
+        phasing phased;
+        internal::field_projection projection;
+
+        std::unique_ptr<::savvy::detail::bgzf_block_reader> bgzf; // Set if blocks can be inflated in parallel
+        std::streambuf* sbuf = nullptr; // Otherwise, text is read from the reader's stream buffer.
+        std::vector<char> pending; // Partial line carried over to the next batch
+
+        std::vector<batch> window;
+        std::size_t filled_count = 0;
+        std::size_t next_batch = 0;
+        std::size_t current_batch = 0;
+        std::size_t current_offset = 0;
+        bool current_acquired = false;
+        bool end_of_text = false;
+        bool source_failed = false;
+        bool stop = false;
+
+        std::mutex mtx;
+        std::condition_variable splitter_cv;
+        std::condition_variable worker_cv;
+        std::condition_variable consumer_cv;
+        std::thread splitter;
+        std::vector<std::thread> workers;
+
+        /**
+         * Stops and joins threads. Batches taken by workers are finished first, so the text of every batch below
+         * filled_count, followed by pending, is exactly the text that was pulled from the source.
+         */
+        void halt()
+        {
+          {
+            std::lock_guard<std::mutex> lock(mtx);
+            stop = true;
+          }
+          splitter_cv.notify_all();
+          worker_cv.notify_all();
+          if (splitter.joinable())
+            splitter.join();
+          for (auto it = workers.begin(); it != workers.end(); ++it)
+          {
+            if (it->joinable())
+              it->join();
+          }
+        }
+
+        ~vcf_pipeline()
+        {
+          halt();
+        }
+      };
+
+      std::unique_ptr<vcf_pipeline> vcf_pipeline_;
+      std::size_t thread_count_ = 1;
+      std::size_t pipeline_skip_ = 0;
+      bool lazy_format_ = false;
+      std::shared_ptr<const internal::sample_subset> lazy_subset_; // Copy of sample subset held by lazily decoded records.
+      internal::field_projection projection_;
+      std::size_t region_index_ = 0;
+      variant matrix_record_;
+      std::vector<std::size_t> matrix_missing_;
     public:
       /**
        * Default constuctor.
@@ -128,6 +407,18 @@ namespace savvy
        */
       const std::list<header_value_details>& info_headers() const { return info_headers_; }
 
+      /**
+       * Creates interned key for INFO or FORMAT lookups on records read by this reader.
+       *
+       * @param key Key string
+       * @return Interned key
+       */
+      field_key intern_key(const std::string& key) const
+      {
+        auto res = dict_.str_to_int[dictionary::id].find(key);
+        return field_key(key, res == dict_.str_to_int[dictionary::id].end() ? -1 : std::int32_t(res->second));
+      }
+
       /**
        * Subsets individual data for future calls to read().
        *
@@ -145,6 +436,18 @@ namespace savvy
        */
       reader& reset_bounds(genomic_region reg, bounding_point bp = bounding_point::beg);
 
+      /**
+       * Uses S1R or CSI index to query many genomic regions at once. Index blocks needed by any region are
+       * read exactly once, even when neighboring regions share a block, and each record within bounds is
+       * returned once. Records are returned in file order, which is also region order when regions are sorted
+       * and non-overlapping. Use region_index() to determine which region a record matched.
+       *
+       * @param regs Genomic regions to query (see load_bed_regions() for BED files)
+       * @param bp Specifies how indels are treated when they cross region bounds
+       * @return *this
+       */
+      reader& reset_bounds(const std::vector<genomic_region>& regs, bounding_point bp = bounding_point::beg);
+
       /**
        * Uses S1R index to query records by offset within file.
        *
@@ -153,6 +456,89 @@ namespace savvy
        */
       reader& reset_bounds(slice_bounds reg);
 
+      /**
+       * Uses S1R index to read every record in a shard created by make_shards().
+       *
+       * @param shard Shard to read
+       * @return *this
+       */
+      reader& reset_bounds(const scan_shard& shard);
+
+      /**
+       * Splits an indexed SAV file into shards with roughly equal record counts. Shard boundaries always fall
+       * on zstd block boundaries, so shards can be read concurrently by separate reader objects.
+       *
+       * @param num_shards Maximum number of shards (fewer are returned if file has fewer blocks)
+       * @return Shards in file order, or an empty vector if file is not an indexed SAV file
+       */
+      std::vector<scan_shard> make_shards(std::size_t num_shards);
+
+      /**
+       * Enables multi-threaded decompression of SAV files. Upcoming zstd blocks are located with the S1R index,
+       * then decompressed and deserialized on worker threads while records are returned in file order.
+       * VCF files are split into batches of lines that are parsed on worker threads, and BGZF blocks are
+       * inflated on the library's shared thread pool. This has no effect on BCF files, SAV files without an
+       * index, or VCF queries bounded by reset_bounds(). Should be called before the first call to read().
+       * Subsequent calls to reset_bounds() will also use worker threads for SAV files.
+       *
+       * @param num_threads Number of worker threads (1 disables multi-threading)
+       * @return *this
+       */
+      reader& set_threads(std::size_t num_threads);
+
+      /**
+       * Enables lazy decoding of FORMAT fields in BCF and SAV files. When enabled, BCF genotype decoding, sample
+       * subsetting and byte swapping (on big-endian hosts) are deferred until a field is first accessed with
+       * variant::get_format() or variant::format_fields(), so fields that are never accessed are not decoded.
+       * PBWT-sorted SAV fields are not deferred and are always unsorted on read. This is a limitation of the current
+       * implementation: the next record only needs this record's sorted values and the previous permutation, but the
+       * permutation is updated in the same pass that scatters values, so deferring the scatter would require keeping
+       * a copy of the previous permutation for every such field.
+       * The const accessors of variant finish decoding in place, so a lazily decoded record must not be accessed
+       * from multiple threads concurrently. This has no effect when multi-threaded decompression is enabled.
+       *
+       * @param enabled Enables lazy decoding if true
+       * @return *this
+       */
+      reader& set_lazy_format(bool enabled) { lazy_format_ = enabled; return *this; }
+
+      /**
+       * Sets minimum size of PBWT-encoded FORMAT vectors for which unsorting is split across the library's
+       * shared thread pool. This is independent of set_threads(), which decodes separate blocks in parallel.
+       * Should be called before the first call to read().
+       *
+       * @param min_size Minimum vector size (number of haplotypes for GT); std::numeric_limits<std::size_t>::max() disables
+       * @return *this
+       */
+      reader& set_pbwt_parallel_threshold(std::size_t min_size) { sort_context_.parallel_threshold = min_size; return *this; }
+
+      /**
+       * Restricts decoding to the specified INFO fields. Other INFO fields are skipped without being
+       * stored in records.
+       *
+       * @param keys INFO keys to decode
+       * @return *this
+       */
+      reader& project_info(const std::unordered_set<std::string>& keys);
+
+      /**
+       * Restricts decoding to the specified FORMAT fields. Other FORMAT fields are skipped without being
+       * stored in records. An empty set skips individual data entirely (sites only), which for VCF files
+       * also skips parsing of sample columns. Skipped PBWT-encoded fields do not keep their sort state, so
+       * this should be called before the first call to read() or reset_bounds().
+       *
+       * @param keys FORMAT keys to decode
+       * @return *this
+       */
+      reader& project_format(const std::unordered_set<std::string>& keys);
+
+      /**
+       * Removes INFO and FORMAT projections so that all fields are decoded.
+       *
+       * @return *this
+       */
+      reader& reset_projection();
+
       /**
        * Getter for file's phasing status.
        *
@@ -189,6 +575,41 @@ namespace savvy
        */
       reader& read(variant& r);
 
+      /**
+       * Reads up to num_records records and writes one FORMAT field of each into a row of a caller-provided dense
+       * matrix. Values are converted directly from the decoded record, avoiding an intermediate vector per record.
+       * Missing values are set to typed_value::missing_value<T>() unless opts.mean_impute is set. Records without
+       * the field are treated as all missing.
+       *
+       * @param key FORMAT key
+       * @param dest Matrix with room for num_records * num_columns values
+       * @param num_records Number of rows in dest (the leading dimension of column-major matrices)
+       * @param num_columns Number of columns in dest (field size divided by opts.stride)
+       * @param layout Storage order of dest
+       * @param opts Stride reduction and imputation options
+       * @param sites Optional destination for site information of each row
+       * @return Number of rows filled (less than num_records at end of file or if a record does not have num_columns columns)
+       */
+      template <typename T>
+      std::size_t read_matrix(const std::string& key, T* dest, std::size_t num_records, std::size_t num_columns, matrix_layout layout, const matrix_options& opts = matrix_options(), std::vector<site_info>* sites = nullptr);
+
+      /**
+       * Reads up to num_records records and writes one FORMAT field of each into a compressed sparse matrix, which
+       * is CSR for matrix_layout::row_major and CSC for matrix_layout::column_major. Zeros are omitted and missing
+       * values are stored explicitly unless opts.mean_impute is set.
+       *
+       * @param key FORMAT key
+       * @param dest Destination matrix (cleared before reading)
+       * @param num_records Maximum number of rows to read
+       * @param num_columns Number of columns (field size divided by opts.stride)
+       * @param layout CSR or CSC
+       * @param opts Stride reduction and imputation options
+       * @param sites Optional destination for site information of each row
+       * @return Number of rows filled
+       */
+      template <typename T>
+      std::size_t read_matrix(const std::string& key, sparse_matrix<T>& dest, std::size_t num_records, std::size_t num_columns, matrix_layout layout, const matrix_options& opts = matrix_options(), std::vector<site_info>* sites = nullptr);
+
       /**
        * Shorthand for read() function.
        *
@@ -210,6 +631,14 @@ namespace savvy
        * @return File position
        */
       std::streampos tellg() { return this->input_stream_->tellg(); }
+
+      /**
+       * Gets index of region matched by the last record read. For multi-region queries, this is the first region
+       * (in the order passed to reset_bounds()) that contains the record. Single-region queries always return 0.
+       *
+       * @return Region index
+       */
+      std::size_t region_index() const { return region_index_; }
     private:
 //      void process_header_pair(const std::string& key, const std::string& val);
       bool read_header();
@@ -217,9 +646,29 @@ namespace savvy
 
       reader& read_record(variant& r);
       reader& read_vcf_record(variant& r);
+      reader& read_vcf_pipelined_record(variant& r);
       reader& read_sav1_record(variant& r);
       reader& read_indexed_record(variant& r);
       reader& read_csi_indexed_record(variant& r);
+      reader& read_pipelined_record(variant& r);
+
+      static void read_binary_record(std::istream& is, variant& r, const ::savvy::dictionary& dict, internal::pbwt_sort_context& sort_context, std::size_t sample_size, bool is_bcf, phasing phased, const internal::field_projection& proj, const internal::sample_subset_view& subset, bool lazy = false);
+      void update_projection_ids();
+      std::shared_ptr<s1r::reader> open_s1r_index();
+      const typed_value* read_matrix_record(const field_key& key, std::size_t row, std::vector<site_info>* sites);
+      void report_matrix_size_error(const std::string& key);
+      template <typename Bounds>
+      reader& reset_index_bounds(const Bounds& bounds, bounding_point bp);
+
+      void start_pipeline(std::vector<std::pair<std::uint64_t, std::uint32_t>> entries, std::size_t skip);
+      static void decompress_blocks(block_pipeline& p);
+
+      void start_vcf_pipeline();
+      void start_vcf_pipeline(std::vector<char> text, std::unique_ptr<::savvy::detail::bgzf_block_reader> bgzf);
+      void restart_pipelines();
+      static void split_vcf_batches(vcf_pipeline& p);
+      static void parse_vcf_batches(vcf_pipeline& p);
+      static bool deserialize_vcf_line(variant& r, char* line, char* line_end, const ::savvy::dictionary& dict, std::size_t sample_size, phasing phased, const internal::field_projection& proj);
     };
 
     //================================================================//
@@ -280,40 +729,155 @@ namespace savvy
 //      return sample_subset{std::move(ret), std::move(subset_map)};
 //    }
 
+    inline
+    reader& reader::project_info(const std::unordered_set<std::string>& keys)
+    {
+      projection_.info_enabled = true;
+      projection_.info_keys = keys;
+      update_projection_ids();
+      restart_pipelines();
+      return *this;
+    }
+
+    inline
+    reader& reader::project_format(const std::unordered_set<std::string>& keys)
+    {
+      projection_.format_enabled = true;
+      projection_.format_keys = keys;
+      update_projection_ids();
+      restart_pipelines();
+      return *this;
+    }
+
+    inline
+    reader& reader::reset_projection()
+    {
+      projection_ = internal::field_projection();
+      restart_pipelines();
+      return *this;
+    }
+
+    inline
+    std::shared_ptr<s1r::reader> reader::open_s1r_index()
+    {
+      if (!s1r_file_)
+      {
+        // TODO: First check whether index is appended, than check file_path_ + ".s1r"
+        s1r_file_ = std::make_shared<s1r::reader>(::savvy::detail::file_exists(file_path_ + ".s1r") ? file_path_ + ".s1r" : file_path_);
+      }
+      return s1r_file_;
+    }
+
+    inline
+    void reader::update_projection_ids()
+    {
+      projection_.info_ids.assign(dict_.entries[dictionary::id].size(), 0);
+      projection_.format_ids.assign(dict_.entries[dictionary::id].size(), 0);
+      for (auto it = projection_.info_keys.begin(); it != projection_.info_keys.end(); ++it)
+      {
+        auto res = dict_.str_to_int[dictionary::id].find(*it);
+        if (res != dict_.str_to_int[dictionary::id].end() && res->second < projection_.info_ids.size())
+          projection_.info_ids[res->second] = 1;
+      }
+
+      for (auto it = projection_.format_keys.begin(); it != projection_.format_keys.end(); ++it)
+      {
+        auto res = dict_.str_to_int[dictionary::id].find(*it);
+        if (res != dict_.str_to_int[dictionary::id].end() && res->second < projection_.format_ids.size())
+          projection_.format_ids[res->second] = 1;
+      }
+    }
+
     inline
     std::vector<std::string> reader::subset_samples(const std::unordered_set<std::string>& subset)
     {
       std::vector<std::string> ret;
       ret.reserve(std::min(subset.size(), ids_.size()));
 
+      lazy_subset_.reset(); // Records read earlier keep the previous subset.
       subset_map_.clear();
       subset_map_.resize(ids_.size(), std::numeric_limits<std::uint64_t>::max());
+      subset_indices_.clear();
       std::uint64_t subset_index = 0;
       for (auto it = ids_.begin(); it != ids_.end(); ++it)
       {
         if (subset.find(*it) != subset.end())
         {
           subset_map_[std::distance(ids_.begin(), it)] = subset_index;
+          subset_indices_.push_back(std::distance(ids_.begin(), it));
           ret.push_back(*it);
           ++subset_index;
         }
       }
 
       subset_size_ = subset_index;
+      restart_pipelines();
 
       return ret;
     }
 
+    inline
+    void reader::restart_pipelines()
+    {
+      // Worker threads hold copies of the subset and projection, and buffered records were decoded with the
+      // previous ones, so workers are restarted from the current position.
+      if (pipeline_)
+      {
+        std::size_t skip = pipeline_->current_offset;
+        std::vector<std::pair<std::uint64_t, std::uint32_t>> entries(pipeline_->entries.begin() + std::min(pipeline_->current_block, pipeline_->entries.size()), pipeline_->entries.end());
+        pipeline_.reset();
+        start_pipeline(std::move(entries), skip);
+      }
+
+      if (vcf_pipeline_)
+      {
+        vcf_pipeline& p = *vcf_pipeline_;
+        p.halt();
+
+        // Batch text is left intact by workers, so unread lines can be handed to the new pipeline.
+        std::vector<char> text;
+        for (std::size_t i = p.current_batch; i < p.filled_count; ++i)
+        {
+          vcf_pipeline::batch& b = p.window[i % p.window.size()];
+          std::size_t beg = 0;
+          if (i == p.current_batch && p.current_acquired)
+            beg = p.current_offset < b.size ? b.line_offsets[p.current_offset] : b.text.size();
+          text.insert(text.end(), b.text.begin() + beg, b.text.end());
+        }
+        text.insert(text.end(), p.pending.begin(), p.pending.end());
+
+        std::unique_ptr<::savvy::detail::bgzf_block_reader> bgzf = std::move(p.bgzf);
+        vcf_pipeline_.reset();
+        start_vcf_pipeline(std::move(text), std::move(bgzf));
+      }
+    }
+
     inline
     reader& reader::reset_bounds(genomic_region reg, bounding_point bp)
+    {
+      return reset_index_bounds(reg, bp);
+    }
+
+    inline
+    reader& reader::reset_bounds(const std::vector<genomic_region>& regs, bounding_point bp)
+    {
+      return reset_index_bounds(regs, bp);
+    }
+
+    template <typename Bounds>
+    reader& reader::reset_index_bounds(const Bounds& bounds, bounding_point bp)
     {
       input_stream_->clear();
+      vcf_lines_.clear();
+      pipeline_.reset();
+      vcf_pipeline_.reset();
+      pipeline_skip_ = 0;
+      region_index_ = 0;
 
       bool csi_exists = false;
       if (file_format_ == format::sav1 || file_format_ == format::sav2)
       {
-        // TODO: First check whether index is appended, than check file_path_ + ".s1r"
-        s1r_index_ = ::savvy::detail::make_unique<index_data>(::savvy::detail::file_exists(file_path_ + ".s1r") ? file_path_ + ".s1r" : file_path_, reg, bp);
+        s1r_index_ = ::savvy::detail::make_unique<index_data>(open_s1r_index(), bounds, bp);
         if (!s1r_index_->file.good())
         {
           input_stream_->setstate(std::ios::failbit); //TODO: error message
@@ -321,7 +885,7 @@ namespace savvy
       }
       else if ((csi_exists = ::savvy::detail::file_exists(file_path_ + ".csi")) || ::savvy::detail::file_exists(file_path_ + ".tbi"))
       {
-        csi_index_ = ::savvy::detail::make_unique<csi_index_data>(file_path_ + (csi_exists ? ".csi" : ".tbi"), dict_.str_to_int[dictionary::contig], reg, bp);
+        csi_index_ = ::savvy::detail::make_unique<csi_index_data>(file_path_ + (csi_exists ? ".csi" : ".tbi"), dict_.str_to_int[dictionary::contig], bounds, bp);
         if (!csi_index_->file.good())
         {
           input_stream_->setstate(std::ios::failbit); //TODO: error message
@@ -381,6 +945,13 @@ namespace savvy
 
               if (num_variants_to_skip < s1r_index_->total_in_block)
               {
+                if (thread_count_ > 1 && file_format_ == format::sav2)
+                {
+                  // Worker threads will decompress this block and discard the skipped records.
+                  pipeline_skip_ = num_variants_to_skip;
+                  return *this;
+                }
+
                 s1r_index_->current_offset_in_block = 0;
                 this->input_stream_->seekg(std::streampos((s1r_index_->iter->value() >> 16) & 0x0000FFFFFFFFFFFF));
                 ++(s1r_index_->iter);
@@ -405,6 +976,71 @@ namespace savvy
       return *this;
     }
 
+    inline
+    reader& reader::reset_bounds(const scan_shard& shard)
+    {
+      input_stream_->clear();
+      pipeline_.reset();
+      pipeline_skip_ = 0;
+      region_index_ = 0;
+
+      if (file_format_ == format::sav1 || file_format_ == format::sav2)
+      {
+        s1r_index_ = ::savvy::detail::make_unique<index_data>(open_s1r_index(), shard.blocks);
+        if (!s1r_index_->file.good())
+          input_stream_->setstate(std::ios::failbit); //TODO: error message
+      }
+      else
+      {
+        input_stream_->setstate(std::ios::failbit); //TODO: error message
+      }
+
+      return *this;
+    }
+
+    inline
+    std::vector<scan_shard> reader::make_shards(std::size_t num_shards)
+    {
+      std::vector<scan_shard> ret;
+      if (file_format_ != format::sav1 && file_format_ != format::sav2)
+        return ret;
+
+      std::shared_ptr<s1r::reader> idx = open_s1r_index();
+      if (!idx->good())
+        return ret;
+
+      std::vector<std::pair<std::uint64_t, std::uint32_t>> blocks;
+      std::uint64_t total_records = 0;
+      auto q = idx->create_query(genomic_region(""));
+      for (auto it = q.begin(); it != q.end(); ++it)
+      {
+        blocks.emplace_back((it->value() >> 16) & 0x0000FFFFFFFFFFFF, std::uint32_t(0x000000000000FFFF & it->value()) + 1);
+        total_records += blocks.back().second;
+      }
+
+      // Sorting by offset guarantees file order even when a chromosome's blocks are not contiguous.
+      std::sort(blocks.begin(), blocks.end());
+
+      num_shards = std::max<std::size_t>(1, std::min(num_shards, blocks.size()));
+      ret.reserve(num_shards);
+      std::uint64_t cumulative_records = 0;
+      for (auto it = blocks.begin(); it != blocks.end(); ++it)
+      {
+        // A new shard starts once the previous one reaches its share of the total.
+        if (ret.empty() || (ret.size() < num_shards && cumulative_records >= total_records * ret.size() / num_shards))
+        {
+          ret.emplace_back();
+          ret.back().id = ret.size() - 1;
+        }
+
+        ret.back().blocks.push_back(*it);
+        ret.back().record_count += it->second;
+        cumulative_records += it->second;
+      }
+
+      return ret;
+    }
+
     inline
     reader& reader::read_indexed_record(variant& r)
     {
@@ -418,17 +1054,17 @@ namespace savvy
 
         if (s1r_index_->current_offset_in_block >= s1r_index_->total_in_block)
         {
-          if (s1r_index_->iter == s1r_index_->query.end())
+          std::pair<std::uint64_t, std::uint32_t> blk;
+          if (!s1r_index_->pop_block(blk))
           {
             this->input_stream_->setstate(std::ios::eofbit);
             break;
           }
           else
           {
-            s1r_index_->total_in_block = std::uint32_t(0x000000000000FFFF & s1r_index_->iter->value()) + 1;
+            s1r_index_->total_in_block = blk.second;
             s1r_index_->current_offset_in_block = 0;
-            this->input_stream_->seekg(std::streampos((s1r_index_->iter->value() >> 16) & 0x0000FFFFFFFFFFFF));
-            ++(s1r_index_->iter);
+            this->input_stream_->seekg(std::streampos(blk.first));
           }
         }
 
@@ -447,9 +1083,11 @@ namespace savvy
         {
           ++(s1r_index_->current_offset_in_block);
           ++(s1r_index_->total_records_read);
-          if (region_compare(s1r_index_->bounding_type, r, s1r_index_->reg))
+          std::size_t idx = s1r_index_->match(r);
+          if (idx != std::numeric_limits<std::size_t>::max())
           {
             //this->read_genotypes(annotations, destination);
+            region_index_ = idx;
             break;
           }
           else
@@ -498,12 +1136,14 @@ namespace savvy
 
         //assert(r.pos() >= pos_before);
 
-        if (region_compare(csi_index_->bounding_type, r, csi_index_->reg))
+        std::size_t idx = csi_index_->match(r);
+        if (idx != std::numeric_limits<std::size_t>::max())
         {
           //this->read_genotypes(annotations, destination);
+          region_index_ = idx;
           break;
         }
-        else if (r.pos() > csi_index_->reg.to())
+        else if (!csi_index_->regions && r.pos() > csi_index_->reg.to())
         {
           input_stream_->setstate(std::ios::eofbit);
         }
@@ -511,11 +1151,179 @@ namespace savvy
       return *this; //TODO: clear site info before returning if not good
     }
 
+    inline
+    reader& reader::set_threads(std::size_t num_threads)
+    {
+      pipeline_.reset();
+      vcf_pipeline_.reset();
+      thread_count_ = std::max<std::size_t>(1, num_threads);
+      return *this;
+    }
+
+    inline
+    void reader::start_pipeline(std::vector<std::pair<std::uint64_t, std::uint32_t>> entries, std::size_t skip)
+    {
+      pipeline_ = ::savvy::detail::make_unique<block_pipeline>();
+      pipeline_->file_path = file_path_;
+      pipeline_->dict = dict_;
+      pipeline_->sample_size = ids_.size();
+      pipeline_->subset_map = subset_map_;
+      pipeline_->subset_indices = subset_indices_;
+      pipeline_->subset_size = subset_size_;
+      pipeline_->phased = phasing_;
+      pipeline_->projection = projection_;
+      pipeline_->pbwt_parallel_threshold = sort_context_.parallel_threshold;
+      pipeline_->entries = std::move(entries);
+      pipeline_->current_offset = skip;
+      pipeline_->window.resize(2 * thread_count_);
+
+      for (std::size_t i = 0; i < thread_count_; ++i)
+        pipeline_->workers.emplace_back(decompress_blocks, std::ref(*pipeline_));
+    }
+
+    inline
+    void reader::decompress_blocks(block_pipeline& p)
+    {
+      std::unique_ptr<std::streambuf> sbuf;
+      FILE* fp = fopen(p.file_path.c_str(), "rb");
+      if (fp)
+        sbuf = ::savvy::detail::make_unique<::shrinkwrap::zstd::ibuf>(fp);
+      std::istream is(sbuf.get());
+      internal::pbwt_sort_context sort_context;
+      sort_context.parallel_threshold = p.pbwt_parallel_threshold;
+
+      std::unique_lock<std::mutex> lock(p.mtx);
+      while (true)
+      {
+        p.worker_cv.wait(lock, [&p]() { return p.stop || p.next_block >= p.entries.size() || p.next_block < p.current_block + p.window.size(); });
+        if (p.stop || p.next_block >= p.entries.size())
+          break;
+
+        std::size_t block_idx = p.next_block++;
+        block_pipeline::block& b = p.window[block_idx % p.window.size()];
+        lock.unlock();
+
+        // This slot is not visible to the consumer until b.ready is set, so it can be filled without holding the lock.
+        std::uint32_t record_cnt = p.entries[block_idx].second;
+        if (b.records.size() < record_cnt)
+          b.records.resize(record_cnt);
+
+        is.clear();
+        is.seekg(std::streampos(p.entries[block_idx].first));
+        sort_context.reset();
+
+        internal::sample_subset_view subset;
+        if (p.subset_size != p.sample_size)
+        {
+          subset.map = &p.subset_map;
+          subset.indices = &p.subset_indices;
+        }
+
+        std::size_t i = 0;
+        for ( ; i < record_cnt && is.good(); ++i)
+        {
+          read_binary_record(is, b.records[i], p.dict, sort_context, p.sample_size, false, p.phased, p.projection, subset);
+          if (!is.good())
+            break;
+        }
+
+        lock.lock();
+        b.size = i;
+        b.failed = i < record_cnt;
+        b.ready = true;
+        p.consumer_cv.notify_all();
+      }
+    }
+
+    inline
+    reader& reader::read_pipelined_record(variant& r)
+    {
+      block_pipeline& p = *pipeline_;
+      while (this->good())
+      {
+        if (s1r_index_->total_records_read == s1r_index_->max_records_to_read || p.current_block >= p.entries.size())
+        {
+          this->input_stream_->setstate(std::ios::eofbit);
+          break;
+        }
+
+        block_pipeline::block& b = p.window[p.current_block % p.window.size()];
+        if (!p.current_acquired)
+        {
+          std::unique_lock<std::mutex> lock(p.mtx);
+          p.consumer_cv.wait(lock, [&b]() { return b.ready; });
+          p.current_acquired = true;
+        }
+
+        if (p.current_offset >= b.size)
+        {
+          if (b.failed)
+          {
+            std::fprintf(stderr, "Error: Invalid record data\n");
+            this->input_stream_->setstate(std::ios::badbit);
+            break;
+          }
+
+          {
+            std::lock_guard<std::mutex> lock(p.mtx);
+            b.ready = false;
+            ++p.current_block;
+            p.current_offset = 0;
+            p.current_acquired = false;
+          }
+          p.worker_cv.notify_all();
+          continue;
+        }
+
+        // Swapping hands the previous record's buffers back to the block so they can be reused by workers.
+        std::swap(r, b.records[p.current_offset++]);
+        ++(s1r_index_->total_records_read);
+        std::size_t idx = s1r_index_->match(r);
+        if (idx != std::numeric_limits<std::size_t>::max())
+        {
+          region_index_ = idx;
+          break;
+        }
+      }
+      return *this;
+    }
+
     inline
     reader& reader::read(variant& r)
     {
       if (good())
       {
+        if (thread_count_ > 1 && !pipeline_ && file_format_ == format::sav2)
+        {
+          if (!s1r_index_)
+          {
+            auto idx = ::savvy::detail::make_unique<index_data>(open_s1r_index(), genomic_region(""));
+            if (idx->file.good())
+              s1r_index_ = std::move(idx);
+            else
+              thread_count_ = 1; // No index, so fall back to single-threaded decompression.
+          }
+
+          if (s1r_index_)
+          {
+            std::vector<std::pair<std::uint64_t, std::uint32_t>> entries;
+            std::pair<std::uint64_t, std::uint32_t> blk;
+            while (s1r_index_->pop_block(blk))
+              entries.push_back(blk);
+            start_pipeline(std::move(entries), pipeline_skip_);
+            pipeline_skip_ = 0;
+          }
+        }
+
+        if (thread_count_ > 1 && !vcf_pipeline_ && file_format_ == format::vcf && !csi_index_)
+          start_vcf_pipeline();
+
+        if (pipeline_)
+          return read_pipelined_record(r);
+
+        if (vcf_pipeline_)
+          return read_vcf_pipelined_record(r);
+
         if (s1r_index_)
           return read_indexed_record(r);
 
@@ -529,25 +1337,358 @@ namespace savvy
       return *this;
     }
 
+    inline
+    const typed_value* reader::read_matrix_record(const field_key& key, std::size_t row, std::vector<site_info>* sites)
+    {
+      if (sites)
+      {
+        if (sites->size() <= row)
+          sites->resize(row + 1);
+        (*sites)[row] = matrix_record_;
+      }
+
+      std::size_t idx = variant::find_field(key, matrix_record_.format_fields_, matrix_record_.format_ids_, matrix_record_.format_slots_);
+      if (idx >= matrix_record_.format_fields_.size())
+        return nullptr;
+
+      matrix_record_.decode_format(idx);
+      return &matrix_record_.format_fields_[idx].second;
+    }
+
+    inline
+    void reader::report_matrix_size_error(const std::string& key)
+    {
+      std::fprintf(stderr, "Error: %s field of record at %s:%u does not match matrix column count\n", key.c_str(), matrix_record_.chromosome().c_str(), matrix_record_.position());
+      input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
+    }
+
+    template <typename T>
+    std::size_t reader::read_matrix(const std::string& key, T* dest, std::size_t num_records, std::size_t num_columns, matrix_layout layout, const matrix_options& opts, std::vector<site_info>* sites)
+    {
+      const field_key fkey = intern_key(key);
+      std::size_t row = 0;
+      for ( ; row < num_records && read(matrix_record_); ++row)
+      {
+        ::savvy::detail::dense_matrix_sink<T> sink;
+        sink.dest = layout == matrix_layout::row_major ? dest + row * num_columns : dest + row;
+        sink.step = layout == matrix_layout::row_major ? 1 : num_records;
+        sink.missing = &matrix_missing_;
+
+        if (!::savvy::detail::reduce_matrix_row<T>(read_matrix_record(fkey, row, sites), num_columns, opts, sink))
+        {
+          report_matrix_size_error(key);
+          break;
+        }
+      }
+
+      return row;
+    }
+
+    template <typename T>
+    std::size_t reader::read_matrix(const std::string& key, sparse_matrix<T>& dest, std::size_t num_records, std::size_t num_columns, matrix_layout layout, const matrix_options& opts, std::vector<site_info>* sites)
+    {
+      sparse_matrix<T> csr;
+      sparse_matrix<T>& rows = layout == matrix_layout::row_major ? dest : csr;
+      rows.values.clear();
+      rows.indices.clear();
+      rows.offsets.assign(1, 0);
+
+      const field_key fkey = intern_key(key);
+      std::size_t row = 0;
+      for ( ; row < num_records && read(matrix_record_); ++row)
+      {
+        ::savvy::detail::sparse_matrix_sink<T> sink;
+        sink.dest = &rows;
+        sink.missing = &matrix_missing_;
+
+        if (!::savvy::detail::reduce_matrix_row<T>(read_matrix_record(fkey, row, sites), num_columns, opts, sink))
+        {
+          rows.values.resize(rows.offsets.back());
+          rows.indices.resize(rows.offsets.back());
+          report_matrix_size_error(key);
+          break;
+        }
+        rows.offsets.push_back(rows.values.size());
+      }
+
+      if (layout == matrix_layout::column_major)
+        ::savvy::detail::transpose_sparse_matrix(csr, num_columns, dest);
+
+      return row;
+    }
+
     inline
     reader& reader::read_vcf_record(variant& r)
     {
-      if (input_stream_->peek() < 0)
+      // Indexed queries compare tellg() to chunk boundaries, so the stream cannot be read ahead.
+      char* line = nullptr;
+      char* line_end = nullptr;
+      bool got_line;
+      while ((got_line = csi_index_ ? vcf_lines_.getline_unbuffered(*input_stream_, line, line_end) : vcf_lines_.getline(*input_stream_, line, line_end)) && line == line_end) {} // skip blank lines
+
+      if (!got_line)
         input_stream_->setstate(input_stream_->rdstate() | std::ios::eofbit);
-      else if (!site_info::deserialize_vcf(r, *input_stream_, dict_))
-        input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
-      else if (ids_.size() && !variant::deserialize_vcf2(r, *input_stream_, dict_, ids_.size(), phasing_))
+      else if (!deserialize_vcf_line(r, line, line_end, dict_, ids_.size(), phasing_, projection_))
         input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
-      else
+
+      return *this;
+    }
+
+    inline
+    bool reader::deserialize_vcf_line(variant& r, char* line, char* line_end, const ::savvy::dictionary& dict, std::size_t sample_size, phasing phased, const internal::field_projection& proj)
+    {
+      if (!site_info::deserialize_vcf(r, line, line_end, dict, proj))
+        return false;
+
+      if (sample_size && !variant::deserialize_vcf2(r, line, line_end, dict, sample_size, phased, proj))
+        return false;
+
+      // TODO: Set not_minimized flag and move minimize routine to writer.
+      for (auto it = r.info_.begin(); it != r.info_.end(); ++it)
+        it->second.minimize();
+
+      for (auto it = r.format_fields_.begin(); it != r.format_fields_.end(); ++it)
+        it->second.minimize();
+
+      return true;
+    }
+
+    inline
+    void reader::start_vcf_pipeline()
+    {
+      // Text that has already been pulled from the stream precedes the rest of the file.
+      std::vector<char> text;
+      vcf_lines_.take(text);
+
+      std::unique_ptr<::savvy::detail::bgzf_block_reader> bgzf;
+      if (dynamic_cast<::shrinkwrap::bgzf::ibuf*>(sbuf_.get()))
       {
-        // TODO: Set not_minimized flag and move minimize routine to writer.
-        for (auto it = r.info_.begin(); it != r.info_.end(); ++it)
-          it->second.minimize();
+        std::streampos pos = input_stream_->tellg();
+        if (pos >= 0)
+        {
+          bgzf = ::savvy::detail::make_unique<::savvy::detail::bgzf_block_reader>(file_path_, std::uint64_t(pos));
+          if (!bgzf->peek_header())
+            bgzf.reset();
+        }
+      }
 
-        for (auto it = r.format_fields_.begin(); it != r.format_fields_.end(); ++it)
-          it->second.minimize();
+      start_vcf_pipeline(std::move(text), std::move(bgzf));
+    }
+
+    inline
+    void reader::start_vcf_pipeline(std::vector<char> text, std::unique_ptr<::savvy::detail::bgzf_block_reader> bgzf)
+    {
+      vcf_pipeline_ = ::savvy::detail::make_unique<vcf_pipeline>();
+      vcf_pipeline& p = *vcf_pipeline_;
+      p.dict = dict_;
+      p.sample_size = ids_.size();
+      p.subset_map = subset_map_;
+      p.subset_size = subset_size_;
+      p.phased = phasing_;
+      p.projection = projection_;
+      p.pending = std::move(text);
+      p.bgzf = std::move(bgzf);
+
+      if (!p.bgzf)
+        p.sbuf = input_stream_->rdbuf();
+
+      p.window.resize(2 * thread_count_);
+      p.splitter = std::thread(split_vcf_batches, std::ref(p));
+      for (std::size_t i = 0; i < thread_count_; ++i)
+        p.workers.emplace_back(parse_vcf_batches, std::ref(p));
+    }
+
+    inline
+    void reader::split_vcf_batches(vcf_pipeline& p)
+    {
+      const std::size_t batch_size = 1u << 22u;
+      const std::size_t read_size = 1u << 20u;
+      const std::size_t bgzf_blocks = std::max<std::size_t>(16, 2 * (::savvy::detail::shared_thread_pool().size() + 1));
+
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(p.mtx);
+          p.splitter_cv.wait(lock, [&p]() { return p.stop || p.filled_count < p.current_batch + p.window.size(); });
+          if (p.stop)
+            return;
+        }
+
+        // Only this thread modifies filled_count, and the slot is not visible to workers until it is incremented.
+        vcf_pipeline::batch& b = p.window[p.filled_count % p.window.size()];
+        std::vector<char>& text = b.text;
+        text.swap(p.pending);
+        p.pending.clear();
+
+        // Read until the batch is large enough and ends with at least one complete line.
+        std::size_t last_nl = text.size();
+        for (std::size_t i = text.size(); i > 0; --i)
+        {
+          if (text[i - 1] == '\n')
+          {
+            last_nl = i - 1;
+            break;
+          }
+        }
+
+        bool more = true;
+        while (more && (text.size() < batch_size || last_nl == text.size()))
+        {
+          std::size_t old_size = text.size();
+          if (p.bgzf)
+          {
+            more = p.bgzf->read(text, bgzf_blocks);
+          }
+          else
+          {
+            text.resize(old_size + read_size);
+            std::streamsize n = p.sbuf->sgetn(text.data() + old_size, read_size);
+            text.resize(old_size + std::size_t(std::max<std::streamsize>(0, n)));
+            more = n > 0;
+          }
+
+          for (std::size_t i = text.size(); i > old_size; --i)
+          {
+            if (text[i - 1] == '\n')
+            {
+              last_nl = i - 1;
+              break;
+            }
+          }
+        }
+
+        if (more)
+        {
+          p.pending.assign(text.begin() + last_nl + 1, text.end());
+          text.resize(last_nl + 1);
+        }
+        else if (text.size() && text.back() != '\n')
+        {
+          text.push_back('\n'); // Last line has no newline.
+        }
+
+        std::lock_guard<std::mutex> lock(p.mtx);
+        if (text.size())
+        {
+          ++p.filled_count;
+          p.worker_cv.notify_one();
+        }
+
+        if (!more)
+        {
+          p.end_of_text = true;
+          p.source_failed = p.bgzf && !p.bgzf->good();
+          p.worker_cv.notify_all();
+          p.consumer_cv.notify_all();
+          return;
+        }
       }
+    }
+
+    inline
+    void reader::parse_vcf_batches(vcf_pipeline& p)
+    {
+      std::vector<char> line_buf;
+      std::unique_lock<std::mutex> lock(p.mtx);
+      while (true)
+      {
+        p.worker_cv.wait(lock, [&p]() { return p.stop || p.next_batch < p.filled_count || p.end_of_text; });
+        if (p.stop || p.next_batch >= p.filled_count)
+          break;
+
+        std::size_t batch_idx = p.next_batch++;
+        vcf_pipeline::batch& b = p.window[batch_idx % p.window.size()];
+        lock.unlock();
+
+        // This slot is not visible to the consumer until b.ready is set, so it can be filled without holding the lock.
+        // Lines are parsed from a copy, since parsing modifies the text and restart_pipelines() needs unread lines.
+        std::size_t n = 0;
+        bool failed = false;
+        const char* line = b.text.data();
+        const char* text_end = line + b.text.size(); // Text always ends with a newline.
+        b.line_offsets.clear();
+        while (line < text_end)
+        {
+          const char* nl = (const char*)std::memchr(line, '\n', text_end - line);
+          line_buf.assign(line, nl + 1);
+          char* line_beg = line_buf.data();
+          char* line_end = ::savvy::detail::terminate_vcf_line(line_beg, line_beg + (nl - line));
+          if (line_beg != line_end)
+          {
+            if (b.records.size() == n)
+              b.records.emplace_back();
+
+            b.line_offsets.push_back(std::size_t(line - b.text.data()));
+            variant& r = b.records[n];
+            if (!deserialize_vcf_line(r, line_beg, line_end, p.dict, p.sample_size, p.phased, p.projection))
+            {
+              failed = true;
+              break;
+            }
+
+            if (p.subset_size != p.sample_size)
+            {
+              for (auto it = r.format_fields_.begin(); it != r.format_fields_.end(); ++it)
+              {
+                it->second.subset(p.subset_map, p.subset_size);
+                it->second.minimize();
+              }
+            }
+            ++n;
+          }
+          line = nl + 1;
+        }
+
+        lock.lock();
+        b.size = n;
+        b.failed = failed;
+        b.ready = true;
+        p.consumer_cv.notify_all();
+      }
+    }
+
+    inline
+    reader& reader::read_vcf_pipelined_record(variant& r)
+    {
+      vcf_pipeline& p = *vcf_pipeline_;
+      while (this->good())
+      {
+        vcf_pipeline::batch& b = p.window[p.current_batch % p.window.size()];
+        if (!p.current_acquired)
+        {
+          std::unique_lock<std::mutex> lock(p.mtx);
+          p.consumer_cv.wait(lock, [&p, &b]() { return b.ready || (p.end_of_text && p.current_batch >= p.filled_count); });
+          if (!b.ready)
+          {
+            this->input_stream_->setstate(p.source_failed ? std::ios::badbit : std::ios::eofbit);
+            break;
+          }
+          p.current_acquired = true;
+        }
+
+        if (p.current_offset >= b.size)
+        {
+          if (b.failed)
+          {
+            this->input_stream_->setstate(std::ios::badbit);
+            break;
+          }
 
+          {
+            std::lock_guard<std::mutex> lock(p.mtx);
+            b.ready = false;
+            ++p.current_batch;
+            p.current_offset = 0;
+            p.current_acquired = false;
+          }
+          p.splitter_cv.notify_one();
+          continue;
+        }
+
+        // Swapping hands the previous record's buffers back to the batch so they can be reused by workers.
+        std::swap(r, b.records[p.current_offset++]);
+        break;
+      }
       return *this;
     }
 
@@ -562,6 +1703,12 @@ namespace savvy
         input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
       else
       {
+        // SAV1 records are always fully decoded, so projection is applied afterward.
+        if (projection_.info_enabled)
+          r.info_.erase(std::remove_if(r.info_.begin(), r.info_.end(), [this](const std::pair<std::string, typed_value>& f) { return !projection_.include_info(f.first); }), r.info_.end());
+        if (projection_.format_enabled)
+          r.format_fields_.erase(std::remove_if(r.format_fields_.begin(), r.format_fields_.end(), [this](const std::pair<std::string, typed_value>& f) { return !projection_.include_format(f.first); }), r.format_fields_.end());
+
         // TODO: Set not_minimized flag and move minimize routine to writer.
         for (auto it = r.info_.begin(); it != r.info_.end(); ++it)
           it->second.minimize();
@@ -573,6 +1720,54 @@ namespace savvy
       return *this;
     }
 
+    inline
+    void reader::read_binary_record(std::istream& is, variant& r, const ::savvy::dictionary& dict, internal::pbwt_sort_context& sort_context, std::size_t sample_size, bool is_bcf, phasing phased, const internal::field_projection& proj, const internal::sample_subset_view& subset, bool lazy)
+    {
+      std::uint32_t shared_sz, indiv_sz;
+      if (!is.read((char*)&shared_sz, sizeof(shared_sz))) // TODO: set to bad if gcount > 0.
+      {
+        return;
+      }
+
+      if (!is.read((char*)&indiv_sz, sizeof(indiv_sz)))
+      {
+        std::fprintf(stderr, "Error: Invalid record data\n");
+        is.setstate(is.rdstate() | std::ios::badbit);
+        return;
+      }
+
+      if (endianness::is_big())
+      {
+        shared_sz = endianness::swap(shared_sz);
+        indiv_sz = endianness::swap(indiv_sz);
+      }
+
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
+      // Read and parse shared and individual data
+      r.shared_data_.resize(shared_sz);
+      r.indiv_buf_.resize(proj.sites_only() ? 0 : indiv_sz);
+      bool read_ok = !is.read(r.shared_data_.data(), r.shared_data_.size()).fail();
+      if (read_ok && proj.sites_only())
+        read_ok = is.ignore(indiv_sz) && is.gcount() == std::streamsize(indiv_sz); // Individual data is not needed, so skip it without copying.
+      else if (read_ok)
+        read_ok = !is.read(r.indiv_buf_.data(), r.indiv_buf_.size()).fail();
+
+      if (!read_ok)
+      {
+        std::fprintf(stderr, "Error: Invalid record data\n");
+        is.setstate(is.rdstate() | std::ios::badbit);
+        return;
+      }
+
+      if (!variant::deserialize(r, dict, sort_context, sample_size, is_bcf, phased, proj, subset, lazy))
+      {
+        std::fprintf(stderr, "Error: Invalid record data\n");
+        is.setstate(is.rdstate() | std::ios::badbit);
+        return;
+      }
+      //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
+    }
+
     inline
     reader& reader::read_record(variant& r)
     {
@@ -585,46 +1780,26 @@ namespace savvy
           read_sav1_record(r);
         else
         {
-          std::uint32_t shared_sz, indiv_sz;
-          if (!input_stream_->read((char*)&shared_sz, sizeof(shared_sz))) // TODO: set to bad if gcount > 0.
-          {
-            return *this;
-          }
-
-          if (!input_stream_->read((char*)&indiv_sz, sizeof(indiv_sz)))
-          {
-            std::fprintf(stderr, "Error: Invalid record data\n");
-            input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
-            return *this;
-          }
-
-          if (endianness::is_big())
-          {
-            shared_sz = endianness::swap(shared_sz);
-            indiv_sz = endianness::swap(indiv_sz);
-          }
-
-          //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
-          // Read and parse shared and individual data
-          r.shared_data_.resize(shared_sz);
-          r.indiv_buf_.resize(indiv_sz);
-          if (!input_stream_->read(r.shared_data_.data(), r.shared_data_.size()) || !input_stream_->read(r.indiv_buf_.data(), r.indiv_buf_.size()))
+          // Sample subset is applied while decoding BCF/SAV records.
+          internal::sample_subset_view subset;
+          if (subset_size_ != ids_.size())
           {
-            std::fprintf(stderr, "Error: Invalid record data\n");
-            input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
-            return *this;
-          }
-
-          if (!variant::deserialize(r, dict_, sort_context_, this->ids_.size(), file_format_ == format::bcf, phasing_))
-          {
-            std::fprintf(stderr, "Error: Invalid record data\n");
-            input_stream_->setstate(input_stream_->rdstate() | std::ios::badbit);
-            return *this;
+            subset.map = &subset_map_;
+            subset.indices = &subset_indices_;
+            if (lazy_format_)
+            {
+              // Lazily decoded records apply the subset when accessed, so they share a copy that outlives subset_samples().
+              if (!lazy_subset_)
+                lazy_subset_ = std::make_shared<internal::sample_subset>(internal::sample_subset{subset_map_, subset_indices_});
+              subset.map = &lazy_subset_->map;
+              subset.indices = &lazy_subset_->indices;
+              subset.owner = lazy_subset_;
+            }
           }
-          //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
+          read_binary_record(*input_stream_, r, dict_, sort_context_, ids_.size(), file_format_ == format::bcf, phasing_, projection_, subset, lazy_format_);
         }
 
-        if (good())
+        if (good() && (file_format_ == format::vcf || file_format_ == format::sav1))
         {
           //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~//
           // Apply sample subset
@@ -10,10 +10,14 @@
 #include "site_info.hpp"
 
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include <limits>
 #include <vector>
 #include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
 
 namespace savvy
 {
@@ -178,6 +182,129 @@ namespace savvy
         return false;
       }
     }
+
+    /**
+     * Parses regions from a BED file. BED start positions are 0-based, so they are incremented to produce
+     * 1-based, inclusive genomic regions. Header, track, and browser lines are skipped.
+     *
+     * @param file_path Path to BED file
+     * @param good Set to false if file could not be opened or contains a malformed line
+     * @return Regions in file order
+     */
+    inline std::vector<genomic_region> load_bed_regions(const std::string& file_path, bool& good)
+    {
+      std::vector<genomic_region> ret;
+      std::ifstream ifs(file_path);
+      good = ifs.good();
+
+      std::string line;
+      while (std::getline(ifs, line))
+      {
+        if (line.empty() || line[0] == '#' || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0)
+          continue;
+
+        std::istringstream ss(line);
+        std::string chrom;
+        std::uint64_t beg, end;
+        if (!(ss >> chrom >> beg >> end))
+        {
+          std::fprintf(stderr, "Error: invalid BED line (%s)\n", line.c_str());
+          good = false;
+          break;
+        }
+
+        ret.emplace_back(chrom, beg + 1, end);
+      }
+
+      return ret;
+    }
+
+    namespace detail
+    {
+      /**
+       * Finds which of many regions a record falls in. Regions are bucketed by chromosome and sorted by start
+       * position alongside a running maximum of end positions, so a lookup is a binary search followed by a
+       * short backward scan over only the regions that could overlap.
+       */
+      class region_lookup
+      {
+      public:
+        region_lookup(const std::vector<genomic_region>& regions, bounding_point bounding_type) :
+          regions_(regions),
+          bounding_type_(bounding_type)
+        {
+          for (std::size_t i = 0; i < regions_.size(); ++i)
+            chromosomes_[regions_[i].chromosome()].push_back({regions_[i].from(), 0, i});
+
+          for (auto it = chromosomes_.begin(); it != chromosomes_.end(); ++it)
+          {
+            std::vector<node>& v = it->second;
+            std::stable_sort(v.begin(), v.end(), [](const node& a, const node& b) { return a.from < b.from; });
+            std::uint64_t max_to = 0;
+            for (auto jt = v.begin(); jt != v.end(); ++jt)
+              jt->max_to = max_to = std::max(max_to, regions_[jt->index].to());
+          }
+        }
+
+        /**
+         * Gets regions in the order they were provided.
+         * @return Vector of regions
+         */
+        const std::vector<genomic_region>& regions() const { return regions_; }
+
+        /**
+         * Finds the first region (in the order provided) that contains var.
+         * @param var Record to look up
+         * @return Index of matching region or regions().size() if no region matches
+         */
+        std::size_t find(const site_info& var) const
+        {
+          std::size_t ret = regions_.size();
+          auto res = chromosomes_.find(var.chrom());
+          if (res != chromosomes_.end())
+            ret = find(res->second, var);
+
+          res = chromosomes_.find("");
+          if (res != chromosomes_.end())
+            ret = std::min(ret, find(res->second, var));
+
+          return ret;
+        }
+      private:
+        struct node
+        {
+          std::uint64_t from;
+          std::uint64_t max_to;
+          std::size_t index;
+        };
+
+        std::size_t find(const std::vector<node>& v, const site_info& var) const
+        {
+          // Every bounding point requires the region to overlap [pos, right].
+          std::size_t max_alt_size = 0;
+          for (auto it = var.alts().begin(); it != var.alts().end(); ++it)
+            max_alt_size = std::max(max_alt_size, it->size());
+          std::uint64_t right = var.pos() + std::max<std::size_t>(1, std::max(var.ref().size(), max_alt_size)) - 1;
+
+          std::size_t ret = regions_.size();
+          auto it = std::upper_bound(v.begin(), v.end(), right, [](std::uint64_t p, const node& n) { return p < n.from; });
+          while (it != v.begin())
+          {
+            --it;
+            if (it->max_to < var.pos())
+              break;
+            if (it->index < ret && region_compare(bounding_type_, var, regions_[it->index]))
+              ret = it->index;
+          }
+
+          return ret;
+        }
+      private:
+        std::vector<genomic_region> regions_;
+        std::unordered_map<std::string, std::vector<node>> chromosomes_;
+        bounding_point bounding_type_;
+      };
+    }
   //}
 
 #if 0
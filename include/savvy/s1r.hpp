@@ -23,6 +23,11 @@
 #include <array>
 #include <cstring>
 #include <tuple>
+#include <limits>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 namespace savvy
 {
@@ -220,15 +225,73 @@ namespace savvy
       std::uint64_t entry_count_;
     };
 
+    namespace detail
+    {
+      /**
+       * Read-only view of a byte range of a file. The range is memory-mapped when possible and is otherwise
+       * read into a heap buffer. No alignment is guaranteed, so entries are loaded with memcpy.
+       */
+      class mapped_region
+      {
+      public:
+        mapped_region() {}
+
+        ~mapped_region()
+        {
+          if (map_ptr_)
+            munmap(map_ptr_, map_size_);
+        }
+
+        mapped_region(const mapped_region&) = delete;
+        mapped_region& operator=(const mapped_region&) = delete;
+
+        bool open(const std::string& file_path, std::uint64_t offset, std::size_t length)
+        {
+          if (length == 0)
+            return true;
+
+          int fd = ::open(file_path.c_str(), O_RDONLY);
+          if (fd >= 0)
+          {
+            std::uint64_t page_size = std::uint64_t(sysconf(_SC_PAGESIZE));
+            std::uint64_t aligned_offset = offset - offset % page_size;
+            std::size_t map_size = length + std::size_t(offset - aligned_offset);
+            void* p = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, off_t(aligned_offset));
+            ::close(fd);
+            if (p != MAP_FAILED)
+            {
+              map_ptr_ = p;
+              map_size_ = map_size;
+              data_ = (const char*)p + (offset - aligned_offset);
+              return true;
+            }
+          }
+
+          std::ifstream ifs(file_path, std::ios::binary);
+          buf_.resize(length);
+          if (!ifs.seekg(std::streamoff(offset)) || !ifs.read(buf_.data(), buf_.size()))
+            return false;
+          data_ = buf_.data();
+          return true;
+        }
+
+        const char* data() const { return data_; }
+      private:
+        void* map_ptr_ = nullptr;
+        std::size_t map_size_ = 0;
+        std::vector<char> buf_;
+        const char* data_ = nullptr;
+      };
+    }
+
     class tree_reader : public tree_base
     {
     public:
       class leaf_iterator
       {
       private:
-        tree_reader* reader_;
-        std::istream* ifs_;
-        std::vector<entry> leaf_node_;
+        const tree_reader* reader_;
+        entry current_;
         tree_position position_;
       public:
         typedef leaf_iterator self_type;
@@ -238,18 +301,11 @@ namespace savvy
         typedef const value_type* pointer;
         typedef std::bidirectional_iterator_tag iterator_category;
 
-        leaf_iterator(tree_reader& rdr, std::istream& ifs, std::size_t i) :
+        leaf_iterator(const tree_reader& rdr, std::size_t i) :
           reader_(&rdr),
-          ifs_(&ifs),
-          leaf_node_(reader_->entries_per_leaf_node()),
           position_(reader_->tree_height() - 1, i / reader_->entries_per_leaf_node(), i % reader_->entries_per_leaf_node())
         {
-          assert(position_.node_offset * reader_->entries_per_leaf_node() < reader_->entry_count());
-          if (i < reader_->entry_count())
-          {
-            ifs_->seekg(reader_->calculate_file_position(position_));
-            ifs_->read((char*)leaf_node_.data(), reader_->bucket_size());
-          }
+          load();
         }
 
         self_type& operator++()
@@ -259,11 +315,8 @@ namespace savvy
           {
             position_.node_offset += 1;
             position_.entry_offset = 0;
-
-            assert(position_.node_offset * reader_->entries_per_leaf_node() < reader_->entry_count());
-            ifs_->seekg(reader_->calculate_file_position(position_));
-            ifs_->read((char*)leaf_node_.data(), reader_->bucket_size());
           }
+          load();
           return *this;
         }
 
@@ -274,20 +327,26 @@ namespace savvy
           return r;
         }
 
-        reference operator*() { return leaf_node_[position_.entry_offset]; }
-        pointer operator->() { return &(leaf_node_[position_.entry_offset]); }
+        reference operator*() { return current_; }
+        pointer operator->() { return &current_; }
         bool operator==(const self_type& other) { return position_ == other.position_; }
         bool operator!=(const self_type& other) { return position_ != other.position_; }
+      private:
+        void load()
+        {
+          if (position_.node_offset * reader_->entries_per_leaf_node() + position_.entry_offset < reader_->entry_count())
+            current_ = reader_->load_entry<entry>(reader_->node_data(position_), position_.entry_offset);
+        }
       };
 
       leaf_iterator leaf_begin()
       {
-        return leaf_iterator(*this, ifs_, 0);
+        return leaf_iterator(*this, 0);
       }
 
       leaf_iterator leaf_end()
       {
-        return leaf_iterator(*this, ifs_, entry_count());
+        return leaf_iterator(*this, entry_count());
       }
 
       class query
@@ -303,101 +362,60 @@ namespace savvy
           typedef const value_type* pointer;
           typedef std::bidirectional_iterator_tag iterator_category;
 
-          iterator(tree_reader& rdr, std::istream& ifs, std::uint64_t beg, std::uint64_t end, tree_position pos = {0, 0, 0}) :
+          iterator(const tree_reader& rdr, std::uint64_t beg, std::uint64_t end, tree_position pos = {0, 0, 0}) :
             reader_(&rdr),
-            ifs_(&ifs),
             beg_(beg),
             end_(end),
-            leaf_node_(reader_->entries_per_leaf_node()),
+            node_(nullptr),
             position_(pos)
           {
             if (position_ != reader_->end_tree_position())
             {
-              const std::uint64_t leaf_level = reader_->tree_height() - 1;
-              ifs_->seekg(reader_->calculate_file_position(position_));
-
-              if (position_.level == leaf_level)
-                ifs_->read((char*) leaf_node_.data(), reader_->bucket_size());
-              else
-              {
-                traversal_chain_.emplace(reader_->entries_per_internal_node());
-                ifs_->read((char*) (traversal_chain_.top().data()), reader_->bucket_size());
-              }
-
+              node_ = reader_->node_data(position_);
               traverse_right();
             }
           }
 
+          // Nodes are visited in place, so moving up or down the tree only requires recomputing the node address.
           void traverse_right()
           {
             const std::uint64_t leaf_level = reader_->tree_height() - 1;
             bool leaf_entry_found = false;
             while (!leaf_entry_found && position_ != reader_->end_tree_position())
             {
-              if (position_.level == leaf_level)
+              const bool is_leaf = position_.level == leaf_level;
+              const std::uint64_t node_size = reader_->calculate_node_size(position_);
+              std::uint64_t i = position_.entry_offset;
+              for ( ; i < node_size; ++i)
               {
-                auto entry_it = leaf_node_.begin() + position_.entry_offset;
-                const auto entry_end_it = leaf_node_.begin() + reader_->calculate_node_size(position_);
-                for (; entry_it != entry_end_it; ++entry_it)
-                {
-                  if (entry_it->region_start() <= end_ && entry_it->region_end() >= beg_)
-                    break;
-                }
+                internal_entry e = is_leaf ? reader_->load_entry<entry>(node_, i) : reader_->load_entry<internal_entry>(node_, i);
+                if (e.region_start() <= end_ && e.region_end() >= beg_)
+                  break;
+              }
 
-                if (entry_it == entry_end_it)
+              if (i == node_size)
+              {
+                if (position_.level > 0)
                 {
-                  if (position_.level > 0)
-                  {
-                    position_ = reader_->calculate_parent_position(position_);
-                    position_ = tree_position(position_, position_.entry_offset + 1);
-                  }
-                  else
-                  {
-                    position_ = reader_->end_tree_position();
-                  }
+                  position_ = reader_->calculate_parent_position(position_);
+                  position_ = tree_position(position_, position_.entry_offset + 1);
+                  node_ = reader_->node_data(position_);
                 }
                 else
                 {
-                  position_ = tree_position(position_.level, position_.node_offset, (std::uint64_t) std::distance(leaf_node_.begin(), entry_it));
-                  leaf_entry_found = true;
+                  position_ = reader_->end_tree_position();
                 }
               }
+              else if (is_leaf)
+              {
+                position_ = tree_position(position_.level, position_.node_offset, i);
+                current_ = reader_->load_entry<entry>(node_, i);
+                leaf_entry_found = true;
+              }
               else
               {
-                auto entry_it = traversal_chain_.top().begin() + position_.entry_offset;
-                const auto entry_end_it = traversal_chain_.top().begin() + reader_->calculate_node_size(position_);
-                for (; entry_it != entry_end_it; ++entry_it)
-                {
-                  if (entry_it->region_start() <= end_ && entry_it->region_end() >= beg_)
-                    break;
-                }
-
-                if (entry_it == entry_end_it)
-                {
-                  if (position_.level > 0)
-                  {
-                    position_ = reader_->calculate_parent_position(position_);
-                    position_ = tree_position(position_, position_.entry_offset + 1);
-                    traversal_chain_.pop();
-                  }
-                  else
-                  {
-                    position_ = reader_->end_tree_position();
-                  }
-                }
-                else
-                {
-                  position_ = tree_position(reader_->calculate_child_position(tree_position(position_, (std::uint64_t) std::distance(traversal_chain_.top().begin(), entry_it))), 0);
-
-                  ifs_->seekg(reader_->calculate_file_position(position_));
-                  if (position_.level == leaf_level)
-                    ifs_->read((char*) leaf_node_.data(), reader_->bucket_size());
-                  else
-                  {
-                    traversal_chain_.emplace(reader_->entries_per_internal_node());
-                    ifs_->read((char*) (traversal_chain_.top().data()), reader_->bucket_size());
-                  }
-                }
+                position_ = tree_position(reader_->calculate_child_position(tree_position(position_, i)), 0);
+                node_ = reader_->node_data(position_);
               }
             }
           }
@@ -416,102 +434,94 @@ namespace savvy
             return r;
           }
 
-          reference operator*() { return leaf_node_[position_.entry_offset]; }
-          pointer operator->() { return &(leaf_node_[position_.entry_offset]); }
+          reference operator*() { return current_; }
+          pointer operator->() { return &current_; }
           bool operator==(const self_type& other) const { return position_ == other.position_; }
           bool operator!=(const self_type& other) const { return position_ != other.position_; }
 
         private:
-          tree_reader* reader_;
-          std::istream* ifs_;
+          const tree_reader* reader_;
           std::uint64_t beg_;
           std::uint64_t end_;
-          std::stack<std::vector<internal_entry>> traversal_chain_;
-          std::vector<entry> leaf_node_;
+          const char* node_;
+          entry current_;
           tree_position position_;
         };
 
-        query(tree_reader& rdr, std::istream& ifs, std::uint64_t beg, std::uint64_t end) :
+        query(const tree_reader& rdr, std::uint64_t beg, std::uint64_t end) :
           reader_(&rdr),
-          ifs_(&ifs),
           beg_(beg),
           end_(end)
         {
         }
 
-        iterator begin() { return iterator(*reader_, *ifs_, beg_, end_); }
-        iterator end() { return iterator(*reader_, *ifs_, beg_, end_, reader_->end_tree_position()); }
+        iterator begin() { return iterator(*reader_, beg_, end_); }
+        iterator end() { return iterator(*reader_, beg_, end_, reader_->end_tree_position()); }
       private:
-        tree_reader* reader_;
-        std::istream* ifs_;
+        const tree_reader* reader_;
         std::uint64_t beg_;
         std::uint64_t end_;
       };
 
-      tree_reader(std::ifstream& file, std::streampos index_file_offset, std::uint8_t block_size_in_kib, std::uint64_t block_offset, const std::string& name, std::uint64_t entry_count) :
+      /**
+       * @param index_data Pointer to first byte of index region (file position index_file_offset)
+       */
+      tree_reader(const char* index_data, std::streampos index_file_offset, std::uint8_t block_size_in_kib, std::uint64_t block_offset, const std::string& name, std::uint64_t entry_count) :
         tree_base(index_file_offset, block_size_in_kib, block_offset, entry_count),
-        ifs_(file),
+        index_data_(index_data),
+        index_file_offset_(index_file_offset),
         name_(name)
       {
-//        std::string version(7, '\0');
-//        ifs_.read(&version[0], version.size());
-//        std::uint8_t block_size_exponent;
-//        ifs_.read((char*)(&block_size_exponent), 1);
-//        block_size_ = static_cast<std::uint16_t>(std::pow(8.0, (0x03 & block_size_exponent) + 2));
-//        ifs_.read((char*)(&entry_count_), 8);
-//        entry_count_ = be64toh(entry_count_);
       }
 
-      bool good() const { return ifs_.good(); }
+      bool good() const { return index_data_ || entry_count() == 0; }
 
-      std::tuple<std::uint32_t, std::uint32_t> range()
+      std::tuple<std::uint32_t, std::uint32_t> range() const
       {
         std::tuple<std::uint32_t, std::uint32_t> ret{std::numeric_limits<std::uint32_t>::max(), 0};
 
-        auto fn = [&ret](const internal_entry& e)
+        node_position position{0, 0};
+        const bool is_leaf = position.level + 1 == this->tree_height();
+        const char* node = this->node_data(position);
+        const std::uint64_t node_size = this->calculate_node_size(position);
+        for (std::uint64_t i = 0; i < node_size; ++i)
         {
+          internal_entry e = is_leaf ? load_entry<entry>(node, i) : load_entry<internal_entry>(node, i);
           std::get<0>(ret) = std::min(std::get<0>(ret), e.region_start());
           std::get<1>(ret) = std::max(std::get<1>(ret), e.region_end());
-        };
-
-        node_position position{0, 0};
-
-        const std::uint64_t leaf_level = this->tree_height() - 1;
-        ifs_.seekg(this->calculate_file_position(position));
-
-        if (position.level == leaf_level)
-        {
-          std::vector<entry> leaf_node(this->entries_per_leaf_node());
-          ifs_.read((char*) leaf_node.data(), this->bucket_size());
-
-          const auto entry_end_it = leaf_node.begin() + this->calculate_node_size(position);
-          std::for_each(leaf_node.begin(), entry_end_it, fn);
-        }
-        else
-        {
-          std::vector<internal_entry> internal_node(this->entries_per_internal_node());
-          ifs_.read((char*) internal_node.data(), this->bucket_size());
-          const auto entry_end_it = internal_node.begin() + this->calculate_node_size(position);
-          std::for_each(internal_node.begin(), entry_end_it, fn);
         }
 
         return ret;
       }
 
-      const tree_position end_tree_position()
+      tree_position end_tree_position() const
       {
         return tree_position(0, 0, calculate_node_size(tree_position(0, 0, 0)));
       }
 
-      query create_query(std::uint64_t beg, std::uint64_t end)
+      query create_query(std::uint64_t beg, std::uint64_t end) const
       {
-        query ret(*this, ifs_, beg, end);
+        query ret(*this, beg, end);
         return ret;
       }
 
       const std::string& name() const { return name_; }
     private:
-      std::ifstream& ifs_;
+      const char* node_data(const node_position& pos) const
+      {
+        return index_data_ + std::int64_t(this->calculate_file_position(pos) - index_file_offset_);
+      }
+
+      template <typename T>
+      static T load_entry(const char* node, std::uint64_t i)
+      {
+        T ret;
+        std::memcpy((char*)&ret, node + i * sizeof(T), sizeof(T));
+        return ret;
+      }
+    private:
+      const char* index_data_;
+      std::streampos index_file_offset_;
       std::string name_;
     };
 
@@ -619,13 +629,17 @@ namespace savvy
             size_on_disk_ = block_count * block_size + footer.size() + tree_details_size;
             assert(total_file_size - (block_count * block_size + footer.size() + tree_details_size) >= 0ll);
 
-            trees_.reserve(tree_details_array.size());
+            // Nodes are traversed in place, so the whole tree region is mapped up front instead of reading each node on every visit.
+            if (!index_region_.open(file_path_, std::uint64_t(std::int64_t(index_file_offset_)), std::size_t(block_count * block_size)))
+              input_file_.setstate(std::ios::badbit);
+
+            trees_.reserve(tree_details_array.size() + 1);
             for (auto it = tree_details_array.begin(); it != tree_details_array.end(); ++it)
-              trees_.emplace_back(input_file_, index_file_offset_, block_size_byte, it->block_offset, it->name, it->entry_count);
+              trees_.emplace_back(index_region_.data(), index_file_offset_, block_size_byte, it->block_offset, it->name, it->entry_count);
           }
         }
 
-        trees_.emplace_back(input_file_, index_file_offset_, block_size_byte, block_count, "", 0); // empty tree (end marker).
+        trees_.emplace_back(index_region_.data(), index_file_offset_, block_size_byte, block_count, "", 0); // empty tree (end marker).
 
 
 //        std::uint8_t block_size_exponent;
@@ -674,6 +688,7 @@ namespace savvy
     private:
       std::string file_path_;
       std::ifstream input_file_;
+      detail::mapped_region index_region_;
       std::vector<tree_reader> trees_;
       std::array<char, 16> uuid_;
       std::streampos index_file_offset_ = 0;
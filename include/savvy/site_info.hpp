@@ -15,6 +15,7 @@
 #include "utility.hpp"
 #include "varint.hpp"
 #include "sav1.hpp"
+#include "vcf_parser.hpp"
 
 #include <string>
 #include <vector>
@@ -24,6 +25,9 @@
 #include <cmath>
 #include <set>
 #include <list>
+#include <memory>
+#include <unordered_set>
+#include <limits>
 
 namespace savvy
 {
@@ -37,8 +41,85 @@ namespace savvy
   };
 
 
+  namespace internal
+  {
+    /**
+     * INFO and FORMAT fields selected for decoding. Fields outside of the projection are skipped without being
+     * materialized in records.
+     */
+    struct field_projection
+    {
+      bool info_enabled = false;
+      bool format_enabled = false;
+      std::unordered_set<std::string> info_keys;
+      std::unordered_set<std::string> format_keys;
+      std::vector<std::uint8_t> info_ids; // Indexed by dictionary ID. Non-zero if included.
+      std::vector<std::uint8_t> format_ids; // Indexed by dictionary ID. Non-zero if included.
+
+      bool include_info(std::int32_t id) const { return !info_enabled || (std::size_t(id) < info_ids.size() && info_ids[id]); }
+      bool include_info(const std::string& key) const { return !info_enabled || info_keys.find(key) != info_keys.end(); }
+      bool include_format(std::int32_t id) const { return !format_enabled || (std::size_t(id) < format_ids.size() && format_ids[id]); }
+      bool include_format(const std::string& key) const { return !format_enabled || format_keys.find(key) != format_keys.end(); }
+      bool sites_only() const { return format_enabled && format_keys.empty(); }
+    };
+
+    /**
+     * Sample subset shared with lazily decoded records, which apply it after the reader has moved on.
+     */
+    struct sample_subset
+    {
+      std::vector<std::size_t> map;
+      std::vector<std::size_t> indices;
+    };
+
+    /**
+     * Sample subset applied to FORMAT fields while decoding.
+     */
+    struct sample_subset_view
+    {
+      const std::vector<std::size_t>* map = nullptr; // Maps file sample index to subset index (max value if excluded).
+      const std::vector<std::size_t>* indices = nullptr; // File sample indices included in subset, in increasing order.
+      std::shared_ptr<const sample_subset> owner; // Set when map and indices point into a shared subset, which allows deferring the subset.
+
+      bool enabled() const { return map != nullptr; }
+    };
+  }
+
   //namespace v2
   //{
+    /**
+     * Interned INFO or FORMAT key. When created with reader::intern_key(), the key holds the field's
+     * dictionary ID, and lookups on records read from BCF or SAV files by the same reader resolve in
+     * constant time without string comparison. Otherwise, lookups fall back to comparing key names.
+     */
+    class field_key
+    {
+    private:
+      std::string name_;
+      std::int32_t id_ = -1;
+    public:
+      field_key() {}
+
+      /**
+       * Constructs field_key object.
+       * @param name Key string
+       * @param id Dictionary ID of key (-1 if unknown)
+       */
+      explicit field_key(std::string name, std::int32_t id = -1) : name_(std::move(name)), id_(id) {}
+
+      /**
+       * Gets key string.
+       * @return Key string
+       */
+      const std::string& name() const { return name_; }
+
+      /**
+       * Gets dictionary ID of key.
+       * @return Dictionary ID (-1 if unknown)
+       */
+      std::int32_t id() const { return id_; }
+    };
+
     class site_info
     {
       friend class reader;
@@ -51,7 +132,10 @@ namespace savvy
       std::string ref_;
       std::vector<std::string> alts_;
       std::vector<std::string> filters_;
+      std::vector<std::int32_t> filter_ids_; // Reused buffer for deserializing FILTER.
       std::vector<std::pair<std::string, typed_value>> info_;
+      std::vector<std::int32_t> info_ids_; // Dictionary IDs parallel to info_. Only valid when sizes match.
+      std::vector<std::uint16_t> info_slots_; // Maps dictionary ID to index in info_.
       std::vector<char> shared_data_;
     protected:
       std::uint32_t n_fmt_ = 0;
@@ -138,6 +222,7 @@ namespace savvy
        */
       std::vector<std::pair<std::string, typed_value>>::const_iterator remove_info(std::vector<std::pair<std::string, typed_value>>::const_iterator it)
       {
+        info_ids_.clear();
         return info_.erase(info_.begin() + (it - info_.cbegin()));
       }
 
@@ -149,7 +234,10 @@ namespace savvy
       {
         auto res = std::find_if(info_.begin(), info_.end(), [&key](const std::pair<std::string, savvy::typed_value>& v) { return v.first == key; });
         if (res != info_.end())
+        {
+          info_ids_.clear();
           info_.erase(res);
+        }
       }
 
       /**
@@ -168,6 +256,21 @@ namespace savvy
         return false;
       }
 
+      /**
+       * Gets value of INFO field using interned key.
+       * @tparam T Destination vector or scalar type
+       * @param key Interned key of INFO field to retrieve
+       * @param dest Destination object
+       * @return False if INFO field is not present
+       */
+      template<typename T>
+      bool get_info(const field_key& key, T& dest) const
+      {
+        std::size_t idx = find_field(key, info_, info_ids_, info_slots_);
+        if (idx < info_.size())
+          return info_[idx].second.get(dest);
+        return false;
+      }
 
       /**
        * Updates INFO field specified by iterator.
@@ -202,12 +305,16 @@ namespace savvy
 
         if (it == info_.end())
         {
+          info_ids_.clear();
           info_.emplace_back(key, val);
         }
       }
     protected:
-      static bool deserialize(site_info& s, const dictionary& dict, std::uint32_t& n_sample);
-      static bool deserialize_vcf(site_info& s, std::istream& is, const dictionary& dict);
+      static std::size_t find_field(const field_key& key, const std::vector<std::pair<std::string, typed_value>>& fields, const std::vector<std::int32_t>& ids, const std::vector<std::uint16_t>& slots);
+      static void index_fields(const std::vector<std::int32_t>& ids, std::vector<std::uint16_t>& slots);
+      static bool deserialize(site_info& s, const dictionary& dict, std::uint32_t& n_sample, const internal::field_projection& proj);
+      static bool deserialize_vcf(site_info& s, std::istream& is, const dictionary& dict, const internal::field_projection& proj);
+      static bool deserialize_vcf(site_info& s, char*& str, char* str_end, const dictionary& dict, const internal::field_projection& proj);
       static bool deserialize_sav1(site_info& s, std::istream& is, const std::list<header_value_details>& info_headers);
 
       template<typename Itr>
@@ -219,16 +326,25 @@ namespace savvy
       friend class reader;
       friend class writer;
     private:
-      std::vector<std::pair<std::string, typed_value>> format_fields_;
+      static const std::uint8_t pending_bcf_gt = 0x01u;
+      static const std::uint8_t pending_endian_swap = 0x02u;
+      static const std::uint8_t pending_subset = 0x04u;
+
+      mutable std::vector<std::pair<std::string, typed_value>> format_fields_;
+      std::vector<std::int32_t> format_ids_; // Dictionary IDs parallel to format_fields_. Only valid when sizes match.
+      std::vector<std::uint16_t> format_slots_; // Maps dictionary ID to index in format_fields_.
+      mutable std::vector<std::uint8_t> format_pending_; // Decode steps deferred until each FORMAT field is accessed.
+      std::shared_ptr<const internal::sample_subset> format_subset_; // Subset applied to fields with pending_subset set.
       std::vector<char> indiv_buf_;
     public:
       using site_info::site_info;
 
       /**
-       * Gets vector of FORMAT key-value pairs.
+       * Gets vector of FORMAT key-value pairs. If the record was read with reader::set_lazy_format() enabled,
+       * this finishes decoding every FORMAT field in place.
        * @return FORMAT fields
        */
-      const decltype(format_fields_)& format_fields() const { return format_fields_; }
+      const decltype(format_fields_)& format_fields() const { decode_format(); return format_fields_; }
 
       /**
        * Gets value of FORMAT field.
@@ -240,6 +356,23 @@ namespace savvy
       template<typename T>
       bool get_format(const std::string& key, T& destination_vector) const;
 
+      /**
+       * Checks whether decoding of FORMAT field is still deferred (see reader::set_lazy_format()).
+       * @param key Key for FORMAT field
+       * @return True if FORMAT field is present and has not been decoded yet
+       */
+      bool format_pending(const std::string& key) const;
+
+      /**
+       * Gets value of FORMAT field using interned key.
+       * @tparam T Data type of destination
+       * @param key Interned key for FORMAT field
+       * @param destination_vector Destinaton value object
+       * @return False if FORMAT field is not present
+       */
+      template<typename T>
+      bool get_format(const field_key& key, T& destination_vector) const;
+
       /**
        * Sets value of FORMAT field.
        * @tparam T Type of data vector
@@ -256,11 +389,15 @@ namespace savvy
        */
       void set_format(const std::string& key, typed_value&& val);
     private:
+      void decode_format(std::size_t idx) const;
+      void decode_format() const;
+
       template <typename OutT>
       static bool serialize(const variant& v, OutT out_it, const dictionary& dict, std::size_t sample_size, bool is_bcf, phasing phased, ::savvy::internal::pbwt_sort_context& pbwt_ctx, const std::vector<::savvy::internal::pbwt_sort_map*>& pbwt_format_pointers);
-      static bool deserialize(variant& v, const dictionary& dict, internal::pbwt_sort_context& pbwt_context, std::size_t sample_size, bool is_bcf, phasing phased);
+      static bool deserialize(variant& v, const dictionary& dict, internal::pbwt_sort_context& pbwt_context, std::size_t sample_size, bool is_bcf, phasing phased, const internal::field_projection& proj, const internal::sample_subset_view& subset, bool lazy);
       static bool deserialize_vcf(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status);
-      static bool deserialize_vcf2(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status);
+      static bool deserialize_vcf2(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status, const internal::field_projection& proj);
+      static bool deserialize_vcf2(variant& v, char* str, char* str_end, const dictionary& dict, std::size_t sample_size, phasing phasing_status, const internal::field_projection& proj);
       static bool deserialize_sav1(variant& v, std::istream& is, const std::list<header_value_details>& format_headers, std::size_t sample_size);
     };
 
@@ -286,6 +423,35 @@ namespace savvy
 
     }
 
+    inline
+    std::size_t site_info::find_field(const field_key& key, const std::vector<std::pair<std::string, typed_value>>& fields, const std::vector<std::int32_t>& ids, const std::vector<std::uint16_t>& slots)
+    {
+      if (key.id() >= 0 && ids.size() == fields.size() && std::size_t(key.id()) < slots.size())
+      {
+        // Slots left over from previous records are rejected by the ID comparison. The name is also compared,
+        // since a key interned against another file's dictionary may map to a different field.
+        std::size_t idx = slots[key.id()];
+        if (idx < ids.size() && ids[idx] == key.id() && fields[idx].first == key.name())
+          return idx;
+      }
+
+      auto res = std::find_if(fields.begin(), fields.end(), [&key](const std::pair<std::string, savvy::typed_value>& v) { return v.first == key.name(); });
+      return res - fields.begin();
+    }
+
+    inline
+    void site_info::index_fields(const std::vector<std::int32_t>& ids, std::vector<std::uint16_t>& slots)
+    {
+      for (std::size_t i = 0; i < ids.size(); ++i)
+      {
+        if (ids[i] < 0)
+          continue;
+        if (std::size_t(ids[i]) >= slots.size())
+          slots.resize(ids[i] + 1);
+        slots[ids[i]] = std::uint16_t(i);
+      }
+    }
+
     struct endian_swapper_fn
     {
       template <typename T>
@@ -306,7 +472,7 @@ namespace savvy
     };
 
     inline
-    bool site_info::deserialize(site_info& s, const dictionary& dict, std::uint32_t& n_sample)
+    bool site_info::deserialize(site_info& s, const dictionary& dict, std::uint32_t& n_sample, const internal::field_projection& proj)
     {
       union u
       {
@@ -374,24 +540,25 @@ namespace savvy
           }
 
           // Parse FILTER
-          std::vector<std::int32_t> filter_ints;
+          std::vector<std::int32_t>& filter_ints = s.filter_ids_;
           shared_it = bcf::deserialize_vec(shared_it, s.shared_data_.end(), filter_ints);
-          s.filters_.clear();
-          s.filters_.reserve(filter_ints.size());
-          for (auto it = filter_ints.begin(); it != filter_ints.end(); ++it)
+          s.filters_.resize(filter_ints.size());
+          for (std::size_t i = 0; i < filter_ints.size(); ++i)
           {
-            if (dict.entries[dictionary::id].size() <= (std::uint32_t)*it)
+            if (dict.entries[dictionary::id].size() <= (std::uint32_t)filter_ints[i])
             {
-              std::fprintf(stderr, "Error: Invalid filter id (%i)\n", *it);
+              std::fprintf(stderr, "Error: Invalid filter id (%i)\n", filter_ints[i]);
               return false;
             }
-            s.filters_.emplace_back(dict.entries[dictionary::id][*it].id);
+            s.filters_[i] = dict.entries[dictionary::id][filter_ints[i]].id; // Assigning reuses string capacity.
           }
 
           // Parse INFO
           s.info_.resize(n_info);
-          auto info_it = s.info_.begin();
-          for ( ; info_it != s.info_.end(); ++info_it)
+          s.info_ids_.resize(n_info);
+          std::size_t info_cnt = 0;
+          std::size_t info_idx = 0;
+          for ( ; info_idx < n_info; ++info_idx)
           {
             std::int32_t info_key_id = -1;
             shared_it = bcf::deserialize_int(shared_it, s.shared_data_.end(), info_key_id);
@@ -400,7 +567,6 @@ namespace savvy
               std::fprintf(stderr, "Error: Invalid info id (%i)\n", info_key_id);
               return false;
             }
-            std::string info_key = dict.entries[dictionary::id][info_key_id].id;
 
             if (shared_it == s.shared_data_.end())
               break;
@@ -416,10 +582,16 @@ namespace savvy
             if (s.shared_data_.end() - shared_it < std::int64_t(sz * type_width))
               break;
 
-            *info_it = std::make_pair(std::move(info_key), typed_value(type_byte & 0x0Fu, sz, sz ? &(*shared_it) : nullptr));
-            if (endianness::is_big() && sz)
+            if (proj.include_info(info_key_id))
             {
-              info_it->second.apply(endian_swapper_fn());
+              auto info_it = s.info_.begin() + info_cnt;
+              s.info_ids_[info_cnt++] = info_key_id;
+              info_it->first = dict.entries[dictionary::id][info_key_id].id;
+              info_it->second = typed_value(type_byte & 0x0Fu, sz, sz ? &(*shared_it) : nullptr);
+              if (endianness::is_big() && sz)
+              {
+                info_it->second.apply(endian_swapper_fn());
+              }
             }
 
             shared_it += sz * type_width;
@@ -427,8 +599,13 @@ namespace savvy
 
           }
 
-          if (info_it == s.info_.end())
+          if (info_idx == n_info)
+          {
+            s.info_.resize(info_cnt);
+            s.info_ids_.resize(info_cnt);
+            index_fields(s.info_ids_, s.info_slots_);
             return true;
+          }
         }
         catch (const std::exception& e)
         {
@@ -442,7 +619,7 @@ namespace savvy
     }
 
     inline
-    bool site_info::deserialize_vcf(site_info& s, std::istream& is, const dictionary& dict)
+    bool site_info::deserialize_vcf(site_info& s, std::istream& is, const dictionary& dict, const internal::field_projection& proj)
     {
       s.chrom_ = "";
       s.alts_.resize(1);
@@ -475,6 +652,7 @@ namespace savvy
       if (is >> info_line)
       {
         s.info_.clear();
+        s.info_ids_.clear();
 
         if (info_line != ".")
         {
@@ -483,6 +661,9 @@ namespace savvy
           for (auto it = info_pairs.begin(); it != info_pairs.end(); ++it)
           {
             auto kvp = detail::split_string_to_vector(*it, '=');
+            if (!proj.include_info(kvp[0]))
+              continue;
+
             if (kvp.size() == 1)
             {
               if (dict.str_to_int[dictionary::id].find(kvp[0]) == dict.str_to_int[dictionary::id].end())
@@ -533,6 +714,99 @@ namespace savvy
       return true;
     }
 
+    inline
+    bool site_info::deserialize_vcf(site_info& s, char*& str, char* str_end, const dictionary& dict, const internal::field_projection& proj)
+    {
+      // Columns are null-terminated in place, including the tab following INFO. On success, str points to the
+      // FORMAT column (or str_end if there are no sample columns).
+      char* cols[8];
+      char* col_ends[8];
+      char* p = str;
+      for (std::size_t i = 0; i < 8; ++i)
+      {
+        if (p > str_end)
+        {
+          fprintf(stderr, "Failed to parse shared data\n");
+          return false;
+        }
+
+        char* t = (char*)std::memchr(p, '\t', str_end - p);
+        if (!t) t = str_end;
+        *t = '\0';
+        cols[i] = p;
+        col_ends[i] = t;
+        p = t + 1;
+      }
+      str = std::min(p, str_end);
+
+      char* pos_end = cols[1];
+      std::int64_t pos = detail::parse_vcf_int(pos_end);
+      if (pos_end == cols[1] || pos_end != col_ends[1] || pos < 0 || pos > std::numeric_limits<std::uint32_t>::max())
+      {
+        fprintf(stderr, "Failed to parse shared data\n");
+        return false;
+      }
+
+      s.chrom_.assign(cols[0], col_ends[0]);
+      s.pos_ = std::uint32_t(pos);
+      s.id_.assign(cols[2], col_ends[2]);
+      s.ref_.assign(cols[3], col_ends[3]);
+      detail::split_vcf_column(cols[4], col_ends[4], ',', s.alts_);
+
+      if (col_ends[5] - cols[5] == 1 && *cols[5] == '.')
+        s.qual_ = typed_value::missing_value<float>();
+      else
+        s.qual_ = detail::parse_vcf_float(cols[5]);
+
+      detail::split_vcf_column(cols[6], col_ends[6], ';', s.filters_);
+
+      s.info_.clear();
+      s.info_ids_.clear();
+      char* info_end = col_ends[7];
+      if (info_end - cols[7] == 1 && *cols[7] == '.')
+        return true;
+
+      std::string key;
+      for (char* kv = cols[7]; kv < info_end; )
+      {
+        char* kv_end = (char*)std::memchr(kv, ';', info_end - kv);
+        if (!kv_end) kv_end = info_end;
+        *kv_end = '\0';
+
+        char* eq = (char*)std::memchr(kv, '=', kv_end - kv);
+        key.assign(kv, eq ? eq : kv_end);
+        if (proj.include_info(key))
+        {
+          auto res = dict.str_to_int[dictionary::id].find(key);
+          if (res == dict.str_to_int[dictionary::id].end())
+          {
+            fprintf(stderr, "Info key not in header: %s\n", key.c_str());
+            return false;
+          }
+
+          if (!eq)
+          {
+            s.info_.emplace_back(key, typed_value(std::int8_t(1)));
+          }
+          else if (std::memchr(eq + 1, '=', kv_end - (eq + 1)))
+          {
+            fprintf(stderr, "Invalid info field: %s\n", kv);
+            return false;
+          }
+          else
+          {
+            // TODO: get info data type from header
+            char* v = eq + 1 < kv_end ? eq + 1 : nullptr;
+            s.info_.emplace_back(key, typed_value(dict.entries[dictionary::id][res->second].type, v, v ? kv_end : nullptr));
+          }
+        }
+
+        kv = kv_end + 1;
+      }
+
+      return true;
+    }
+
     inline
     bool site_info::deserialize_sav1(savvy::site_info& s, std::istream& is, const std::list<header_value_details>& info_headers)
     {
@@ -602,6 +876,7 @@ namespace savvy
                   s.filters_.clear();
                   s.qual_ = typed_value::missing_value<float>();
                   s.info_.clear();
+                  s.info_ids_.clear();
                   s.info_.reserve(info_headers.size());
                   std::string prop_val;
                   for (const header_value_details& hval : info_headers)
@@ -766,24 +1041,78 @@ namespace savvy
 
 
     inline
-    bool variant::deserialize(variant& v, const dictionary& dict, internal::pbwt_sort_context& pbwt_context, std::size_t sample_size, bool is_bcf, phasing phased)
+    void variant::decode_format(std::size_t idx) const
+    {
+      if (idx < format_pending_.size() && format_pending_[idx])
+      {
+        std::uint8_t pending = format_pending_[idx];
+        format_pending_[idx] = 0;
+
+        typed_value& val = format_fields_[idx].second;
+        if (pending & pending_endian_swap)
+          val.apply(endian_swapper_fn());
+
+        if (pending & pending_bcf_gt)
+          val.apply_dense(typed_value::bcf_gt_decoder());
+
+        if (pending & pending_subset)
+        {
+          // Genotypes can be subset after decoding, or before, since decoding is element-wise.
+          typed_value::internal::subset(val, format_subset_->map, format_subset_->indices);
+          val.minimize(); // TODO: Set not_minimized flag and move minimize routine to writer.
+        }
+      }
+    }
+
+    inline
+    bool variant::format_pending(const std::string& key) const
+    {
+      auto res = std::find_if(format_fields_.begin(), format_fields_.end(), [&key](const std::pair<std::string, savvy::typed_value>& v) { return v.first == key;});
+      std::size_t idx = res - format_fields_.begin();
+      return idx < format_pending_.size() && format_pending_[idx] != 0;
+    }
+
+    inline
+    void variant::decode_format() const
+    {
+      for (std::size_t i = 0; i < format_pending_.size(); ++i)
+        decode_format(i);
+    }
+
+    inline
+    bool variant::deserialize(variant& v, const dictionary& dict, internal::pbwt_sort_context& pbwt_context, std::size_t sample_size, bool is_bcf, phasing phased, const internal::field_projection& proj, const internal::sample_subset_view& subset, bool lazy)
     {
       std::uint32_t shared_n_sample = 0;
-      if (site_info::deserialize(v, dict, shared_n_sample))
+      if (site_info::deserialize(v, dict, shared_n_sample, proj))
       {
         bool pbwt_reset = !is_bcf && 0x800000u & shared_n_sample;
         if (pbwt_reset)
           pbwt_context.reset();
 
-        auto indiv_it = v.indiv_buf_.begin();
         v.format_fields_.clear(); // Temp fix for crash until flat buffer design is removed.
+        v.format_subset_.reset();
+        if (proj.sites_only())
+        {
+          // Individual data was not read (see reader::read_binary_record).
+          v.format_ids_.clear();
+          v.format_pending_.clear();
+          return true;
+        }
+
+        auto indiv_it = v.indiv_buf_.begin();
         v.format_fields_.reserve(v.n_fmt_ + 1);
         v.format_fields_.resize(v.n_fmt_);
+        v.format_ids_.resize(v.n_fmt_);
+        v.format_pending_.assign(v.n_fmt_, 0);
 
         typed_value ph_value;
 
-        auto fmt_it = v.format_fields_.begin();
-        for (; fmt_it != v.format_fields_.end(); ++fmt_it)
+        // Subsetting can only be deferred when the subset outlives the reader's current state.
+        bool defer_subset = lazy && subset.enabled() && subset.owner;
+
+        std::size_t fmt_cnt = 0;
+        std::size_t fmt_idx = 0;
+        for (; fmt_idx < v.n_fmt_; ++fmt_idx)
         {
           try
           {
@@ -794,11 +1123,15 @@ namespace savvy
               std::fprintf(stderr, "Error: Invalid FMT id\n");
               return false;
             }
-            std::string fmt_key = dict.entries[dictionary::id][fmt_key_id].id;
+            const std::string& fmt_key = dict.entries[dictionary::id][fmt_key_id].id;
 
             if (indiv_it == v.indiv_buf_.end())
               break;
 
+            // Fields outside of the projection are skipped over, including PBWT state updates.
+            bool include = proj.include_format(fmt_key_id);
+            auto fmt_it = v.format_fields_.begin() + fmt_cnt;
+
             // ------------------------------------------- //
             // TODO: potentially move this to static method since it's similar to INFO parsing.
             std::uint8_t type_byte = *(indiv_it++);
@@ -829,14 +1162,36 @@ namespace savvy
               if (v.indiv_buf_.end() - indiv_it < std::int64_t(sp_sz * pair_width))
                 break;
 
+              if (!include)
+              {
+                indiv_it += sp_sz * pair_width;
+                continue;
+              }
+
+              v.format_ids_[fmt_cnt++] = fmt_key_id;
               //fmt_it->first = fmt_key;
               //fmt_it->second.init(val_type, sz, off_type, sp_sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin()));
-              *fmt_it = std::make_pair(std::string(fmt_key), typed_value(val_type, sz, off_type, sp_sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin())));
+              fmt_it->first = fmt_key;
+              fmt_it->second = typed_value(val_type, sz, off_type, sp_sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin()));
               indiv_it += sp_sz * pair_width;
 
+              std::uint8_t& pending = v.format_pending_[fmt_it - v.format_fields_.begin()];
               if (endianness::is_big() && sp_sz)
               {
-                fmt_it->second.apply(endian_swapper_fn());
+                if (lazy)
+                  pending |= pending_endian_swap;
+                else
+                  fmt_it->second.apply(endian_swapper_fn());
+              }
+
+              if (defer_subset)
+              {
+                pending |= pending_subset;
+              }
+              else if (subset.enabled())
+              {
+                typed_value::internal::subset(fmt_it->second, *subset.map, *subset.indices);
+                fmt_it->second.minimize(); // TODO: Set not_minimized flag and move minimize routine to writer.
               }
             }
             else
@@ -849,14 +1204,28 @@ namespace savvy
               if (v.indiv_buf_.end() - indiv_it < std::int64_t(sz * type_width))
                 break;
 
+              if (!include)
+              {
+                indiv_it += sz * type_width;
+                continue;
+              }
+
+              v.format_ids_[fmt_cnt++] = fmt_key_id;
               //fmt_it->first = fmt_key;
               //fmt_it->second.init(type, sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin()));
-              *fmt_it = std::make_pair(std::string(fmt_key), typed_value(type, sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin())));
+              fmt_it->first = fmt_key;
+              fmt_it->second = typed_value(type, sz, v.indiv_buf_.data() + (indiv_it - v.indiv_buf_.begin()));
               indiv_it += sz * type_width;
 
+              // PBWT-sorted fields are not deferred since pbwt_unsort() updates the permutation and scatters values in one pass.
+              bool defer = lazy && !(pbwt_enabled && !is_bcf);
+              std::uint8_t& pending = v.format_pending_[fmt_it - v.format_fields_.begin()];
               if (endianness::is_big() && sz)
               {
-                fmt_it->second.apply(endian_swapper_fn());
+                if (defer)
+                  pending |= pending_endian_swap;
+                else
+                  fmt_it->second.apply(endian_swapper_fn());
               }
 
               if (is_bcf && fmt_key == "GT")
@@ -864,9 +1233,18 @@ namespace savvy
                 // TODO: save phases when partially phased.
                 if (phased == phasing::unknown || phased == phasing::partial)
                 {
+                  if (pending & pending_endian_swap)
+                  {
+                    fmt_it->second.apply(endian_swapper_fn());
+                    pending &= ~pending_endian_swap;
+                  }
                   ph_value = typed_value(typed_value::int8, (sz / sample_size - 1) * sample_size, nullptr);
                   fmt_it->second.apply_dense(typed_value::bcf_gt_decoder(), (std::int8_t*) ph_value.val_ptr_, sz / sample_size);
                 }
+                else if (defer)
+                {
+                  pending |= pending_bcf_gt;
+                }
                 else
                 {
                   fmt_it->second.apply_dense(typed_value::bcf_gt_decoder());
@@ -876,8 +1254,22 @@ namespace savvy
               if (pbwt_enabled && !is_bcf)
               {
                 auto& format_pbwt_ctx = pbwt_context.format_contexts[fmt_key][sz];
-                typed_value::internal::pbwt_unsort(fmt_it->second, format_pbwt_ctx, pbwt_context.prev_sort_mapping, pbwt_context.counts);
+                if (subset.enabled())
+                  typed_value::internal::pbwt_unsort(fmt_it->second, format_pbwt_ctx, pbwt_context, *subset.map, subset.indices->size());
+                else
+                  typed_value::internal::pbwt_unsort(fmt_it->second, format_pbwt_ctx, pbwt_context);
+              }
+              else if (defer && defer_subset)
+              {
+                pending |= pending_subset;
               }
+              else if (subset.enabled())
+              {
+                typed_value::internal::subset(fmt_it->second, *subset.map, *subset.indices);
+              }
+
+              if (subset.enabled() && !(pending & pending_subset))
+                fmt_it->second.minimize(); // TODO: Set not_minimized flag and move minimize routine to writer.
               // ------------------------------------------- //
             }
           }
@@ -888,10 +1280,23 @@ namespace savvy
           }
         }
 
-        if (fmt_it == v.format_fields_.end())
+        if (fmt_idx == v.n_fmt_)
         {
+          v.format_fields_.resize(fmt_cnt);
+          v.format_ids_.resize(fmt_cnt);
+          v.format_pending_.resize(fmt_cnt);
           if (v.format_fields_.size() && ph_value.size())
+          {
+            if (subset.enabled())
+              typed_value::internal::subset(ph_value, *subset.map, *subset.indices);
+            auto ph_res = dict.str_to_int[dictionary::id].find("PH");
             v.format_fields_.insert(v.format_fields_.begin() + 1, std::make_pair("PH", std::move(ph_value)));
+            v.format_ids_.insert(v.format_ids_.begin() + 1, ph_res == dict.str_to_int[dictionary::id].end() ? -1 : std::int32_t(ph_res->second));
+            v.format_pending_.insert(v.format_pending_.begin() + 1, 0);
+          }
+          if (defer_subset)
+            v.format_subset_ = subset.owner;
+          index_fields(v.format_ids_, v.format_slots_);
           return true;
         }
       }
@@ -933,6 +1338,8 @@ namespace savvy
       std::size_t off_width = 1u << bcf_type_shift[v.off_type_];
 
       var.format_fields_.clear();
+      var.format_ids_.clear();
+      var.format_pending_.clear();
 
       if (format_headers.front().id == "GT")
       {
@@ -994,32 +1401,76 @@ namespace savvy
 
 
     inline
-    bool variant::deserialize_vcf2(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status)
+    bool variant::deserialize_vcf2(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status, const internal::field_projection& proj)
     {
-      v.format_fields_.clear();
-      std::vector<std::string> fmt_keys(1);
-      if (!(is >> fmt_keys.front()) || fmt_keys.front().empty())
+      if (proj.sites_only())
+      {
+        // Skip FORMAT and sample columns entirely.
+        v.format_fields_.clear();
+        v.format_ids_.clear();
+        v.format_pending_.clear();
+        if (!is.ignore(std::numeric_limits<std::streamsize>::max(), '\n'))
+        {
+          std::fprintf(stderr, "Error: Truncated file. No indiv VCf data.\n");
+          return false;
+        }
+        return true;
+      }
+
+      std::string line, sample_line;
+      if (!(is >> line) || line.empty())
       {
         std::fprintf(stderr, "Error: FMT column empty\n");
         return false;
       }
 
-      fmt_keys = detail::split_string_to_vector(fmt_keys.front(), ':');
+      std::getline(is, sample_line, '\n');
+      if (sample_line.size() && sample_line.back() == '\r')
+        sample_line.pop_back();
+      line += sample_line;
+      return deserialize_vcf2(v, &line[0], &line[0] + line.size(), dict, sample_size, phasing_status, proj);
+    }
 
-      v.format_fields_.reserve(fmt_keys.size());
+    inline
+    bool variant::deserialize_vcf2(variant& v, char* str, char* str_end, const dictionary& dict, std::size_t sample_size, phasing phasing_status, const internal::field_projection& proj)
+    {
+      // str points to the FORMAT column and *str_end must be a null character.
+      v.format_fields_.clear();
+      v.format_ids_.clear();
+      v.format_pending_.clear();
 
-      bool gt_present = fmt_keys[0] == "GT";
+      if (proj.sites_only())
+        return true;
 
-      std::string sample_line;
-      if (!std::getline(is, sample_line, '\n') || sample_line.empty())
+      char* fmt_end = (char*)std::memchr(str, '\t', str_end - str);
+      if (fmt_end == str || str == str_end)
+      {
+        std::fprintf(stderr, "Error: FMT column empty\n");
+        return false;
+      }
+
+      if (!fmt_end)
       {
         std::fprintf(stderr, "Error: Truncated file. No indiv VCf data.\n");
         return false;
       }
 
+      std::vector<std::string> fmt_keys;
+      detail::split_vcf_column(str, fmt_end, ':', fmt_keys);
+      if (fmt_keys.empty()) // FORMAT of "."
+        fmt_keys.emplace_back(".");
+
+      v.format_fields_.reserve(fmt_keys.size());
+
+      bool gt_present = fmt_keys[0] == "GT";
+
+      char* sample_line = fmt_end; // starts with tab
+      char* c_end = str_end;
+
       struct vcf_fmt_stats
       {
         bool is_gt = false;
+        bool skip = false;
         std::size_t max_stride = 0;
         std::size_t max_ploidy = 0; // redundant with stride ?
         std::size_t max_byte_length = 0;
@@ -1029,61 +1480,70 @@ namespace savvy
       if (fmt_keys[0] == "GT")
         fmt_stats[0].is_gt = true;
 
-      // ================================================================ //
-      // Adapted from https://github.com/samtools/htslib/blob/8127bfc98e9b4361dca2423fd42a59ad7c25dda7/vcf.c#L2324-L2383
-      // collect fmt stats: max vector size, length, number of alleles
-      std::size_t sample_cnt = 0;
-      vcf_fmt_stats* f = fmt_stats.data();
-      vcf_fmt_stats* f_end = f + fmt_stats.size();
-      std::size_t byte_length = 0, stride = 1, ploidy = 1;
-      const char* c_end = sample_line.c_str() + sample_line.size();
-      for (char* c = &sample_line[0] + 1; c <= c_end; ++c,++byte_length)
+      // Lines of only single-digit diploid genotypes have fixed offsets, so the pre-scan can be skipped.
+      const bool diploid_gt_line = fmt_keys.size() == 1 && gt_present && detail::is_diploid_gt_line(sample_line, c_end, sample_size);
+      if (diploid_gt_line)
       {
-        switch (*c)
-        {
-        case ',':
-          ++stride;
-          break;
-
-        case '|':
-        case '/':
-          if (f->is_gt) ++ploidy,++stride;
-          break;
-
-        case ':':
-        case '\t':  //*c = 0; // fall through
-        case '\r':
-        case '\0':
+        fmt_stats[0].max_stride = fmt_stats[0].max_ploidy = 2;
+        fmt_stats[0].max_byte_length = 3;
+      }
+      else
+      {
+        // ================================================================ //
+        // Adapted from https://github.com/samtools/htslib/blob/8127bfc98e9b4361dca2423fd42a59ad7c25dda7/vcf.c#L2324-L2383
+        // collect fmt stats: max vector size, length, number of alleles
+        std::size_t sample_cnt = 0;
+        vcf_fmt_stats* f = fmt_stats.data();
+        vcf_fmt_stats* f_end = f + fmt_stats.size();
+        std::size_t byte_length = 0, stride = 1, ploidy = 1;
+        for (char* c = sample_line + 1; c <= c_end; ++c,++byte_length)
         {
-          if (f->max_stride < stride) f->max_stride = stride;
-          if (f->max_byte_length < byte_length) f->max_byte_length = byte_length;
-          if (f->is_gt && f->max_ploidy < ploidy) f->max_ploidy = ploidy;
-          byte_length = std::size_t(-1), stride = ploidy = 1;
-          if (*c == ':')
+          switch (*c)
           {
-            f++;
-            if (f >= f_end)
+          case ',':
+            ++stride;
+            break;
+
+          case '|':
+          case '/':
+            if (f->is_gt) ++ploidy,++stride;
+            break;
+
+          case ':':
+          case '\t':  //*c = 0; // fall through
+          case '\r':
+          case '\0':
+          {
+            if (f->max_stride < stride) f->max_stride = stride;
+            if (f->max_byte_length < byte_length) f->max_byte_length = byte_length;
+            if (f->is_gt && f->max_ploidy < ploidy) f->max_ploidy = ploidy;
+            byte_length = std::size_t(-1), stride = ploidy = 1;
+            if (*c == ':')
             {
-              std::fprintf(stderr, "Error: incorrect number of FORMAT fields at position %s:%i\n", v.chrom().c_str(), v.position());
-              return false;
+              f++;
+              if (f >= f_end)
+              {
+                std::fprintf(stderr, "Error: incorrect number of FORMAT fields at position %s:%i\n", v.chrom().c_str(), v.position());
+                return false;
+              }
             }
+            else
+            {
+              f = fmt_stats.data();
+              ++sample_cnt;
+            }
+            break;
           }
-          else
-          {
-            f = fmt_stats.data();
-            ++sample_cnt;
           }
-          break;
         }
-        }
-      }
 
-      if (sample_cnt != sample_size)
-      {
-        std::fprintf(stderr, "Error: incorrect number of sample columns at position %s:%i\n", v.chrom().c_str(), v.position());
-        return false;
+        if (sample_cnt != sample_size)
+        {
+          std::fprintf(stderr, "Error: incorrect number of sample columns at position %s:%i\n", v.chrom().c_str(), v.position());
+          return false;
+        }
+        // ================================================================ //
       }
-      // ================================================================ //
 
       typed_value* ph_value = nullptr;
       for (std::size_t i = 0; i < fmt_keys.size(); ++i)
@@ -1155,10 +1615,11 @@ namespace savvy
         if (type == typed_value::str)
           fmt_stats[i].max_stride = fmt_stats[i].max_byte_length;
 
-        v.format_fields_.emplace_back(fmt_keys[i], typed_value(type, sample_size * fmt_stats[i].max_stride, nullptr));
+        fmt_stats[i].skip = !proj.include_format(fmt_keys[i]);
+        v.format_fields_.emplace_back(fmt_keys[i], typed_value(type, fmt_stats[i].skip ? 0 : sample_size * fmt_stats[i].max_stride, nullptr));
       }
 
-      if (fmt_stats[0].is_gt && fmt_stats[0].max_stride > 1 && (phasing_status == phasing::partial || phasing_status == phasing::unknown))
+      if (fmt_stats[0].is_gt && !fmt_stats[0].skip && fmt_stats[0].max_stride > 1 && (phasing_status == phasing::partial || phasing_status == phasing::unknown))
       {
         fmt_keys.insert(fmt_keys.begin() + 1, "PH");
         auto insert_it = fmt_stats.insert(fmt_stats.begin() + 1, vcf_fmt_stats());
@@ -1168,9 +1629,16 @@ namespace savvy
         ph_value = &v.format_fields_[1].second;
       }
 
-      char* c = &sample_line[0]; // c starts with tab
+      char* c = sample_line; // c starts with tab
       std::size_t sample_idx = std::size_t(-1);
       std::size_t fmt_idx = 0;
+      if (diploid_gt_line && typed_value::type_code((std::int64_t)v.alts().size()) == typed_value::int8)
+      {
+        if (!fmt_stats[0].skip)
+          v.format_fields_[0].second.deserialize_vcf2_diploid_gt(sample_line, sample_size, ph_value);
+        c = c_end;
+      }
+
       while (c < c_end)
       {
         if (*c == '\t')
@@ -1180,7 +1648,11 @@ namespace savvy
         }
         ++c;
 
-        if (fmt_stats[fmt_idx].is_gt)
+        if (fmt_stats[fmt_idx].skip)
+        {
+          c = detail::find_vcf_delimiter(c, c_end, ':', '\t');
+        }
+        else if (fmt_stats[fmt_idx].is_gt)
         {
           v.format_fields_[fmt_idx].second.deserialize_vcf2_gt(sample_idx * fmt_stats[fmt_idx].max_stride, fmt_stats[fmt_idx].max_stride, c, ph_value);
           if (ph_value) ++fmt_idx; // skip PH
@@ -1194,6 +1666,21 @@ namespace savvy
 
       }
 
+      if (proj.format_enabled)
+      {
+        std::size_t dest = 0;
+        for (std::size_t i = 0; i < v.format_fields_.size(); ++i)
+        {
+          if (!fmt_stats[i].skip)
+          {
+            if (dest != i)
+              v.format_fields_[dest] = std::move(v.format_fields_[i]);
+            ++dest;
+          }
+        }
+        v.format_fields_.resize(dest);
+      }
+
       return true;
     }
 
@@ -1202,6 +1689,8 @@ namespace savvy
     bool variant::deserialize_vcf(variant& v, std::istream& is, const dictionary& dict, std::size_t sample_size, phasing phasing_status)
     {
       v.format_fields_.clear();
+      v.format_ids_.clear();
+      v.format_pending_.clear();
       std::vector<std::string> fmt_keys(1);
       is >> fmt_keys.front();
       fmt_keys = detail::split_string_to_vector(fmt_keys.front(), ':');
@@ -1373,6 +1862,8 @@ namespace savvy
     template <typename OutT>
     bool variant::serialize(const variant& v, OutT out_it, const dictionary& dict, std::size_t sample_size, bool is_bcf, phasing phased, ::savvy::internal::pbwt_sort_context& pbwt_ctx, const std::vector<::savvy::internal::pbwt_sort_map*>& pbwt_format_pointers)
     {
+      v.decode_format();
+
       // Encode FMT
       for (auto it = v.format_fields_.begin(); it != v.format_fields_.end(); ++it)
       {
@@ -1390,7 +1881,7 @@ namespace savvy
         auto* pbwt_ptr = pbwt_format_pointers[it - v.format_fields_.begin()];
         if (pbwt_ptr)
         {
-          typed_value::internal::serialize(it->second, out_it, *pbwt_ptr, pbwt_ctx.prev_sort_mapping, pbwt_ctx.counts);
+          typed_value::internal::serialize(it->second, out_it, *pbwt_ptr, pbwt_ctx);
         }
         else
         {
@@ -1436,13 +1927,29 @@ namespace savvy
     {
       auto res = std::find_if(format_fields_.begin(), format_fields_.end(), [&key](const std::pair<std::string, savvy::typed_value>& v) { return v.first == key;});
       if (res != format_fields_.end())
+      {
+        decode_format(res - format_fields_.begin());
         return res->second.get(destination_vector);
+      }
+      return false;
+    }
+
+    template <typename T>
+    bool variant::get_format(const field_key& key, T& destination_vector) const
+    {
+      std::size_t idx = find_field(key, format_fields_, format_ids_, format_slots_);
+      if (idx < format_fields_.size())
+      {
+        decode_format(idx);
+        return format_fields_[idx].second.get(destination_vector);
+      }
       return false;
     }
 
     template <typename T>
     void variant::set_format(const std::string& key, const T& geno)
     {
+      decode_format();
       auto it = format_fields_.begin();
       for ( ; it != format_fields_.end(); ++it)
       {
@@ -1450,6 +1957,7 @@ namespace savvy
         {
           if (geno.size() == 0)
           {
+            format_ids_.clear();
             format_fields_.erase(it);
             return;
           }
@@ -1461,6 +1969,7 @@ namespace savvy
 
       if (it == format_fields_.end() && geno.size())
       {
+        format_ids_.clear();
         format_fields_.emplace_back(key, geno);
       }
     }
@@ -1468,6 +1977,7 @@ namespace savvy
     inline
     void variant::set_format(const std::string& key, typed_value&& val)
     {
+      decode_format();
       auto it = format_fields_.begin();
       for ( ; it != format_fields_.end(); ++it)
       {
@@ -1475,6 +1985,7 @@ namespace savvy
         {
           if (val.size() == 0)
           {
+            format_ids_.clear();
             format_fields_.erase(it);
             return;
           }
@@ -1486,6 +1997,7 @@ namespace savvy
 
       if (it == format_fields_.end() && val.size())
       {
+        format_ids_.clear();
         format_fields_.emplace_back(key, std::move(val));
       }
     }
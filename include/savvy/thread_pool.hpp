@@ -0,0 +1,152 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_THREAD_POOL_HPP
+#define LIBSAVVY_THREAD_POOL_HPP
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+namespace savvy
+{
+  namespace detail
+  {
+    /**
+     * Fixed-size pool of worker threads for data-parallel loops. The calling thread always participates in
+     * its own loop, so run() makes progress even when every worker is busy, and run() may be called
+     * concurrently from multiple threads.
+     */
+    class thread_pool
+    {
+    public:
+      thread_pool(std::size_t num_workers)
+      {
+        for (std::size_t i = 0; i < num_workers; ++i)
+          workers_.emplace_back(&thread_pool::work, this);
+      }
+
+      ~thread_pool()
+      {
+        {
+          std::lock_guard<std::mutex> lock(mtx_);
+          stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto it = workers_.begin(); it != workers_.end(); ++it)
+          it->join();
+      }
+
+      thread_pool(const thread_pool&) = delete;
+      thread_pool& operator=(const thread_pool&) = delete;
+
+      /**
+       * Gets number of worker threads (not including the calling thread).
+       * @return Worker count
+       */
+      std::size_t size() const { return workers_.size(); }
+
+      /**
+       * Calls fn(i) for each i in [0, n_tasks) and blocks until all calls have returned.
+       * @param n_tasks Number of tasks
+       * @param fn Callable taking task index
+       */
+      template <typename Fn>
+      void run(std::size_t n_tasks, Fn fn)
+      {
+        if (n_tasks < 2 || workers_.empty())
+        {
+          for (std::size_t i = 0; i < n_tasks; ++i)
+            fn(i);
+          return;
+        }
+
+        auto j = std::make_shared<job>();
+        j->fn = std::ref(fn);
+        j->size = n_tasks;
+        {
+          std::lock_guard<std::mutex> lock(mtx_);
+          jobs_.push_back(j);
+        }
+        cv_.notify_all();
+
+        process(*j);
+
+        std::unique_lock<std::mutex> lock(j->mtx);
+        j->cv.wait(lock, [&j]() { return j->done == j->size; });
+      }
+    private:
+      struct job
+      {
+        std::function<void(std::size_t)> fn;
+        std::size_t size = 0;
+        std::atomic<std::size_t> next{0};
+        std::size_t done = 0;
+        std::mutex mtx;
+        std::condition_variable cv;
+      };
+
+      static void process(job& j)
+      {
+        std::size_t i;
+        while ((i = j.next++) < j.size)
+        {
+          j.fn(i);
+          std::lock_guard<std::mutex> lock(j.mtx);
+          if (++j.done == j.size)
+            j.cv.notify_all();
+        }
+      }
+
+      void work()
+      {
+        std::unique_lock<std::mutex> lock(mtx_);
+        while (true)
+        {
+          cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+          if (stop_)
+            break;
+
+          std::shared_ptr<job> j = jobs_.front();
+          if (j->next >= j->size)
+          {
+            jobs_.pop_front(); // All tasks have been claimed, though some may still be running.
+            continue;
+          }
+
+          lock.unlock();
+          process(*j);
+          lock.lock();
+        }
+      }
+    private:
+      std::vector<std::thread> workers_;
+      std::deque<std::shared_ptr<job>> jobs_;
+      bool stop_ = false;
+      std::mutex mtx_;
+      std::condition_variable cv_;
+    };
+
+    /**
+     * Gets process-wide pool used internally by the library. Workers are created on first use, one fewer
+     * than the number of hardware threads since callers participate in their own loops.
+     * @return Shared pool
+     */
+    inline thread_pool& shared_thread_pool()
+    {
+      static thread_pool pool(std::max(1u, std::thread::hardware_concurrency()) - 1u);
+      return pool;
+    }
+  }
+}
+
+#endif // LIBSAVVY_THREAD_POOL_HPP
@@ -12,6 +12,10 @@
 #include "sample_subset.hpp"
 #include "portable_endian.hpp"
 #include "endianness.hpp"
+#include "nonzero_scan.hpp"
+#include "pbwt.hpp"
+#include "vcf_parser.hpp"
+#include "vcf_formatter.hpp"
 
 #include <cstdint>
 #include <type_traits>
@@ -811,7 +815,9 @@ namespace savvy
     void init(std::uint8_t type, std::size_t sz, char *data_ptr);
     void init(std::uint8_t val_type, std::size_t sz, std::uint8_t off_type, std::size_t sp_sz, char *data_ptr);
 
-    typed_value(typed_value&& src)
+    // Moves must not throw so that vectors of fields move elements when they grow. Copying would read values that
+    // reference the buffer of a previous record.
+    typed_value(typed_value&& src) noexcept
     {
       operator=(std::move(src));
     }
@@ -839,7 +845,7 @@ namespace savvy
       return *this;
     }
 
-    typed_value& operator=(typed_value&& src);
+    typed_value& operator=(typed_value&& src) noexcept;
     typed_value& operator=(const typed_value& src);
     //void swap(typed_value& src); // This is not a good idea since the pointers sometimes reference external data.
 
@@ -848,22 +854,19 @@ namespace savvy
       template <typename T>
       void operator()(const T* p, const T* p_end, typed_value& dest)
       {
-        std::size_t sz = p_end - p;
-        dest.sparse_size_ = 0;
         std::size_t offset_max = 0;
         std::size_t last_off = 0;
-        for (std::size_t i = 0; i < sz; ++i)
+        std::size_t cnt = 0;
+        detail::for_each_nonzero(p, std::size_t(p_end - p), [&](std::size_t i)
         {
-          if (p[i])
-          {
-            std::size_t off = i - last_off;
-            last_off = i + 1;
-            if (off > offset_max)
-              offset_max = off;
-            ++dest.sparse_size_;
-          }
-        }
+          std::size_t off = i - last_off;
+          last_off = i + 1;
+          if (off > offset_max)
+            offset_max = off;
+          ++cnt;
+        });
 
+        dest.sparse_size_ = cnt;
         dest.off_type_ = type_code_ignore_missing(static_cast<std::int64_t>(offset_max));
       }
     };
@@ -876,20 +879,38 @@ namespace savvy
         const ValT* dense_p = (const ValT*)src_p;
 
         std::size_t last_off = 0;
-        for (std::size_t i = 0; i < dense_sz; ++i)
+        detail::for_each_nonzero(dense_p, dense_sz, [&](std::size_t i)
         {
-          if (dense_p[i])
-          {
-            std::size_t off = i - last_off;
-            last_off = i + 1;
+          *(off_p++) = i - last_off;
+          last_off = i + 1;
+          *(p++) = dense_p[i];
+        });
+      }
+    };
 
-            *(off_p++) = off;
-            *(p++) = dense_p[i];
-          }
-        }
+    struct count_non_zero_fn
+    {
+      template <typename T>
+      void operator()(const T* p, const T* p_end, std::size_t& dest)
+      {
+        dest = detail::count_nonzero(p, std::size_t(p_end - p));
       }
     };
 
+    /**
+     * Counts non-zero values without copying. For sparse values, this is the same as non_zero_size().
+     * Can be used to decide whether a conversion with copy_as_sparse() is worthwhile.
+     * @return Number of non-zero elements
+     */
+    std::size_t count_non_zero() const
+    {
+      if (off_type_)
+        return sparse_size_;
+      std::size_t ret = 0;
+      capply_dense(count_non_zero_fn(), std::ref(ret));
+      return ret;
+    }
+
 #if defined(__GNUC__) && !(defined(__clang__) || defined(__INTEL_COMPILER))
     __attribute((optimize("no-tree-vectorize")))
 #endif
@@ -927,11 +948,16 @@ namespace savvy
       dest.local_data_.resize(size_ * (1u << bcf_type_shift[val_type_]));
 
       dest.val_type_ = val_type_;
+      dest.off_type_ = 0;
       dest.size_ = size_;
+      dest.sparse_size_ = 0;
       dest.val_ptr_ = dest.local_data_.data();
+      dest.off_ptr_ = nullptr;
 
       if (off_type_)
       {
+        // dest may be reused, so zeros must be written explicitly before scattering the non-zero values.
+        std::memset(dest.local_data_.data(), 0, dest.local_data_.size());
         switch (val_type_)
         {
         case 0x01u:
@@ -1680,16 +1706,18 @@ namespace savvy
     class internal
     {
     public:
-      static void pbwt_unsort(typed_value& v, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts);
+      static void pbwt_unsort(typed_value& v, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx);
+      static void pbwt_unsort(typed_value& v, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx, const std::vector<std::size_t>& subset_map, std::size_t subset_size);
+      static bool subset(typed_value& v, const std::vector<std::size_t>& subset_map, const std::vector<std::size_t>& subset_indices);
 
       template<typename InIter, typename OutIter>
-      static void pbwt_sort(InIter in_data, std::size_t in_data_size, OutIter out_it, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts);
+      static void pbwt_sort(InIter in_data, std::size_t in_data_size, OutIter out_it, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx);
 
       template<typename Iter>
       static void serialize(const typed_value& v, Iter out_it, std::size_t size_divisor);
 
       template<typename Iter>
-      static void serialize(const typed_value& v, Iter out_it, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts);
+      static void serialize(const typed_value& v, Iter out_it, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx);
     };
 
   private:
@@ -1837,6 +1865,22 @@ namespace savvy
       }
     };
 
+    struct subset_gather_tpl
+    {
+      template <typename T>
+      void operator()(T* valp, T* /*endp*/, const std::vector<std::size_t>& subset_indices, std::size_t stride)
+      {
+        // Subset indices are increasing, so values can be gathered in place.
+        T* dest = valp;
+        for (auto it = subset_indices.begin(); it != subset_indices.end(); ++it)
+        {
+          const T* src = valp + *it * stride;
+          for (std::size_t j = 0; j < stride; ++j)
+            *(dest++) = src[j];
+        }
+      }
+    };
+
     struct subset_shift_sparse_tpl
     {
       template <typename T, typename T2>
@@ -2106,9 +2150,57 @@ namespace savvy
       }
     }
 
+    // Formats like serialize_vcf(idx, os, delim), but into dest, which must have room for detail::max_vcf_number_width + 1 characters.
+    char* serialize_vcf(std::size_t idx, char* dest, char delim) const
+    {
+      assert(!off_ptr_ && idx < size_);
+      return serialize_vcf_value(val_type_, val_ptr_, idx, dest, delim);
+    }
+
+    // Also used for values of sparse vectors (val_ptr is then the non-zero array). Unknown types write nothing.
+    static char* serialize_vcf_value(std::uint8_t val_type, const char* val_ptr, std::size_t idx, char* dest, char delim)
+    {
+      switch (val_type)
+      {
+      case 0x01u:
+        return serialize_vcf_number(((const std::int8_t*)val_ptr)[idx], dest, delim);
+      case 0x02u:
+        return serialize_vcf_number(((const std::int16_t*)val_ptr)[idx], dest, delim); // TODO: handle endianess
+      case 0x03u:
+        return serialize_vcf_number(((const std::int32_t*)val_ptr)[idx], dest, delim);
+      case 0x04u:
+        return serialize_vcf_number(((const std::int64_t*)val_ptr)[idx], dest, delim);
+      case 0x05u:
+        return serialize_vcf_number(((const float*)val_ptr)[idx], dest, delim);
+      case 0x07u:
+        if (val_ptr[idx] > '\r')
+          *(dest++) = val_ptr[idx];
+        return dest;
+      default:
+        return dest;
+      }
+    }
+
+    template <typename T>
+    static char* serialize_vcf_number(T v, char* dest, char delim)
+    {
+      if (is_end_of_vector(v))
+        return dest;
+      if (delim)
+        *(dest++) = delim;
+      if (is_missing(v))
+        *(dest++) = '.';
+      else if (std::is_floating_point<T>::value)
+        dest = ::savvy::detail::format_vcf_float(dest, float(v));
+      else
+        dest = ::savvy::detail::format_vcf_int(dest, std::int64_t(v));
+      return dest;
+    }
+
     void deserialize_vcf(std::size_t idx, std::size_t length, char* str);
     void deserialize_vcf2(std::size_t idx, std::size_t length, char*& str);
     void deserialize_vcf2_gt(std::size_t idx, std::size_t length, char*& str, typed_value* ph_value);
+    void deserialize_vcf2_diploid_gt(const char* str, std::size_t sample_count, typed_value* ph_value); // str must be validated with detail::is_diploid_gt_line()
 
     template<typename ValT, typename OffT, typename DestT>
     void copy_sparse2(DestT* dest) const
@@ -2461,7 +2553,7 @@ namespace savvy
   }
 
   inline
-  typed_value& typed_value::operator=(typed_value&& src)
+  typed_value& typed_value::operator=(typed_value&& src) noexcept
   {
     if (&src != this)
     {
@@ -2518,130 +2610,61 @@ namespace savvy
     return *this;
   }
 
-  /*template<typename SrcT, typename DestT>
-  static void pbwt_unsort(SrcT src_ptr, std::size_t sz, DestT dest_ptr, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts_old, omp::internal::thread_pool2& tpool)
+  // dest_index maps each unsorted index to its position in dest_ptr (or max value to drop it). The sort
+  // mapping is always updated for every element so that PBWT state stays valid for subsequent records.
+  template<typename SrcT, typename DestT, typename IndexFn = internal::pbwt_identity_index>
+  static void pbwt_unsort(const SrcT* src_ptr, std::size_t sz, DestT* dest_ptr, internal::pbwt_sort_map& sort_mapping, internal::pbwt_sort_context& ctx, IndexFn dest_index = IndexFn())
   {
-    std::swap(sort_mapping, prev_sort_mapping);
-    if (prev_sort_mapping.empty())
-    {
-      prev_sort_mapping.resize(sz);
-      std::iota(prev_sort_mapping.begin(), prev_sort_mapping.end(), 0);
-    }
-
-    if (sort_mapping.empty())
-      sort_mapping.resize(sz);
-
-    if (prev_sort_mapping.size() != sz)
-    {
-      fprintf(stderr, "Variable-sized data vectors not allowed with PBWT\n"); // TODO: handle better
-      exit(-1);
-    }
-
-    std::size_t thread_cnt = tpool.thread_count();
-    std::size_t counts_vec_size = std::numeric_limits<typename std::make_unsigned<typename std::iterator_traits<SrcT>::value_type>::type>::max() + 2;
-    std::vector<std::vector<std::size_t>> counts(thread_cnt + 1, std::vector<std::size_t>(counts_vec_size));
-    omp::parallel_for_exp(omp::static_schedule{}, counts.begin(), counts.begin() + thread_cnt, [src_ptr, sz, thread_cnt](std::vector<std::size_t>& c, const omp::iteration_context& ctx)
-    {
-      std::size_t* counts_ptr = c.data() + 1;
-      std::size_t chunk_size = omp::internal::ceil_divide(sz, thread_cnt);
-      auto* src_uptr = ((typename std::make_unsigned<typename std::iterator_traits<SrcT>::value_type>::type*)src_ptr) + ctx.thread_index * chunk_size;
-      auto* end_uptr = std::min(((typename std::make_unsigned<typename std::iterator_traits<SrcT>::value_type>::type*)src_ptr) + sz, src_uptr + chunk_size);
-      for (auto it = src_uptr; it != end_uptr; ++it)
-      {
-        ++(counts_ptr[*it]);
-      }
-    }, tpool);
+    internal::pbwt_swap_mappings(sort_mapping, ctx.prev_sort_mapping, sz);
 
-//      tpool([&counts, counts_vec_size, thread_cnt](std::size_t tidx)
-//      {
-//        std::size_t chunk_size = omp::internal::ceil_divide(counts_vec_size, thread_cnt);
-//        std::size_t off = chunk_size * tidx;
-//
-//        for (int i = 1; i < counts.size(); ++i)
-//          counts[i][off] = counts[i - 1][off] + counts[i][off];
-//      });
-
-    for (std::size_t i = 0; i < counts_vec_size; ++i)
+    typedef typename std::make_unsigned<SrcT>::type utype;
+    const internal::pbwt_index* prev_ptr = ctx.prev_sort_mapping.data();
+    internal::pbwt_index* sort_ptr = sort_mapping.data();
+    std::size_t n_chunks = internal::pbwt_chunk_count(sz, ctx.parallel_threshold);
+    if (n_chunks > 1)
     {
-      for (std::size_t j = 1; j < thread_cnt; ++j)
+      internal::pbwt_chunk_bucket_offsets((const utype*)src_ptr, sz, n_chunks, ctx.chunk_counts);
+      const std::size_t chunk_size = (sz + n_chunks - 1) / n_chunks;
+      detail::shared_thread_pool().run(n_chunks, [&](std::size_t c)
       {
-        counts[j][i]
-      }
+        internal::pbwt_unsort_range(src_ptr, c * chunk_size, std::min(sz, (c + 1) * chunk_size), dest_ptr, prev_ptr, sort_ptr, ctx.chunk_counts[c].data(), dest_index);
+      });
     }
-
-    for (int j = 1; j < counts.size(); ++j)
-      counts[i][off] = counts[j - 1][off] + counts[i][off];
-
-    for (int i = 1; i < counts.size(); ++i)
-      counts[i] = counts[i - 1] + counts[i];
-
-    for (int i = 0; i < prev_sort_mapping.size(); ++i)
+    else
     {
-//        std::size_t unsorted_index = prev_sort_mapping[i];
-//        dest_ptr[unsorted_index] = src_ptr[i];
-//        std::uint8_t d(dest_ptr[unsorted_index]);
-//        sort_mapping[counts[d]++] = unsorted_index;
-
-      const std::size_t unsorted_index = prev_sort_mapping[i];
-      dest_ptr[unsorted_index] = src_ptr[i];
-      sort_mapping[counts[src_uptr[i]]++] = unsorted_index;
+      internal::pbwt_bucket_offsets((const utype*)src_ptr, sz, ctx.counts);
+      internal::pbwt_unsort_range(src_ptr, 0, sz, dest_ptr, prev_ptr, sort_ptr, ctx.counts.data(), dest_index);
     }
-  }*/
+  }
 
-  template<typename SrcT, typename DestT>
-  static void pbwt_unsort(SrcT src_ptr, std::size_t sz, DestT dest_ptr, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts)
+  inline void typed_value::internal::pbwt_unsort(typed_value& v, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx)
   {
-    std::swap(sort_mapping, prev_sort_mapping);
-    if (prev_sort_mapping.empty())
-    {
-      prev_sort_mapping.resize(sz);
-      for (std::size_t i = 0; i < sz; ++i)
-        prev_sort_mapping[i] = i;
-    }
-
-    sort_mapping.resize(sz);
+    assert(v.off_ptr_ == nullptr);
+    //assert(v.local_data_.empty());
 
-    if (prev_sort_mapping.size() != sz)
+    if (v.off_ptr_)
     {
-      fprintf(stderr, "Variable-sized data vectors not allowed with PBWT\n"); // TODO: handle better
+      fprintf(stderr, "PBWT sort not supported with sparse vectors\n"); // TODO: implement
       exit(-1);
     }
-
-    typedef typename std::make_unsigned<typename std::iterator_traits<SrcT>::value_type>::type utype;
-    auto src_uptr = (utype*)src_ptr;
-    counts.clear();
-    counts.resize(std::numeric_limits<utype>::max() + 2);
-    auto counts_ptr = counts.data() + 1;
-    for (std::size_t i = 0; i < sz; ++i)
-    {
-//        unsigned int d = utype(src_ptr[i]) + 1u;
-//        if (d >= counts.size())
-//          counts.resize(d + 1u);
-//        ++counts[d];
-      ++(counts_ptr[src_uptr[i]]);
-    }
-
-    for (std::size_t i = 1; i < counts.size(); ++i)
-      counts[i] = counts[i - 1] + counts[i];
-
-    for (std::size_t i = 0; i < prev_sort_mapping.size(); ++i)
+    else if (v.val_ptr_)
     {
-//        std::size_t unsorted_index = prev_sort_mapping[i];
-//        dest_ptr[unsorted_index] = src_ptr[i];
-//        std::uint8_t d(dest_ptr[unsorted_index]);
-//        sort_mapping[counts[d]++] = unsorted_index;
 
-      const std::size_t unsorted_index = prev_sort_mapping[i];
-      dest_ptr[unsorted_index] = src_ptr[i];
-      const utype d(src_ptr[i]);
-      sort_mapping[counts[d]++] = unsorted_index;
+      v.local_data_.resize(v.size_ * (1u << bcf_type_shift[v.val_type_]));
+      if (v.val_type_ == 0x01u) ::savvy::pbwt_unsort((std::int8_t *) v.val_ptr_, v.size_, (std::int8_t *) v.local_data_.data(), sort_mapping, ctx);
+      else if (v.val_type_ == 0x02u) ::savvy::pbwt_unsort((std::int16_t *) v.val_ptr_, v.size_, (std::int16_t *) v.local_data_.data(), sort_mapping, ctx); // TODO: make sure this works
+      else
+      {
+        fprintf(stderr, "PBWT sorted vector values cannot be wider than 16 bits\n"); // TODO: handle better
+        exit(-1);
+      }
+      v.val_ptr_ = v.local_data_.data();
     }
   }
 
-  inline void typed_value::internal::pbwt_unsort(typed_value& v, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts)
+  inline void typed_value::internal::pbwt_unsort(typed_value& v, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx, const std::vector<std::size_t>& subset_map, std::size_t subset_size)
   {
     assert(v.off_ptr_ == nullptr);
-    //assert(v.local_data_.empty());
 
     if (v.off_ptr_)
     {
@@ -2650,19 +2673,44 @@ namespace savvy
     }
     else if (v.val_ptr_)
     {
+      if (subset_map.empty() || v.size_ % subset_map.size())
+      {
+        fprintf(stderr, "Error: PBWT vector size is not a multiple of sample size\n");
+        exit(-1);
+      }
 
-      v.local_data_.resize(v.size_ * (1u << bcf_type_shift[v.val_type_]));
-      if (v.val_type_ == 0x01u) ::savvy::pbwt_unsort((std::int8_t *) v.val_ptr_, v.size_, (std::int8_t *) v.local_data_.data(), sort_mapping, prev_sort_mapping, counts);
-      else if (v.val_type_ == 0x02u) ::savvy::pbwt_unsort((std::int16_t *) v.val_ptr_, v.size_, (std::int16_t *) v.local_data_.data(), sort_mapping, prev_sort_mapping, counts); // TODO: make sure this works
+      // Unsorting and subsetting are fused so that only subset values are written.
+      std::size_t stride = v.size_ / subset_map.size();
+      ::savvy::internal::pbwt_subset_index dest_index{subset_map, stride};
+      v.local_data_.resize(subset_size * stride * (1u << bcf_type_shift[v.val_type_]));
+      if (v.val_type_ == 0x01u) ::savvy::pbwt_unsort((std::int8_t *) v.val_ptr_, v.size_, (std::int8_t *) v.local_data_.data(), sort_mapping, ctx, dest_index);
+      else if (v.val_type_ == 0x02u) ::savvy::pbwt_unsort((std::int16_t *) v.val_ptr_, v.size_, (std::int16_t *) v.local_data_.data(), sort_mapping, ctx, dest_index);
       else
       {
         fprintf(stderr, "PBWT sorted vector values cannot be wider than 16 bits\n"); // TODO: handle better
         exit(-1);
       }
       v.val_ptr_ = v.local_data_.data();
+      v.size_ = subset_size * stride;
     }
   }
 
+  inline bool typed_value::internal::subset(typed_value& v, const std::vector<std::size_t>& subset_map, const std::vector<std::size_t>& subset_indices)
+  {
+    if (v.val_type_ == 0x07u || subset_map.empty() || v.size_ < subset_map.size() || v.size_ % subset_map.size())
+      return false;
+
+    bool ret = false;
+    std::size_t stride = v.size_ / subset_map.size();
+    if (v.off_type_)
+      ret = v.apply_sparse(subset_shift_sparse_tpl(), subset_map, v.size_, std::ref(v.sparse_size_)); // Offsets are remapped in place in a single pass.
+    else if (v.val_type_)
+      ret = v.apply_dense(subset_gather_tpl(), subset_indices, stride); // Only subset columns are visited.
+
+    v.size_ = subset_indices.size() * stride;
+    return ret;
+  }
+
   template <typename Iter>
   void typed_value::internal::serialize(const typed_value& v, Iter out_it, std::size_t size_divisor)
   {
@@ -2719,79 +2767,73 @@ namespace savvy
 
   }
 
-  template<typename InIter, typename OutIter>
-  inline void typed_value::internal::pbwt_sort(InIter in_data, std::size_t in_data_sz, OutIter out_it, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts)
+  template <typename ValT, typename OutIter>
+  struct pbwt_sort_output
   {
-    std::swap(sort_mapping, prev_sort_mapping);
-    if (prev_sort_mapping.empty())
-    {
-      prev_sort_mapping.resize(in_data_sz);
-      for (std::size_t i = 0; i < in_data_sz; ++i)
-        prev_sort_mapping[i] = i;
-    }
-
-    sort_mapping.resize(in_data_sz);
+    OutIter& out_it;
+    bool swap_bytes;
 
-    if (prev_sort_mapping.size() != in_data_sz)
+    void operator()(std::size_t, ValT val)
     {
-      fprintf(stderr, "Variable-sized data vectors not allowed with PBWT\n"); // TODO: handle better
-      exit(-1);
+      const char* v_ptr = (const char*)(&val);
+      if (swap_bytes)
+      {
+        for (std::size_t j = sizeof(ValT); j > 0; --j)
+          *(out_it++) = v_ptr[j - 1];
+      }
+      else
+      {
+        for (std::size_t j = 0; j < sizeof(ValT); ++j)
+          *(out_it++) = v_ptr[j];
+      }
     }
+  };
+
+  template<typename InIter, typename OutIter>
+  inline void typed_value::internal::pbwt_sort(InIter in_data, std::size_t in_data_sz, OutIter out_it, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx)
+  {
+    ::savvy::internal::pbwt_swap_mappings(sort_mapping, ctx.prev_sort_mapping, in_data_sz);
 
     typedef typename std::iterator_traits<InIter>::value_type val_t;
     typedef typename std::make_unsigned<val_t>::type utype;
-    counts.clear();
-    for (std::size_t i = 0; i < in_data_sz; ++i)
-    {
-      unsigned int d = utype(in_data[i]) + 1u;
-      if (d >= counts.size())
-        counts.resize(d + 1u);
-      ++counts[d];
-    }
+    const val_t* in_ptr = &in_data[0];
+    const ::savvy::internal::pbwt_index* prev_ptr = ctx.prev_sort_mapping.data();
+    ::savvy::internal::pbwt_index* sort_ptr = sort_mapping.data();
+    pbwt_sort_output<val_t, OutIter> out_fn{out_it, sizeof(val_t) > 1 && endianness::is_big()};
 
-    for (std::size_t i = 1; i < counts.size(); ++i)
-      counts[i] = counts[i - 1] + counts[i];
-
-    for (std::size_t i = 0; i < prev_sort_mapping.size(); ++i)
+    std::size_t n_chunks = ::savvy::internal::pbwt_chunk_count(in_data_sz, ctx.parallel_threshold);
+    if (n_chunks > 1)
     {
-      std::size_t unsorted_index = prev_sort_mapping[i];
-      utype d(in_data[unsorted_index]);
-      sort_mapping[counts[d]++] = unsorted_index;
-    }
+      // The output iterator must be written in order, so values are first gathered into scratch. Bucket
+      // offsets depend on the order of values within each chunk, so they are computed after gathering.
+      ctx.gathered.resize(in_data_sz * sizeof(val_t));
+      val_t* gathered_ptr = (val_t*)ctx.gathered.data();
+      const std::size_t chunk_size = (in_data_sz + n_chunks - 1) / n_chunks;
+      ::savvy::detail::shared_thread_pool().run(n_chunks, [&](std::size_t c)
+      {
+        ::savvy::internal::pbwt_gather_range(in_ptr, c * chunk_size, std::min(in_data_sz, (c + 1) * chunk_size), prev_ptr, gathered_ptr);
+      });
 
-    //sorted_data.resize(in_data_sz);
-    if (std::is_same<val_t, std::int8_t>::value)
-    {
-      for (std::size_t i = 0; i < prev_sort_mapping.size(); ++i)
+      ::savvy::internal::pbwt_chunk_bucket_offsets((const utype*)gathered_ptr, in_data_sz, n_chunks, ctx.chunk_counts);
+      ::savvy::detail::shared_thread_pool().run(n_chunks, [&](std::size_t c)
       {
-        *(out_it++) = in_data[prev_sort_mapping[i]];
-      }
+        ::savvy::internal::pbwt_bucket_range(gathered_ptr, c * chunk_size, std::min(in_data_sz, (c + 1) * chunk_size), prev_ptr, sort_ptr, ctx.chunk_counts[c].data());
+      });
+
+      for (std::size_t i = 0; i < in_data_sz; ++i)
+        out_fn(i, gathered_ptr[i]);
     }
-    else //std::is_same<val_t, std::int16_t>::value
+    else
     {
-      if (endianness::is_big())
-      {
-        for (std::size_t i = 0; i < prev_sort_mapping.size(); ++i)
-        {
-          char* v_ptr = (char*)(&in_data[prev_sort_mapping[i]]);
-          *(out_it++) = v_ptr[1];
-          *(out_it++) = v_ptr[0];
-        }
-      }
-      else
-      {
-        for (std::size_t i = 0; i < prev_sort_mapping.size(); ++i)
-        {
-          char* v_ptr = (char*)(&in_data[prev_sort_mapping[i]]);
-          *(out_it++) = v_ptr[0];
-          *(out_it++) = v_ptr[1];
-        }
-      }
+      // The histogram does not depend on order, so it is built with a sequential pass over the unsorted data.
+      // Values are then gathered, written and bucketed in a single pass over the previous permutation.
+      ::savvy::internal::pbwt_bucket_offsets((const utype*)in_ptr, in_data_sz, ctx.counts);
+      ::savvy::internal::pbwt_sort_range(in_ptr, 0, in_data_sz, prev_ptr, sort_ptr, ctx.counts.data(), out_fn);
     }
   }
 
   template <typename Iter>
-  void typed_value::internal::serialize(const typed_value& v, Iter out_it, std::vector<std::size_t>& sort_mapping, std::vector<std::size_t>& prev_sort_mapping, std::vector<std::size_t>& counts)
+  void typed_value::internal::serialize(const typed_value& v, Iter out_it, ::savvy::internal::pbwt_sort_map& sort_mapping, ::savvy::internal::pbwt_sort_context& ctx)
   {
     std::uint8_t type_byte =  v.off_type_ ? typed_value::sparse : (0x08u | v.val_type_); // sparse with PBWT not currently supported.
     type_byte = std::uint8_t(std::min(std::size_t(15), v.size_) << 4u) | type_byte;
@@ -2835,8 +2877,8 @@ namespace savvy
     else
     {
       // ---- PBWT ---- //
-      if (v.val_type_ == 0x01u) internal::pbwt_sort((std::int8_t *) v.val_ptr_, v.size_, out_it, sort_mapping, prev_sort_mapping, counts);
-      else if (v.val_type_ == 0x02u) internal::pbwt_sort((std::int16_t *) v.val_ptr_, v.size_, out_it, sort_mapping, prev_sort_mapping, counts); // TODO: make sure this works
+      if (v.val_type_ == 0x01u) internal::pbwt_sort((std::int8_t *) v.val_ptr_, v.size_, out_it, sort_mapping, ctx);
+      else if (v.val_type_ == 0x02u) internal::pbwt_sort((std::int16_t *) v.val_ptr_, v.size_, out_it, sort_mapping, ctx); // TODO: make sure this works
       else
       {
         fprintf(stderr, "PBWT sorted vector values cannot be wider than 16 bits\n"); // TODO: handle better
@@ -3092,7 +3134,7 @@ namespace savvy
       {
         typedef std::int8_t T;
         local_data_.resize(local_data_.size() + sizeof(T));
-        if (*str == '.') ((T*)val_ptr_)[size_++] = T(0x80), ++str;
+        if (*str == '.') ((T*)local_data_.data())[size_++] = T(0x80), ++str;
         else ((T*)local_data_.data())[size_++] = std::strtol(str, &str, 10);
       }
       break;
@@ -3103,7 +3145,7 @@ namespace savvy
       {
         typedef std::int16_t T;
         local_data_.resize(local_data_.size() + sizeof(T));
-        if (*str == '.') ((T*)val_ptr_)[size_++] = T(0x8000), ++str;
+        if (*str == '.') ((T*)local_data_.data())[size_++] = T(0x8000), ++str;
         else ((T*)local_data_.data())[size_++] = std::strtol(str, &str, 10);
       }
       break;
@@ -3114,7 +3156,7 @@ namespace savvy
       {
         typedef std::int32_t T;
         local_data_.resize(local_data_.size() + sizeof(T));
-        if (*str == '.') ((T*)val_ptr_)[size_++] = T(0x80000000), ++str;
+        if (*str == '.') ((T*)local_data_.data())[size_++] = T(0x80000000), ++str;
         else ((T*)local_data_.data())[size_++] = std::strtol(str, &str, 10);
       }
       break;
@@ -3125,7 +3167,7 @@ namespace savvy
       {
         typedef std::int64_t T;
         local_data_.resize(local_data_.size() + sizeof(T));
-        if (*str == '.') ((T*)val_ptr_)[size_++] = T(0x8000000000000000), ++str;
+        if (*str == '.') ((T*)local_data_.data())[size_++] = T(0x8000000000000000), ++str;
         else ((T*)local_data_.data())[size_++] = std::strtol(str, &str, 10);
       }
       break;
@@ -3136,7 +3178,7 @@ namespace savvy
       {
         typedef float T;
         local_data_.resize(local_data_.size() + sizeof(T));
-        if (*str == '.') ((T*)val_ptr_)[size_++] = missing_value<float>(), ++str;
+        if (*str == '.') ((T*)local_data_.data())[size_++] = missing_value<float>(), ++str;
         else ((T*)local_data_.data())[size_++] = std::strtof(str, &str);
       }
       break;
@@ -3249,7 +3291,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int8_t*)val_ptr_)[idx++] = std::int8_t(0x80), ++str;
-        else ((std::int8_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int8_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str != ',') break;
       }
 
@@ -3262,7 +3304,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int16_t*)val_ptr_)[idx++] = std::int16_t(0x8000), ++str;
-        else ((std::int16_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int16_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str != ',') break;
       }
 
@@ -3275,7 +3317,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int32_t*)val_ptr_)[idx++] = std::int32_t(0x80000000), ++str;
-        else ((std::int32_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int32_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str != ',') break;
       }
 
@@ -3288,7 +3330,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int64_t*)val_ptr_)[idx++] = std::int64_t(0x8000000000000000), ++str;
-        else ((std::int64_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int64_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str != ',') break;
       }
 
@@ -3301,7 +3343,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((float*)val_ptr_)[idx++] = missing_value<float>(), ++str;
-        else ((float*)val_ptr_)[idx++] = std::strtof(str, &str);
+        else ((float*)val_ptr_)[idx++] = detail::parse_vcf_float(str);
         if (*str != ',') break;
       }
 
@@ -3335,6 +3377,17 @@ namespace savvy
     assert(length);
     std::size_t ph_idx = idx / length * (length - 1);
 
+    // Fast path for single-digit diploid genotypes (e.g., "0|1" or "./."), which are the vast majority.
+    if (length == 2 && val_type_ == 0x01u && (detail::is_vcf_digit(str[0]) || str[0] == '.') && (str[1] == '|' || str[1] == '/')
+      && (detail::is_vcf_digit(str[2]) || str[2] == '.') && (str[3] == ':' || str[3] == '\t' || str[3] == '\0'))
+    {
+      ((std::int8_t*)val_ptr_)[idx] = str[0] == '.' ? std::int8_t(0x80) : std::int8_t(str[0] - '0');
+      ((std::int8_t*)val_ptr_)[idx + 1] = str[2] == '.' ? std::int8_t(0x80) : std::int8_t(str[2] - '0');
+      if (ph_value) ph_value->val_ptr_[ph_idx] = str[1] == '|';
+      str += 3;
+      return;
+    }
+
     switch (val_type_)
     {
     case 0x01u:
@@ -3342,7 +3395,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int8_t*)val_ptr_)[idx++] = std::int8_t(0x80), ++str;
-        else ((std::int8_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int8_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str == '/')
         {
           if (ph_value) ph_value->val_ptr_[ph_idx++] = 0;
@@ -3364,7 +3417,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int16_t*)val_ptr_)[idx++] = std::int16_t(0x8000), ++str;
-        else ((std::int16_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int16_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str == '/')
         {
           if (ph_value) ph_value->val_ptr_[ph_idx++] = 0;
@@ -3379,13 +3432,14 @@ namespace savvy
 
       for ( ; idx < end; ++idx)
         ((std::int16_t*)val_ptr_)[idx] = std::int16_t(0x8001);
+      break;
     }
     case 0x03u:
     {
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int32_t*)val_ptr_)[idx++] = std::int32_t(0x80000000), ++str;
-        else ((std::int32_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int32_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str == '/')
         {
           if (ph_value) ph_value->val_ptr_[ph_idx++] = 0;
@@ -3407,7 +3461,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((std::int64_t*)val_ptr_)[idx++] = std::int64_t(0x8000000000000000), ++str;
-        else ((std::int64_t*)val_ptr_)[idx++] = std::strtol(str, &str, 10);
+        else ((std::int64_t*)val_ptr_)[idx++] = detail::parse_vcf_int(str);
         if (*str == '/')
         {
           if (ph_value) ph_value->val_ptr_[ph_idx++] = 0;
@@ -3429,7 +3483,7 @@ namespace savvy
       for ( ; idx < end; ++str)
       {
         if (*str == '.') ((float*)val_ptr_)[idx++] = missing_value<float>(), ++str;
-        else ((float*)val_ptr_)[idx++] = std::strtof(str, &str);
+        else ((float*)val_ptr_)[idx++] = detail::parse_vcf_float(str);
         if (*str == '/')
         {
           if (ph_value) ph_value->val_ptr_[ph_idx++] = 0;
@@ -3451,6 +3505,26 @@ namespace savvy
 
     }
   }
+
+  inline
+  void typed_value::deserialize_vcf2_diploid_gt(const char* str, std::size_t sample_count, typed_value* ph_value)
+  {
+    assert(!off_ptr_ && val_type_ == 0x01u && size_ == sample_count * 2);
+
+    std::int8_t* dest = (std::int8_t*)val_ptr_;
+    for (std::size_t i = 0; i < sample_count; ++i, str += 4)
+    {
+      dest[i * 2] = str[1] == '.' ? std::int8_t(0x80) : std::int8_t(str[1] - '0');
+      dest[i * 2 + 1] = str[3] == '.' ? std::int8_t(0x80) : std::int8_t(str[3] - '0');
+    }
+
+    if (ph_value)
+    {
+      str -= sample_count * 4;
+      for (std::size_t i = 0; i < sample_count; ++i, str += 4)
+        ph_value->val_ptr_[i] = str[2] == '|';
+    }
+  }
 }
 
 #endif // LIBSAVVY_TYPED_VALUE_HPP
\ No newline at end of file
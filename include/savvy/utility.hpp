@@ -132,6 +132,12 @@ namespace savvy
       return (stat(file_path.c_str(), &st) == 0);
     }
 
+    inline bool is_regular_file(const std::string& file_path)
+    {
+      struct stat st;
+      return (stat(file_path.c_str(), &st) == 0 && S_ISREG(st.st_mode));
+    }
+
 
     inline std::string& rtrim(std::string& s, const char* d = " \t\n\r\f\v")
     {
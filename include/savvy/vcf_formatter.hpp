@@ -0,0 +1,185 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_VCF_FORMATTER_HPP
+#define LIBSAVVY_VCF_FORMATTER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+namespace savvy
+{
+  namespace detail
+  {
+    /// Maximum number of characters written by format_vcf_int() or format_vcf_float().
+    static const std::size_t max_vcf_number_width = 24;
+
+    /**
+     * Writes a base-10 integer like std::ostream::operator<<.
+     * @return End of written characters
+     */
+    inline char* format_vcf_int(char* dest, std::int64_t v)
+    {
+      std::uint64_t u = std::uint64_t(v);
+      if (v < 0)
+      {
+        *dest++ = '-';
+        u = 0 - u;
+      }
+
+      if (u < 10)
+      {
+        *dest++ = char('0' + u);
+        return dest;
+      }
+
+      char tmp[20];
+      char* t = tmp + sizeof(tmp);
+      do
+      {
+        *--t = char('0' + u % 10u);
+        u /= 10u;
+      } while (u);
+
+      std::size_t n = std::size_t(tmp + sizeof(tmp) - t);
+      std::memcpy(dest, t, n);
+      return dest + n;
+    }
+
+    /**
+     * Writes a float like std::ostream::operator<< with default flags and precision (i.e., printf's "%g"). Values
+     * between 1e-4 and 1e6 are scaled to six significant digits with a multiplication that is exact in double
+     * precision (24-bit mantissa times 5^9 at most), so rounding matches printf. Anything else is passed to snprintf.
+     *
+     * @return End of written characters
+     */
+    inline char* format_vcf_float(char* dest, float v)
+    {
+      static const double lower_bounds[] = {1e-4, 1e-3, 1e-2, 1e-1, 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6};
+      static const double scales[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+
+      double d = std::fabs(double(v));
+      if (d < 1e6 && (d >= 1e-4 || d == 0.))
+      {
+        char* p = dest;
+        if (std::signbit(v))
+          *p++ = '-';
+
+        std::uint32_t whole = std::uint32_t(d);
+        if (double(whole) == d)
+          return format_vcf_int(p, whole);
+
+        int x = 5; // Decimal exponent
+        while (d < lower_bounds[x + 4])
+          --x;
+
+        std::uint32_t scaled = std::uint32_t(std::nearbyint(d * scales[5 - x]));
+        if (scaled < 1000000u)
+        {
+          char digits[6];
+          for (int i = 5; i >= 0; --i, scaled /= 10u)
+            digits[i] = char('0' + scaled % 10u);
+
+          int n = 6;
+          while (digits[n - 1] == '0')
+            --n;
+
+          if (x >= 0)
+          {
+            std::memcpy(p, digits, x + 1);
+            p += x + 1;
+            if (n > x + 1)
+            {
+              *p++ = '.';
+              std::memcpy(p, digits + x + 1, n - x - 1);
+              p += n - x - 1;
+            }
+          }
+          else
+          {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i = -1; i > x; --i)
+              *p++ = '0';
+            std::memcpy(p, digits, n);
+            p += n;
+          }
+          return p;
+        }
+        // Otherwise, value rounds up to the next power of ten, which may change notation.
+      }
+
+      int n = std::snprintf(dest, max_vcf_number_width, "%g", double(v));
+      return dest + std::max(0, std::min(n, int(max_vcf_number_width) - 1));
+    }
+
+    /**
+     * Lookup table for formatting genotypes, indexed by int8 allele value (cast to std::uint8_t). Alleles 0-9 map
+     * to digits and missing maps to '.'. Everything else (including end-of-vector) maps to '\0' and must be
+     * formatted with typed_value::serialize_vcf().
+     */
+    inline const char* vcf_allele_chars()
+    {
+      struct table
+      {
+        char chars[256];
+        table()
+        {
+          std::memset(chars, 0, sizeof(chars));
+          for (int i = 0; i < 10; ++i)
+            chars[i] = char('0' + i);
+          chars[0x80] = '.';
+        }
+      };
+
+      static const table t;
+      return t.chars;
+    }
+
+    /**
+     * Growable character buffer for formatting VCF lines. Callers reserve the maximum number of characters they
+     * will write, write through the returned pointer, and then commit the end pointer.
+     */
+    class vcf_text_buffer
+    {
+    public:
+      void clear() { size_ = 0; }
+      const char* data() const { return buf_.data(); }
+      std::size_t size() const { return size_; }
+
+      /**
+       * @param n Number of characters that will be written
+       * @return Pointer to end of buffer data
+       */
+      char* reserve(std::size_t n)
+      {
+        if (buf_.size() < size_ + n)
+          buf_.resize(std::max(buf_.size() * 2, size_ + n));
+        return &buf_[size_];
+      }
+
+      void commit(char* end) { size_ = std::size_t(end - buf_.data()); }
+
+      void append(const char* s, std::size_t n)
+      {
+        std::memcpy(reserve(n), s, n);
+        size_ += n;
+      }
+
+      void put(char c) { *reserve(1) = c; ++size_; }
+    private:
+      std::vector<char> buf_;
+      std::size_t size_ = 0;
+    };
+  }
+}
+
+#endif // LIBSAVVY_VCF_FORMATTER_HPP
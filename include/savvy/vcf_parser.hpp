@@ -0,0 +1,325 @@
+/*
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef LIBSAVVY_VCF_PARSER_HPP
+#define LIBSAVVY_VCF_PARSER_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <cfloat>
+#include <string>
+#include <vector>
+#include <istream>
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define SAVVY_VCF_PARSER_SIMD 1
+#include <emmintrin.h>
+#endif
+
+namespace savvy
+{
+  namespace detail
+  {
+    inline bool is_vcf_digit(char c) { return unsigned(c - '0') < 10u; }
+
+    /**
+     * Parses a base-10 integer like std::strtol(str, &str, 10), but without locale or errno overhead. Numbers
+     * with more digits than fit in 64 bits are passed to strtoll.
+     */
+    inline std::int64_t parse_vcf_int(char*& str)
+    {
+      char* p = str;
+      bool neg = false;
+      if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+
+      const char* digits = p;
+      std::uint64_t v = 0;
+      for ( ; is_vcf_digit(*p) && p - digits < 18; ++p)
+        v = v * 10u + unsigned(*p - '0');
+
+      if (p == digits)
+        return 0; // Like strtol, str is not advanced.
+      if (is_vcf_digit(*p))
+        return std::strtoll(str, &str, 10);
+
+      str = p;
+      return neg ? -std::int64_t(v) : std::int64_t(v);
+    }
+
+    /**
+     * Parses a float like std::strtof(str, &str). Values with at most 9 significant digits, a mantissa no greater
+     * than 2^24 and a decimal exponent within +/-10 (e.g., "0.125", "1e-05") are computed with a single correctly
+     * rounded multiplication or division. Since the mantissa and power of ten are both exact floats, this gives the
+     * same result as strtof. Anything else is passed to strtof.
+     */
+    inline float parse_vcf_float(char*& str)
+    {
+#if FLT_EVAL_METHOD == 0
+      static const float pow10[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+      char* p = str;
+      bool neg = false;
+      if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+
+      std::uint32_t m = 0;
+      int exp10 = 0;
+      int n_digits = 0;
+      int n_significant = 0;
+      for ( ; is_vcf_digit(*p); ++p, ++n_digits)
+      {
+        if (m || *p != '0') ++n_significant;
+        if (n_significant > 9) break;
+        m = m * 10u + unsigned(*p - '0');
+      }
+
+      if (*p == '.' && n_significant <= 9)
+      {
+        for (++p; is_vcf_digit(*p); ++p, ++n_digits)
+        {
+          if (m || *p != '0') ++n_significant;
+          if (n_significant > 9) break;
+          m = m * 10u + unsigned(*p - '0');
+          --exp10;
+        }
+      }
+
+      if (n_digits && n_significant <= 9 && (*p == 'e' || *p == 'E'))
+      {
+        char* e = p + 1;
+        bool exp_neg = false;
+        if (*e == '-' || *e == '+')
+          exp_neg = (*e++ == '-');
+        int x = 0;
+        const char* exp_digits = e;
+        for ( ; is_vcf_digit(*e) && x < 100; ++e)
+          x = x * 10 + (*e - '0');
+        if (e != exp_digits)
+        {
+          exp10 += exp_neg ? -x : x;
+          p = e;
+        }
+      }
+
+      if (n_digits && m <= (1u << 24u) && exp10 >= -10 && exp10 <= 10 && !is_vcf_digit(*p) && *p != 'x' && *p != 'X')
+      {
+        float f = exp10 < 0 ? float(m) / pow10[-exp10] : float(m) * pow10[exp10];
+        str = p;
+        return neg ? -f : f;
+      }
+#endif
+      return std::strtof(str, &str);
+    }
+
+    /**
+     * Splits a column (e.g., ALT or FILTER) into dest, reusing its strings. A column of "." produces no values.
+     */
+    inline void split_vcf_column(const char* beg, const char* end, char delim, std::vector<std::string>& dest)
+    {
+      std::size_t n = 0;
+      if (beg != end && !(end - beg == 1 && *beg == '.'))
+      {
+        for (const char* d = beg; d != end; beg = d + 1)
+        {
+          d = (const char*)std::memchr(beg, delim, end - beg);
+          if (!d) d = end;
+          if (n == dest.size())
+            dest.emplace_back();
+          dest[n++].assign(beg, d);
+        }
+      }
+      dest.resize(n);
+    }
+
+    /**
+     * Finds the first occurrence of a or b in [p, end).
+     * @return Pointer to delimiter or end
+     */
+    inline char* find_vcf_delimiter(char* p, char* end, char a, char b)
+    {
+#ifdef SAVVY_VCF_PARSER_SIMD
+      const __m128i va = _mm_set1_epi8(a);
+      const __m128i vb = _mm_set1_epi8(b);
+      for ( ; end - p >= 16; p += 16)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (mask)
+          return p + __builtin_ctz(unsigned(mask));
+      }
+#endif
+      for ( ; p < end; ++p)
+      {
+        if (*p == a || *p == b)
+          return p;
+      }
+      return end;
+    }
+
+    /**
+     * Checks whether sample columns consist only of single-digit diploid genotypes (e.g., "\t0|1\t./.\t1/1"),
+     * which is the layout of most GT-only files. Such lines need no pre-scan since every sample has the same
+     * stride and fixed byte offsets.
+     *
+     * @param p Pointer to the tab preceding the first sample
+     * @param end End of line
+     * @param sample_count Expected number of samples
+     * @return True if line matches layout
+     */
+    inline bool is_diploid_gt_line(const char* p, const char* end, std::size_t sample_count)
+    {
+      if (std::size_t(end - p) != 4 * sample_count)
+        return false;
+
+#ifdef SAVVY_VCF_PARSER_SIMD
+      // Four samples per register: tabs at byte 0, alleles at bytes 1 and 3, and phase at byte 2 (mod 4).
+      const __m128i tab_pos = _mm_set1_epi32(0x000000FF);
+      const __m128i sep_pos = _mm_set1_epi32(0x00FF0000);
+      const __m128i allele_pos = _mm_set1_epi32(int(0xFF00FF00));
+      const __m128i zero_char = _mm_set1_epi8('0');
+      const __m128i nine = _mm_set1_epi8(9);
+      for ( ; end - p >= 16; p += 16)
+      {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i offset = _mm_sub_epi8(v, zero_char);
+        __m128i allele = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(offset, nine), nine), _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+        __m128i sep = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('|')), _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+        __m128i ok = _mm_or_si128(_mm_or_si128(_mm_and_si128(tab, tab_pos), _mm_and_si128(sep, sep_pos)), _mm_and_si128(allele, allele_pos));
+        if (_mm_movemask_epi8(ok) != 0xFFFF)
+          return false;
+      }
+#endif
+      for ( ; p < end; p += 4)
+      {
+        if (p[0] != '\t' || (p[2] != '|' && p[2] != '/'))
+          return false;
+        if ((!is_vcf_digit(p[1]) && p[1] != '.') || (!is_vcf_digit(p[3]) && p[3] != '.'))
+          return false;
+      }
+
+      return true;
+    }
+
+    /**
+     * Replaces the newline at line_end (and a preceding carriage return) with a null character.
+     * @return New end of line
+     */
+    inline char* terminate_vcf_line(char* line, char* line_end)
+    {
+      if (line_end > line && line_end[-1] == '\r')
+        --line_end;
+      *line_end = '\0';
+      return line_end;
+    }
+
+    /**
+     * Splits a text stream into lines. Lines are returned as pointers into an internal buffer, with the newline
+     * (and a preceding carriage return) replaced by a null character so that they can be parsed in place.
+     */
+    class vcf_line_buffer
+    {
+    public:
+      /**
+       * Reads the next line by pulling large blocks directly from the stream buffer. The stream is read ahead of
+       * the returned line, so tellg() does not correspond to record boundaries in this mode.
+       *
+       * @param is Input stream
+       * @param line Set to beginning of line
+       * @param line_end Set to end of line (which points to a null character)
+       * @return False if end of stream has been reached (eofbit is set on is)
+       */
+      bool getline(std::istream& is, char*& line, char*& line_end)
+      {
+        const std::size_t block_size = 1u << 20u;
+        std::size_t scanned = beg_;
+        while (true)
+        {
+          char* nl = end_ > scanned ? (char*)std::memchr(buf_.data() + scanned, '\n', end_ - scanned) : nullptr;
+          if (nl)
+          {
+            line = buf_.data() + beg_;
+            beg_ = std::size_t(nl - buf_.data()) + 1;
+            line_end = terminate_vcf_line(line, nl);
+            return true;
+          }
+
+          if (beg_)
+          {
+            std::memmove(buf_.data(), buf_.data() + beg_, end_ - beg_);
+            end_ -= beg_;
+            beg_ = 0;
+          }
+          scanned = end_;
+
+          if (buf_.size() < end_ + block_size + 1) // +1 for terminating final line
+            buf_.resize(end_ + block_size + 1);
+
+          std::streamsize n = is.rdbuf() ? is.rdbuf()->sgetn(buf_.data() + end_, block_size) : 0;
+          if (n <= 0)
+          {
+            if (end_ == beg_)
+            {
+              is.setstate(is.rdstate() | std::ios::eofbit);
+              return false;
+            }
+
+            // Last line has no newline.
+            line = buf_.data() + beg_;
+            line_end = terminate_vcf_line(line, buf_.data() + end_);
+            beg_ = end_;
+            return true;
+          }
+
+          end_ += std::size_t(n);
+        }
+      }
+
+      /**
+       * Reads the next line without reading ahead, so that the stream position stays at the following line
+       * (e.g., for index-bounded queries).
+       */
+      bool getline_unbuffered(std::istream& is, char*& line, char*& line_end)
+      {
+        clear();
+        if (is.peek() < 0 || !std::getline(is, line_str_))
+          return false;
+
+        line_str_.push_back('\0');
+        line = &line_str_[0];
+        line_end = terminate_vcf_line(line, line + line_str_.size() - 1);
+        return true;
+      }
+
+      /**
+       * Moves data that has been read from the stream but not yet returned as a line to the end of dest.
+       */
+      void take(std::vector<char>& dest)
+      {
+        dest.insert(dest.end(), buf_.begin() + beg_, buf_.begin() + end_);
+        clear();
+      }
+
+      /**
+       * Discards buffered data. Must be called after seeking the stream.
+       */
+      void clear()
+      {
+        beg_ = end_ = 0;
+      }
+    private:
+      std::vector<char> buf_;
+      std::string line_str_;
+      std::size_t beg_ = 0;
+      std::size_t end_ = 0;
+    };
+  }
+}
+
+#endif // LIBSAVVY_VCF_PARSER_HPP
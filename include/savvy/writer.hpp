@@ -15,7 +15,12 @@
 #include "compressed_vector.hpp"
 #include "region.hpp"
 #include "s1r.hpp"
+#include "csi.hpp"
 #include "pbwt.hpp"
+#include "parallel_obuf.hpp"
+#include "bgzf.hpp"
+#include "vcf_formatter.hpp"
+#include "block_stats.hpp"
 
 
 #include <shrinkwrap/zstd.hpp>
@@ -34,6 +39,7 @@
 #include <list>
 #include <cstdint>
 #include <type_traits>
+#include <deque>
 
 namespace savvy
 {
@@ -59,6 +65,8 @@ namespace savvy
     {
     public:
       static const int default_compression_level = 3;
+      static const int default_bgzf_compression_level = 6;
+      static const std::uint8_t format_default_compression_level = 0xFF; ///< Selects default_compression_level for SAV and default_bgzf_compression_level for BCF and VCF
       static const int default_block_size = 4096;
     private:
       std::mt19937_64 rng_;
@@ -78,10 +86,47 @@ namespace savvy
       std::size_t record_count_in_block_ = 0;
       std::uint32_t current_block_min_ = std::numeric_limits<std::uint32_t>::max();
       std::uint32_t current_block_max_ = 0;
+
+      // Multi-threaded compression. File offsets of blocks are not known until they are compressed, so index entries are queued.
+      struct pending_index_entry
+      {
+        std::string chrom;
+        std::uint32_t min_pos;
+        std::uint32_t max_pos;
+        std::size_t record_count;
+        std::size_t block_idx;
+        block_statistics stats;
+      };
+      ::savvy::detail::parallel_obuf* parallel_buf_ = nullptr;
+      std::deque<pending_index_entry> pending_index_entries_;
+
+      // Optional per-block summary statistics, which are written to a skippable frame preceding the S1R index.
+      std::unique_ptr<block_statistics_index> block_stats_;
+      block_statistics current_block_stats_;
+
+      // CSI index for BGZF output. Records are added with offsets of the form (block index << 16 | offset in block),
+      // which are mapped to virtual offsets once every block has been written.
+      std::unique_ptr<csi_writer> csi_index_;
+
+      // VCF records are formatted into a reusable buffer and written with a single call.
+      struct vcf_format_field
+      {
+        const typed_value* value;
+        std::size_t stride;
+        char delim;
+        std::size_t zero_offset; // Position of formatted zero values in vcf_zero_sample_
+        std::size_t zero_size;
+        std::vector<std::size_t> sparse_indices;
+        std::size_t sparse_pos;
+      };
+      ::savvy::detail::vcf_text_buffer vcf_buf_;
+      std::vector<vcf_format_field> vcf_fields_;
+      std::string vcf_zero_sample_;
+      std::string vcf_zero_run_;
     private:
       static std::filebuf *create_std_filebuf(const std::string& file_path, std::ios::openmode mode);
 
-      static std::unique_ptr<std::streambuf> create_out_streambuf(const std::string& file_path, format file_format, std::uint8_t compression_level);
+      static std::unique_ptr<std::streambuf> create_out_streambuf(const std::string& file_path, format file_format, std::uint8_t compression_level, std::size_t num_threads);
 
     public:
       /**
@@ -90,10 +135,11 @@ namespace savvy
        * @param file_format Type of file to create (SAV, BCF, or VCF)
        * @param headers Meta-information lines for file header
        * @param ids Sample IDs for file
-       * @param compression_level Compression level (0 is no compression)
-       * @param custom_index_path Non-default path for index file (use /dev/null to disable indexing)
+       * @param compression_level Compression level (0 is no compression, BGZF levels are capped at 9, and format_default_compression_level picks the default for the file format)
+       * @param custom_index_path Non-default path for index file (use /dev/null to disable indexing; BCF and VCF output that is not a regular file is only indexed when this is set)
+       * @param num_threads Number of threads used to compress SAV or BGZF blocks (1 compresses SAV on calling thread)
        */
-      writer(const std::string& file_path, file::format file_format, std::vector<std::pair<std::string, std::string>> headers, const std::vector<std::string>& ids, std::uint8_t compression_level = default_compression_level, std::string custom_index_path = "");
+      writer(const std::string& file_path, file::format file_format, std::vector<std::pair<std::string, std::string>> headers, const std::vector<std::string>& ids, std::uint8_t compression_level = format_default_compression_level, std::string custom_index_path = "", std::size_t num_threads = 1);
 
       ~writer();
 
@@ -109,6 +155,23 @@ namespace savvy
        */
       void set_pbwt(const std::unordered_set<std::string>& pbwt_fields);
 
+      /**
+       * Sets minimum size of PBWT-encoded FORMAT vectors for which sorting is split across the library's
+       * shared thread pool.
+       * @param min_size Minimum vector size (number of haplotypes for GT); std::numeric_limits<std::size_t>::max() disables
+       */
+      void set_pbwt_parallel_threshold(std::size_t min_size);
+
+      /**
+       * Enables per-block summary statistics (record count, allele count histogram, allele frequency ranges and
+       * non-zero counts of FORMAT fields) for indexed SAV files. See block_statistics_index. Should be called
+       * before the first record is written. Requests for other outputs (VCF, BCF or SAV without an S1R index)
+       * are ignored and do not affect the stream state.
+       * @param enable Whether to store statistics
+       * @return False if statistics were requested but output is not an indexed SAV file
+       */
+      bool set_block_statistics(bool enable);
+
       /**
        * Checks for EOF or write error.
        *
@@ -134,10 +197,32 @@ namespace savvy
       std::streampos tellp() { return ofs_.tellp(); }
     private:
       writer& write_vcf(const variant& r);
+      void write_index_entry(std::uint64_t file_pos, const std::string& chrom, std::uint32_t min_pos, std::uint32_t max_pos, std::size_t record_count);
+      void end_index_block();
+      void write_pending_index_entries(bool wait);
+      std::uint64_t csi_offset() const { return std::uint64_t(parallel_buf_->block_index()) << 16u | parallel_buf_->block_fill(); }
+      void write_csi_entry(const site_info& r, std::uint64_t beg_off);
+      void write_csi_index();
       void write_header(std::vector<std::pair<std::string, std::string>>& headers, const std::vector<std::string>& ids);
 
       bool serialize_vcf_shared(const site_info& s);
       bool serialize_vcf_indiv(const variant& v, phasing phased);
+      void serialize_vcf_info_value(const typed_value& v);
+      void serialize_vcf_zero_run(std::size_t sample_count);
+
+      struct vcf_sparse_indices_fn
+      {
+        template <typename ValT, typename OffT>
+        void operator()(const ValT* p, const ValT* p_end, const OffT* off, std::vector<std::size_t>* dest)
+        {
+          std::size_t idx = 0;
+          for ( ; p != p_end; ++p, ++off)
+          {
+            idx += *off;
+            dest->push_back(idx++);
+          }
+        }
+      };
     };
 
 
@@ -152,14 +237,19 @@ namespace savvy
     }
 
     inline
-    std::unique_ptr<std::streambuf> writer::create_out_streambuf(const std::string& file_path, format file_fmt, std::uint8_t compression_level)
+    std::unique_ptr<std::streambuf> writer::create_out_streambuf(const std::string& file_path, format file_fmt, std::uint8_t compression_level, std::size_t num_threads)
     {
+      if (compression_level == format_default_compression_level)
+        compression_level = (file_fmt == format::sav2 || file_fmt == format::sav1) ? default_compression_level : default_bgzf_compression_level;
+
       if (compression_level > 0)
       {
-        if (file_fmt == format::sav2 || file_fmt == format::sav1)
+        if ((file_fmt == format::sav2 || file_fmt == format::sav1) && num_threads > 1)
+          return ::savvy::detail::make_unique<::savvy::detail::parallel_obuf>(file_path, ::savvy::detail::compress_zstd_frame, compression_level, num_threads);
+        else if (file_fmt == format::sav2 || file_fmt == format::sav1)
           return std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path, compression_level));
         else
-          return std::unique_ptr<std::streambuf>(new shrinkwrap::bgzf::obuf(file_path));  //, compression_level)); TODO: Add compression level
+          return ::savvy::detail::make_unique<::savvy::detail::parallel_bgzf_obuf>(file_path, compression_level, num_threads);
       }
       else
       {
@@ -168,9 +258,9 @@ namespace savvy
     }
 
     inline
-    writer::writer(const std::string& file_path, file::format file_format, std::vector<std::pair<std::string, std::string>> headers, const std::vector<std::string>& ids, std::uint8_t compression_level, std::string custom_index_path) :
+    writer::writer(const std::string& file_path, file::format file_format, std::vector<std::pair<std::string, std::string>> headers, const std::vector<std::string>& ids, std::uint8_t compression_level, std::string custom_index_path, std::size_t num_threads) :
       rng_(std::chrono::high_resolution_clock::now().time_since_epoch().count() ^ std::clock() ^ (std::uint64_t) this),
-      output_buf_(create_out_streambuf(file_path, file_format, compression_level)), //opts.compression == compression_type::zstd ? std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path)) : std::unique_ptr<std::streambuf>(new std::filebuf(file_path, std::ios::binary))),
+      output_buf_(create_out_streambuf(file_path, file_format, compression_level, num_threads)), //opts.compression == compression_type::zstd ? std::unique_ptr<std::streambuf>(new shrinkwrap::zstd::obuf(file_path)) : std::unique_ptr<std::streambuf>(new std::filebuf(file_path, std::ios::binary))),
       file_path_(file_path),
       //samples_(samples_beg, samples_end),
       index_path_(custom_index_path),
@@ -178,6 +268,7 @@ namespace savvy
     {
       file_format_ = file_format;
       uuid_ = ::savvy::detail::gen_uuid(rng_);
+      parallel_buf_ = dynamic_cast<::savvy::detail::parallel_obuf*>(output_buf_.get());
 
       if (file_format_ == format::sav1)
       {
@@ -212,43 +303,153 @@ namespace savvy
 
       write_header(headers, ids);
       ofs_.flush();
+
+      // The default index path only makes sense next to a regular file (not /dev/stdout, pipes, etc.).
+      if ((file_format_ == format::bcf || file_format_ == format::vcf) && dynamic_cast<::savvy::detail::parallel_bgzf_obuf*>(output_buf_.get()) && index_path_ != "/dev/null"
+        && (index_path_.size() || ::savvy::detail::is_regular_file(file_path_)))
+      {
+        std::uint64_t max_contig_length = 0;
+        for (auto it = headers.begin(); it != headers.end(); ++it)
+        {
+          if (it->first == "contig")
+            max_contig_length = std::max<std::uint64_t>(max_contig_length, std::strtoull(parse_header_sub_field(it->second, "length").c_str(), nullptr, 10));
+        }
+
+        // BCF records refer to contigs by header index, while VCF indices store contig names.
+        std::vector<std::string> contigs;
+        if (file_format_ == format::bcf)
+        {
+          for (auto it = dict_.entries[dictionary::contig].begin(); it != dict_.entries[dictionary::contig].end(); ++it)
+            contigs.emplace_back(it->id);
+        }
+
+        csi_index_ = ::savvy::detail::make_unique<csi_writer>(contigs, max_contig_length ? max_contig_length : std::numeric_limits<std::uint32_t>::max());
+      }
     }
 
     inline
     writer::~writer()
     {
+      if (csi_index_)
+        write_csi_index();
+
       // TODO: This is only a temp solution.
       if (index_file_)
       {
         if (record_count_in_block_)
+          end_index_block();
+
+        ofs_.flush();
+        write_pending_index_entries(true);
+        auto idx_fs = index_file_->close();
+
+        if (index_path_.empty() || block_stats_)
         {
-          auto file_pos = std::uint64_t(ofs_.tellp());
-          if (record_count_in_block_ > 0x10000) // Max records per block: 64*1024
+          std::fstream ofs(file_path_, std::ios::out | std::ios::binary | std::ios::app); // TODO: THIS SEEMS DANGEROUS. Store FILE* when creating zstd stream and use instead of opening new descriptor.
+          if (block_stats_ && !block_stats_->write(ofs)) // Statistics frame precedes S1R index, which must end the file.
           {
-            assert(!"Too many records in zstd frame to be indexed!");
+            ofs_.setstate(ofs_.rdstate() | std::ios::badbit);
+            std::cerr << "Error: block statistics too big for skippable zstd frame" << std::endl;
           }
 
-          if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
+          if (index_path_.empty() && !::savvy::detail::append_skippable_zstd_frame(idx_fs, ofs)) // append if custom index path was not provided
           {
-            assert(!"File size to large to be indexed!");
+            ofs_.setstate(ofs_.rdstate() | std::ios::badbit); // TODO: Use linkat or send file (see https://stackoverflow.com/a/25154505/1034772)
+            std::cerr << "Error: index file too big for skippable zstd frame" << std::endl;
           }
+        }
+      }
+    }
+
+    inline
+    void writer::write_index_entry(std::uint64_t file_pos, const std::string& chrom, std::uint32_t min_pos, std::uint32_t max_pos, std::size_t record_count)
+    {
+      if (record_count > 0x10000) // Max records per block: 64*1024
+      {
+        assert(!"Too many records in zstd frame to be indexed!");
+        ofs_.setstate(std::ios::badbit);
+      }
+
+      if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
+      {
+        assert(!"File size too large to be indexed!");
+        ofs_.setstate(std::ios::badbit);
+      }
+
+      s1r::entry e(min_pos, max_pos, (file_pos << 16) | std::uint16_t(record_count - 1));
+      index_file_->write(chrom, e);
+    }
+
+    inline
+    void writer::write_csi_entry(const site_info& r, std::uint64_t beg_off)
+    {
+      std::int64_t beg = std::int64_t(r.pos()) - 1;
+      std::int64_t end = beg + std::int64_t(r.ref().size());
+      std::int64_t info_end = 0;
+      if (r.get_info("END", info_end))
+        end = std::max(end, info_end);
+
+      csi_index_->push(r.chrom(), beg, end, beg_off, csi_offset());
+    }
+
+    inline
+    void writer::write_csi_index()
+    {
+      ofs_.flush();
+      if (!parallel_buf_->drain())
+        return;
+
+      std::uint64_t eof_pos = std::uint64_t(ofs_.tellp()) >> 16u;
+      std::string idx_path = index_path_.size() ? index_path_ : file_path_ + ".csi";
+      bool res = csi_index_->write(idx_path, [this, eof_pos](std::uint64_t off)
+      {
+        std::uint64_t file_pos = eof_pos; // Offset at end of last block points to EOF marker.
+        parallel_buf_->block_offset(off >> 16u, file_pos);
+        return file_pos << 16u | (off & 0xFFFFu);
+      });
+
+      if (!res && csi_index_->good())
+        std::fprintf(stderr, "Error: failed to write CSI index (%s)\n", idx_path.c_str());
+    }
 
-          s1r::entry e(current_block_min_, current_block_max_, (file_pos << 16) | std::uint16_t(record_count_in_block_ - 1));
-          index_file_->write(current_chromosome_, e);
+    inline
+    void writer::end_index_block()
+    {
+      if (parallel_buf_)
+      {
+        pending_index_entries_.push_back({current_chromosome_, current_block_min_, current_block_max_, record_count_in_block_, parallel_buf_->block_index(), block_statistics()});
+        if (block_stats_)
+          std::swap(pending_index_entries_.back().stats, current_block_stats_);
+      }
+      else
+      {
+        std::uint64_t file_pos = std::uint64_t(ofs_.tellp());
+        write_index_entry(file_pos, current_chromosome_, current_block_min_, current_block_max_, record_count_in_block_);
+        if (block_stats_)
+        {
+          current_block_stats_.file_pos = file_pos;
+          block_stats_->push_back(std::move(current_block_stats_));
         }
+      }
+    }
 
-        ofs_.flush();
-        auto idx_fs = index_file_->close();
+    inline
+    void writer::write_pending_index_entries(bool wait)
+    {
+      if (parallel_buf_ && wait && !parallel_buf_->drain())
+        ofs_.setstate(ofs_.rdstate() | std::ios::badbit);
 
-        if (index_path_.empty()) // append if custom index path was not provided
+      std::uint64_t file_pos = 0;
+      while (pending_index_entries_.size() && parallel_buf_->block_offset(pending_index_entries_.front().block_idx, file_pos))
+      {
+        pending_index_entry& p = pending_index_entries_.front();
+        write_index_entry(file_pos, p.chrom, p.min_pos, p.max_pos, p.record_count);
+        if (block_stats_)
         {
-          std::fstream ofs(file_path_, std::ios::out | std::ios::binary | std::ios::app); // TODO: THIS SEEMS DANGEROUS. Store FILE* when creating zstd stream and use instead of opening new descriptor.
-          if (!::savvy::detail::append_skippable_zstd_frame(idx_fs, ofs))
-          {
-            ofs_.setstate(ofs_.rdstate() | std::ios::badbit); // TODO: Use linkat or send file (see https://stackoverflow.com/a/25154505/1034772)
-            std::cerr << "Error: index file too big for skippable zstd frame" << std::endl;
-          }
+          p.stats.file_pos = file_pos;
+          block_stats_->push_back(std::move(p.stats));
         }
+        pending_index_entries_.pop_front();
       }
     }
 
@@ -266,11 +467,43 @@ namespace savvy
       // TODO: potentially set failbit if not sav2.
     }
 
+    inline
+    void writer::set_pbwt_parallel_threshold(std::size_t min_size)
+    {
+      sort_context_.parallel_threshold = min_size;
+    }
+
+    inline
+    bool writer::set_block_statistics(bool enable)
+    {
+      if (!enable)
+      {
+        block_stats_.reset();
+        return true;
+      }
+
+      if (!index_file_)
+        return false;
+
+      if (!block_stats_)
+        block_stats_ = ::savvy::detail::make_unique<block_statistics_index>();
+      return true;
+    }
+
     inline
     writer& writer::write_vcf(const variant& r)
     {
       if (!serialize_vcf_shared(r) || !serialize_vcf_indiv(r, phasing_))
+      {
         ofs_.setstate(ofs_.rdstate() | std::ios::badbit);
+      }
+      else
+      {
+        std::uint64_t beg_off = csi_index_ ? csi_offset() : 0;
+        ofs_.write(vcf_buf_.data(), vcf_buf_.size());
+        if (csi_index_)
+          write_csi_entry(r, beg_off);
+      }
 
       return *this;
     }
@@ -287,28 +520,15 @@ namespace savvy
       if (block_size_ != 0 && file_format_ == format::sav2 && (block_size_ <= record_count_in_block_ || r.chrom() != current_chromosome_)) // TODO: this needs to be fixed to support variable block size
       {
         if (index_file_ && record_count_in_block_)
-        {
-          auto file_pos = std::uint64_t(ofs_.tellp());
-          if (record_count_in_block_ > 0x10000) // Max records per block: 64*1024
-          {
-            assert(!"Too many records in zstd frame to be indexed!");
-            ofs_.setstate(std::ios::badbit);
-          }
-
-          if (file_pos > 0x0000FFFFFFFFFFFF) // Max file size: 256 TiB
-          {
-            assert(!"File size too large to be indexed!");
-            ofs_.setstate(std::ios::badbit);
-          }
-
-          s1r::entry e(current_block_min_, current_block_max_, (file_pos << 16) | std::uint16_t(record_count_in_block_ - 1));
-          index_file_->write(current_chromosome_, e);
-        }
+          end_index_block();
         ofs_.flush();
+        if (index_file_)
+          write_pending_index_entries(false);
         current_chromosome_ = r.chrom();
         record_count_in_block_ = 0;
         current_block_min_ = std::numeric_limits<std::uint32_t>::max();
         current_block_max_ = 0;
+        current_block_stats_ = block_statistics();
 
         sort_context_.reset();
         flushed = true;
@@ -400,9 +620,12 @@ namespace savvy
         indiv_sz = endianness::swap(indiv_sz);
       }
 
+      std::uint64_t beg_off = csi_index_ ? csi_offset() : 0;
       ofs_.write((char *) &shared_sz, sizeof(shared_sz));
       ofs_.write((char *) &indiv_sz, sizeof(indiv_sz));
       ofs_.write(serialized_buf_.data(), serialized_buf_.size());
+      if (csi_index_)
+        write_csi_entry(r, beg_off);
 
       current_block_min_ = std::min(current_block_min_, std::uint32_t(r.pos()));
       std::size_t max_alt_size = 0;
@@ -411,6 +634,8 @@ namespace savvy
       current_block_max_ = std::max(current_block_max_, std::uint32_t(r.pos() + std::max(r.ref().size(), max_alt_size)) - 1);
       ++record_count_in_block_;
       ++record_count_;
+      if (block_stats_)
+        block_stats_->add_record(current_block_stats_, r);
 
 
       return *this;
@@ -519,142 +744,263 @@ namespace savvy
     inline
     bool writer::serialize_vcf_shared(const site_info& s)
     {
-      (ofs_) << s.chrom_
-        << "\t" << s.pos_
-        << "\t" << std::string(s.id_.size() ? s.id_ : ".")
-        << "\t" << s.ref_;
+      using ::savvy::detail::max_vcf_number_width;
+
+      vcf_buf_.clear();
+      vcf_buf_.append(s.chrom_.data(), s.chrom_.size());
+      vcf_buf_.put('\t');
+      vcf_buf_.commit(::savvy::detail::format_vcf_int(vcf_buf_.reserve(max_vcf_number_width), s.pos_));
+      vcf_buf_.put('\t');
+      if (s.id_.size())
+        vcf_buf_.append(s.id_.data(), s.id_.size());
+      else
+        vcf_buf_.put('.');
+      vcf_buf_.put('\t');
+      vcf_buf_.append(s.ref_.data(), s.ref_.size());
 
+      vcf_buf_.put('\t');
       if (s.alts_.empty())
+        vcf_buf_.put('.');
+      for (auto it = s.alts_.begin(); it != s.alts_.end(); ++it)
       {
-        ofs_ << "\t.";
-      }
-      else
-      {
-        ofs_ << "\t" << s.alts_.front();
-        for (auto it = s.alts_.begin() + 1; it != s.alts_.end(); ++it)
-          ofs_ << "," << *it;
+        if (it != s.alts_.begin())
+          vcf_buf_.put(',');
+        vcf_buf_.append(it->data(), it->size());
       }
 
+      vcf_buf_.put('\t');
       if (std::isnan(s.qual_))
-        ofs_ << "\t.";
+        vcf_buf_.put('.');
       else
-        ofs_ << "\t" << s.qual_;
+        vcf_buf_.commit(::savvy::detail::format_vcf_float(vcf_buf_.reserve(max_vcf_number_width), s.qual_));
 
+      vcf_buf_.put('\t');
       if (s.filters_.empty())
+        vcf_buf_.put('.');
+      for (auto it = s.filters_.begin(); it != s.filters_.end(); ++it)
       {
-        ofs_ << "\t.";
+        if (it != s.filters_.begin())
+          vcf_buf_.put(';');
+        vcf_buf_.append(it->data(), it->size());
       }
-      else
+
+      vcf_buf_.put('\t');
+      if (s.info_.empty())
+        vcf_buf_.put('.');
+      for (auto it = s.info_.begin(); it != s.info_.end(); ++it)
       {
-        ofs_ << "\t" << s.filters_.front();
-        for (auto it = s.filters_.begin() + 1; it != s.filters_.end(); ++it)
-          ofs_ << ";" << *it;
+        if (it != s.info_.begin())
+          vcf_buf_.put(';');
+        vcf_buf_.append(it->first.data(), it->first.size());
+
+        auto hdr_detail_it = info_headers_map_.find(it->first);
+        if (hdr_detail_it == info_headers_map_.end() || hdr_detail_it->second.get().type != "Flag")
+        {
+          vcf_buf_.put('=');
+          serialize_vcf_info_value(it->second);
+        }
       }
 
-      if (s.info_.empty())
+      return true;
+    }
+
+    inline
+    void writer::serialize_vcf_info_value(const typed_value& v)
+    {
+      // Same output as operator<<(std::ostream&, const typed_value&).
+      if (!v.val_ptr_ || v.size_ == 0)
+      {
+        vcf_buf_.put('.');
+      }
+      else if (v.val_type_ == typed_value::str)
       {
-        ofs_ << "\t.";
+        vcf_buf_.append(v.val_ptr_, v.size_);
       }
       else
       {
-        auto hdr_detail_it = info_headers_map_.find(s.info_.front().first);
-        if (hdr_detail_it != info_headers_map_.end() && hdr_detail_it->second.get().type == "Flag")
-          ofs_ << "\t" << s.info_.front().first;
-        else
-          ofs_ << "\t" << s.info_.front().first << "=" << s.info_.front().second;
-        for (auto it = s.info_.begin() + 1; it != s.info_.end(); ++it)
+        char* p = vcf_buf_.reserve(v.size_ * (::savvy::detail::max_vcf_number_width + 1));
+        for (std::size_t i = 0; i < v.size_; ++i)
         {
-          auto hdr_detail_it = info_headers_map_.find(it->first);
-          if (hdr_detail_it != info_headers_map_.end() && hdr_detail_it->second.get().type == "Flag")
-            ofs_ << ";" << it->first;
-          else
-            ofs_ << ";" << it->first << "=" << it->second;
+          if (i > 0)
+            *(p++) = ',';
+          switch (v.val_type_)
+          {
+          case 0x01u: p = ::savvy::detail::format_vcf_int(p, ((const std::int8_t*)v.val_ptr_)[i]); break;
+          case 0x02u: p = ::savvy::detail::format_vcf_int(p, ((const std::int16_t*)v.val_ptr_)[i]); break; // TODO: handle endianess
+          case 0x03u: p = ::savvy::detail::format_vcf_int(p, ((const std::int32_t*)v.val_ptr_)[i]); break;
+          case 0x04u: p = ::savvy::detail::format_vcf_int(p, ((const std::int64_t*)v.val_ptr_)[i]); break;
+          case 0x05u: p = ::savvy::detail::format_vcf_float(p, ((const float*)v.val_ptr_)[i]); break;
+          }
         }
+        vcf_buf_.commit(p);
+      }
+    }
+
+    inline
+    void writer::serialize_vcf_zero_run(std::size_t sample_count)
+    {
+      // Samples without non-zero values in any field are copied from a block of repeated zero patterns.
+      // Each sample has a single tab, so the block is reused if its first sample matches.
+      const std::size_t pattern_size = vcf_zero_sample_.size();
+      if (vcf_zero_run_.size() < pattern_size || vcf_zero_run_.compare(0, pattern_size, vcf_zero_sample_) != 0 || (vcf_zero_run_.size() > pattern_size && vcf_zero_run_[pattern_size] != '\t'))
+      {
+        vcf_zero_run_.clear();
+        for (std::size_t i = 0; i < std::max<std::size_t>(1, 4096 / pattern_size); ++i)
+          vcf_zero_run_ += vcf_zero_sample_;
       }
 
-      return ofs_.good();
+      const std::size_t samples_per_copy = vcf_zero_run_.size() / pattern_size;
+      char* p = vcf_buf_.reserve(sample_count * pattern_size);
+      while (sample_count)
+      {
+        std::size_t n = std::min(sample_count, samples_per_copy);
+        std::memcpy(p, vcf_zero_run_.data(), n * pattern_size);
+        p += n * pattern_size;
+        sample_count -= n;
+      }
+      vcf_buf_.commit(p);
     }
 
     inline
     bool writer::serialize_vcf_indiv(const savvy::variant& v, phasing phased)
     {
-      std::vector<const typed_value*> typed_value_ptrs(v.format_fields_.size());
-      std::vector<std::size_t> strides(v.format_fields_.size());
-      std::vector<char> delims(v.format_fields_.size());
-      std::list<typed_value> dense_copies;
-      std::int8_t* ph_ptr = nullptr;
+      v.decode_format();
+
+      const std::int8_t* ph_ptr = nullptr;
+      std::size_t n_fields = 0;
+      std::size_t max_sample_size = 0;
+      bool all_sparse = true;
+      vcf_fields_.resize(v.format_fields_.size());
+      vcf_zero_sample_.assign(1, '\t');
       for (std::size_t i = 0; i < v.format_fields_.size(); ++i)
       {
         assert(n_samples_); // TODO
+        const typed_value& val = v.format_fields_[i].second;
 
         if (v.format_fields_[i].first == "PH")
         {
           assert(i == 1); // TODO: return error
-          ph_ptr = (std::int8_t*)v.format_fields_[i].second.val_ptr_;
+          ph_ptr = (const std::int8_t*)val.val_ptr_;
           continue;
         }
 
-        ofs_ << (i == 0 ? "\t" : ":") << v.format_fields_[i].first;
+        if (val.val_type_ < typed_value::int8 || val.val_type_ > typed_value::str || val.val_type_ == 0x06u)
+          return false;
 
-        strides[i] = (n_samples_ ? v.format_fields_[i].second.size() / n_samples_ : 0);
+        vcf_buf_.put(i == 0 ? '\t' : ':');
+        vcf_buf_.append(v.format_fields_[i].first.data(), v.format_fields_[i].first.size());
 
-        if (v.format_fields_[i].first == "GT")
-          delims[i] = (phased == phasing::phased ? '|' : '/');
-        else
-          delims[i] = ',';
+        vcf_format_field& f = vcf_fields_[n_fields++];
+        f.value = &val;
+        f.stride = (n_samples_ ? val.size() / n_samples_ : 0);
+        f.delim = v.format_fields_[i].first == "GT" ? (phased == phasing::phased ? '|' : '/') : ',';
+        f.sparse_indices.clear();
+        f.sparse_pos = 0;
 
-        if (v.format_fields_[i].second.is_sparse())
+        if (val.is_sparse())
         {
-          dense_copies.emplace_back();
-          v.format_fields_[i].second.copy_as_dense(dense_copies.back());
-          typed_value_ptrs[i] = &dense_copies.back();
+          if (val.non_zero_size() && !val.capply_sparse(vcf_sparse_indices_fn(), &f.sparse_indices))
+            return false;
         }
         else
         {
-          typed_value_ptrs[i] = &v.format_fields_[i].second;
+          all_sparse = false;
         }
-      }
 
+        // Zero values are skipped for strings, just like when densified.
+        if (n_fields > 1)
+          vcf_zero_sample_ += ':';
+        f.zero_offset = vcf_zero_sample_.size();
+        for (std::size_t k = 0; k < f.stride && val.val_type_ != typed_value::str; ++k)
+        {
+          if (k > 0)
+            vcf_zero_sample_ += f.delim;
+          vcf_zero_sample_ += '0';
+        }
+        f.zero_size = vcf_zero_sample_.size() - f.zero_offset;
+
+        max_sample_size += 1 + f.stride * (val.val_type_ == typed_value::str ? 1 : ::savvy::detail::max_vcf_number_width + 1);
+      }
 
-      if (ph_ptr)
+      const char* allele_chars = ::savvy::detail::vcf_allele_chars();
+      const std::size_t ph_stride = n_fields && vcf_fields_[0].stride ? vcf_fields_[0].stride - 1 : 0;
+      for (std::size_t i = 0; i < n_samples_ && n_fields; )
       {
-        std::size_t ph_stride = strides[0] - 1;
-        for (std::size_t i = 0; i < n_samples_; ++i)
+        if (all_sparse && !ph_ptr)
         {
-          ofs_.put('\t');
-          for (std::size_t k = 0; k < strides[0]; ++k)
+          std::size_t next_non_zero = n_samples_;
+          for (std::size_t j = 0; j < n_fields; ++j)
           {
-            typed_value_ptrs[0]->serialize_vcf(i * strides[0] + k, ofs_, k > 0 ? (ph_ptr[i * ph_stride + k - 1] ? '|' : '/') : '\0'); // TODO: allow for PH
+            const vcf_format_field& f = vcf_fields_[j];
+            if (f.stride && f.sparse_pos < f.sparse_indices.size())
+              next_non_zero = std::min(next_non_zero, f.sparse_indices[f.sparse_pos] / f.stride);
           }
 
-          for (std::size_t j = 2; j < v.format_fields_.size(); ++j)
+          if (next_non_zero > i)
           {
-            ofs_.put(':');
-            for (std::size_t k = 0; k < strides[j]; ++k)
-            {
-              typed_value_ptrs[j]->serialize_vcf(i * strides[j] + k, ofs_, k > 0 ? delims[j] : '\0');
-            }
+            serialize_vcf_zero_run(next_non_zero - i);
+            i = next_non_zero;
+            continue;
           }
         }
-      }
-      else
-      {
-        for (std::size_t i = 0; i < n_samples_; ++i)
+
+        char* p = vcf_buf_.reserve(max_sample_size);
+        for (std::size_t j = 0; j < n_fields; ++j)
         {
-          for (std::size_t j = 0; j < v.format_fields_.size(); ++j)
+          vcf_format_field& f = vcf_fields_[j];
+          const typed_value& val = *f.value;
+          const bool ph_delims = ph_ptr && j == 0;
+          const std::size_t idx = i * f.stride;
+          *(p++) = j > 0 ? ':' : '\t';
+
+          if (val.is_sparse())
+          {
+            if (!ph_delims && (f.sparse_pos == f.sparse_indices.size() || f.sparse_indices[f.sparse_pos] >= idx + f.stride))
+            {
+              std::memcpy(p, vcf_zero_sample_.data() + f.zero_offset, f.zero_size);
+              p += f.zero_size;
+              continue;
+            }
+
+            for (std::size_t k = 0; k < f.stride; ++k)
+            {
+              char delim = k == 0 ? '\0' : (ph_delims ? (ph_ptr[i * ph_stride + k - 1] ? '|' : '/') : f.delim);
+              if (f.sparse_pos < f.sparse_indices.size() && f.sparse_indices[f.sparse_pos] == idx + k)
+                p = typed_value::serialize_vcf_value(val.val_type_, val.val_ptr_, f.sparse_pos++, p, delim);
+              else if (val.val_type_ != typed_value::str)
+                p = typed_value::serialize_vcf_number(std::int8_t(0), p, delim);
+            }
+          }
+          else
           {
-            ofs_.put(j > 0 ? ':' : '\t');
-            for (std::size_t k = 0; k < strides[j]; ++k)
+            if (f.stride == 2 && val.val_type_ == typed_value::int8 && !ph_delims)
             {
-              typed_value_ptrs[j]->serialize_vcf(i * strides[j] + k, ofs_, k > 0 ? delims[j] : '\0'); // TODO: allow for PH
+              char a = allele_chars[std::uint8_t(val.val_ptr_[idx])];
+              char b = allele_chars[std::uint8_t(val.val_ptr_[idx + 1])];
+              if (a && b)
+              {
+                p[0] = a;
+                p[1] = f.delim;
+                p[2] = b;
+                p += 3;
+                continue;
+              }
+            }
+
+            for (std::size_t k = 0; k < f.stride; ++k)
+            {
+              char delim = k == 0 ? '\0' : (ph_delims ? (ph_ptr[i * ph_stride + k - 1] ? '|' : '/') : f.delim);
+              p = val.serialize_vcf(idx + k, p, delim); // TODO: allow for PH
             }
           }
         }
+        vcf_buf_.commit(p);
+        ++i;
       }
 
-      ofs_.put('\n');
+      vcf_buf_.put('\n');
 
-      return ofs_.good();
+      return true;
     }
     //================================================================//
 
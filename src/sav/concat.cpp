@@ -13,6 +13,22 @@
 #include <fstream>
 #include <getopt.h>
 #include <vector>
+#include <memory>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <iterator>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <zstd.h>
 
 class concat_prog_args
 {
@@ -22,6 +38,7 @@ private:
   std::vector<std::string> input_paths_;
   std::string output_path_;
   std::string sample_ids_path_;
+  int compression_level_ = -1;
   bool help_ = false;
 public:
   concat_prog_args() :
@@ -38,6 +55,7 @@ public:
   const std::vector<std::string>& input_paths() const { return input_paths_; }
   const std::string& output_path() const { return output_path_; }
   const std::string& sample_ids_path() const { return sample_ids_path_; }
+  std::uint8_t compression_level() const { return std::uint8_t(compression_level_); }
 
   bool help_is_set() const { return help_; }
 
@@ -45,6 +63,7 @@ public:
   {
     os << "Usage: sav concat [opts ...] <first.sav> <second.sav> [addl_files.sav ...] \n";
     os << "\n";
+    os << " -#                     Number (#) of compression level used for blocks that are recompressed (1-19; default: " << savvy::writer::default_compression_level << ")\n";
     os << " -h, --help             Print usage\n";
     os << " -o, --out              Output file (default: /dev/stdout)\n";
     os << std::flush;
@@ -54,11 +73,26 @@ public:
   {
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "ho:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "0123456789ho:", long_options_.data(), &long_index )) != -1)
     {
       char copt = char(opt & 0xFF);
       switch (copt)
       {
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        if (compression_level_ < 0)
+          compression_level_ = 0;
+        compression_level_ *= 10;
+        compression_level_ += copt - '0';
+        break;
       case 'h':
         help_ = true;
         return true;
@@ -87,104 +121,599 @@ public:
     if (output_path_.empty())
       output_path_ = "/dev/stdout";
 
+    // Remapped blocks must remain zstd frames, so level 0 (no compression) is not allowed.
+    if (compression_level_ < 0)
+      compression_level_ = savvy::writer::default_compression_level;
+    else if (compression_level_ < 1)
+      compression_level_ = 1;
+    else if (compression_level_ > 19)
+      compression_level_ = 19;
+
     return true;
   }
 };
 
 
+/**
+ * Header, data boundaries and index of an input file, loaded up front so that every input can be validated
+ * before output is written.
+ */
+struct concat_input
+{
+  savvy::dictionary dict;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::vector<std::string> samples;
+  std::vector<std::pair<std::string, std::vector<savvy::s1r::entry>>> trees;
+  std::uint64_t data_beg = 0; // End of header
+  std::uint64_t data_end = 0; // Beginning of block statistics or index frame, or end of file if not indexed
+  savvy::block_statistics_index block_stats;
+  bool indexed = false;
+  bool has_block_stats = false;
+  int fd = -1;
+  std::string error;
+
+  concat_input() = default;
+  concat_input(const concat_input&) = delete;
+  concat_input& operator=(const concat_input&) = delete;
+  ~concat_input()
+  {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
 
+static bool load_concat_input(const std::string& path, concat_input& input)
+{
+  {
+    savvy::reader sav_reader(path);
+    if (!sav_reader)
+    {
+      input.error = "Error: could not open input SAV file (" + path + ")";
+      return false;
+    }
 
-int concat_main(int argc, char **argv)
+    if (sav_reader.file_format() != savvy::file::format::sav2)
+    {
+      input.error = "Error: " + path + " is not a SAV v2 file";
+      return false;
+    }
+
+    input.dict = sav_reader.dictionary();
+    input.headers = sav_reader.headers();
+    input.samples = sav_reader.samples();
+    input.data_beg = std::uint64_t(sav_reader.tellg());
+  }
+
+  struct stat st;
+  input.fd = ::open(path.c_str(), O_RDONLY);
+  if (input.fd < 0 || ::fstat(input.fd, &st) != 0)
+  {
+    input.error = "Error: could not open input SAV file (" + path + ")";
+    return false;
+  }
+  input.data_end = std::uint64_t(st.st_size);
+
+  savvy::s1r::reader idx(path);
+  std::int64_t idx_off = idx.file_offset(); // If index doesn't exist at end of file, then idx.file_offset() is equal to 0.
+  if (!idx.good() || idx_off == 0)
+    return true;
+
+  if (idx_off < 8 || std::uint64_t(idx_off - 8) < input.data_beg)
+  {
+    input.error = "Error: index is out of bounds, so " + path + " is likely corrupted";
+    return false;
+  }
+  input.data_end = std::uint64_t(idx_off - 8);
+  input.indexed = true;
+
+  // Test that index is preceded by a skippable frame header with matching size.
+  std::array<char, 8> frame_header;
+  std::uint32_t index_file_size_le = 0;
+  if (::pread(input.fd, frame_header.data(), frame_header.size(), off_t(input.data_end)) != ssize_t(frame_header.size()) || std::string(frame_header.data(), 4) != "\x50\x2A\x4D\x18")
+  {
+    input.error = "Error: boundary not at skippable frame, so " + path + " is likely corrupted";
+    return false;
+  }
+
+  std::memcpy(&index_file_size_le, frame_header.data() + 4, 4);
+  if (le32toh(index_file_size_le) != idx.size_on_disk())
+  {
+    input.error = "Error: skippable frame size does not match index size, so " + path + " is likely corrupted";
+    return false;
+  }
+
+  // Block statistics are stored in a frame between the records and the index.
+  if (input.block_stats.load(path))
+  {
+    if (input.block_stats.frame_offset() < input.data_beg)
+    {
+      input.error = "Error: block statistics are out of bounds, so " + path + " is likely corrupted";
+      return false;
+    }
+    input.data_end = input.block_stats.frame_offset();
+    input.has_block_stats = true;
+  }
+
+  for (auto it = idx.trees_begin(); it != idx.trees_end(); ++it)
+  {
+    input.trees.emplace_back(it->name(), std::vector<savvy::s1r::entry>());
+    for (auto jt = it->leaf_begin(); jt != it->leaf_end(); ++jt)
+    {
+      std::uint64_t file_pos = jt->value() >> 16u;
+      if (file_pos < input.data_beg || file_pos >= input.data_end || (input.trees.size() == 1 && input.trees.back().second.empty() && file_pos != input.data_beg))
+      {
+        input.error = "Error: index entry does not point to a block, so " + path + " is likely corrupted";
+        return false;
+      }
+      input.trees.back().second.push_back(*jt);
+    }
+  }
+
+  return true;
+}
+
+static bool write_all(int fd, const char* data, std::size_t size)
 {
-  concat_prog_args args;
-  if (!args.parse(argc, argv))
+  while (size > 0)
   {
-    args.print_usage(std::cerr);
-    return EXIT_FAILURE;
+    ssize_t w = ::write(fd, data, size);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return false;
+    data += w;
+    size -= std::size_t(w);
   }
+  return true;
+}
 
-  if (args.help_is_set())
+/**
+ * Copies size bytes of in_fd starting at offset to the current position of out_fd. Data is moved within the
+ * kernel by copy_file_range() or sendfile() when the file systems support it and otherwise through a large
+ * aligned buffer.
+ */
+static bool copy_file_region(int in_fd, std::uint64_t offset, std::uint64_t size, int out_fd)
+{
+  const std::uint64_t max_chunk_size = 1u << 30u;
+#ifdef __linux__
+  off_t in_off = off_t(offset);
+  while (size > 0)
   {
-    args.print_usage(std::cout);
-    return EXIT_SUCCESS;
+    ssize_t n = ::copy_file_range(in_fd, &in_off, out_fd, nullptr, std::size_t(std::min(size, max_chunk_size)), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break; // Not supported between these files (e.g., output is a pipe), so try sendfile().
+    size -= std::uint64_t(n);
   }
 
-  savvy::dictionary dict;
-  std::vector<std::string> samples;
+  while (size > 0)
+  {
+    ssize_t n = ::sendfile(out_fd, in_fd, &in_off, std::size_t(std::min(size, max_chunk_size)));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    size -= std::uint64_t(n);
+  }
+  offset = std::uint64_t(in_off);
+#endif
 
-  std::vector<std::pair<std::string,std::string>> headers;
-  //std::vector<std::pair<std::string,std::string>> merged_headers;
-  //std::set<std::string> info_fields;
-  //std::set<std::string> unique_headers;
+  if (size == 0)
+    return true;
 
-  std::vector<std::size_t> variant_offsets;
-  variant_offsets.reserve(args.input_paths().size());
+  const std::size_t buf_size = 4u << 20u;
+  void* p = nullptr;
+  if (::posix_memalign(&p, 4096, buf_size) != 0)
+    return false;
+  std::unique_ptr<char, decltype(&std::free)> buf((char*)p, &std::free);
 
-  for (auto it = args.input_paths().begin(); it != args.input_paths().end(); ++it)
+  while (size > 0)
   {
-    savvy::reader sav_reader(*it);
+    ssize_t n = ::pread(in_fd, buf.get(), std::size_t(std::min<std::uint64_t>(size, buf_size)), off_t(offset));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0 || !write_all(out_fd, buf.get(), std::size_t(n)))
+      return false;
 
-    if (!sav_reader)
+    offset += std::uint64_t(n);
+    size -= std::uint64_t(n);
+  }
+
+  return true;
+}
+
+/**
+ * Maps dictionary IDs of an input file to IDs of the output file. Placeholder entries map to -1.
+ */
+class dictionary_remap
+{
+public:
+  std::array<std::vector<std::int32_t>, 2> ids; // Indexed by savvy::dictionary::id and savvy::dictionary::contig
+
+  bool init(const savvy::dictionary& src, const savvy::dictionary& dest)
+  {
+    for (std::uint8_t which : {savvy::dictionary::id, savvy::dictionary::contig})
     {
-      std::cerr << "Error: could not open input SAV file (" << (*it) << ")\n";
-      return EXIT_FAILURE;
+      ids[which].assign(src.entries[which].size(), -1);
+      for (std::size_t i = 0; i < src.entries[which].size(); ++i)
+      {
+        auto res = dest.str_to_int[which].find(src.entries[which][i].id);
+        if (res != dest.str_to_int[which].end())
+          ids[which][i] = std::int32_t(res->second);
+        else if (src.entries[which][i].id != "DELETED")
+          return false;
+      }
     }
+    return true;
+  }
 
-    if (sav_reader.file_format() != savvy::file::format::sav2)
+  bool identity() const
+  {
+    for (auto it = ids.begin(); it != ids.end(); ++it)
     {
-      std::cerr << "Error: " << (*it) << " is not a SAV v2 file\n";
-      return EXIT_FAILURE;
+      for (std::size_t i = 0; i < it->size(); ++i)
+      {
+        if ((*it)[i] >= 0 && (*it)[i] != std::int32_t(i))
+          return false;
+      }
     }
+    return true;
+  }
+
+  std::int32_t operator()(std::uint8_t which, std::int64_t id) const
+  {
+    if (id < 0 || std::uint64_t(id) >= ids[which].size() || ids[which][id] < 0)
+      throw std::runtime_error("Invalid dictionary id");
+    return ids[which][id];
+  }
+};
+
+/**
+ * Gets the number of bytes used by the data of a serialized typed value, which starts at p.
+ * @param p Set to end of type descriptor
+ * @param sparse_allowed True for FORMAT values, where type 0 marks a sparse vector
+ */
+static std::size_t typed_value_data_size(const char*& p, const char* end, bool sparse_allowed)
+{
+  if (p == end)
+    throw std::runtime_error("Invalid byte sequence");
 
-    if (it == args.input_paths().begin())
+  std::uint8_t type_byte = std::uint8_t(*(p++));
+  std::uint8_t type = type_byte & (sparse_allowed ? 0x07u : 0x0Fu); // 0x08 is the PBWT flag for FORMAT values.
+  std::size_t sz = type_byte >> 4u;
+  if (sz == 15u)
+    p = savvy::bcf::deserialize_int(p, end, sz);
+
+  if (sparse_allowed && type == savvy::typed_value::sparse)
+  {
+    if (p == end)
+      throw std::runtime_error("Invalid byte sequence");
+    std::uint8_t sp_type_byte = std::uint8_t(*(p++));
+    std::size_t sp_sz = 0;
+    p = savvy::bcf::deserialize_int(p, end, sp_sz);
+    return sp_sz * ((1u << savvy::bcf_type_shift[sp_type_byte >> 4u]) + (1u << savvy::bcf_type_shift[sp_type_byte & 0x0Fu]));
+  }
+
+  return sz * (1u << savvy::bcf_type_shift[type]);
+}
+
+static const char* copy_typed_value(const char* p, const char* end, std::vector<char>& dest, bool sparse_allowed)
+{
+  const char* beg = p;
+  std::size_t sz = typed_value_data_size(p, end, sparse_allowed);
+  if (std::size_t(end - p) < sz)
+    throw std::runtime_error("Invalid byte sequence");
+  dest.insert(dest.end(), beg, p + sz);
+  return p + sz;
+}
+
+/**
+ * Scratch space for remapping frames. Each task of the thread pool is given its own instance.
+ */
+struct remap_buffers
+{
+  std::unique_ptr<ZSTD_DStream, std::size_t(*)(ZSTD_DStream*)> dstream{ZSTD_createDStream(), ZSTD_freeDStream};
+  std::vector<char> records;
+  std::vector<char> remapped;
+  std::vector<std::int32_t> filter_ints;
+};
+
+/**
+ * Copies serialized SAV records from [p, end) to dest with contig, FILTER, INFO and FORMAT IDs replaced. Values
+ * are copied as is, so genotypes are never decoded. Since PBWT state is keyed by field name, PBWT-sorted fields
+ * remain valid.
+ */
+static void remap_records(const char* p, const char* end, std::vector<char>& dest, const dictionary_remap& remap, std::vector<std::int32_t>& filter_ints)
+{
+  while (p != end)
+  {
+    std::uint32_t sizes[2];
+    if (end - p < 8)
+      throw std::runtime_error("Invalid byte sequence");
+    std::memcpy(sizes, p, 8);
+    std::uint32_t shared_sz = le32toh(sizes[0]);
+    std::uint32_t indiv_sz = le32toh(sizes[1]);
+    p += 8;
+    if (std::uint64_t(end - p) < std::uint64_t(shared_sz) + indiv_sz || shared_sz < 24)
+      throw std::runtime_error("Invalid byte sequence");
+
+    const char* shared_end = p + shared_sz;
+    const char* indiv_end = shared_end + indiv_sz;
+    std::size_t sizes_pos = dest.size();
+    dest.insert(dest.end(), 8, '\0');
+
+    // Fixed fields (chrom, pos, rlen, qual, n_allele/n_info, n_fmt/n_sample)
+    std::int32_t fixed[6];
+    std::memcpy(fixed, p, sizeof(fixed));
+    fixed[0] = std::int32_t(htole32(std::uint32_t(remap(savvy::dictionary::contig, std::int32_t(le32toh(std::uint32_t(fixed[0])))))));
+    std::size_t n_info = le32toh(std::uint32_t(fixed[4])) & 0xFFFFu;
+    std::size_t n_allele = le32toh(std::uint32_t(fixed[4])) >> 16u;
+    std::size_t n_fmt = le32toh(std::uint32_t(fixed[5])) >> 24u;
+    dest.insert(dest.end(), (const char*)fixed, (const char*)fixed + sizeof(fixed));
+    p += sizeof(fixed);
+
+    // ID, REF and ALT
+    const char* alleles_beg = p;
+    for (std::size_t i = 0; i < 1 + n_allele; ++i)
     {
-      dict = sav_reader.dictionary();
-      headers = sav_reader.headers();
-      samples = sav_reader.samples();
+      std::size_t sz = typed_value_data_size(p, shared_end, false);
+      if (std::size_t(shared_end - p) < sz)
+        throw std::runtime_error("Invalid byte sequence");
+      p += sz;
     }
-    else
+    dest.insert(dest.end(), alleles_beg, p);
+
+    // FILTER
+    p = savvy::bcf::deserialize_vec(const_cast<char*>(p), const_cast<char*>(shared_end), filter_ints);
+    for (auto it = filter_ints.begin(); it != filter_ints.end(); ++it)
+      *it = remap(savvy::dictionary::id, *it);
+    savvy::bcf::serialize_typed_vec(std::back_inserter(dest), filter_ints);
+
+    // INFO
+    for (std::size_t i = 0; i < n_info; ++i)
     {
-      if (dict != sav_reader.dictionary())
+      std::int32_t key = 0;
+      p = savvy::bcf::deserialize_int(p, shared_end, key);
+      savvy::bcf::serialize_typed_scalar(std::back_inserter(dest), remap(savvy::dictionary::id, key));
+      p = copy_typed_value(p, shared_end, dest, false);
+    }
+
+    if (p != shared_end)
+      throw std::runtime_error("Invalid byte sequence");
+    shared_sz = std::uint32_t(dest.size() - sizes_pos - 8);
+
+    // FORMAT
+    for (std::size_t i = 0; i < n_fmt; ++i)
+    {
+      std::int32_t key = 0;
+      p = savvy::bcf::deserialize_int(p, indiv_end, key);
+      savvy::bcf::serialize_typed_scalar(std::back_inserter(dest), remap(savvy::dictionary::id, key));
+      p = copy_typed_value(p, indiv_end, dest, true);
+    }
+
+    if (p != indiv_end)
+      throw std::runtime_error("Invalid byte sequence");
+    indiv_sz = std::uint32_t(dest.size() - sizes_pos - 8 - shared_sz);
+
+    sizes[0] = htole32(shared_sz);
+    sizes[1] = htole32(indiv_sz);
+    std::memcpy(dest.data() + sizes_pos, sizes, 8);
+  }
+}
+
+/**
+ * Decompresses a zstd frame of SAV records, remaps their IDs and compresses the result as a new frame.
+ * @param buf Scratch space, which must not be shared with concurrent calls
+ */
+static bool remap_frame(const char* data, std::size_t size, std::vector<char>& dest, const dictionary_remap& remap, int compression_level, remap_buffers& buf)
+{
+  auto& dstream = buf.dstream;
+  auto& records = buf.records;
+  auto& remapped = buf.remapped;
+  if (!dstream || ZSTD_isError(ZSTD_initDStream(dstream.get())))
+    return false;
+
+  // Frames written by older versions do not store their content size.
+  unsigned long long content_size = ZSTD_getFrameContentSize(data, size);
+  records.resize(content_size < (1ull << 32u) ? std::size_t(content_size) : ZSTD_DStreamOutSize());
+  ZSTD_inBuffer in = {data, size, 0};
+  ZSTD_outBuffer out = {records.data(), records.size(), 0};
+  while (true)
+  {
+    std::size_t res = ZSTD_decompressStream(dstream.get(), &out, &in);
+    if (ZSTD_isError(res))
+      return false;
+    if (res == 0)
+      break;
+    if (out.pos == out.size)
+    {
+      records.resize(std::max(records.size() * 2, ZSTD_DStreamOutSize()));
+      out.dst = records.data();
+      out.size = records.size();
+    }
+    else if (in.pos == in.size)
+    {
+      return false; // Truncated frame
+    }
+  }
+
+  remapped.clear();
+  try
+  {
+    remap_records(records.data(), records.data() + out.pos, remapped, remap, buf.filter_ints);
+  }
+  catch (const std::exception&)
+  {
+    return false;
+  }
+
+  return savvy::detail::compress_zstd_frame(remapped.data(), remapped.size(), dest, compression_level);
+}
+
+/**
+ * Writes the records of an input to out_fd with IDs remapped to the output dictionary. Batches of frames are
+ * read from disk and then remapped on the shared thread pool.
+ * @param out_pos Output file position, which is advanced past the written frames
+ * @param frame_offsets Receives input and output file positions of each frame (used to rewrite index entries)
+ */
+static bool write_remapped_records(const concat_input& input, const dictionary_remap& remap, int compression_level, int out_fd, std::uint64_t& out_pos, std::vector<std::pair<std::uint64_t, std::uint64_t>>& frame_offsets)
+{
+  const std::size_t min_batch_size = 64u << 20u;
+  std::vector<char> batch;
+  std::vector<std::pair<std::size_t, std::size_t>> frames;
+  std::vector<std::vector<char>> compressed;
+  std::vector<remap_buffers> task_buffers(savvy::detail::shared_thread_pool().size() + 1); // The calling thread also runs tasks.
+
+  frame_offsets.clear();
+  for (std::uint64_t pos = input.data_beg; pos < input.data_end; )
+  {
+    std::size_t batch_size = std::size_t(std::min<std::uint64_t>(std::max<std::size_t>(batch.size(), min_batch_size), input.data_end - pos));
+    batch.resize(batch_size);
+    for (std::size_t n = 0; n < batch_size; )
+    {
+      ssize_t r = ::pread(input.fd, batch.data() + n, batch_size - n, off_t(pos + n));
+      if (r < 0 && errno == EINTR)
+        continue;
+      if (r <= 0)
+        return false;
+      n += std::size_t(r);
+    }
+
+    frames.clear();
+    for (std::size_t off = 0; off < batch_size; )
+    {
+      std::size_t frame_size = ZSTD_findFrameCompressedSize(batch.data() + off, batch_size - off);
+      if (ZSTD_isError(frame_size))
+        break; // Incomplete frame at end of batch
+      frames.emplace_back(off, frame_size);
+      off += frame_size;
+    }
+
+    if (frames.empty())
+    {
+      if (batch_size == input.data_end - pos)
+        return false; // Not a zstd frame
+      batch.resize(batch_size * 2); // Frame is larger than batch
+      continue;
+    }
+
+    if (compressed.size() < frames.size())
+      compressed.resize(frames.size());
+    // Frames are interleaved across a fixed number of tasks so that each task can reuse one set of buffers.
+    std::size_t n_tasks = std::min(frames.size(), task_buffers.size());
+    std::atomic<bool> ok(true);
+    savvy::detail::shared_thread_pool().run(n_tasks, [&](std::size_t t)
+    {
+      for (std::size_t i = t; i < frames.size() && ok; i += n_tasks)
       {
-        std::cerr << "Header dictionaries incompatible\n";
-        return EXIT_FAILURE;
+        if (!remap_frame(batch.data() + frames[i].first, frames[i].second, compressed[i], remap, compression_level, task_buffers[t]))
+          ok = false;
       }
+    });
+
+    if (!ok)
+      return false;
+
+    for (std::size_t i = 0; i < frames.size(); ++i)
+    {
+      if (!write_all(out_fd, compressed[i].data(), compressed[i].size()))
+        return false;
+      frame_offsets.emplace_back(pos + frames[i].first, out_pos);
+      out_pos += compressed[i].size();
+    }
 
-      if (samples.size() != sav_reader.samples().size())
+    pos += frames.back().first + frames.back().second;
+  }
+
+  return true;
+}
+
+int concat_main(int argc, char **argv)
+{
+  concat_prog_args args;
+  if (!args.parse(argc, argv))
+  {
+    args.print_usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  if (args.help_is_set())
+  {
+    args.print_usage(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  // Headers and indices of all inputs are loaded and validated in parallel.
+  std::vector<concat_input> inputs(args.input_paths().size());
+  savvy::detail::shared_thread_pool().run(inputs.size(), [&](std::size_t i)
+  {
+    load_concat_input(args.input_paths()[i], inputs[i]);
+  });
+
+  bool create_index = true;
+  bool create_block_stats = true;
+  std::vector<std::pair<std::string, std::string>> headers = inputs.front().headers;
+  for (auto it = inputs.begin(); it != inputs.end(); ++it)
+  {
+    const std::string& path = args.input_paths()[it - inputs.begin()];
+    if (it->error.size())
+    {
+      std::cerr << it->error << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    if (it != inputs.begin())
+    {
+      if (inputs.front().samples.size() != it->samples.size())
       {
         std::cerr << "Files do not have the same sameple size\n";
         return EXIT_FAILURE;
       }
+
+      if (!merge_headers(headers, it->headers))
+        return EXIT_FAILURE;
     }
 
-    // TODO: Add --merge-headers option.
-//    for (auto it = sav_reader.headers().begin(); it != sav_reader.headers().end(); ++it)
-//    {
-//      if ((it->first != "INFO" || info_fields.insert(savvy::parse_header_sub_field(it->second, "ID")).second) && unique_headers.insert(it->first + "=" + it->second).second)
-//      {
-//        merged_headers.push_back(*it);
-//      }
-//    }
+    if (!it->indexed && create_index)
+    {
+      std::cerr << "Warning: " << path << " is not indexed, so output will not be indexed\n";
+      create_index = false;
+    }
 
-    variant_offsets.push_back(sav_reader.tellg());
+    if (!it->has_block_stats)
+      create_block_stats = false;
   }
 
-  std::int64_t output_pos;
+  std::uint64_t output_pos;
   std::array<std::uint8_t, 16> uuid;
+  std::vector<dictionary_remap> remaps(inputs.size());
+  std::vector<bool> remap_required(inputs.size());
 
   {
-    savvy::writer header_writer( args.output_path(), savvy::file::format::sav2, headers, samples, savvy::writer::default_compression_level, "/dev/null");
+    savvy::writer header_writer( args.output_path(), savvy::file::format::sav2, headers, inputs.front().samples, args.compression_level(), "/dev/null");
     uuid = header_writer.uuid();
-    output_pos = header_writer.tellp();
+    output_pos = std::uint64_t(header_writer.tellp());
+
+    // Inputs whose dictionary IDs differ from the output are copied with their IDs rewritten.
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+      if (!remaps[i].init(inputs[i].dict, header_writer.dictionary()))
+      {
+        std::cerr << "Error: could not map header dictionary of " << args.input_paths()[i] << std::endl;
+        return EXIT_FAILURE;
+      }
+      remap_required[i] = !remaps[i].identity();
+    }
   }
 
+  savvy::block_statistics_index output_block_stats;
   std::unique_ptr<savvy::s1r::writer> output_index;
-  bool create_index = true;
   if (create_index)
   {
     std::string idx_path = "/tmp/tmpfileXXXXXX";
     int tmp_fd = mkstemp(&idx_path[0]);
-    if (!tmp_fd)
+    if (tmp_fd < 0)
     {
       std::cerr << "Error: could not open temp file for s1r index (" << idx_path << ")" << std::endl;
     }
@@ -196,85 +725,145 @@ int concat_main(int argc, char **argv)
     }
   }
 
-  std::ofstream ofs(args.output_path(), std::ios::binary | std::ios::app);
-  if (!ofs)
-  {
-    std::cerr << "Could not open output path (" << args.output_path() << ")\n";
-    return EXIT_FAILURE;
-  }
-
-  std::vector<char> buf(4096);
-  for (auto ft = args.input_paths().begin(); ft != args.input_paths().end(); ++ft)
   {
-    std::ifstream ifs(*ft, std::ios::binary);
-    ifs.seekg(variant_offsets[ft - args.input_paths().begin()]);
-
-    if (!ifs)
+    int out_fd = ::open(args.output_path().c_str(), O_WRONLY);
+    if (out_fd < 0)
     {
-      std::cerr << "Could not open input SAV file (" << (*ft) << ")\n";
+      std::cerr << "Could not open output path (" << args.output_path() << ")\n";
       return EXIT_FAILURE;
     }
+    ::lseek(out_fd, 0, SEEK_END); // Fails harmlessly for pipes.
 
-    auto delta = output_pos - ifs.tellg();
-    savvy::s1r::reader idx(*ft);
-    if (output_index && idx.good())
+    std::vector<std::uint64_t> output_offsets(inputs.size());
+    std::vector<std::vector<std::pair<std::uint64_t, std::uint64_t>>> frame_offsets(inputs.size());
+    for (std::size_t i = 0; i < inputs.size(); ++i)
     {
-      std::size_t cnt = 0;
-      for (auto it = idx.trees_begin(); it != idx.trees_end(); ++it)
+      output_offsets[i] = output_pos;
+      if (remap_required[i])
       {
-        for (auto jt = it->leaf_begin(); jt != it->leaf_end(); ++jt)
+        if (!write_remapped_records(inputs[i], remaps[i], args.compression_level(), out_fd, output_pos, frame_offsets[i]))
         {
-          std::uint64_t old_file_pos = jt->value() >> 16u;
-          std::uint64_t record_cnt = jt->value() & 0xFFFF;
-          if (cnt == 0)
-          {
-            assert(old_file_pos == std::size_t(ifs.tellg()));
-          }
-          std::uint64_t new_file_pos = old_file_pos + delta;
-          output_index->write(it->name(), ::savvy::s1r::entry(jt->region_start(), jt->region_end(), (new_file_pos << 16u) | record_cnt));
-          ++cnt;
+          std::cerr << "Error: failed to remap records from " << args.input_paths()[i] << std::endl;
+          ::close(out_fd);
+          return EXIT_FAILURE;
         }
       }
+      else if (!copy_file_region(inputs[i].fd, inputs[i].data_beg, inputs[i].data_end - inputs[i].data_beg, out_fd))
+      {
+        std::cerr << "Error: failed to copy records from " << args.input_paths()[i] << std::endl;
+        ::close(out_fd);
+        return EXIT_FAILURE;
+      }
+      else
+      {
+        output_pos += inputs[i].data_end - inputs[i].data_beg;
+      }
     }
 
-    std::int64_t idx_off = idx.file_offset();
-    assert(idx_off == 0 || idx_off >= 8);
-
-    std::int64_t bytes_to_read = (idx_off ? idx_off - 8 : 0) - ifs.tellg(); // If index doesn't exist at end of file, then idx.file_offset() is equal to 0.
-
-    while (ifs && bytes_to_read > 0)
+    if (::close(out_fd) != 0)
     {
-      std::size_t sz = ifs.read(buf.data(), std::min<std::size_t>(bytes_to_read, buf.size())).gcount();
-      ofs.write(buf.data(), sz);
-      bytes_to_read -= sz;
-      output_pos += sz;
-      assert(bytes_to_read >= 0);
+      std::cerr << "Error: failed to write output (" << args.output_path() << ")\n";
+      return EXIT_FAILURE;
     }
 
-    if (idx_off)
+    if (output_index)
     {
-      // Test that next bytes in file are a skippable frame
-      std::string h(4, '\0');
-      ifs.read(&h[0], 4);
-      if (h != "\x50\x2A\x4D\x18")
+      // Rewrite index entries and block statistics to point to output positions.
+      std::vector<char> relocated(inputs.size(), 1);
+      savvy::detail::shared_thread_pool().run(inputs.size(), [&](std::size_t i)
       {
-        std::cerr << "Error: boundary not at skippable frame, so " << (*ft) << " is likely corrupted\n";
-        return EXIT_FAILURE;
-      }
+        std::uint64_t delta = output_offsets[i] - inputs[i].data_beg;
+        const auto& frames = frame_offsets[i];
+        auto relocate = [&](std::uint64_t& file_pos)
+        {
+          if (!remap_required[i])
+          {
+            file_pos += delta;
+            return true;
+          }
+
+          // Blocks start at frame boundaries, which were recompressed.
+          auto res = std::lower_bound(frames.begin(), frames.end(), std::make_pair(file_pos, std::uint64_t(0)));
+          if (res == frames.end() || res->first != file_pos)
+            return false;
+          file_pos = res->second;
+          return true;
+        };
 
-      // Test that size of index matches size of skippable frame
-      std::uint32_t index_file_size_le = 0;
-      ifs.read((char*)&index_file_size_le, 4);
-      if (le32toh(index_file_size_le) != idx.size_on_disk())
+        for (auto it = inputs[i].trees.begin(); it != inputs[i].trees.end(); ++it)
+        {
+          for (auto jt = it->second.begin(); jt != it->second.end(); ++jt)
+          {
+            std::uint64_t new_file_pos = jt->value() >> 16u;
+            if (!relocate(new_file_pos))
+            {
+              relocated[i] = 0;
+              return;
+            }
+            *jt = ::savvy::s1r::entry(jt->region_start(), jt->region_end(), (new_file_pos << 16u) | (jt->value() & 0xFFFFu));
+          }
+        }
+
+        if (create_block_stats)
+        {
+          for (auto it = inputs[i].block_stats.blocks().begin(); it != inputs[i].block_stats.blocks().end(); ++it)
+          {
+            if (!relocate(it->file_pos))
+            {
+              relocated[i] = 0;
+              return;
+            }
+          }
+        }
+      });
+
+      for (std::size_t i = 0; i < inputs.size(); ++i)
       {
-        std::cerr << "Error: skippable frame size does not match index size, so " << (*ft) << " is likely corrupted\n";
-        return EXIT_FAILURE;
-      }
+        if (!relocated[i])
+        {
+          std::cerr << "Error: index entry of " << args.input_paths()[i] << " does not point to a zstd frame" << std::endl;
+          return EXIT_FAILURE;
+        }
 
-      // TODO: use this test in reader class when hitting the end of file
+        for (auto it = inputs[i].trees.begin(); it != inputs[i].trees.end(); ++it)
+        {
+          for (auto jt = it->second.begin(); jt != it->second.end(); ++jt)
+            output_index->write(it->first, *jt);
+        }
+
+        if (create_block_stats)
+        {
+          // FORMAT keys are matched by name, since each input lists them in the order they were first written.
+          const savvy::block_statistics_index& src = inputs[i].block_stats;
+          std::vector<std::size_t> key_map(src.format_keys().size());
+          for (std::size_t k = 0; k < key_map.size(); ++k)
+            key_map[k] = output_block_stats.format_key_index(src.format_keys()[k]);
+
+          for (auto it = src.blocks().begin(); it != src.blocks().end(); ++it)
+          {
+            savvy::block_statistics b = *it;
+            b.format_non_zero.assign(output_block_stats.format_keys().size(), 0);
+            for (std::size_t k = 0; k < key_map.size() && k < it->format_non_zero.size(); ++k)
+              b.format_non_zero[key_map[k]] = it->format_non_zero[k];
+            output_block_stats.push_back(std::move(b));
+          }
+        }
+      }
     }
   }
 
+  std::ofstream ofs(args.output_path(), std::ios::binary | std::ios::app);
+  if (!ofs)
+  {
+    std::cerr << "Could not open output path (" << args.output_path() << ")\n";
+    return EXIT_FAILURE;
+  }
+
+  if (output_index && create_block_stats && !output_block_stats.write(ofs))
+  {
+    std::cerr << "Error: failed to write block statistics" << std::endl;
+    return EXIT_FAILURE;
+  }
 
   if (output_index)
   {
@@ -283,14 +872,6 @@ int concat_main(int argc, char **argv)
     {
       // TODO: Use linkat or send file (see https://stackoverflow.com/a/25154505/1034772)
       std::cerr << "Error: index file too big for skippable zstd frame" << std::endl;
-      // Possible solutions:
-      //   linkat(fd,"",destdirfd,"filename",AT_EMPTY_PATH);
-      // or
-      //   struct stat s;
-      //   off_t offset = 0;
-      //   int targetfd = open("target/filename", O_WRONLY | O_CREAT | O_EXCL);
-      //   fstat(fd,&s);
-      //   sendfile(targetfd,fd,&offset, s.st_size);
       return EXIT_FAILURE;
     }
   }
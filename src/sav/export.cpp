@@ -60,7 +60,9 @@ private:
   int update_info_ = -1;
   int compression_level_ = -1;
   std::uint16_t block_size_ = default_block_size;
+  std::size_t threads_ = 1;
   bool sites_only_ = false;
+  bool block_stats_ = false;
   bool help_ = false;
   bool index_ = false;
 public:
@@ -68,6 +70,7 @@ public:
     long_options_(
       {
         {"block-size", required_argument, 0, 'b'},
+        {"block-stats", no_argument, 0, '\x02'},
         {"bounding-point", required_argument, 0, 'p'},
         //{"data-format", required_argument, 0, 'd'},
         {"filter", required_argument, 0, 'f'},
@@ -90,6 +93,7 @@ public:
         {"sparse-fields", required_argument, 0, '\x01'},
         {"sparse-threshold", required_argument, 0, '\x01'},
         {"sites-only", no_argument, 0, '\x02'},
+        {"threads", required_argument, 0, 't'},
         {"update-info", required_argument, 0, '\x01'},
         {0, 0, 0, 0}
       })
@@ -116,9 +120,11 @@ public:
   savvy::bounding_point bounding_point() const { return bounding_point_; }
   std::uint8_t compression_level() const { return std::uint8_t(compression_level_); }
   std::uint16_t block_size() const { return block_size_; }
+  std::size_t threads() const { return threads_; }
   bool update_info() const { return update_info_ == 1 || (update_info_ == -1 && subset_ids_.size()); }
   bool index_is_set() const { return index_; }
   bool sites_only_is_set() const { return sites_only_; }
+  bool block_stats_is_set() const { return block_stats_; }
   bool help_is_set() const { return help_; }
 
   void print_usage(std::ostream& os)
@@ -128,7 +134,7 @@ public:
     else
       os << "Usage: sav export [opts ...] [in.sav] [out.{vcf,vcf.gz,sav}]\n";
     os << "\n";
-    os << " -#                     Number (#) of compression level (1-19, default: " << default_compression_level << ")\n";
+    os << " -#                     Number (#) of compression level (1-19 for SAV and 1-9 for BGZF, default: " << default_compression_level << " for SAV and " << savvy::writer::default_bgzf_compression_level << " for BGZF)\n";
     os << " -b, --block-size       Number of markers in SAV compression block (0-65535, default: " << default_block_size << ")\n";
     os << " -c, --slice            Range formatted as begin:end (non-inclusive end) that specifies a subset of record offsets within file\n";
     //os << " -d, --data-format      Format field to export (GT, DS, HDS or GP, default: GT)\n";
@@ -143,11 +149,13 @@ public:
     os << " -p, --bounding-point   Determines the inclusion policy of indels during region queries (any, all, beg or end, default: beg)\n";
     os << " -r, --regions          Comma separated list of genomic regions formatted as chr[:start-end]\n";
     os << " -R, --regions-file     Path to file containing list of regions formatted as chr<tab>start<tab>end\n";
+    os << " -t, --threads          Number of threads used for SAV and BGZF compression, SAV decompression and VCF parsing (default: 1)\n";
     //os << " -s, --sort             Enables sorting by first position of allele\n";
     //os << " -S, --sort-point       Enables sorting and specifies which allele position to sort by (beg, mid or end)\n";
     //os << " -x, --index            Enables indexing (SAV output only)\n";
-    os << " -X, --index-file       Specifies index output file (SAV output only)\n";
+    os << " -X, --index-file       Specifies index output file (SAV output, or CSI for BCF and VCF.gz output)\n";
     os << "\n";
+    os << "     --block-stats      Stores per-block summary statistics (AC histogram, AF range and FORMAT non-zero counts) in indexed SAV output\n";
     os << "     --phasing          Sets file phasing status if phasing header is not present (none, full, or partial)\n";
     os << "     --pbwt-fields         Comma separated list of FORMAT fields for which to enable PBWT sorting\n";
     os << "     --sparse-fields       Comma separated list of FORMAT fields to make sparse (default: GT,HDS,DS,EC)\n";
@@ -164,7 +172,7 @@ public:
 
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "0123456789b:c:f:hi:I:m:O:p:r:R:sS:xX:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "0123456789b:c:f:hi:I:m:O:p:r:R:sS:t:xX:", long_options_.data(), &long_index )) != -1)
     {
       char copt = char(opt & 0xFF);
       switch (copt)
@@ -237,6 +245,10 @@ public:
         {
           sites_only_ = true;
         }
+        else if (std::string(long_options_[long_index].name) == "block-stats")
+        {
+          block_stats_ = true;
+        }
         break;
       }
       case '0':
@@ -414,6 +426,9 @@ public:
         }
         break;
       }
+      case 't':
+        threads_ = std::size_t(std::max(1, std::atoi(optarg)));
+        break;
       case 'x':
         index_ = true;
         break;
@@ -499,8 +514,10 @@ public:
     {
       if (file_format_ == "vcf")
         compression_level_ = 0;
-      else
+      else if (file_format_ == "sav")
         compression_level_ = default_compression_level;
+      else
+        compression_level_ = savvy::writer::default_bgzf_compression_level;
     }
     else if (compression_level_ > 19)
     {
@@ -899,9 +916,11 @@ void export_records(savvy::reader& rdr, savvy::writer& wrt, const export_prog_ar
         bool should_be_sparse = args.sparse_fields().find(it->first) != args.sparse_fields().end();
         if (!it->second.is_sparse() && should_be_sparse)
         {
-          it->second.copy_as_sparse(tmp_val);
-          if (tmp_val.size() && static_cast<double>(tmp_val.non_zero_size()) / tmp_val.size() <= args.sparse_threshold())
+          if (static_cast<double>(it->second.count_non_zero()) / it->second.size() <= args.sparse_threshold())
+          {
+            it->second.copy_as_sparse(tmp_val);
             var.set_format(it->first, std::move(tmp_val)); // typed_value move operator implementation allows for reuse of tmp_val;
+          }
         }
         else if (it->second.is_sparse() && (!should_be_sparse || static_cast<double>(it->second.non_zero_size()) / it->second.size() > args.sparse_threshold()))
         {
@@ -943,9 +962,11 @@ int export_main(int argc, char** argv)
     return EXIT_FAILURE;
   }
 
+  rdr.set_threads(args.threads());
+
   if (args.regions().size())
   {
-    if (rdr.reset_bounds(args.regions().front(), args.bounding_point()).bad())
+    if (rdr.reset_bounds(args.regions(), args.bounding_point()).bad())
     {
       std::cerr << "Error: failed to load index for genomic region query" << std::endl;
       return EXIT_FAILURE;
@@ -1065,25 +1086,13 @@ int export_main(int argc, char** argv)
   if (args.subset_ids().size())
     sample_ids = rdr.subset_samples({args.subset_ids().begin(), args.subset_ids().end()});
 
-  savvy::writer wrt(args.output_path(), fmt, hdrs, sample_ids, args.compression_level(), args.index_path());
+  savvy::writer wrt(args.output_path(), fmt, hdrs, sample_ids, args.compression_level(), args.index_path(), args.threads());
   wrt.set_block_size(args.block_size());
   wrt.set_pbwt(args.pbwt_fields());
+  if (!wrt.set_block_statistics(args.block_stats_is_set()))
+    std::cerr << "Warning: ignoring --block-stats since output is not an indexed SAV file\n";
 
   export_records(rdr, wrt, args, remove_ph);
 
-  if (args.regions().size())
-  {
-    for (auto it = args.regions().begin() + 1; it != args.regions().end(); ++it)
-    {
-      if (rdr.reset_bounds(*it, args.bounding_point()).bad())
-      {
-        std::cerr << "Error: failed to load index for genomic region query" << std::endl;
-        return EXIT_FAILURE;
-      }
-
-      export_records(rdr, wrt, args, remove_ph);
-    }
-  }
-
   return wrt.good() && !rdr.bad() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
\ No newline at end of file
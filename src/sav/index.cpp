@@ -138,6 +138,9 @@ bool create_index(const std::string& input_file_path, std::string output_file_pa
     return EXIT_FAILURE;
   }
 
+  r.project_info({});
+  r.project_format({}); // Only CHROM/POS/REF/ALT are needed.
+
   std::int64_t start_pos = r.tellg();
 
   bool append_index = output_file_path.empty();
@@ -4,66 +4,63 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
-#ifdef NEEDS_PORT_TO_SAV_V2
-#include <cmath>
 #include "sav/merge.hpp"
+#include "sav/utility.hpp"
 #include "savvy/reader.hpp"
-#include "savvy/utility.hpp"
+#include "savvy/writer.hpp"
+#include "savvy/thread_pool.hpp"
 
-#include <cstdlib>
 #include <getopt.h>
-
-#include <fstream>
-#include <list>
+#include <cstdlib>
+#include <cstdint>
 #include <deque>
 #include <vector>
-#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 
 class merge_prog_args
 {
 private:
-  static const int default_compression_level = 3;
-  static const int default_block_size = 2048;
-
   std::vector<option> long_options_;
   std::vector<std::string> input_paths_;
-  std::string output_path_;
+  std::string output_path_ = "/dev/stdout";
   int compression_level_ = -1;
-  std::uint16_t block_size_ = default_block_size;
-  savvy::fmt format_ = savvy::fmt::gt;
+  std::size_t threads_ = 1;
   bool help_ = false;
-  std::uint32_t ploidy_ = 2;
 public:
   merge_prog_args() :
     long_options_(
       {
-        {"block-size", required_argument, 0, 'b'},
-        {"format", required_argument, 0, 'f'},
         {"help", no_argument, 0, 'h'},
         {"output", required_argument, 0, 'o'},
+        {"threads", required_argument, 0, 't'},
         {0, 0, 0, 0}
-      }),
-    output_path_("tmp.sav")
+      })
   {
   }
 
   const std::vector<std::string>& input_paths() const { return input_paths_; }
   const std::string& output_path() const { return output_path_; }
   std::uint8_t compression_level() const { return std::uint8_t(compression_level_); }
-  std::uint16_t block_size() const { return block_size_; }
-  savvy::fmt format() const { return format_; }
-  std::uint32_t ploidy() const { return ploidy_; }
+  std::size_t threads() const { return threads_; }
   bool help_is_set() const { return help_; }
 
   void print_usage(std::ostream& os)
   {
-    os << "Usage: sav merge [opts ...] <input.{sav,vcf,vcf.gz,bcf}> <input2.{sav,vcf,vcf.gz,bcf}> [additional_input.{sav,vcf,vcf.gz,bcf} ...] \n";
+    os << "Usage: sav merge [opts ...] <input1.sav> <input2.sav> [additional_input.sav ...]\n";
     os << "\n";
-    os << " -#                # compression level (1-19, default: " << default_compression_level << ")\n";
-    os << " -b, --block-size  Number of markers in compression block (0-65535, default: " << default_block_size << ")\n";
-    os << " -f, --format      Format field to copy (GT or HDS, default: GT)\n";
+    os << " -#                # compression level (1-19, default: " << int(savvy::writer::default_compression_level) << ")\n";
     os << " -h, --help        Print usage\n";
-    os << " -o, --output      Output file (default: stdout)\n";
+    os << " -o, --output      Path to output SAV file (default: /dev/stdout)\n";
+    os << " -t, --threads     Number of threads used for compression (default: 1)\n";
+    os << "\n";
+    os << "Inputs must be sorted by position with contigs in the same order. Sites are matched by position, REF\n";
+    os << "and ALT, and samples of inputs that do not have a site are set to missing. Site-level fields (ID, QUAL,\n";
+    os << "FILTER and INFO) are copied from the first input that has the site.\n";
     os << std::flush;
   }
 
@@ -71,48 +68,37 @@ public:
   {
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "0123456789b:f:ho:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "0123456789ho:t:", long_options_.data(), &long_index )) != -1)
     {
-      std::string str_opt_arg(optarg ? optarg : "");
       char copt = char(opt & 0xFF);
       switch (copt)
       {
-        case '0':
-        case '1':
-        case '2':
-        case '3':
-        case '4':
-        case '5':
-        case '6':
-        case '7':
-        case '8':
-        case '9':
-          if (compression_level_ < 0)
-            compression_level_ = 0;
-          compression_level_ *= 10;
-          compression_level_ += copt - '0';
-          break;
-        case 'b':
-          block_size_ = std::uint16_t(atoi(optarg) > 0xFFFF ? 0xFFFF : atoi(optarg));
-          break;
-        case 'f':
-          if (str_opt_arg == "HDS")
-          {
-            format_ = savvy::fmt::hds;
-          }
-          else if (str_opt_arg != "GT")
-          {
-            std::cerr << "Invalid format field value (" << str_opt_arg << ")\n";
-            return false;
-          }
-          break;
-        case 'h':
-          help_ = true;
-          return true;
-        case 'o':
-          output_path_ = std::string(optarg);
-        default:
-          return false;
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+      case '8':
+      case '9':
+        if (compression_level_ < 0)
+          compression_level_ = 0;
+        compression_level_ *= 10;
+        compression_level_ += copt - '0';
+        break;
+      case 'h':
+        help_ = true;
+        return true;
+      case 'o':
+        output_path_ = std::string(optarg ? optarg : "");
+        break;
+      case 't':
+        threads_ = std::size_t(std::max(1, std::atoi(optarg ? optarg : "")));
+        break;
+      default:
+        return false;
       }
     }
 
@@ -123,18 +109,11 @@ public:
       std::cerr << "Too few arguments\n";
       return false;
     }
-    else
-    {
-      input_paths_.reserve((unsigned)remaining_arg_count);
-      for (int i = optind; i < argc; ++i)
-      {
-        input_paths_.emplace_back(argv[i]);
-      }
-    }
 
+    input_paths_.assign(argv + optind, argv + argc);
 
     if (compression_level_ < 0)
-      compression_level_ = default_compression_level;
+      compression_level_ = savvy::writer::default_compression_level;
     else if (compression_level_ > 19)
       compression_level_ = 19;
 
@@ -142,251 +121,205 @@ public:
   }
 };
 
-template <std::size_t BitWidth, typename T, typename OutIt>
-void merge_serialize_alleles(const savvy::compressed_vector<T>& m, OutIt os_it, std::int64_t last_pos = 0)
+/**
+ * FORMAT values of a record in sparse form. Integer fields are stored in ints and float fields in floats.
+ */
+struct merge_format_values
 {
-  auto end = m.end();
-  for (auto it = m.begin(); it != end; ++it)
-  {
-    std::int8_t signed_allele = savvy::sav::detail::allele_encoder<BitWidth>::encode(*it);
-    if (signed_allele >= 0)
-    {
-      std::uint64_t dist = it.offset();
-      std::uint64_t offset = dist - last_pos;
-      last_pos = dist + 1;
-      savvy::prefixed_varint<BitWidth>::encode((std::uint8_t)(signed_allele), offset, os_it);
-    }
-  }
-
-}
+  std::vector<std::string> keys;
+  std::vector<savvy::compressed_vector<std::int32_t>> ints;
+  std::vector<savvy::compressed_vector<float>> floats;
+};
 
-class sav_reader : public savvy::sav::reader_base
+/**
+ * Input file along with its records at the current merge position.
+ */
+struct merge_input
 {
-public:
-  using savvy::sav::reader_base::reader_base;
-  using savvy::sav::reader_base::read_variant_details;
-  using savvy::sav::reader_base::read_genotypes;
+  savvy::reader rdr;
+  savvy::variant head;
+  bool has_head = false;
+  std::vector<savvy::variant> records;
+  std::vector<merge_format_values> values;
+  std::size_t n_records = 0;
+
+  merge_input(const std::string& path) : rdr(path) {}
 };
 
-template <typename T>
-class compressed_vector_append_wrapper
+enum class merge_field_type { integer, real, unsupported };
+
+/**
+ * Prints a warning the first time each FORMAT field is dropped. Records are decoded on several threads, so
+ * access is serialized.
+ */
+class dropped_field_log
 {
 public:
-  typedef T value_type;
-  static const T const_value_type;
-
-  compressed_vector_append_wrapper(savvy::compressed_vector<T>& vec) :
-    vec_(vec),
-    offset_(vec.size())
+  void warn(const std::string& key, const std::string& reason)
   {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (fields_.insert(key).second)
+      std::cerr << "Warning: dropping FORMAT field " << key << " since " << reason << "\n";
   }
+private:
+  std::mutex mtx_;
+  std::unordered_set<std::string> fields_;
+};
 
-  void resize(std::size_t sz)
+/**
+ * Decodes FORMAT fields of a record without densifying sparse vectors.
+ * @param dropped Receives fields that are not in the header or whose values cannot be decoded (fields with
+ * unsupported header types are reported when the header is parsed)
+ */
+static void decode_format_values(const savvy::variant& rec, const std::unordered_map<std::string, merge_field_type>& field_types, merge_format_values& dest, dropped_field_log& dropped)
+{
+  dest.keys.clear();
+  for (auto it = rec.format_fields().begin(); it != rec.format_fields().end(); ++it)
   {
-    vec_.resize(offset_ + sz);
-  }
+    auto res = field_types.find(it->first);
+    if (res == field_types.end())
+    {
+      dropped.warn(it->first, "it is not defined in the header");
+      continue;
+    }
 
-  T& operator[](std::size_t pos)
-  {
-    return vec_[offset_ + pos];
-  }
+    merge_field_type type = res->second;
+    if (type == merge_field_type::unsupported)
+      continue;
 
-  const T& operator[](std::size_t pos) const
-  {
-    return vec_[offset_ + pos];
-  }
+    std::size_t idx = dest.keys.size();
+    dest.keys.push_back(it->first);
+    if (dest.ints.size() <= idx)
+    {
+      dest.ints.resize(idx + 1);
+      dest.floats.resize(idx + 1);
+    }
 
-  std::size_t size() const
-  {
-    return vec_.size() - offset_;
+    bool ok = type == merge_field_type::integer ? it->second.get(dest.ints[idx]) : it->second.get(dest.floats[idx]);
+    if (!ok)
+    {
+      dropped.warn(it->first, std::string("its values could not be decoded as ") + (type == merge_field_type::integer ? "integers" : "floats"));
+      dest.keys.pop_back();
+      continue;
+    }
+
+    // Values of the other type are left empty.
+    if (type == merge_field_type::integer)
+      dest.floats[idx].clear();
+    else
+      dest.ints[idx].clear();
   }
-private:
-  savvy::compressed_vector<T>& vec_;
-  std::size_t offset_;
-};
+}
 
-int merge_main(int argc, char** argv)
+/**
+ * Appends the values of one input to dest, shifting offsets of non-zero values by the current size of dest. When
+ * the input has fewer values per sample than the output (e.g., haploid genotypes merged with diploid), each
+ * sample is padded with end-of-vector values.
+ *
+ * @param src Input values (nullptr if input does not have the field or site, in which case values are missing)
+ * @param n_samples Number of samples in input
+ * @param stride Number of values per sample in output
+ */
+template <typename T>
+static void append_format_values(savvy::compressed_vector<T>& dest, const savvy::compressed_vector<T>* src, std::size_t n_samples, std::size_t stride)
 {
-  merge_prog_args args;
-  if (!args.parse(argc, argv))
+  std::size_t base = dest.size();
+  if (!src)
   {
-    args.print_usage(std::cerr);
-    return EXIT_FAILURE;
+    dest.resize(base + n_samples * stride, savvy::typed_value::missing_value<T>());
+    return;
   }
 
-  if (args.help_is_set())
+  std::size_t src_stride = src->size() / n_samples;
+  const std::size_t* off = src->index_data();
+  const T* val = src->value_data();
+  const T* val_end = val + src->non_zero_size();
+  if (src_stride == stride)
   {
-    args.print_usage(std::cout);
-    return EXIT_SUCCESS;
+    for ( ; val != val_end; ++val, ++off)
+      dest[base + *off] = *val; // Appending in order is amortized constant time.
   }
-
-  std::deque<savvy::sav::reader> input_files;
-  for (auto it = args.input_paths().begin(); it != args.input_paths().end(); ++it)
+  else
   {
-    input_files.emplace_back(*it, args.format());
-    if (!input_files.back().good())
+    for (std::size_t i = 0; i < n_samples; ++i)
     {
-      std::cerr << "Could not open file (" << input_files.back().file_path() << ")\n";
-      return EXIT_FAILURE;
+      std::size_t sample_end = (i + 1) * src_stride;
+      for ( ; val != val_end && *off < sample_end; ++val, ++off)
+        dest[base + i * stride + (*off - i * src_stride)] = *val;
+      for (std::size_t j = src_stride; j < stride; ++j)
+        dest[base + i * stride + j] = savvy::typed_value::end_of_vector_value<T>();
     }
   }
 
-  std::size_t num_samples = 0;
-  std::vector<std::size_t> sample_offsets(input_files.size());
+  dest.resize(base + n_samples * stride);
+}
+
+/**
+ * Sets a merged FORMAT field on dest. Fields that are mostly non-zero are stored as dense vectors since offsets
+ * would only add overhead.
+ */
+template <typename T>
+static void set_merged_format(savvy::variant& dest, const std::string& key, const savvy::compressed_vector<T>& vec, std::vector<T>& dense_buf)
+{
+  if (vec.non_zero_size() * 2 > vec.size())
   {
-    auto ft = input_files.begin();
-    for (auto it = sample_offsets.begin(); it != sample_offsets.end(); ++it, ++ft)
-    {
-      (*it) = num_samples;
-      num_samples += ft->samples().size();
-    }
+    dense_buf.assign(vec.size(), T());
+    const std::size_t* off = vec.index_data();
+    for (const T* val = vec.value_data(); val != vec.value_data() + vec.non_zero_size(); ++val, ++off)
+      dense_buf[*off] = *val;
+    dest.set_format(key, dense_buf);
   }
-
-
-  //std::vector<savvy::compressed_vector<float>> genos(args.input_paths().size()); //std::vector<savvy::compressed_vector<float>> genos(args.input_paths().size());
-  std::vector<float> output_genos(num_samples * args.ploidy());
-
-  std::vector<std::string> sample_ids;
-  sample_ids.reserve(num_samples);
-
-  std::vector<std::pair<std::string,std::string>> merged_headers;
-
-  std::set<std::string> info_fields;
-  std::set<std::string> unique_headers;
-
-  for (auto& f : input_files)
+  else
   {
-    for (auto it = f.samples().begin(); it != f.samples().end(); ++it)
-      sample_ids.emplace_back(*it);
-
-    //merged_headers.reserve(merged_headers.size() + (f.headers().end() - f.headers().begin()));
-    for (auto it = f.headers().begin(); it != f.headers().end(); ++it)
-    {
-      if ((it->first != "INFO" || info_fields.insert(savvy::parse_header_sub_field(it->second, "ID")).second) && unique_headers.insert(it->first + "=" + it->second).second)
-      {
-        merged_headers.push_back(*it);
-      }
-    }
+    dest.set_format(key, vec);
   }
+}
 
+/**
+ * Output site along with the record index it uses from each input (npos if input does not have site).
+ */
+struct merge_site
+{
+  static const std::size_t npos = std::size_t(-1);
+  std::size_t lead_input;
+  std::vector<std::size_t> records;
+};
 
-  if (info_fields.insert("FILTER").second)
-    merged_headers.insert(merged_headers.begin(), {"INFO","<ID=FILTER,Description=\"Variant filter\">"});
-  if (info_fields.insert("QUAL").second)
-    merged_headers.insert(merged_headers.begin(), {"INFO","<ID=QUAL,Description=\"Variant quality\">"});
-  if (info_fields.insert("ID").second)
-    merged_headers.insert(merged_headers.begin(), {"INFO","<ID=ID,Description=\"Variant ID\">"});
-
-  savvy::sav::writer::options opts;
-  opts.compression_level = args.compression_level();
-  opts.block_size = args.block_size();
-
-  savvy::sav::writer output(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), merged_headers.begin(), merged_headers.end(), args.format());
-
-  std::vector<std::list<savvy::variant<std::vector<float>>>> variants(args.input_paths().size());
-
-
-  for (std::size_t i = 0; i < input_files.size(); ++i)
-  {
-    variants[i].emplace_back();
-    input_files[i] >> variants[i].back();
-    if (!input_files[i])
-      variants[i].pop_back();
-  }
+const std::size_t merge_site::npos;
 
-  std::size_t min_pos_index = 0;
-  while (min_pos_index < input_files.size())
+template <typename T>
+static bool merge_field(const std::string& key, const std::deque<merge_input>& inputs, const merge_site& site, const std::vector<std::size_t>& n_samples, savvy::compressed_vector<T>& dest, std::vector<T>& dense_buf, savvy::variant& out, std::vector<savvy::compressed_vector<T>> merge_format_values::* member)
+{
+  // Find values of each input and the maximum number of values per sample.
+  std::vector<const savvy::compressed_vector<T>*> src(inputs.size(), nullptr);
+  std::size_t stride = 0;
+  for (std::size_t i = 0; i < inputs.size(); ++i)
   {
-    min_pos_index = (std::size_t)-1;
-    savvy::site_info min_site;
-    for (std::size_t i = 0; i < input_files.size(); ++i)
-    {
-      if (variants[i].size())
-      {
-        if (min_site.chromosome().empty())
-        {
-          min_site = variants[i].front();
-          min_pos_index = i;
-        }
-        else
-        {
-          if (input_files[i].good() && min_site.chromosome() == variants[i].front().chromosome() && variants[i].front().position() < min_site.position())
-          {
-            min_site = variants[i].front();
-            min_pos_index = i;
-          }
-        }
-      }
-    }
-
-    while (true)
-    {
-      std::size_t equal_cnt = 0;
-      for (std::size_t i = 0; i < input_files.size(); ++i)
-      {
-        if (input_files[i].good())
-        {
-          if (variants[i].back().chromosome() == min_site.chromosome() &&
-            variants[i].back().position() == min_site.position())
-          {
-            ++equal_cnt;
-            variants[i].emplace_back();
-            input_files[i] >> variants[i].back();
-            if (!input_files[i])
-              variants[i].pop_back();
-          }
-        }
-      }
+    if (site.records[i] == merge_site::npos || n_samples[i] == 0)
+      continue;
 
-      if (equal_cnt == 0)
-        break;
-    }
+    const merge_format_values& vals = inputs[i].values[site.records[i]];
+    auto res = std::find(vals.keys.begin(), vals.keys.end(), key);
+    if (res == vals.keys.end())
+      continue;
 
-    output_genos.resize(0);
-    output_genos.resize(num_samples * args.ploidy());
-    for (std::size_t i = 0; i < input_files.size(); ++i)
+    src[i] = &(vals.*member)[res - vals.keys.begin()];
+    if (src[i]->size() % n_samples[i])
     {
-      for (auto v = variants[i].begin(); v != variants[i].end(); ++v)
-      {
-        if (v->chromosome() == min_site.chromosome() &&
-          v->position() == min_site.position() &&
-          v->ref() == min_site.ref() &&
-          v->alt() == min_site.alt())
-        {
-          for (std::size_t j = 0; j < v->data().size(); ++j)
-            output_genos[sample_offsets[i]* args.ploidy() + j] = v->data()[j];
-
-          if (i != min_pos_index)
-          {
-            auto end_it = input_files[i].info_fields().end();
-            for (auto it = input_files[i].info_fields().begin(); it != end_it; ++it)
-            {
-              min_site.prop(*it, v->prop(*it));
-            }
-          }
-
-          variants[i].erase(v);
-          if (variants[i].empty() && input_files[i].good())
-          {
-            variants[i].emplace_back();
-            input_files[i] >> variants[i].back();
-            if (!input_files[i])
-              variants[i].pop_back();
-          }
-          break;
-        }
-      }
+      std::cerr << "Error: size of " << key << " is not a multiple of sample size at " << out.chromosome() << ":" << out.position() << std::endl;
+      return false;
     }
-
-    savvy::update_info_fields(min_site, output_genos, args.format());
-    output.write(min_site, output_genos);
+    stride = std::max(stride, src[i]->size() / n_samples[i]);
   }
 
-  return output.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+  dest.clear();
+  for (std::size_t i = 0; i < inputs.size(); ++i)
+    append_format_values(dest, src[i], n_samples[i], stride);
+
+  set_merged_format(out, key, dest, dense_buf);
+  return true;
 }
-#endif
 
-#ifdef MERGE_OLD
 int merge_main(int argc, char** argv)
 {
   merge_prog_args args;
@@ -402,154 +335,211 @@ int merge_main(int argc, char** argv)
     return EXIT_SUCCESS;
   }
 
-  std::deque<sav_reader> input_files;
+  std::deque<merge_input> inputs;
   for (auto it = args.input_paths().begin(); it != args.input_paths().end(); ++it)
   {
-    input_files.emplace_back(*it, args.format());
-    if (!input_files.back().good())
+    inputs.emplace_back(*it);
+    if (!inputs.back().rdr)
     {
-      std::cerr << "Could not open file (" << input_files.back().file_path() << ")\n";
+      std::cerr << "Error: could not open file (" << *it << ")\n";
       return EXIT_FAILURE;
     }
   }
-  std::vector<savvy::site_info> sites(args.input_paths().size());
-  //std::vector<savvy::compressed_vector<float>> genos(args.input_paths().size()); //std::vector<savvy::compressed_vector<float>> genos(args.input_paths().size());
-  savvy::compressed_vector<float> output_genos;
 
+  std::vector<std::pair<std::string, std::string>> headers = inputs.front().rdr.headers();
+  std::vector<std::string> sample_ids;
+  std::vector<std::size_t> n_samples(inputs.size());
+  std::unordered_set<std::string> unique_ids;
+  for (std::size_t i = 0; i < inputs.size(); ++i)
   {
-    std::size_t num_samples = 0;
-    for (auto& f : input_files)
-      num_samples += f.samples().size();
-    std::vector<std::string> sample_ids;
-    sample_ids.reserve(num_samples);
-
-    std::vector<std::pair<std::string,std::string>> merged_headers;
-
-    std::set<std::string> info_fields;
+    if (i > 0 && !merge_headers(headers, inputs[i].rdr.headers()))
+      return EXIT_FAILURE;
 
-    for (auto& f : input_files)
+    n_samples[i] = inputs[i].rdr.samples().size();
+    for (auto it = inputs[i].rdr.samples().begin(); it != inputs[i].rdr.samples().end(); ++it)
     {
-      for (auto it = f.samples().begin(); it != f.samples().end(); ++it)
-        sample_ids.emplace_back(*it);
-
-      merged_headers.reserve(merged_headers.size() + (f.headers().end() - f.headers().begin()));
-      for (auto it = f.headers().begin(); it != f.headers().end(); ++it)
+      if (!unique_ids.insert(*it).second)
       {
-        if (it->first != "INFO" || info_fields.insert(savvy::parse_header_sub_field(it->second, "ID")).second)
-        {
-          merged_headers.push_back(*it);
-        }
+        std::cerr << "Error: duplicate sample ID (" << *it << ")\n";
+        return EXIT_FAILURE;
       }
+      sample_ids.push_back(*it);
+    }
+  }
+
+  std::unordered_map<std::string, std::size_t> contig_ranks;
+  std::unordered_map<std::string, merge_field_type> field_types;
+  for (auto it = headers.begin(); it != headers.end(); ++it)
+  {
+    if (it->first == "contig")
+    {
+      contig_ranks.emplace(savvy::parse_header_sub_field(it->second, "ID"), contig_ranks.size());
+    }
+    else if (it->first == "FORMAT")
+    {
+      savvy::header_value_details hval = savvy::parse_header_value(it->second);
+      merge_field_type type = merge_field_type::unsupported;
+      if (hval.id == "GT" || hval.type == "Integer")
+        type = merge_field_type::integer;
+      else if (hval.type == "Float")
+        type = merge_field_type::real;
+      else
+        std::cerr << "Warning: dropping FORMAT field " << hval.id << " since " << hval.type << " values cannot be merged\n";
+      field_types.emplace(hval.id, type);
     }
+  }
 
+  savvy::writer output(args.output_path(), savvy::file::format::sav2, headers, sample_ids, args.compression_level(), "", args.threads());
+  if (!output)
+  {
+    std::cerr << "Error: could not open output file (" << args.output_path() << ")\n";
+    return EXIT_FAILURE;
+  }
 
-    if (info_fields.insert("FILTER").second)
-      merged_headers.insert(merged_headers.begin(), {"INFO","<ID=FILTER,Description=\"Variant filter\">"});
-    if (info_fields.insert("QUAL").second)
-      merged_headers.insert(merged_headers.begin(), {"INFO","<ID=QUAL,Description=\"Variant quality\">"});
-    if (info_fields.insert("ID").second)
-      merged_headers.insert(merged_headers.begin(), {"INFO","<ID=ID,Description=\"Variant ID\">"});
+  // Records of all inputs are read and decoded in parallel.
+  std::vector<std::size_t> active(inputs.size());
+  for (std::size_t i = 0; i < inputs.size(); ++i)
+    active[i] = i;
 
-    savvy::sav::writer::options opts;
-    opts.compression_level = args.compression_level();
-    opts.block_size = args.block_size();
+  std::atomic<bool> read_failed(false);
+  dropped_field_log dropped_fields;
+  auto read_records = [&](const std::string& chrom, std::uint64_t pos)
+  {
+    savvy::detail::shared_thread_pool().run(active.size(), [&](std::size_t a)
+    {
+      merge_input& in = inputs[active[a]];
+      in.n_records = 0;
+      while (in.has_head && in.head.position() == pos && in.head.chromosome() == chrom)
+      {
+        if (in.records.size() == in.n_records)
+        {
+          in.records.emplace_back();
+          in.values.emplace_back();
+        }
+        std::swap(in.records[in.n_records], in.head);
+        decode_format_values(in.records[in.n_records], field_types, in.values[in.n_records], dropped_fields);
+        ++in.n_records;
+        in.has_head = in.rdr.read(in.head);
+      }
 
-    savvy::sav::writer output(args.output_path(), opts, sample_ids.begin(), sample_ids.end(), merged_headers.begin(), merged_headers.end(), args.format());
+      if (!in.has_head && in.rdr.bad())
+        read_failed = true;
+    });
+  };
 
-    std::string current_chrom;
-    std::size_t min_pos_index = input_files.size();
-    std::uint64_t min_pos = std::numeric_limits<std::uint64_t>::max();
-    for (std::size_t i = 0; i < input_files.size(); ++i)
+  savvy::detail::shared_thread_pool().run(inputs.size(), [&](std::size_t i)
+  {
+    inputs[i].has_head = inputs[i].rdr.read(inputs[i].head);
+    if (!inputs[i].has_head && inputs[i].rdr.bad())
+      read_failed = true;
+  });
+
+  std::vector<merge_site> sites;
+  savvy::variant out;
+  savvy::compressed_vector<std::int32_t> merged_ints;
+  savvy::compressed_vector<float> merged_floats;
+  std::vector<std::int32_t> dense_ints;
+  std::vector<float> dense_floats;
+  std::vector<std::string> out_keys;
+  std::pair<std::size_t, std::uint64_t> prev_key(0, 0);
+  while (!read_failed && output)
+  {
+    // Find next position.
+    std::size_t min_input = inputs.size();
+    std::pair<std::size_t, std::uint64_t> min_key;
+    for (std::size_t i = 0; i < inputs.size(); ++i)
     {
-      input_files[i].read_variant_details(sites[i]);
-      if (current_chrom.empty())
-        current_chrom = sites[i].chromosome();
+      if (!inputs[i].has_head)
+        continue;
 
-      if (input_files[i].good() && current_chrom == sites[i].chromosome() && sites[i].position() < min_pos)
+      auto rank = contig_ranks.emplace(inputs[i].head.chromosome(), contig_ranks.size()).first->second;
+      std::pair<std::size_t, std::uint64_t> key(rank, inputs[i].head.position());
+      if (key < prev_key)
       {
-        min_pos = sites[i].position();
-        min_pos_index = i;
+        std::cerr << "Error: " << args.input_paths()[i] << " is not sorted or has different contig order (" << inputs[i].head.chromosome() << ":" << inputs[i].head.position() << ")\n";
+        return EXIT_FAILURE;
       }
-    }
 
-    while (min_pos_index < input_files.size())
-    {
-      std::vector<bool> matching(input_files.size(), false);
-      savvy::site_info merged_site = sites[min_pos_index];
-      for (std::size_t i = 0; i < input_files.size(); ++i)
+      if (min_input == inputs.size() || key < min_key)
       {
-        if (i == min_pos_index
-          || (input_files[i].good()
-          && sites[i].chromosome() == sites[min_pos_index].chromosome()
-          && sites[i].position() == sites[min_pos_index].position()
-          && sites[i].ref() == sites[min_pos_index].ref()
-          && sites[i].alt() == sites[min_pos_index].alt()))
-        {
-          matching[i] = true;
-          if (i != min_pos_index)
-          {
-            // TODO: merge props.
-          }
-        }
+        min_input = i;
+        min_key = key;
       }
+    }
 
-      output_genos.resize(0);
-      for (std::size_t i = 0; i < input_files.size(); ++i)
+    if (min_input == inputs.size())
+      break;
+    prev_key = min_key;
+
+    active.clear();
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+      if (inputs[i].has_head && inputs[i].head.position() == min_key.second && inputs[i].head.chromosome() == inputs[min_input].head.chromosome())
+        active.push_back(i);
+      else
+        inputs[i].n_records = 0;
+    }
+    std::string chrom = inputs[min_input].head.chromosome();
+    read_records(chrom, min_key.second);
+
+    // Match records by alleles.
+    sites.clear();
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+      for (std::size_t r = 0; r < inputs[i].n_records; ++r)
       {
-        compressed_vector_append_wrapper<float> vec_wrapper(output_genos);
-        if (!matching[i])
+        const savvy::variant& rec = inputs[i].records[r];
+        auto res = std::find_if(sites.begin(), sites.end(), [&](const merge_site& s)
         {
-          vec_wrapper.resize(input_files[i].samples().size() * args.ploidy());
-        }
-        else
+          const savvy::variant& lead = inputs[s.lead_input].records[s.records[s.lead_input]];
+          return s.records[i] == merge_site::npos && lead.ref() == rec.ref() && lead.alts() == rec.alts();
+        });
+
+        if (res == sites.end())
         {
-          savvy::site_info tmp;
-          input_files[i].read_genotypes(tmp, vec_wrapper);
-          if (!input_files[i].good())
-          {
-            // TODO: Corrupt File
-          }
+          sites.push_back({i, std::vector<std::size_t>(inputs.size(), merge_site::npos)});
+          res = sites.end() - 1;
         }
+        res->records[i] = r;
       }
+    }
 
+    for (auto s = sites.begin(); s != sites.end() && output; ++s)
+    {
+      const savvy::variant& lead = inputs[s->lead_input].records[s->records[s->lead_input]];
+      out = savvy::variant(lead.chromosome(), lead.position(), lead.ref(), lead.alts(), lead.id(), lead.qual(), lead.filters(), lead.info_fields());
 
-      output.write(merged_site, output_genos);
-
-      min_pos_index = input_files.size();
-      min_pos = std::numeric_limits<std::uint64_t>::max();
-
-      for (int j = 0; j < 2 && min_pos_index == input_files.size(); ++j)
+      out_keys.clear();
+      for (std::size_t i = 0; i < inputs.size(); ++i)
       {
-        for (std::size_t i = 0; i < input_files.size(); ++i)
+        if (s->records[i] == merge_site::npos)
+          continue;
+        const merge_format_values& vals = inputs[i].values[s->records[i]];
+        for (auto it = vals.keys.begin(); it != vals.keys.end(); ++it)
         {
-          if (matching[i])
-          {
-            input_files[i].read_variant_details(sites[i]);
-            matching[i] = false;
-          }
-
-          if (input_files[i].good() && current_chrom == sites[i].chromosome() && sites[i].position() < min_pos)
-          {
-            min_pos = sites[i].position();
-            min_pos_index = i;
-          }
+          if (std::find(out_keys.begin(), out_keys.end(), *it) == out_keys.end())
+            out_keys.push_back(*it);
         }
+      }
 
-        if (min_pos_index == input_files.size())
-        {
-          for (std::size_t i = 0; i < input_files.size(); ++i)
-          {
-            if (input_files[i].good())
-            {
-              current_chrom = sites[i].chromosome();
-              break;
-            }
-          }
-        }
+      for (auto it = out_keys.begin(); it != out_keys.end(); ++it)
+      {
+        bool ok = field_types[*it] == merge_field_type::integer ?
+          merge_field(*it, inputs, *s, n_samples, merged_ints, dense_ints, out, &merge_format_values::ints) :
+          merge_field(*it, inputs, *s, n_samples, merged_floats, dense_floats, out, &merge_format_values::floats);
+        if (!ok)
+          return EXIT_FAILURE;
       }
+
+      output.write(out);
     }
   }
 
-  return EXIT_FAILURE;
+  if (read_failed)
+  {
+    std::cerr << "Error: read failure" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  return output.good() ? EXIT_SUCCESS : EXIT_FAILURE;
 }
-#endif
\ No newline at end of file
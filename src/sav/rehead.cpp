@@ -215,7 +215,8 @@ int rehead_main(int argc, char **argv)
     return  EXIT_FAILURE;
   }
 
-  savvy::writer sav_writer(args.output_path(), savvy::file::format::sav2, headers, sample_ids);
+  // The index is rewritten below, so the writer must not append one of its own.
+  savvy::writer sav_writer(args.output_path(), savvy::file::format::sav2, headers, sample_ids, savvy::writer::default_compression_level, "/dev/null");
   if (!sav_writer)
   {
     std::cerr << "Failed writing header to file (" << args.output_path() << ")" << std::endl;
@@ -241,7 +242,11 @@ int rehead_main(int argc, char **argv)
   std::int64_t idx_off = s1r_reader.file_offset();
   assert(idx_off == 0 || idx_off >= 8);
 
-  std::int64_t bytes_to_read = (idx_off ? idx_off - 8 : 0) - ifs.tellg(); // If index doesn't exist at end of file, then s1r_reader.file_offset() is equal to 0.
+  // Block statistics precede the index and are rewritten with shifted file positions.
+  savvy::block_statistics_index block_stats;
+  bool has_block_stats = idx_off && block_stats.load(args.input_path());
+
+  std::int64_t bytes_to_read = (has_block_stats ? std::int64_t(block_stats.frame_offset()) : (idx_off ? idx_off - 8 : 0)) - ifs.tellg(); // If index doesn't exist at end of file, then s1r_reader.file_offset() is equal to 0.
   assert(bytes_to_read >= 0);
 
   std::vector<char> buf(4096);
@@ -254,6 +259,18 @@ int rehead_main(int argc, char **argv)
     assert(bytes_to_read >= 0);
   }
 
+  if (has_block_stats)
+  {
+    for (auto it = block_stats.blocks().begin(); it != block_stats.blocks().end(); ++it)
+      it->file_pos += delta;
+
+    if (!block_stats.write(ofs))
+    {
+      std::cerr << "Error: failed to write block statistics" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
   std::unique_ptr<savvy::s1r::writer> output_index;
   if (idx_off)
   {
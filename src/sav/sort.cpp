@@ -10,168 +10,42 @@
 
 #include <getopt.h>
 #include <chrono>
+#include <cstdlib>
+#include <cctype>
+#include <future>
+#include <deque>
+#include <vector>
+#include <algorithm>
 
 //================================================================//
-less_than_comparator::less_than_comparator(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map) :
+sort_key_builder::sort_key_builder(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map) :
   contig_order_map_(std::move(contig_order_map)),
   sort_type_(type)
 {
 }
 
-bool less_than_comparator::operator()(const savvy::site_info& a, const savvy::site_info& b) const
+sort_key sort_key_builder::operator()(const savvy::site_info& site, std::size_t index) const
 {
-  switch (sort_type_)
-  {
-  case savvy::s1r::sort_point::mid: return mid(a, b);
-  case savvy::s1r::sort_point::beg: return left(a, b);
-  default: return right(a, b);
-  }
-}
-
-bool less_than_comparator::contig_compare(const std::string& a, const std::string& b) const
-{
-  auto a_res = contig_order_map_.find(a);
-  auto b_res = contig_order_map_.find(b);
-
-  if (a_res != contig_order_map_.end() && b_res != contig_order_map_.end())
-  {
-    return (a_res->second < b_res->second);
-  }
-  else if (a_res == contig_order_map_.end() && b_res == contig_order_map_.end())
-  {
-    return a < b;
-  }
-  else
-  {
-    return a_res != contig_order_map_.end(); // put a before b if b is not in headers, or put b before a if a is not in headers.
-  }
-}
-
-bool less_than_comparator::left(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
-    return a.position() < b.position();
-  return contig_compare(a.chromosome(), b.chromosome());
-}
-
-bool less_than_comparator::right(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
-  {
-    std::size_t a_max = a.ref().size();
-    for (auto it = a.alts().begin(); it != a.alts().end(); ++it)
-      a_max = std::max(a_max, it->size());
-
-    std::size_t b_max = b.ref().size();
-    for (auto it = b.alts().begin(); it != b.alts().end(); ++it)
-      b_max = std::max(b_max, it->size());
-
-    return (a.position() + a_max) < (b.position() + b_max);
-  }
-  return contig_compare(a.chromosome(), b.chromosome());
-}
-
-bool less_than_comparator::mid(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
-  {
-    std::size_t a_max = a.ref().size();
-    for (auto it = a.alts().begin(); it != a.alts().end(); ++it)
-      a_max = std::max(a_max, it->size());
-
-    std::size_t b_max = b.ref().size();
-    for (auto it = b.alts().begin(); it != b.alts().end(); ++it)
-      b_max = std::max(b_max, it->size());
-
-    double mid_a = static_cast<double>(a.position()) + (static_cast<double>(a_max) / 2.0);
-    double mid_b = static_cast<double>(b.position()) + (static_cast<double>(b_max) / 2.0);
-
-    return mid_a < mid_b;
-  }
-
-  return contig_compare(a.chromosome(), b.chromosome());
-}
-//================================================================//
-
-//================================================================//
-greater_than_comparator::greater_than_comparator(savvy::s1r::sort_point type, std::unordered_map<std::string, std::size_t> contig_order_map) :
-  contig_order_map_(std::move(contig_order_map)),
-  sort_type_(type)
-{
-}
-
-bool greater_than_comparator::operator()(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  switch (sort_type_)
-  {
-  case savvy::s1r::sort_point::mid: return mid(a, b);
-  case savvy::s1r::sort_point::beg: return left(a, b);
-  default: return right(a, b);
-  }
-}
-
-bool greater_than_comparator::contig_compare(const std::string& a, const std::string& b) const
-{
-  auto a_res = contig_order_map_.find(a);
-  auto b_res = contig_order_map_.find(b);
-
-  if (a_res != contig_order_map_.end() && b_res != contig_order_map_.end())
-  {
-    return (a_res->second > b_res->second);
-  }
-  else if (a_res == contig_order_map_.end() && b_res == contig_order_map_.end())
-  {
-    return a > b;
-  }
-  else
-  {
-    return b_res != contig_order_map_.end(); // put b before a if a is not in headers, or put a before b if b is not in headers.
-  }
-}
-
-bool greater_than_comparator::left(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
-    return a.position() > b.position();
-  return contig_compare(a.chromosome(), b.chromosome());
-}
-
-bool greater_than_comparator::right(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
-  {
-    std::size_t a_max = a.ref().size();
-    for (auto it = a.alts().begin(); it != a.alts().end(); ++it)
-      a_max = std::max(a_max, it->size());
-
-    std::size_t b_max = b.ref().size();
-    for (auto it = b.alts().begin(); it != b.alts().end(); ++it)
-      b_max = std::max(b_max, it->size());
+  std::uint64_t rank = sort_key::unknown_contig_rank;
+  auto res = contig_order_map_.find(site.chromosome());
+  if (res != contig_order_map_.end() && res->second < rank)
+    rank = res->second;
 
-    return (a.position() + a_max) > (b.position() + b_max);
-  }
-  return contig_compare(a.chromosome(), b.chromosome());
-}
-
-bool greater_than_comparator::mid(const savvy::site_info& a, const savvy::site_info& b) const
-{
-  if (a.chromosome() == b.chromosome())
+  std::uint64_t point = site.position();
+  if (sort_type_ != savvy::s1r::sort_point::beg)
   {
-    std::size_t a_max = a.ref().size();
-    for (auto it = a.alts().begin(); it != a.alts().end(); ++it)
-      a_max = std::max(a_max, it->size());
-
-    std::size_t b_max = b.ref().size();
-    for (auto it = b.alts().begin(); it != b.alts().end(); ++it)
-      b_max = std::max(b_max, it->size());
-
-    double mid_a = static_cast<double>(a.position()) + (static_cast<double>(a_max) / 2.0);
-    double mid_b = static_cast<double>(b.position()) + (static_cast<double>(b_max) / 2.0);
+    std::size_t max_allele_size = site.ref().size();
+    for (auto it = site.alts().begin(); it != site.alts().end(); ++it)
+      max_allele_size = std::max(max_allele_size, it->size());
 
-    return mid_a > mid_b;
+    // Mid point is doubled so that it stays an integer.
+    if (sort_type_ == savvy::s1r::sort_point::mid)
+      point = 2 * point + max_allele_size;
+    else
+      point += max_allele_size;
   }
 
-  return contig_compare(a.chromosome(), b.chromosome());
+  return {rank << 40u | (point & 0xFFFFFFFFFFull), &site.chromosome(), index};
 }
 //================================================================//
 
@@ -202,7 +76,10 @@ private:
   std::string input_path_;
   std::string output_path_ = "/dev/stdout";
   std::string direction_ = "asc";
+  std::string temp_dir_ = std::getenv("TMPDIR") && *std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
   savvy::s1r::sort_point point_ = savvy::s1r::sort_point::beg;
+  std::size_t max_memory_ = std::size_t(1) << 30u;
+  std::size_t threads_ = 1;
   bool help_ = false;
 public:
   sort_prog_args() :
@@ -210,8 +87,11 @@ public:
       {
         {"direction", required_argument, 0, 'd'},
         {"help", no_argument, 0, 'h'},
+        {"max-memory", required_argument, 0, 'm'},
         {"output", required_argument, 0, 'o'},
         {"point", required_argument, 0, 'p'},
+        {"threads", required_argument, 0, 't'},
+        {"temp-dir", required_argument, 0, 'T'},
         {0, 0, 0, 0}
       })
   {
@@ -220,7 +100,10 @@ public:
   const std::string& direction() const { return direction_; }
   const std::string& input_path() const { return input_path_; }
   const std::string& output_path() const { return output_path_; }
+  const std::string& temp_dir() const { return temp_dir_; }
   savvy::s1r::sort_point point() const { return point_; }
+  std::size_t max_memory() const { return max_memory_; }
+  std::size_t threads() const { return threads_; }
 
   bool help_is_set() const { return help_; }
 
@@ -230,8 +113,11 @@ public:
     os << "\n";
     os << " -d, --direction   Specifies whether to sort in ascending or descending order (asc or desc; default: asc)\n";
     os << " -h, --help        Print usage\n";
+    os << " -m, --max-memory  Memory used for sorting records before they are written to temp files (e.g., 512M or 4G; default: 1G)\n";
     os << " -o, --output      Path to output SAV file (default: /dev/stdout).\n";
     os << " -p, --point       Specifies which allele position to sort by (beg, mid or end; default: beg)\n";
+    os << " -t, --threads     Number of threads used for sorting and compression (default: 1)\n";
+    os << " -T, --temp-dir    Directory for temp files (default: $TMPDIR or /tmp)\n";
 
     os << std::flush;
   }
@@ -240,7 +126,7 @@ public:
   {
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "d:ho:p:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "d:hm:o:p:t:T:", long_options_.data(), &long_index )) != -1)
     {
       char copt = char(opt & 0xFF);
       switch (copt)
@@ -256,6 +142,23 @@ public:
       case 'h':
         help_ = true;
         return true;
+      case 'm':
+      {
+        char* suffix = nullptr;
+        max_memory_ = std::strtoull(optarg ? optarg : "", &suffix, 10);
+        switch (suffix ? std::toupper(*suffix) : 0)
+        {
+        case 'G': max_memory_ <<= 10u; // fallthrough
+        case 'M': max_memory_ <<= 10u; // fallthrough
+        case 'K': max_memory_ <<= 10u; ++suffix; break;
+        }
+        if (max_memory_ == 0 || !suffix || (*suffix && std::toupper(*suffix) != 'B'))
+        {
+          std::cerr << "Invalid --max-memory argument (" << (optarg ? optarg : "") << ")." << std::endl;
+          return false;
+        }
+        break;
+      }
       case 'o':
         output_path_ = std::string(optarg ? optarg : "");
         break;
@@ -281,6 +184,12 @@ public:
         }
         break;
       }
+      case 't':
+        threads_ = std::size_t(std::max(1, std::atoi(optarg ? optarg : "")));
+        break;
+      case 'T':
+        temp_dir_ = std::string(optarg ? optarg : "");
+        break;
       default:
         return false;
       }
@@ -307,106 +216,252 @@ public:
   }
 };
 
-template <typename SiteCompare>
-int run(savvy::reader& in, savvy::writer& out, const SiteCompare& compare_fn)
+// Temp files are read back once, so compression favors speed over size.
+static const std::uint8_t temp_compression_level = 1;
+
+// Maximum number of temp files merged at once. Runs beyond this are merged in multiple passes.
+static const std::size_t max_merge_width = 64;
+
+/**
+ * Removes temp files when sort finishes or fails. Files are also removed as soon as they are opened for
+ * merging, so this only cleans up after errors.
+ */
+class temp_file_list
 {
-  random_string_generator str_gen;
-  const std::size_t temp_file_size = 8192;
-  std::deque<std::string> temp_file_paths;
-  std::deque<savvy::writer> temp_writers;
-  std::deque<savvy::reader> temp_readers;
+public:
+  explicit temp_file_list(std::string dir) : dir_(std::move(dir)) {}
+  ~temp_file_list()
+  {
+    for (auto it = paths_.begin(); it != paths_.end(); ++it)
+      std::remove(it->c_str());
+  }
 
+  const std::string& create()
+  {
+    paths_.emplace_back(dir_ + "/tmp-" + str_gen_(32) + ".sav");
+    return paths_.back();
+  }
+private:
+  std::string dir_;
+  std::deque<std::string> paths_;
+  random_string_generator str_gen_;
+};
 
-  std::vector<savvy::variant> in_mem_variants(temp_file_size);
-  std::vector<std::reference_wrapper<savvy::variant>> in_mem_variant_refs(in_mem_variants.begin(), in_mem_variants.end());
+static std::size_t approx_field_size(const std::pair<std::string, savvy::typed_value>& f)
+{
+  const savvy::typed_value& v = f.second;
+  return f.first.size() + sizeof(f) + (v.is_sparse() ? v.non_zero_size() * (v.val_width() + v.off_width()) : v.size() * v.val_width());
+}
 
-  std::size_t read_counter = temp_file_size;
-  while (read_counter == temp_file_size)
+/**
+ * Estimates memory held by a record, which is used to size sorted runs.
+ */
+static std::size_t approx_record_size(const savvy::variant& v)
+{
+  std::size_t ret = sizeof(savvy::variant) + sizeof(sort_key) + v.chromosome().size() + v.id().size() + v.ref().size();
+  for (auto it = v.alts().begin(); it != v.alts().end(); ++it)
+    ret += sizeof(*it) + it->size();
+  for (auto it = v.info_fields().begin(); it != v.info_fields().end(); ++it)
+    ret += approx_field_size(*it);
+  for (auto it = v.format_fields().begin(); it != v.format_fields().end(); ++it)
+    ret += approx_field_size(*it);
+  return ret;
+}
+
+/**
+ * Computes keys for records and sorts them. Keys are built and sorted in one slice per thread on the shared
+ * thread pool, and then slices are merged pairwise. Records themselves are never moved.
+ */
+template <typename KeyCompare>
+void sort_keys(const std::vector<savvy::variant>& records, std::vector<sort_key>& keys, const sort_key_builder& make_key, const KeyCompare& compare_fn, std::size_t n_threads)
+{
+  const std::size_t min_slice_size = 1024;
+  std::size_t n_slices = std::max<std::size_t>(1, std::min(n_threads, keys.size() / min_slice_size));
+  std::vector<std::size_t> bounds(n_slices + 1);
+  for (std::size_t i = 0; i < bounds.size(); ++i)
+    bounds[i] = keys.size() * i / n_slices;
+
+  savvy::detail::shared_thread_pool().run(n_slices, [&](std::size_t i)
   {
-    read_counter = 0;
-    for (; read_counter < temp_file_size; )
-    {
-      in >> in_mem_variant_refs[read_counter].get();
-      if (!in.good())
-      {
-        break;
-      }
-      else
-      {
-        ++read_counter;
-      }
-    }
+    for (std::size_t j = bounds[i]; j < bounds[i + 1]; ++j)
+      keys[j] = make_key(records[j], j);
+    std::sort(keys.begin() + bounds[i], keys.begin() + bounds[i + 1], compare_fn);
+  });
 
-    if (read_counter)
+  for (std::size_t width = 1; width < n_slices; width *= 2)
+  {
+    savvy::detail::shared_thread_pool().run((n_slices + 2 * width - 1) / (2 * width), [&](std::size_t i)
     {
-      std::sort(in_mem_variant_refs.begin(), in_mem_variant_refs.begin() + read_counter, compare_fn);
-
-      temp_file_paths.emplace_back("/tmp/tmp-" + str_gen(32) + ".sav");
-      temp_writers.emplace_back(temp_file_paths.back(), savvy::file::format::sav2, in.headers(), in.samples());
-      // TODO: open FILE*  and unlink file
-      // temp_readers.emplace_back(temp_path, /*in.samples().begin(), in.samples().end(), in.headers().begin(), in.headers().end(),*/ out_format);
-      // std::remove(temp_path.c_str());
-      for (std::size_t i = 0; i<read_counter; ++i)
-      {
-        temp_writers.back() << in_mem_variant_refs[i].get();
-      }
-    }
+      std::size_t lo = i * 2 * width;
+      std::size_t mid = std::min(lo + width, n_slices);
+      std::size_t hi = std::min(lo + 2 * width, n_slices);
+      std::inplace_merge(keys.begin() + bounds[lo], keys.begin() + bounds[mid], keys.begin() + bounds[hi], compare_fn);
+    });
   }
+}
 
+/**
+ * K-way merges sorted files with a binary heap of keys. Key indices are file indices, so ties are broken by file
+ * order and merging stable runs is stable.
+ */
+template <typename KeyCompare>
+bool merge_runs(const std::vector<std::string>& paths, savvy::writer& out, const sort_key_builder& make_key, const KeyCompare& compare_fn)
+{
+  std::deque<savvy::reader> readers;
+  std::vector<savvy::variant> records(paths.size());
+  std::vector<sort_key> heap;
+  heap.reserve(paths.size());
 
+  // std heap functions keep the greatest element in front, so order is reversed.
+  auto heap_compare = [&compare_fn](const sort_key& a, const sort_key& b) { return compare_fn(b, a); };
 
-  temp_writers.clear();
-
-  for (auto it = temp_file_paths.begin(); it != temp_file_paths.end(); ++it)
+  for (std::size_t i = 0; i < paths.size(); ++i)
   {
-    temp_readers.emplace_back(*it);
-    std::remove(it->c_str());
+    readers.emplace_back(paths[i]);
+    std::remove(paths[i].c_str());
+    if (readers.back().read(records[i]))
+      heap.push_back(make_key(records[i], i));
+    else if (readers.back().bad())
+    {
+      std::cerr << "Error: read failure with temp file " << paths[i] << std::endl;
+      return false;
+    }
   }
 
-  std::vector<savvy::variant> write_variants(temp_readers.size());
-  std::size_t i = 0;
-  for (auto it = temp_readers.begin(); it != temp_readers.end(); ++it)
+  std::make_heap(heap.begin(), heap.end(), heap_compare);
+  while (heap.size() && out.good())
   {
-    it->read(write_variants[i]);
-    ++i;
+    std::pop_heap(heap.begin(), heap.end(), heap_compare);
+    std::size_t i = heap.back().index;
+    out << records[i];
+    if (readers[i].read(records[i]))
+    {
+      heap.back() = make_key(records[i], i);
+      std::push_heap(heap.begin(), heap.end(), heap_compare);
+    }
+    else
+    {
+      heap.pop_back();
+      if (readers[i].bad())
+      {
+        std::cerr << "Error: read failure with temp file " << paths[i] << std::endl;
+        return false;
+      }
+    }
   }
 
+  return out.good();
+}
 
-  std::size_t min_index;
-
-  do
+/**
+ * Merges groups of runs into larger runs until they can be merged into the output in a single pass. Groups are
+ * merged concurrently, one per thread.
+ */
+template <typename KeyCompare>
+bool reduce_runs(std::vector<std::string>& run_paths, const savvy::reader& in, temp_file_list& temp_files, const sort_key_builder& make_key, const KeyCompare& compare_fn, std::size_t n_threads)
+{
+  while (run_paths.size() > max_merge_width)
   {
-    min_index = write_variants.size();
-    for (std::size_t rdr_index = 0; rdr_index < write_variants.size(); ++rdr_index)
+    std::size_t n_groups = (run_paths.size() + max_merge_width - 1) / max_merge_width;
+    std::vector<std::string> next_paths;
+    for (std::size_t i = 0; i < n_groups; ++i)
+      next_paths.emplace_back(temp_files.create());
+
+    for (std::size_t wave = 0; wave < n_groups; wave += n_threads)
     {
-      if (temp_readers[rdr_index].good())
+      std::vector<std::future<bool>> results;
+      for (std::size_t i = wave; i < std::min(n_groups, wave + n_threads); ++i)
       {
-        if (min_index < write_variants.size())
+        results.emplace_back(std::async(std::launch::async, [&, i]()
         {
-          if (compare_fn(write_variants[rdr_index], write_variants[min_index]))
-            min_index = rdr_index;
-        }
-        else
-        {
-          min_index = rdr_index;
-        }
+          std::vector<std::string> group(run_paths.begin() + run_paths.size() * i / n_groups, run_paths.begin() + run_paths.size() * (i + 1) / n_groups);
+          savvy::writer wtr(next_paths[i], savvy::file::format::sav2, in.headers(), in.samples(), temp_compression_level, "/dev/null");
+          return merge_runs(group, wtr, make_key, compare_fn);
+        }));
       }
-      else if (temp_readers[rdr_index].bad())
-      {
-        std::cerr << "Error: read failure with temp reader " << rdr_index << std::endl;
+
+      bool ok = true;
+      for (auto it = results.begin(); it != results.end(); ++it)
+        ok = it->get() && ok;
+      if (!ok)
         return false;
-      }
     }
 
-    if (min_index < write_variants.size())
+    run_paths.swap(next_paths);
+  }
+
+  return true;
+}
+
+/**
+ * External merge sort. Records are read into a buffer until it reaches half of the memory budget, and then the
+ * buffer is sorted and written to a temp file in the background while the other half is filled. Input that fits
+ * in a single buffer is sorted in memory and written directly to the output.
+ */
+template <typename KeyCompare>
+bool run(savvy::reader& in, savvy::writer& out, const sort_key_builder& make_key, const KeyCompare& compare_fn, const sort_prog_args& args)
+{
+  const std::size_t buffer_size = std::max<std::size_t>(1, args.max_memory() / 2);
+  temp_file_list temp_files(args.temp_dir());
+  std::vector<std::string> run_paths;
+
+  std::vector<savvy::variant> buffers[2];
+  std::vector<sort_key> keys[2];
+  std::future<bool> pending_run;
+  for (std::size_t cur = 0; ; cur ^= 1u)
+  {
+    std::vector<savvy::variant>& buf = buffers[cur];
+    std::size_t n = 0;
+    for (std::size_t mem = 0; mem < buffer_size; ++n)
     {
-      out << write_variants[min_index];
-      temp_readers[min_index] >> write_variants[min_index];
+      if (n == buf.size())
+        buf.emplace_back();
+      if (!in.read(buf[n]))
+        break;
+      mem += approx_record_size(buf[n]);
     }
 
-  } while (min_index < write_variants.size());
+    if (in.bad())
+    {
+      std::cerr << "Error: read failure" << std::endl;
+      return false;
+    }
 
-  return true;
+    keys[cur].resize(n);
+    if (pending_run.valid() && !pending_run.get())
+      return false;
+
+    if (run_paths.empty() && !in.good())
+    {
+      sort_keys(buf, keys[cur], make_key, compare_fn, args.threads());
+      for (auto it = keys[cur].begin(); it != keys[cur].end() && out.good(); ++it)
+        out << buf[it->index];
+      return out.good();
+    }
+
+    if (n)
+    {
+      run_paths.emplace_back(temp_files.create());
+      pending_run = std::async(std::launch::async, [&, cur](const std::string& path)
+      {
+        sort_keys(buffers[cur], keys[cur], make_key, compare_fn, args.threads());
+        savvy::writer wtr(path, savvy::file::format::sav2, in.headers(), in.samples(), temp_compression_level, "/dev/null", args.threads());
+        for (auto it = keys[cur].begin(); it != keys[cur].end() && wtr.good(); ++it)
+          wtr << buffers[cur][it->index];
+        if (!wtr.good())
+          std::cerr << "Error: failed to write temp file " << path << std::endl;
+        return wtr.good();
+      }, run_paths.back());
+    }
+
+    if (!in.good())
+      break;
+  }
+
+  if (pending_run.valid() && !pending_run.get())
+    return false;
+
+  return reduce_runs(run_paths, in, temp_files, make_key, compare_fn, args.threads()) && merge_runs(run_paths, out, make_key, compare_fn);
 }
 
 int sort_main(int argc, char** argv)
@@ -431,7 +486,8 @@ int sort_main(int argc, char** argv)
     return EXIT_FAILURE;
   }
 
-  savvy::writer wtr(args.output_path(), savvy::file::format::sav2, rdr.headers(), rdr.samples());
+  rdr.set_threads(args.threads());
+  savvy::writer wtr(args.output_path(), savvy::file::format::sav2, rdr.headers(), rdr.samples(), savvy::writer::default_compression_level, "", args.threads());
 
   std::unordered_map<std::string, std::size_t> contig_order_map;
   contig_order_map.reserve(rdr.headers().size()); // std::count_if(in.headers().begin(), in.headers().end(), [](const std::pair<std::string,std::string>& e) { return e.first == "contig"; }));
@@ -447,15 +503,10 @@ int sort_main(int argc, char** argv)
   }
 
 
+  sort_key_builder make_key(args.point(), std::move(contig_order_map));
   if (args.direction() == "desc")
-  {
-    greater_than_comparator greater_than(args.point(), std::move(contig_order_map));
-    return run(rdr, wtr, greater_than) ? EXIT_SUCCESS : EXIT_FAILURE;
-  }
+    return run(rdr, wtr, make_key, greater_than_comparator(), args) ? EXIT_SUCCESS : EXIT_FAILURE;
   else
-  {
-    less_than_comparator less_than(args.point(), std::move(contig_order_map));
-    return run(rdr, wtr, less_than) ? EXIT_SUCCESS : EXIT_FAILURE;
-  }
+    return run(rdr, wtr, make_key, less_than_comparator(), args) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
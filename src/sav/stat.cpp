@@ -11,10 +11,18 @@
 #include "savvy/reader.hpp"
 #include "savvy/writer.hpp"
 #include "sav/filter.hpp"
+#include "savvy/parallel_scan.hpp"
+#include "savvy/block_stats.hpp"
 
 #include <functional>
 #include <getopt.h>
 #include <memory>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
 
 class stat_prog_args
 {
@@ -26,6 +34,9 @@ private:
   std::string per_ac_path_;
   std::string per_sample_path_;
   std::unique_ptr<savvy::genomic_region> reg_;
+  std::size_t threads_ = 1;
+  float maf_threshold_ = -1.f;
+  bool filter_set_ = false;
   bool help_ = false;
 public:
   stat_prog_args() :
@@ -33,10 +44,12 @@ public:
       {
         {"filter", required_argument, 0, 'f'},
         {"help", no_argument, 0, 'h'},
+        {"maf-below", required_argument, 0, '\x01'},
         {"per-ac-out", required_argument, 0, '\x01'},
         {"per-sample-out", required_argument, 0, '\x01'},
         {"region", required_argument, 0, 'r'},
         {"summary-out", required_argument, 0, '\x01'},
+        {"threads", required_argument, 0, 't'},
         {0, 0, 0, 0}
       })
   {
@@ -48,13 +61,19 @@ public:
   const std::string& per_ac_path() const { return per_ac_path_; }
   const std::string& per_sample_path() const { return per_sample_path_; }
   const std::unique_ptr<savvy::genomic_region>& reg() const { return reg_; }
+  std::size_t threads() const { return threads_; }
+  float maf_threshold() const { return maf_threshold_; }
   bool help_is_set() const { return help_; }
 
   void print_usage(std::ostream& os)
   {
     os << "Usage: sav stat [opts ...] <in.sav> \n";
     os << "\n";
-    os << " -h, --help  Print usage\n";
+    os << " -h, --help     Print usage\n";
+    os << " -r, --region   Genomic region formatted as chr[:start-end]\n";
+    os << " -t, --threads  Number of threads used to scan indexed SAV files (default: 1)\n";
+    os << "\n";
+    os << "     --maf-below  Counts records with minor allele frequency below threshold, using block statistics of indexed SAV files to avoid decompression where possible\n";
     os << std::flush;
   }
 
@@ -62,7 +81,7 @@ public:
   {
     int long_index = 0;
     int opt = 0;
-    while ((opt = getopt_long(argc, argv, "\x01:hr:", long_options_.data(), &long_index )) != -1)
+    while ((opt = getopt_long(argc, argv, "\x01:f:hr:t:", long_options_.data(), &long_index )) != -1)
     {
       char copt = char(opt & 0xFF);
       switch (copt)
@@ -70,7 +89,17 @@ public:
       case '\x01':
       {
         std::string long_opt_name = long_options_[long_index].name;
-        if (long_opt_name == "per-ac-out")
+        if (long_opt_name == "maf-below")
+        {
+          maf_threshold_ = float(std::atof(optarg ? optarg : ""));
+          if (maf_threshold_ < 0.f)
+          {
+            std::cerr << "Invalid --maf-below value (" << (optarg ? optarg : "") << ")\n";
+            return false;
+          }
+          break;
+        }
+        else if (long_opt_name == "per-ac-out")
         {
           per_ac_path_ = optarg ? optarg : "";
           break;
@@ -93,6 +122,7 @@ public:
           std::cerr << "Invalid filter expression (" << str_opt_arg << ")\n";
           return false;
         }
+        filter_set_ = true;
         break;
       }
       case 'h':
@@ -101,6 +131,9 @@ public:
       case 'r':
         reg_ = savvy::detail::make_unique<savvy::genomic_region>(string_to_region(optarg ? optarg : ""));
         break;
+      case 't':
+        threads_ = std::size_t(std::max(1, std::atoi(optarg ? optarg : "")));
+        break;
       default:
         return false;
       }
@@ -123,6 +156,12 @@ public:
       return false;
     }
 
+    if (maf_threshold_ >= 0.f && (filter_set_ || per_ac_path_.size() || per_sample_path_.size()))
+    {
+      std::cerr << "--maf-below cannot be combined with --filter, --per-ac-out or --per-sample-out\n";
+      return false;
+    }
+
     return true;
   }
 };
@@ -151,7 +190,6 @@ struct per_ac_t
 
 struct per_sample_t
 {
-  std::string sample_id;
   std::size_t n_het = 0;
   std::size_t n_hom = 0;
   std::size_t n_snp = 0;
@@ -159,17 +197,12 @@ struct per_sample_t
   std::size_t n_syn = 0;
   std::size_t n_nonsyn = 0;
 
-  per_sample_t(std::string sid) :
-    sample_id(std::move(sid))
-  {
-  }
-
   static void print_header(std::ostream& os)
   {
     os << "#sample_id\tn_het\tn_hom\tn_snp\tn_indel\tn_syn\tn_nonsyn\n";
   }
 
-  void print(std::ostream& os) const
+  void print(std::ostream& os, const std::string& sample_id) const
   {
     os << sample_id << "\t"
        << n_het << "\t"
@@ -179,71 +212,129 @@ struct per_sample_t
        << n_syn << "\t"
        << n_nonsyn << "\n";
   }
-};
 
-int stat_main(int argc, char** argv)
-{
-  stat_prog_args args;
-  if (!args.parse(argc, argv))
+  per_sample_t& operator+=(const per_sample_t& other)
   {
-    args.print_usage(std::cerr);
-    return EXIT_FAILURE;
+    n_het += other.n_het;
+    n_hom += other.n_hom;
+    n_snp += other.n_snp;
+    n_indel += other.n_indel;
+    n_syn += other.n_syn;
+    n_nonsyn += other.n_nonsyn;
+    return *this;
   }
+};
 
-  if (args.help_is_set())
+/**
+ * Classifies ANN consequences as synonymous or nonsynonymous. Results are cached per distinct consequence
+ * string (e.g., "missense_variant&splice_region_variant"), which repeats across records far more often than
+ * whole ANN values do.
+ */
+class ann_classifier
+{
+public:
+  /**
+   * @param ann Value of ANN INFO field
+   * @param is_syn Set if any transcript is synonymous and none are nonsynonymous
+   * @param is_nonsyn Set if any transcript is nonsynonymous
+   */
+  void operator()(const std::string& ann, bool& is_syn, bool& is_nonsyn)
   {
-    args.print_usage(std::cout);
-    return EXIT_SUCCESS;
-  }
+    static const std::size_t max_cache_size = 1u << 16u;
 
-  std::size_t multi_allelic{}, record_cnt{}, variant_cnt{};
+    bool any_syn = false;
+    is_nonsyn = false;
+    const char* p = ann.data();
+    const char* const end = p + ann.size();
+    while (true)
+    {
+      const char* transcript_end = std::find(p, end, ',');
+      const char* effect_beg = std::find(p, transcript_end, '|');
+      if (effect_beg != transcript_end)
+      {
+        ++effect_beg;
+        const char* effect_end = std::find(effect_beg, transcript_end, '|');
+        key_.assign(effect_beg, effect_end);
+        auto res = cache_.find(key_);
+        if (res == cache_.end())
+        {
+          if (cache_.size() >= max_cache_size)
+            cache_.clear();
+          res = cache_.emplace(key_, classify(effect_beg, effect_end)).first;
+        }
 
+        any_syn = any_syn || res->second.first;
+        is_nonsyn = is_nonsyn || res->second.second;
+      }
 
-  savvy::reader input_file(args.input_path());
-  if (!input_file)
-  {
-    std::cerr << "Error: could not open " << args.input_path() << std::endl;
-    return EXIT_FAILURE;
-  }
+      if (transcript_end == end)
+        break;
+      p = transcript_end + 1;
+    }
 
-  if (args.reg())
+    is_syn = any_syn && !is_nonsyn;
+  }
+private:
+  static std::pair<bool, bool> classify(const char* beg, const char* end)
   {
-    input_file.reset_bounds(*args.reg());
-    if (!input_file)
+    static const std::unordered_set<std::string> synonymous_labels = {
+      "start_retained",
+      "stop_retained",
+      "synonymous"};
+
+    static const std::unordered_set<std::string> nonsynonymous_labels = {
+      "stop_gained",
+      "frameshift",
+      "stop_lost",
+      "start_lost",
+      "inframe_insertion",
+      "inframe_deletion",
+      "missense"};
+
+    std::pair<bool, bool> ret(false, false);
+    std::string effect;
+    while (true)
     {
-      std::cerr << "Error: could not load region " << args.reg()->chromosome() << ":" << args.reg()->from() << "-" << args.reg()->to() << std::endl;
-      return EXIT_FAILURE;
+      const char* d = std::find(beg, end, '&');
+      effect.assign(beg, d);
+      if (synonymous_labels.find(effect) != synonymous_labels.end())
+        ret.first = true;
+      else if (nonsynonymous_labels.find(effect) != nonsynonymous_labels.end())
+        ret.second = true;
+
+      if (d == end)
+        break;
+      beg = d + 1;
     }
+    return ret;
   }
+private:
+  std::unordered_map<std::string, std::pair<bool, bool>> cache_;
+  std::string key_;
+};
 
-  savvy::variant rec;
-  std::vector<std::int8_t> geno;
-
-  std::vector<per_sample_t> per_sample_stats;
-  if (args.per_sample_path().size())
-    per_sample_stats.assign(input_file.samples().begin(), input_file.samples().end());
-
-  std::size_t bin_width = 1;
+/**
+ * Statistics gathered by one thread. Threads process separate shards of the file and their accumulators are
+ * summed at the end.
+ */
+struct stat_accumulator
+{
+  std::size_t multi_allelic = 0;
+  std::size_t record_cnt = 0;
+  std::size_t variant_cnt = 0;
   std::vector<per_ac_t> per_ac_stats;
+  std::vector<per_sample_t> per_sample_stats;
+  std::string error;
 
-  std::unordered_set<std::string> synonymous_labels = {
-    "start_retained",
-    "stop_retained",
-    "synonymous"};
-
-  std::unordered_set<std::string> nonsynonymous_labels = {
-    "stop_gained",
-    "frameshift",
-    "stop_lost",
-    "start_lost",
-    "inframe_insertion",
-    "inframe_deletion",
-    "missense"};
+  ann_classifier classify_ann;
+  savvy::compressed_vector<std::int8_t> geno;
+  std::string ann;
 
-  while (input_file.read(rec))
+  /**
+   * @return False on error (see error member)
+   */
+  bool add(const savvy::variant& rec, bool per_ac, std::size_t bin_width)
   {
-    if (!args.filter_functor()(rec)) continue;
-
     if (rec.alts().size() > 1)
       ++multi_allelic;
     variant_cnt += std::max<std::size_t>(1, rec.alts().size());
@@ -252,46 +343,22 @@ int stat_main(int argc, char** argv)
     bool is_snp = rec.ref().size() == 1 && rec.alts()[0].size() == 1;
     bool is_syn = false;
     bool is_nonsyn = false;
-    std::string ann;
     if (rec.get_info("ANN", ann))
-    {
-      std::size_t scnt = 0, nonscnt = 0;
-      std::vector<std::string> transcripts = split_string_to_vector(ann.c_str(), ',');
-      for (auto it = transcripts.begin(); it != transcripts.end(); ++it)
-      {
-        std::vector<std::string> fields = split_string_to_vector(it->c_str(), '|');
-        if (fields.size() >= 2)
-        {
-          std::vector<std::string> effects = split_string_to_vector(fields[1].c_str(), '&');
-          for (auto jt = effects.begin(); jt != effects.end(); ++jt)
-          {
-            if (synonymous_labels.find(*jt) != synonymous_labels.end())
-              ++scnt;
-            else if (nonsynonymous_labels.find(*jt) != nonsynonymous_labels.end())
-              ++nonscnt;
-          }
-        }
-      }
-
-      //is_syn = scnt && !nonscnt;
-      //is_nonsyn = !scnt && nonscnt;
-      is_nonsyn = nonscnt > 0;
-      is_syn = scnt && !nonscnt;
-    }
+      classify_ann(ann, is_syn, is_nonsyn);
 
-    if (args.per_ac_path().size())
+    if (per_ac)
     {
       std::int64_t ac,an;
       if (!rec.get_info("AC", ac) || !rec.get_info("AN", an))
       {
-        std::cerr << "Error: AC and AN INFO fields are required" << std::endl;
-        return EXIT_FAILURE;
+        error = "Error: AC and AN INFO fields are required";
+        return false;
       }
 
       if (ac > an || ac < 0)
       {
-        std::cerr << "Error: AC INFO field must be in range of [0, AN]" << std::endl;
-        return EXIT_FAILURE;
+        error = "Error: AC INFO field must be in range of [0, AN]";
+        return false;
       }
 
       if (an / bin_width + 1 > per_ac_stats.size())
@@ -310,58 +377,286 @@ int stat_main(int argc, char** argv)
         s.n_nonsyn += 1;
     }
 
-    if (per_sample_stats.size())
+    if (per_sample_stats.size() && rec.get_format("GT", geno))
     {
-      if (!rec.get_format("GT", geno)) continue;
-
-      savvy::stride_reduce(geno, geno.size() / per_sample_stats.size());
+      // Only non-zero alleles are visited. Samples are grouped by offset, and a sample with a missing allele
+      // (or end-of-vector padding) is skipped.
+      std::size_t stride = geno.size() / per_sample_stats.size();
+      if (stride == 0)
+        return true;
 
-      for (std::size_t i = 0; i < geno.size(); ++i)
+      const std::size_t* off = geno.index_data();
+      const std::int8_t* val = geno.value_data();
+      const std::int8_t* val_end = val + geno.non_zero_size();
+      while (val != val_end)
       {
-        int8_t g = geno[i];
-        if (g < 0) continue;
-        if (g)
+        std::size_t sample = *off / stride;
+        std::size_t sample_end = (sample + 1) * stride;
+        int g = 0;
+        bool missing = false;
+        for ( ; val != val_end && *off < sample_end; ++val, ++off)
         {
-          if (is_snp)
-            per_sample_stats[i].n_snp += g;
+          if (*val < 0)
+            missing = true;
           else
-            per_sample_stats[i].n_indel += g;
+            g += *val;
+        }
 
-          if (g == 1)
-            ++per_sample_stats[i].n_het;
-          else // assuming  g == 2
-            ++per_sample_stats[i].n_hom;
+        if (missing || !g)
+          continue;
 
-          if (is_syn)
-            per_sample_stats[i].n_syn += g;
-          if (is_nonsyn)
-            per_sample_stats[i].n_nonsyn += g;
-        }
+        per_sample_t& s = per_sample_stats[sample];
+        if (is_snp)
+          s.n_snp += g;
+        else
+          s.n_indel += g;
+
+        if (g == 1)
+          ++s.n_het;
+        else // assuming  g == 2
+          ++s.n_hom;
+
+        if (is_syn)
+          s.n_syn += g;
+        if (is_nonsyn)
+          s.n_nonsyn += g;
+      }
+    }
+
+    return true;
+  }
+
+  stat_accumulator& operator+=(const stat_accumulator& other)
+  {
+    multi_allelic += other.multi_allelic;
+    record_cnt += other.record_cnt;
+    variant_cnt += other.variant_cnt;
+
+    if (per_ac_stats.size() < other.per_ac_stats.size())
+      per_ac_stats.resize(other.per_ac_stats.size());
+    for (std::size_t i = 0; i < other.per_ac_stats.size(); ++i)
+    {
+      per_ac_stats[i].n_snp += other.per_ac_stats[i].n_snp;
+      per_ac_stats[i].n_indel += other.per_ac_stats[i].n_indel;
+      per_ac_stats[i].n_syn += other.per_ac_stats[i].n_syn;
+      per_ac_stats[i].n_nonsyn += other.per_ac_stats[i].n_nonsyn;
+    }
+
+    for (std::size_t i = 0; i < other.per_sample_stats.size(); ++i)
+      per_sample_stats[i] += other.per_sample_stats[i];
+
+    if (error.empty())
+      error = other.error;
+    return *this;
+  }
+};
+
+/**
+ * Counts records with minor allele frequency below a threshold. Blocks that lie within the region and whose MAF
+ * range is entirely on one side of the threshold are counted from embedded block statistics, so only the
+ * remaining blocks are decompressed.
+ */
+static int count_maf_below(const stat_prog_args& args)
+{
+  savvy::block_statistics_index block_stats;
+  block_stats.load(args.input_path()); // Without statistics, every block is decompressed.
+
+  savvy::s1r::reader idx(savvy::detail::file_exists(args.input_path() + ".s1r") ? args.input_path() + ".s1r" : args.input_path());
+  if (!idx.good())
+  {
+    std::cerr << "Error: --maf-below requires an indexed SAV file" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const savvy::genomic_region reg = args.reg() ? *args.reg() : savvy::genomic_region("");
+  const float threshold = args.maf_threshold();
+  std::uint64_t record_cnt = 0, below_cnt = 0, summarized_cnt = 0;
+  savvy::scan_shard undecided;
+
+  auto q = idx.create_query(reg);
+  for (auto it = q.begin(); it != q.end(); ++it)
+  {
+    std::uint64_t file_pos = (it->value() >> 16u) & 0x0000FFFFFFFFFFFF;
+    std::uint32_t cnt = std::uint32_t(0x000000000000FFFF & it->value()) + 1;
+    const savvy::block_statistics* b = block_stats.find(file_pos);
+    if (b && b->record_count == cnt && it->region_start() >= reg.from() && it->region_end() <= reg.to() && (b->max_maf < threshold || b->min_maf >= threshold))
+    {
+      record_cnt += cnt;
+      if (b->max_maf < threshold)
+        below_cnt += cnt - b->unknown_af_count;
+      ++summarized_cnt;
+    }
+    else
+    {
+      undecided.blocks.emplace_back(file_pos, cnt);
+      undecided.record_count += cnt;
+    }
+  }
+
+  if (undecided.blocks.size())
+  {
+    std::sort(undecided.blocks.begin(), undecided.blocks.end());
+    savvy::reader rdr(args.input_path());
+    rdr.project_format({"GT"});
+    rdr.reset_bounds(undecided);
+
+    savvy::variant rec;
+    while (rdr.read(rec))
+    {
+      if (rec.pos() < reg.from() || rec.pos() > reg.to())
+        continue;
+
+      ++record_cnt;
+      std::uint64_t ac, an;
+      if (savvy::block_statistics::allele_counts(rec, ac, an) && an && ac <= an)
+      {
+        float af = savvy::block_statistics::allele_frequency(ac, an);
+        if (std::min(af, 1.f - af) < threshold)
+          ++below_cnt;
+      }
+    }
+
+    if (rdr.bad())
+    {
+      std::cerr << "Error: read failure" << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  std::cout << "records\t" << record_cnt << "\n";
+  std::cout << "maf below " << threshold << "\t" << below_cnt << "\n";
+  std::cout << "blocks summarized\t" << summarized_cnt << "\n";
+  std::cout << "blocks decompressed\t" << undecided.blocks.size() << std::endl;
+
+  return EXIT_SUCCESS;
+}
+
+int stat_main(int argc, char** argv)
+{
+  stat_prog_args args;
+  if (!args.parse(argc, argv))
+  {
+    args.print_usage(std::cerr);
+    return EXIT_FAILURE;
+  }
+
+  if (args.help_is_set())
+  {
+    args.print_usage(std::cout);
+    return EXIT_SUCCESS;
+  }
+
+  if (args.maf_threshold() >= 0.f)
+    return count_maf_below(args);
+
+  savvy::reader input_file(args.input_path());
+  if (!input_file)
+  {
+    std::cerr << "Error: could not open " << args.input_path() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Genotypes are only needed for per-sample stats.
+  std::unordered_set<std::string> projected_fields;
+  if (args.per_sample_path().size())
+    projected_fields.insert("GT");
+
+  const std::size_t bin_width = 1;
+  const bool per_ac = !args.per_ac_path().empty();
+  const std::size_t n_samples = args.per_sample_path().size() ? input_file.samples().size() : 0;
+  stat_accumulator totals;
+  totals.per_sample_stats.resize(n_samples);
+
+  if (args.reg() || args.threads() == 1)
+  {
+    input_file.project_format(projected_fields);
+    if (args.reg())
+    {
+      input_file.reset_bounds(*args.reg());
+      if (!input_file)
+      {
+        std::cerr << "Error: could not load region " << args.reg()->chromosome() << ":" << args.reg()->from() << "-" << args.reg()->to() << std::endl;
+        return EXIT_FAILURE;
       }
     }
+
+    savvy::variant rec;
+    while (input_file.read(rec))
+    {
+      if (!args.filter_functor()(rec)) continue;
+      if (!totals.add(rec, per_ac, bin_width))
+        break;
+    }
+  }
+  else
+  {
+    // Each shard borrows an accumulator that no other thread is using, so there are at most as many copies
+    // of the per-sample counters as there are threads.
+    std::deque<stat_accumulator> accumulators;
+    std::vector<stat_accumulator*> available;
+    std::mutex mtx;
+    std::atomic<bool> failed(false);
+
+    savvy::parallel_scan_options opts;
+    opts.init = [&projected_fields](savvy::reader& rdr) { rdr.project_format(projected_fields); };
+    bool ok = savvy::parallel_for_each_shard(args.input_path(), args.threads(), [&](const savvy::scan_shard&, savvy::reader& rdr)
+    {
+      stat_accumulator* acc = nullptr;
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (available.empty())
+        {
+          accumulators.emplace_back();
+          accumulators.back().per_sample_stats.resize(n_samples);
+          available.push_back(&accumulators.back());
+        }
+        acc = available.back();
+        available.pop_back();
+      }
+
+      savvy::variant rec;
+      while (!failed && rdr.read(rec))
+      {
+        if (!args.filter_functor()(rec)) continue;
+        if (!acc->add(rec, per_ac, bin_width))
+          failed = true;
+      }
+
+      std::lock_guard<std::mutex> lock(mtx);
+      available.push_back(acc);
+    }, opts);
+
+    for (auto it = accumulators.begin(); it != accumulators.end(); ++it)
+      totals += *it;
+
+    if (!ok && totals.error.empty())
+      totals.error = "Error: read failure";
   }
 
+  if (totals.error.size())
+  {
+    std::cerr << totals.error << std::endl;
+    return EXIT_FAILURE;
+  }
 
   std::ofstream summary_out(args.summary_path(), std::ios::binary);
-  std::cout << record_cnt << "\t" << variant_cnt << "\t" << multi_allelic << "\n";
+  std::cout << totals.record_cnt << "\t" << totals.variant_cnt << "\t" << totals.multi_allelic << "\n";
 
   if (args.per_sample_path().size())
   {
     std::ofstream per_sample_out(args.per_sample_path(), std::ios::binary);
     per_sample_t::print_header(per_sample_out);
-    for (const per_sample_t& s : per_sample_stats)
-    {
-      s.print(per_sample_out);
-    }
+    for (std::size_t i = 0; i < totals.per_sample_stats.size(); ++i)
+      totals.per_sample_stats[i].print(per_sample_out, input_file.samples()[i]);
   }
 
-  if (args.per_ac_path().size())
+  if (per_ac)
   {
     std::ofstream per_ac_out(args.per_ac_path(), std::ios::binary);
     per_ac_t::print_header(per_ac_out);
-    for (std::size_t i = 0; i < per_ac_stats.size(); ++i)
+    for (std::size_t i = 0; i < totals.per_ac_stats.size(); ++i)
     {
-      per_ac_stats[i].print(per_ac_out, i / bin_width);
+      totals.per_ac_stats[i].print(per_ac_out, i / bin_width);
     }
   }
 
@@ -373,6 +668,7 @@ class stat_index_prog_args
 private:
   std::vector<option> long_options_;
   std::string input_path_;
+  std::string sav_path_;
   bool help_ = false;
 public:
   stat_index_prog_args() :
@@ -385,6 +681,7 @@ public:
   }
 
   const std::string& input_path() const { return input_path_; }
+  const std::string& sav_path() const { return sav_path_; }
   bool help_is_set() const { return help_; }
 
   void print_usage(std::ostream& os)
@@ -417,6 +714,7 @@ public:
     if (remaining_arg_count == 1)
     {
       input_path_ = argv[optind];
+      sav_path_ = input_path_;
       if (savvy::detail::file_exists(input_path_ + ".s1r"))
         input_path_ += ".s1r";
     }
@@ -435,6 +733,75 @@ public:
   }
 };
 
+/**
+ * Prints per-chromosome totals of embedded block statistics as additional stat-index rows.
+ */
+static void print_block_statistics(const std::string& index_path, const savvy::block_statistics_index& block_stats, std::size_t contig_cnt)
+{
+  savvy::s1r::reader index_file(index_path);
+  std::vector<savvy::block_statistics> totals(contig_cnt);
+  std::vector<std::uint64_t> block_cnts(contig_cnt);
+  auto s = totals.begin();
+  for (auto it = index_file.trees_begin(); it != index_file.trees_end() && s != totals.end(); ++it, ++s)
+  {
+    auto q = it->create_query(0, std::numeric_limits<std::uint64_t>::max());
+    for (auto e = q.begin(); e != q.end(); ++e)
+    {
+      const savvy::block_statistics* b = block_stats.find((e->value() >> 16u) & 0x0000FFFFFFFFFFFF);
+      if (b)
+      {
+        *s += *b;
+        ++block_cnts[s - totals.begin()];
+      }
+    }
+  }
+
+  auto print_row = [&totals](const std::string& label, std::function<void(const savvy::block_statistics&)> fn)
+  {
+    std::cout << label;
+    for (auto it = totals.begin(); it != totals.end(); ++it)
+    {
+      std::cout << "\t";
+      fn(*it);
+    }
+    std::cout << std::endl;
+  };
+
+  std::cout << "blocks with stats";
+  for (auto it = block_cnts.begin(); it != block_cnts.end(); ++it)
+    std::cout << "\t" << *it;
+  std::cout << std::endl;
+
+  print_row("unknown AF count", [](const savvy::block_statistics& b) { std::cout << b.unknown_af_count; });
+  print_row("min AF", [](const savvy::block_statistics& b) { if (b.min_af > b.max_af) std::cout << "."; else std::cout << b.min_af; });
+  print_row("max AF", [](const savvy::block_statistics& b) { if (b.min_af > b.max_af) std::cout << "."; else std::cout << b.max_af; });
+  print_row("min MAF", [](const savvy::block_statistics& b) { if (b.min_maf > b.max_maf) std::cout << "."; else std::cout << b.min_maf; });
+  print_row("max MAF", [](const savvy::block_statistics& b) { if (b.min_maf > b.max_maf) std::cout << "."; else std::cout << b.max_maf; });
+
+  std::size_t max_bucket = 0;
+  for (auto it = totals.begin(); it != totals.end(); ++it)
+  {
+    for (std::size_t i = 0; i < savvy::block_statistics::ac_bucket_count; ++i)
+    {
+      if (it->ac_histogram[i])
+        max_bucket = std::max(max_bucket, i);
+    }
+  }
+
+  for (std::size_t i = 0; i <= max_bucket; ++i)
+  {
+    std::string label = "AC " + std::to_string(i ? std::uint64_t(1) << (i - 1) : 0);
+    if (i + 1 == savvy::block_statistics::ac_bucket_count)
+      label += "+";
+    else if (i > 1)
+      label += "-" + std::to_string((std::uint64_t(1) << i) - 1);
+    print_row(label, [i](const savvy::block_statistics& b) { std::cout << b.ac_histogram[i]; });
+  }
+
+  for (std::size_t i = 0; i < block_stats.format_keys().size(); ++i)
+    print_row(block_stats.format_keys()[i] + " non-zero", [i](const savvy::block_statistics& b) { std::cout << (i < b.format_non_zero.size() ? b.format_non_zero[i] : 0); });
+}
+
 int stat_index_main(int argc, char** argv)
 {
   stat_index_prog_args args;
@@ -499,6 +866,10 @@ int stat_index_main(int argc, char** argv)
   }
   std::cout << std::endl;
 
+  savvy::block_statistics_index block_stats;
+  if (block_stats.load(args.sav_path()))
+    print_block_statistics(args.input_path(), block_stats, stats.size());
+
   return EXIT_SUCCESS;
 }
 
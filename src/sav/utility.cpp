@@ -5,12 +5,13 @@
  */
 
 #include "sav/utility.hpp"
-
+#include "savvy/utility.hpp"
 
 #include <fstream>
 #include <iostream>
 #include <cstring>
 #include <algorithm>
+#include <unordered_map>
 
 savvy::genomic_region string_to_region(const std::string& s)
 {
@@ -117,4 +118,45 @@ std::vector<std::string> split_file_to_vector(const char* in, std::size_t size_h
   }
 
   return ret;
-}
\ No newline at end of file
+}
+
+bool merge_headers(std::vector<std::pair<std::string, std::string>>& dest, const std::vector<std::pair<std::string, std::string>>& src)
+{
+  // Maps header type and ID to the position of the first matching line in dest.
+  std::unordered_map<std::string, std::unordered_map<std::string, std::size_t>> dest_lookup;
+  for (std::size_t i = 0; i < dest.size(); ++i)
+  {
+    if (dest[i].first == "contig" || dest[i].first == "FILTER" || dest[i].first == "INFO" || dest[i].first == "FORMAT")
+      dest_lookup[dest[i].first].emplace(savvy::parse_header_sub_field(dest[i].second, "ID"), i);
+  }
+
+  for (auto it = src.begin(); it != src.end(); ++it)
+  {
+    if (it->first != "contig" && it->first != "FILTER" && it->first != "INFO" && it->first != "FORMAT")
+      continue;
+
+    savvy::header_value_details src_val = savvy::parse_header_value(it->second);
+    auto insert_res = dest_lookup[it->first].emplace(src_val.id, dest.size());
+
+    if (insert_res.second)
+    {
+      // IDX refers to the dictionary of src, so it is dropped and the output writer assigns a new one.
+      std::string val = it->second;
+      std::size_t idx_pos = val.find(",IDX=");
+      if (idx_pos != std::string::npos)
+        val.erase(idx_pos, val.find_first_of(",>", idx_pos + 1) - idx_pos);
+      dest.emplace_back(it->first, std::move(val));
+    }
+    else if (it->first == "INFO" || it->first == "FORMAT")
+    {
+      savvy::header_value_details dest_val = savvy::parse_header_value(dest[insert_res.first->second].second);
+      if (dest_val.number != src_val.number || dest_val.type != src_val.type)
+      {
+        std::cerr << "Error: conflicting definitions of " << it->first << " field " << src_val.id << std::endl;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
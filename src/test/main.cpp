@@ -13,18 +13,28 @@
 #include "savvy/variant_iterator.hpp"
 #include "savvy/reader.hpp"
 #include "savvy/writer.hpp"
+#include "savvy/parallel_scan.hpp"
+#include "savvy/block_stats.hpp"
 #include "savvy/site_info.hpp"
 #include "savvy/data_format.hpp"
+#include "sav/sort.hpp"
 
 #include <iostream>
 #include <fstream>
+#include <map>
 #include <algorithm>
 #include <numeric>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
 #include <sstream>
 #include <tuple>
+#include <random>
+#include <unordered_map>
 #include <type_traits>
 #include <utility>
+#include <thread>
+#include <iterator>
 #include <sys/stat.h>
 
 
@@ -175,6 +185,44 @@ bool file_exists(const std::string& file_path)
   return (stat(file_path.c_str(), &st) == 0);
 }
 
+// Runs a sub-command of the sav executable, whose path is passed to the tests that need it.
+bool run_sav(const std::string& sav_path, const std::string& args)
+{
+  std::string cmd = "\"" + sav_path + "\" " + args;
+  std::cout << cmd << std::endl;
+  return std::system(cmd.c_str()) == 0;
+}
+
+// Compares float vectors, treating NaN values (e.g., missing integers) as equal.
+bool same_values(const std::vector<float>& a, const std::vector<float>& b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](float x, float y) { return x == y || (std::isnan(x) && std::isnan(y)); });
+}
+
+// Text form of every site field and FORMAT value, used to compare records across files with different dictionaries.
+std::string record_string(const savvy::variant& var)
+{
+  std::stringstream ss;
+  ss << var.chromosome() << '\t' << var.position() << '\t' << var.id() << '\t' << var.ref() << '\t' << var.qual();
+  for (const auto& a : var.alts())
+    ss << '\t' << a;
+  for (const auto& f : var.filters())
+    ss << "\tFILTER=" << f;
+  for (const auto& field : var.info_fields())
+    ss << '\t' << field.first << '=' << field.second;
+
+  std::vector<float> values;
+  for (const auto& field : var.format_fields())
+  {
+    var.get_format(field.first, values);
+    ss << '\t' << field.first << ':';
+    for (auto it = values.begin(); it != values.end(); ++it)
+      ss << (std::isnan(*it) ? std::string(".") : std::to_string(*it)) << ',';
+  }
+
+  return ss.str();
+}
+
 int varint_test()
 {
   std::vector<std::uint64_t> arr(0xFFFFFF);
@@ -606,6 +654,1280 @@ void convert_file_test(const std::string& fmt_field)
 //};
 
 
+void threaded_read_test(const std::string& fmt_field)
+{
+  savvy::reader input_file_reader1(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  savvy::reader input_file_reader2(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  input_file_reader2.set_threads(4);
+  auto t = make_file_checksum_test(input_file_reader1, input_file_reader2, fmt_field);
+  assert(t());
+  assert(!input_file_reader2.bad());
+
+  savvy::reader vcf_reader1(SAVVYT_VCF_FILE);
+  savvy::reader vcf_reader2(SAVVYT_VCF_FILE);
+  vcf_reader2.set_threads(4);
+  auto vcf_t = make_file_checksum_test(vcf_reader1, vcf_reader2, fmt_field);
+  assert(vcf_t());
+  assert(!vcf_reader2.bad());
+
+  // BGZF-compressed text is inflated in parallel by the VCF pipeline.
+  std::string vcf_gz_path = std::string(SAVVYT_SAV_FILE_HARD) + ".rd.vcf.gz";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output(vcf_gz_path, savvy::file::format::vcf, input.headers(), input.samples(), 6);
+
+    savvy::variant var;
+    while (input.read(var))
+      output.write(var);
+
+    assert(output.good() && !input.bad());
+  }
+
+  savvy::reader gz_reader1(vcf_gz_path);
+  savvy::reader gz_reader2(vcf_gz_path);
+  gz_reader2.set_threads(4);
+  auto gz_t = make_file_checksum_test(gz_reader1, gz_reader2, fmt_field);
+  assert(gz_t());
+  assert(!gz_reader2.bad());
+
+  // Changing the subset or projection mid-stream restarts the pipeline from the next unread line.
+  auto same = [](const std::vector<float>& a, const std::vector<float>& b)
+  {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](float x, float y) { return x == y || (std::isnan(x) && std::isnan(y)); });
+  };
+
+  for (const std::string& path : {std::string(SAVVYT_VCF_FILE), vcf_gz_path})
+  {
+    savvy::reader expected_rdr(path);
+    savvy::reader mt_rdr(path);
+    mt_rdr.set_threads(4);
+
+    savvy::variant expected_var, mt_var;
+    std::vector<float> expected_vec, mt_vec;
+    std::size_t cnt = 0;
+    while (expected_rdr.read(expected_var) && mt_rdr.read(mt_var))
+    {
+      assert(expected_var.position() == mt_var.position());
+      assert(expected_var.format_fields().size() == mt_var.format_fields().size());
+      assert(expected_var.get_format(fmt_field, expected_vec) == mt_var.get_format(fmt_field, mt_vec));
+      assert(same(expected_vec, mt_vec));
+
+      if (++cnt == 5)
+      {
+        expected_rdr.subset_samples({"NA00002", "NA00005"});
+        mt_rdr.subset_samples({"NA00002", "NA00005"});
+      }
+      else if (cnt == 10)
+      {
+        expected_rdr.project_format({fmt_field});
+        mt_rdr.project_format({fmt_field});
+      }
+    }
+    assert(cnt == SAVVYT_MARKER_COUNT_HARD);
+    assert(!expected_rdr.read(expected_var) && !mt_rdr.read(mt_var));
+    assert(!expected_rdr.bad() && !mt_rdr.bad());
+  }
+
+  savvy::reader rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  rdr.set_threads(2);
+  rdr.reset_bounds({"20", 1234600, 2234567});
+
+  savvy::variant anno;
+  std::size_t cnt = 0;
+  while (rdr.read(anno))
+  {
+    assert(anno.chromosome() == "20");
+    assert(anno.position() >= 1234600 && anno.position() <= 2234567);
+    ++cnt;
+  }
+  assert(cnt == 4);
+  assert(!rdr.bad());
+}
+
+void interned_key_test()
+{
+  savvy::reader rdr(SAVVYT_SAV_FILE_HARD);
+  savvy::field_key gt_key = rdr.intern_key("GT");
+  savvy::field_key af_key = rdr.intern_key("AF");
+  savvy::field_key missing_key = rdr.intern_key("XX");
+  assert(gt_key.id() >= 0 && af_key.id() >= 0 && missing_key.id() < 0);
+
+  savvy::variant var;
+  std::vector<std::int8_t> gt_a, gt_b;
+  std::vector<float> af_a, af_b;
+  std::size_t cnt = 0;
+  while (rdr.read(var))
+  {
+    assert(var.get_format("GT", gt_a) == var.get_format(gt_key, gt_b));
+    assert(gt_a == gt_b);
+    assert(var.get_info("AF", af_a) == var.get_info(af_key, af_b));
+    assert(af_a == af_b);
+    assert(!var.get_format(missing_key, gt_b));
+
+    // A key whose ID belongs to another field (e.g., interned against another file) is matched by name.
+    savvy::field_key foreign_af_key("AF", gt_key.id());
+    assert(var.get_info("AF", af_a) == var.get_info(foreign_af_key, af_b));
+    assert(af_a == af_b);
+
+    // Modified records fall back to string comparison.
+    var.set_info("XX", std::int32_t(7));
+    std::int32_t xx = 0;
+    assert(var.get_info(missing_key, xx) && xx == 7);
+    assert(var.get_info("AF", af_a) == var.get_info(af_key, af_b));
+    ++cnt;
+  }
+  assert(cnt > 0);
+  assert(!rdr.bad());
+}
+
+void lazy_format_test()
+{
+  for (auto path : {SAVVYT_SAV_FILE_HARD, SAVVYT_SAV_FILE_DOSE})
+  {
+    savvy::reader eager_rdr(path);
+    savvy::reader lazy_rdr(path);
+    lazy_rdr.set_lazy_format(true);
+    eager_rdr.subset_samples({"NA00002", "NA00005"});
+    lazy_rdr.subset_samples({"NA00002", "NA00005"});
+
+    savvy::variant eager_var, lazy_var;
+    std::vector<float> eager_vec, lazy_vec;
+    std::size_t cnt = 0;
+    while (eager_rdr.read(eager_var) && lazy_rdr.read(lazy_var))
+    {
+      // Access only the second field directly, then compare everything.
+      if (eager_var.format_fields().size() > 1)
+      {
+        const std::string& key = eager_var.format_fields()[1].first;
+        bool eager_found = eager_var.get_format(key, eager_vec);
+        bool lazy_found = lazy_var.get_format(key, lazy_vec);
+        assert(eager_found == lazy_found);
+        assert(same_values(eager_vec, lazy_vec));
+      }
+
+      assert(eager_var.format_fields().size() == lazy_var.format_fields().size());
+      for (std::size_t i = 0; i < eager_var.format_fields().size(); ++i)
+      {
+        eager_var.format_fields()[i].second.get(eager_vec);
+        lazy_var.format_fields()[i].second.get(lazy_vec);
+        assert(same_values(eager_vec, lazy_vec));
+      }
+      ++cnt;
+    }
+    assert(cnt > 0);
+    assert(!eager_rdr.bad() && !lazy_rdr.bad());
+  }
+
+  // Reading dosages alone must leave genotypes undecoded.
+  savvy::reader eager_rdr(SAVVYT_SAV_FILE_DOSE);
+  savvy::reader lazy_rdr(SAVVYT_SAV_FILE_DOSE);
+  lazy_rdr.set_lazy_format(true);
+  eager_rdr.subset_samples({"NA00002", "NA00005"});
+  lazy_rdr.subset_samples({"NA00002", "NA00005"});
+
+  savvy::variant eager_var, lazy_var;
+  std::vector<float> eager_vec, lazy_vec;
+  std::size_t pending_cnt = 0;
+  while (eager_rdr.read(eager_var) && lazy_rdr.read(lazy_var))
+  {
+    if (!lazy_var.get_format("HDS", lazy_vec))
+      continue;
+    bool eager_found = eager_var.get_format("HDS", eager_vec);
+    assert(eager_found && same_values(eager_vec, lazy_vec));
+
+    if (eager_var.get_format("GT", eager_vec))
+    {
+      assert(lazy_var.format_pending("GT"));
+      bool lazy_found = lazy_var.get_format("GT", lazy_vec);
+      assert(lazy_found && !lazy_var.format_pending("GT"));
+      assert(same_values(eager_vec, lazy_vec));
+      ++pending_cnt;
+    }
+  }
+  assert(pending_cnt > 0);
+  assert(!eager_rdr.bad() && !lazy_rdr.bad());
+}
+
+void projection_test()
+{
+  for (auto path : {SAVVYT_VCF_FILE, SAVVYT_SAV_FILE_HARD})
+  {
+    savvy::reader full_rdr(path);
+    savvy::reader gt_rdr(path);
+    savvy::reader sites_rdr(path);
+    gt_rdr.project_format({"GT"});
+    gt_rdr.project_info({"AF"});
+    sites_rdr.project_format({});
+
+    savvy::variant full_var, gt_var, sites_var;
+    std::vector<std::int8_t> full_gt, gt;
+    std::size_t cnt = 0;
+    while (full_rdr.read(full_var))
+    {
+      assert(gt_rdr.read(gt_var) && sites_rdr.read(sites_var));
+      assert(gt_var.position() == full_var.position() && sites_var.position() == full_var.position());
+      assert(sites_var.format_fields().empty());
+      assert(sites_var.info_fields().size() == full_var.info_fields().size());
+
+      assert(gt_var.format_fields().size() && gt_var.format_fields().front().first == "GT"); // PH may follow GT.
+      assert(full_var.get_format("GT", full_gt) && gt_var.get_format("GT", gt));
+      assert(full_gt == gt);
+      assert(gt_var.info_fields().size() <= 1);
+      ++cnt;
+    }
+    assert(cnt > 0);
+    assert(!gt_rdr.read(gt_var) && !sites_rdr.read(sites_var));
+    assert(!full_rdr.bad() && !gt_rdr.bad() && !sites_rdr.bad());
+  }
+}
+
+void subset_decode_test()
+{
+  std::string pbwt_path = std::string(SAVVYT_SAV_FILE_HARD) + ".pbwt.sav";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output(pbwt_path, savvy::file::format::sav2, input.headers(), input.samples());
+    output.set_pbwt({"GT"});
+
+    savvy::variant var;
+    while (input.read(var))
+      output.write(var);
+    assert(output.good() && !input.bad());
+  }
+
+  for (auto path : {pbwt_path, std::string(SAVVYT_SAV_FILE_HARD), std::string(SAVVYT_SAV_FILE_DOSE)})
+  {
+    savvy::reader full_rdr(path);
+    savvy::reader sub_rdr(path);
+    auto ids = sub_rdr.subset_samples({"NA00002", "NA00005", "NA00006"});
+    std::vector<std::size_t> sample_indices;
+    for (auto it = ids.begin(); it != ids.end(); ++it)
+      sample_indices.push_back(std::find(full_rdr.samples().begin(), full_rdr.samples().end(), *it) - full_rdr.samples().begin());
+
+    savvy::variant full_var, sub_var;
+    std::vector<float> full_vec, sub_vec;
+    std::size_t cnt = 0;
+    while (full_rdr.read(full_var))
+    {
+      assert(sub_rdr.read(sub_var));
+      assert(full_var.format_fields().size() == sub_var.format_fields().size());
+      for (std::size_t i = 0; i < full_var.format_fields().size(); ++i)
+      {
+        full_var.format_fields()[i].second.get(full_vec);
+        sub_var.format_fields()[i].second.get(sub_vec);
+        std::size_t stride = full_vec.size() / full_rdr.samples().size();
+        assert(sub_vec.size() == stride * sample_indices.size());
+        for (std::size_t j = 0; j < sample_indices.size(); ++j)
+        {
+          for (std::size_t k = 0; k < stride; ++k)
+            assert(sub_vec[j * stride + k] == full_vec[sample_indices[j] * stride + k] || (std::isnan(sub_vec[j * stride + k]) && std::isnan(full_vec[sample_indices[j] * stride + k])));
+        }
+      }
+      ++cnt;
+    }
+    assert(cnt > 0);
+    assert(!sub_rdr.read(sub_var));
+    assert(!full_rdr.bad() && !sub_rdr.bad());
+  }
+}
+
+template <typename T>
+void sparse_conversion_test(T non_zero_val)
+{
+  // Sizes straddle vector register widths so both the vectorized body and the scalar tail are exercised.
+  for (std::size_t sz : {std::size_t(1), std::size_t(15), std::size_t(33), std::size_t(257), std::size_t(1000)})
+  {
+    std::vector<T> dense(sz, T());
+    for (std::size_t i = 0; i < sz; i += (i % 7) + 1)
+      dense[i] = non_zero_val;
+    dense[sz - 1] = non_zero_val;
+
+    savvy::typed_value dense_val(dense), sparse_val, dense_copy;
+    std::size_t expected = std::count_if(dense.begin(), dense.end(), [](T v) { return v != T(); });
+    assert(dense_val.count_non_zero() == expected);
+
+    assert(dense_val.copy_as_sparse(sparse_val));
+    assert(sparse_val.is_sparse() && sparse_val.non_zero_size() == expected && sparse_val.count_non_zero() == expected);
+
+    // Reuse a destination holding non-zero data to check that zeros are rewritten.
+    savvy::typed_value(std::vector<T>(sz, non_zero_val)).copy_as_dense(dense_copy);
+    assert(sparse_val.copy_as_dense(dense_copy));
+    assert(!dense_copy.is_sparse());
+
+    std::vector<T> round_trip;
+    dense_copy.get(round_trip);
+    assert(round_trip == dense);
+  }
+}
+
+void read_matrix_test(const std::string& fmt_field)
+{
+  const std::size_t block_rows = 5;
+  savvy::reader expected_rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  savvy::reader dense_rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  savvy::reader sparse_rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+  const std::size_t num_samples = dense_rdr.samples().size();
+
+  // GT is reduced to per-sample dosages, while HDS is read per haplotype.
+  savvy::matrix_options opts;
+  opts.stride = fmt_field == "GT" ? 2 : 1;
+  const std::size_t num_columns = fmt_field == "GT" ? num_samples : 2 * num_samples;
+
+  auto same = [](float a, float b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+
+  std::vector<float> dense(block_rows * num_columns);
+  savvy::sparse_matrix<float> sparse;
+  std::vector<savvy::site_info> sites;
+  savvy::variant var;
+  std::vector<float> expected;
+  std::size_t total = 0;
+  std::size_t n;
+  while ((n = dense_rdr.read_matrix(fmt_field, dense.data(), block_rows, num_columns, savvy::matrix_layout::column_major, opts, &sites)) > 0)
+  {
+    std::size_t sparse_n = sparse_rdr.read_matrix(fmt_field, sparse, block_rows, num_columns, savvy::matrix_layout::row_major, opts);
+    assert(sparse_n == n);
+    assert(sparse.offsets.size() == n + 1);
+
+    for (std::size_t i = 0; i < n; ++i)
+    {
+      bool read_ok = expected_rdr.read(var);
+      assert(read_ok);
+      if (!var.get_format(fmt_field, expected))
+        expected.assign(num_columns * opts.stride, savvy::typed_value::missing_value<float>()); // Records without the field are all missing.
+      savvy::stride_reduce(expected, opts.stride);
+      assert(expected.size() == num_columns);
+      assert(sites[i].position() == var.position());
+
+      std::vector<float> sparse_row(num_columns, 0.f);
+      for (std::size_t j = sparse.offsets[i]; j < sparse.offsets[i + 1]; ++j)
+        sparse_row[sparse.indices[j]] = sparse.values[j];
+
+      for (std::size_t j = 0; j < num_columns; ++j)
+      {
+        assert(same(dense[j * block_rows + i], expected[j]));
+        assert(same(sparse_row[j], expected[j]));
+      }
+    }
+
+    total += n;
+  }
+
+  assert(total > 0);
+  bool extra_record = expected_rdr.read(var);
+  assert(!extra_record);
+  assert(!dense_rdr.bad() && !sparse_rdr.bad());
+
+  // Float values are summed before rounding into an integer matrix.
+  savvy::typed_value dosages(std::vector<float>{0.6f, 0.6f, 0.4f, 0.3f, 0.2f, 0.2f});
+  std::vector<std::int32_t> int_row(3);
+  std::vector<std::size_t> int_missing;
+  savvy::detail::dense_matrix_sink<std::int32_t> int_sink;
+  int_sink.dest = int_row.data();
+  int_sink.step = 1;
+  int_sink.missing = &int_missing;
+  savvy::matrix_options int_opts;
+  int_opts.stride = 2;
+  assert(savvy::detail::reduce_matrix_row<std::int32_t>(&dosages, int_row.size(), int_opts, int_sink));
+  assert((int_row == std::vector<std::int32_t>{1, 1, 0}));
+}
+
+void vcf_parser_test()
+{
+  // Integers: sign, missing ('.') and values too long for the fast path.
+  struct int_case { const char* str; std::size_t consumed; };
+  for (const int_case& c : {int_case{"123\t", 3}, int_case{"-45:", 3}, int_case{"+7", 2}, int_case{".", 0}, int_case{"-", 0},
+    int_case{"123456789012345678", 18}, int_case{"-9223372036854775808", 20}, int_case{"99999999999999999999", 20}})
+  {
+    std::string buf(c.str);
+    char* expected_end = &buf[0];
+    long long expected = std::strtoll(expected_end, &expected_end, 10);
+    char* p = &buf[0];
+    assert(savvy::detail::parse_vcf_int(p) == expected);
+    assert(p == expected_end && std::size_t(p - &buf[0]) == c.consumed);
+  }
+
+  // Floats must match strtof bit for bit, including inputs that fall back to it.
+  for (const char* str : {"0.125", "1e-05", "-2.5E+3", "+3", ".5", "5.", "0", "-0", "123456789", "1234567891", "16777216", "16777217",
+    "0.000000001", "1e10", "1e11", "3.4028235e38", "1e-45", "1.5e", "1e+", "0x1p3", "nan", "inf", ".", "0.1:", "7,8"})
+  {
+    std::string buf(str);
+    char* expected_end = &buf[0];
+    float expected = std::strtof(expected_end, &expected_end);
+    char* p = &buf[0];
+    float f = savvy::detail::parse_vcf_float(p);
+    assert(p == expected_end);
+    assert(std::memcmp(&f, &expected, sizeof(f)) == 0 || (std::isnan(f) && std::isnan(expected)));
+  }
+
+  // Five samples span one SSE2 register plus a scalar tail.
+  std::string gt_line = "\t0|1\t1|1\t./.\t0/0\t1|0";
+  assert(savvy::detail::is_diploid_gt_line(&gt_line[0], &gt_line[0] + gt_line.size(), 5));
+  assert(!savvy::detail::is_diploid_gt_line(&gt_line[0], &gt_line[0] + gt_line.size(), 4));
+  for (const char* bad : {"\t0|1\t1|1\t./.\t0:0\t1|0", "\t0|1\t1|1\t./.\t0/0\t1|x", "\t0|1 1|1\t./.\t0/0\t1|0", "\t0|1\t1|1\t.|.\t0/0\t|00"})
+    assert(!savvy::detail::is_diploid_gt_line(bad, bad + std::strlen(bad), 5));
+
+  // CRLF line endings, blank lines and a final line without a newline.
+  std::string path = std::string(SAVVYT_SAV_FILE_HARD) + ".crlf.vcf";
+  {
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << "##fileformat=VCFv4.2\r\n"
+      << "##contig=<ID=20>\r\n"
+      << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\r\n"
+      << "##FORMAT=<ID=DP,Number=1,Type=Integer,Description=\"Read Depth\">\r\n"
+      << "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO\tFORMAT\tS1\tS2\tS3\tS4\tS5\r\n"
+      << "20\t100\t.\tA\tG\t.\t.\t.\tGT" << gt_line << "\r\n"
+      << "\r\n"
+      << "\n"
+      << "20\t200\t.\tA\tG\t.\t.\t.\tGT\t0|1\t1\t./.\t0/0\t1|0\r\n"
+      << "20\t300\t.\tA\tG\t.\t.\t.\tGT:DP\t0|1:3\t1|1:4\t./.:.\t0/0:5\t1|0:6";
+  }
+
+  const std::int8_t m = savvy::typed_value::missing_value<std::int8_t>();
+  const std::int8_t e = savvy::typed_value::end_of_vector_value<std::int8_t>();
+  std::vector<std::vector<std::int8_t>> expected_gt = {
+    {0, 1, 1, 1, m, m, 0, 0, 1, 0},
+    {0, 1, 1, e, m, m, 0, 0, 1, 0},
+    {0, 1, 1, 1, m, m, 0, 0, 1, 0}};
+  std::vector<std::uint32_t> expected_pos = {100, 200, 300};
+
+  savvy::reader rdr(path);
+  savvy::variant var;
+  std::vector<std::int8_t> gt;
+  std::vector<std::int32_t> dp;
+  std::size_t cnt = 0;
+  while (rdr.read(var))
+  {
+    assert(cnt < expected_gt.size());
+    assert(var.position() == expected_pos[cnt]);
+    assert(var.alts().size() == 1 && var.alts()[0] == "G");
+    assert(var.get_format("GT", gt));
+    assert(gt == expected_gt[cnt]);
+    ++cnt;
+  }
+  assert(cnt == expected_gt.size());
+  assert(!rdr.bad());
+  assert(var.get_format("DP", dp));
+  assert((dp == std::vector<std::int32_t>{3, 4, savvy::typed_value::missing_value<std::int32_t>(), 5, 6}));
+}
+
+void threaded_write_test()
+{
+  std::string out_path = std::string(SAVVYT_SAV_FILE_HARD) + ".mt.sav";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    auto file_info = input.headers();
+    savvy::writer output(out_path, savvy::file::format::sav2, file_info, input.samples(), savvy::writer::default_compression_level, "", 4);
+    output.set_block_size(3);
+
+    savvy::variant var;
+    while (input.read(var))
+      output.write(var);
+
+    assert(output.good() && !input.bad());
+  }
+
+  run_file_checksum_test(SAVVYT_VCF_FILE, out_path, "GT");
+
+  savvy::reader rdr(out_path);
+  rdr.reset_bounds({"20", 1234600, 2234567});
+
+  savvy::variant anno;
+  std::size_t cnt = 0;
+  while (rdr.read(anno))
+  {
+    assert(anno.chromosome() == "20");
+    ++cnt;
+  }
+  assert(cnt == 4);
+  assert(!rdr.bad());
+
+  // BGZF output is also compressed on worker threads.
+  std::string vcf_path = std::string(SAVVYT_SAV_FILE_HARD) + ".mt.vcf.gz";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output(vcf_path, savvy::file::format::vcf, input.headers(), input.samples(), 6, "", 4);
+
+    savvy::variant var;
+    while (input.read(var))
+      output.write(var);
+
+    assert(output.good() && !input.bad());
+  }
+
+  run_file_checksum_test(SAVVYT_VCF_FILE, vcf_path, "GT");
+}
+
+void vcf_write_test(const std::string& fmt_field)
+{
+  // SAV fields are sparse, so this exercises zero runs as well as non-zero values.
+  std::string in_path = fmt_field == "HDS" ? SAVVYT_SAV_FILE_DOSE : SAVVYT_SAV_FILE_HARD;
+  std::string out_path = in_path + ".out.vcf";
+  {
+    savvy::reader input(in_path);
+    savvy::writer output(out_path, savvy::file::format::vcf, input.headers(), input.samples(), 0);
+
+    savvy::variant var;
+    while (input.read(var))
+      output.write(var);
+
+    assert(output.good() && !input.bad());
+  }
+
+  run_file_checksum_test(SAVVYT_VCF_FILE, out_path, fmt_field);
+}
+
+// Checks region queries against a scan of the whole input and returns the number of matching records.
+std::size_t check_region_query(const std::string& path, const savvy::genomic_region& reg)
+{
+  std::vector<std::string> expected;
+  savvy::reader input(SAVVYT_VCF_FILE);
+  savvy::variant var;
+  while (input.read(var))
+  {
+    if (var.chromosome() == reg.chromosome() && var.position() >= reg.from() && var.position() <= reg.to())
+      expected.push_back(record_string(var));
+  }
+
+  std::vector<std::string> observed;
+  savvy::reader rdr(path);
+  rdr.reset_bounds(reg);
+  while (rdr.read(var))
+    observed.push_back(record_string(var));
+  assert(!rdr.bad());
+
+  assert(observed == expected);
+  return observed.size();
+}
+
+void csi_test()
+{
+  std::vector<savvy::genomic_region> regions = {{"18", 2234670, 2234700}, {"20", 1234600, 2234567}, {"20"}, {"20", 5000000, 6000000}, {"19"}};
+
+  for (savvy::file::format fmt : {savvy::file::format::bcf, savvy::file::format::vcf})
+  {
+    std::string ext = fmt == savvy::file::format::bcf ? ".bcf" : ".vcf.gz";
+
+    // Regular files are indexed at the default path.
+    for (std::size_t threads : {1, 4})
+    {
+      std::string out_path = std::string(SAVVYT_SAV_FILE_HARD) + ".csi" + std::to_string(threads) + ext;
+      std::remove((out_path + ".csi").c_str());
+      {
+        savvy::reader input(SAVVYT_VCF_FILE);
+        savvy::writer output(out_path, fmt, input.headers(), input.samples(), savvy::writer::format_default_compression_level, "", threads);
+
+        savvy::variant var;
+        while (input.read(var))
+          output.write(var);
+
+        assert(output.good() && !input.bad());
+      }
+
+      assert(file_exists(out_path + ".csi"));
+      assert(check_region_query(out_path, regions[0]) == 3);
+      assert(check_region_query(out_path, regions[1]) == 4);
+      assert(check_region_query(out_path, regions[2]) == 19);
+      assert(check_region_query(out_path, regions[3]) == 0);
+      assert(check_region_query(out_path, regions[4]) == 0);
+    }
+
+    // Output that is not a regular file is only indexed when an index path is given.
+    for (bool explicit_index : {false, true})
+    {
+      std::string fifo_path = std::string(SAVVYT_SAV_FILE_HARD) + ".fifo" + ext;
+      std::string copy_path = std::string(SAVVYT_SAV_FILE_HARD) + ".fifo_copy" + ext;
+      std::remove(fifo_path.c_str());
+      std::remove((fifo_path + ".csi").c_str());
+      std::remove((copy_path + ".csi").c_str());
+      int res = mkfifo(fifo_path.c_str(), 0600);
+      assert(res == 0);
+
+      std::string received;
+      std::thread consumer([&fifo_path, &received]()
+      {
+        std::ifstream ifs(fifo_path, std::ios::binary);
+        received.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+      });
+
+      {
+        savvy::reader input(SAVVYT_VCF_FILE);
+        savvy::writer output(fifo_path, fmt, input.headers(), input.samples(), savvy::writer::format_default_compression_level, explicit_index ? copy_path + ".csi" : "");
+
+        savvy::variant var;
+        while (input.read(var))
+          output.write(var);
+
+        assert(output.good() && !input.bad());
+      }
+      consumer.join();
+      std::remove(fifo_path.c_str());
+
+      assert(!file_exists(fifo_path + ".csi"));
+      assert(file_exists(copy_path + ".csi") == explicit_index);
+
+      std::ofstream(copy_path, std::ios::binary) << received;
+      if (explicit_index)
+      {
+        for (const auto& reg : regions)
+          check_region_query(copy_path, reg);
+      }
+      else
+      {
+        run_file_checksum_test(SAVVYT_VCF_FILE, copy_path, "GT");
+      }
+    }
+  }
+}
+
+void parallel_scan_test()
+{
+  // Small blocks so that the file is split into several shards.
+  std::string path = std::string(SAVVYT_SAV_FILE_HARD) + ".shard.sav";
+  std::vector<std::pair<std::string, std::uint32_t>> expected;
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output(path, savvy::file::format::sav2, input.headers(), input.samples());
+    output.set_block_size(2);
+
+    savvy::variant var;
+    while (input.read(var))
+    {
+      expected.emplace_back(var.chromosome(), var.position());
+      output.write(var);
+    }
+    assert(output.good() && !input.bad());
+  }
+
+  savvy::reader rdr(path);
+  std::vector<savvy::scan_shard> shards = rdr.make_shards(3);
+  assert(shards.size() == 3);
+  std::uint64_t shard_total = 0;
+  for (auto it = shards.begin(); it != shards.end(); ++it)
+    shard_total += it->record_count;
+  assert(shard_total == expected.size());
+
+  // parallel_for_each_variant() splits the file into shards_per_thread shards per thread.
+  const std::size_t thread_cnt = 3;
+  const std::size_t max_shard_cnt = thread_cnt * savvy::parallel_scan_options().shards_per_thread;
+  std::vector<std::size_t> counts(max_shard_cnt);
+  std::mutex mtx;
+  bool scan_ok = savvy::parallel_for_each_variant(path, thread_cnt, [&](std::size_t shard_id, savvy::variant& /*var*/)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++counts.at(shard_id);
+  });
+  assert(scan_ok);
+  assert(std::accumulate(counts.begin(), counts.end(), std::size_t(0)) == expected.size());
+
+  std::vector<std::pair<std::string, std::uint32_t>> observed;
+  bool transform_ok = savvy::parallel_transform_variants(path, thread_cnt,
+    [](std::size_t, savvy::variant& var) { return std::make_pair(var.chromosome(), var.position()); },
+    [&observed](std::pair<std::string, std::uint32_t>&& p) { observed.push_back(std::move(p)); });
+  assert(transform_ok);
+  assert(observed == expected);
+}
+
+// Checks that every S1R leaf of an indexed SAV file has block statistics with a matching record count.
+void check_block_stats_match_index(const std::string& path, std::size_t record_cnt)
+{
+  savvy::block_statistics_index stats;
+  bool stats_loaded = stats.load(path);
+  assert(stats_loaded);
+
+  savvy::s1r::reader idx(path);
+  std::size_t leaf_cnt = 0;
+  auto q = idx.create_query(savvy::genomic_region(""));
+  for (auto it = q.begin(); it != q.end(); ++it, ++leaf_cnt)
+  {
+    const savvy::block_statistics* b = stats.find(it->value() >> 16u);
+    assert(b && b->record_count == (it->value() & 0xFFFFu) + 1);
+  }
+  assert(leaf_cnt == stats.blocks().size());
+
+  savvy::block_statistics total;
+  for (auto it = stats.blocks().begin(); it != stats.blocks().end(); ++it)
+    total += *it;
+  assert(total.record_count == record_cnt);
+}
+
+// Parses "<label>\t<count>" lines printed by sav stat.
+std::map<std::string, std::uint64_t> read_stat_output(const std::string& path)
+{
+  std::map<std::string, std::uint64_t> ret;
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line))
+  {
+    std::size_t tab = line.rfind('\t');
+    if (tab != std::string::npos)
+      ret[line.substr(0, tab)] = std::strtoull(line.c_str() + tab + 1, nullptr, 10);
+  }
+  return ret;
+}
+
+void block_stats_test(const std::string& sav_path)
+{
+  for (std::size_t threads : {1, 4})
+  {
+    std::string path = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats.sav";
+    std::array<std::uint32_t, savvy::block_statistics::ac_bucket_count> expected_histogram = {{}};
+    std::size_t record_cnt = 0;
+    {
+      savvy::reader input(SAVVYT_VCF_FILE);
+      savvy::writer output(path, savvy::file::format::sav2, input.headers(), input.samples(), savvy::writer::default_compression_level, "", threads);
+      output.set_block_size(3);
+      bool stats_enabled = output.set_block_statistics(true);
+      assert(stats_enabled);
+
+      savvy::variant var;
+      std::uint64_t ac, an;
+      while (input.read(var))
+      {
+        if (savvy::block_statistics::allele_counts(var, ac, an))
+          ++expected_histogram[savvy::block_statistics::ac_bucket(ac)];
+        output.write(var);
+        ++record_cnt;
+      }
+      assert(output.good() && !input.bad());
+    }
+
+    // Every S1R leaf has statistics, and totals match records.
+    check_block_stats_match_index(path, record_cnt);
+
+    savvy::block_statistics_index stats;
+    bool stats_loaded = stats.load(path);
+    assert(stats_loaded);
+    savvy::block_statistics total;
+    for (auto it = stats.blocks().begin(); it != stats.blocks().end(); ++it)
+      total += *it;
+    assert(total.ac_histogram == expected_histogram);
+    assert(std::find(stats.format_keys().begin(), stats.format_keys().end(), "GT") != stats.format_keys().end());
+
+    // Statistics frame is skipped by sequential reads.
+    savvy::reader rdr(path);
+    savvy::variant var;
+    std::size_t read_cnt = 0;
+    while (rdr.read(var))
+      ++read_cnt;
+    assert(read_cnt == record_cnt && !rdr.bad());
+  }
+
+  // Requests for outputs without an S1R index are ignored.
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output(std::string(SAVVYT_SAV_FILE_HARD) + ".bstats.bcf", savvy::file::format::bcf, input.headers(), input.samples());
+    bool stats_enabled = output.set_block_statistics(true);
+    assert(!stats_enabled);
+    bool stats_disabled = output.set_block_statistics(false);
+    assert(stats_disabled);
+  }
+
+  // Block file positions change when files are concatenated or reheaded, so statistics must follow the index.
+  std::string path_a = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_a.sav";
+  std::string path_b = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_b.sav";
+  std::string concat_path = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_concat.sav";
+  std::string rehead_path = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_rehead.sav";
+  std::string ids_path = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_ids.txt";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    savvy::writer output_a(path_a, savvy::file::format::sav2, input.headers(), input.samples());
+    savvy::writer output_b(path_b, savvy::file::format::sav2, input.headers(), input.samples());
+    output_a.set_block_size(3);
+    output_b.set_block_size(2);
+    output_a.set_block_statistics(true);
+    output_b.set_block_statistics(true);
+
+    savvy::variant var;
+    for (std::size_t i = 0; input.read(var); ++i)
+      (i < 10 ? output_a : output_b).write(var);
+    assert(output_a.good() && output_b.good() && !input.bad());
+
+    std::ofstream ids_ofs(ids_path);
+    for (const auto& id : input.samples())
+      ids_ofs << id << "_new\n";
+  }
+
+  bool concat_ok = run_sav(sav_path, "concat -o \"" + concat_path + "\" \"" + path_a + "\" \"" + path_b + "\"");
+  assert(concat_ok);
+  check_block_stats_match_index(concat_path, SAVVYT_MARKER_COUNT_HARD);
+
+  bool rehead_ok = run_sav(sav_path, "rehead -I \"" + ids_path + "\" \"" + concat_path + "\" \"" + rehead_path + "\"");
+  assert(rehead_ok);
+  check_block_stats_match_index(rehead_path, SAVVYT_MARKER_COUNT_HARD);
+
+  // MAF counts of --maf-below are compared to a full scan. Block kinds (4 records each) are chosen so that some
+  // blocks are summarized from statistics, some straddle the threshold, and blocks cut by the region edges must be
+  // decompressed even though their range is below the threshold. Records without GT have unknown frequencies.
+  enum block_kind { rare, common, mixed };
+  const std::vector<block_kind> kinds = {rare, rare, common, rare, mixed, rare, common, mixed, mixed, rare};
+  const std::size_t n_haplotypes = 8;
+  std::string maf_path = std::string(SAVVYT_SAV_FILE_HARD) + ".bstats_maf.sav";
+  {
+    std::vector<std::pair<std::string, std::string>> headers = {
+      {"fileformat", "VCFv4.2"},
+      {"contig", "<ID=1,length=10000>"},
+      {"FORMAT", "<ID=GT,Number=1,Type=String,Description=\"Genotype\">"}};
+    savvy::writer output(maf_path, savvy::file::format::sav2, headers, {"S1", "S2", "S3", "S4"});
+    output.set_block_size(4);
+    bool stats_enabled = output.set_block_statistics(true);
+    assert(stats_enabled);
+
+    std::vector<std::int8_t> gt(n_haplotypes);
+    for (std::size_t i = 0; i < kinds.size() * 4; ++i)
+    {
+      std::size_t j = i % 4;
+      savvy::variant var("1", 100 * (i + 1), "A", {"T"});
+      if (kinds[i / 4] != common && j == 2)
+      {
+        output.write(var); // Unknown frequency
+        continue;
+      }
+
+      std::size_t ac = kinds[i / 4] == rare ? j % 2 : (kinds[i / 4] == common || j % 2 ? 4 : 1);
+      std::fill(gt.begin(), gt.end(), 0);
+      std::fill(gt.begin(), gt.begin() + ac, 1);
+      var.set_format("GT", gt);
+      output.write(var);
+    }
+    assert(output.good());
+  }
+
+  const float threshold = 0.2f;
+  const savvy::genomic_region reg("1", 250, 3850);
+  std::string stat_out_path = maf_path + ".stat.txt";
+  bool stat_ok = run_sav(sav_path, "stat --maf-below 0.2 -r 1:250-3850 \"" + maf_path + "\" > \"" + stat_out_path + "\"");
+  assert(stat_ok);
+  std::map<std::string, std::uint64_t> stat_out = read_stat_output(stat_out_path);
+
+  std::uint64_t expected_records = 0, expected_below = 0;
+  savvy::reader rdr(maf_path);
+  savvy::variant var;
+  while (rdr.read(var))
+  {
+    if (var.position() < reg.from() || var.position() > reg.to())
+      continue;
+    ++expected_records;
+    std::uint64_t ac, an;
+    if (savvy::block_statistics::allele_counts(var, ac, an) && an && ac <= an)
+    {
+      float af = savvy::block_statistics::allele_frequency(ac, an);
+      if (std::min(af, 1.f - af) < threshold)
+        ++expected_below;
+    }
+  }
+  assert(!rdr.bad());
+
+  assert(stat_out["records"] == expected_records);
+  assert(stat_out["maf below 0.2"] == expected_below);
+  assert(stat_out["blocks summarized"] == 5); // Blocks 1, 2, 3, 5 and 6
+  assert(stat_out["blocks decompressed"] == 5); // Edge blocks 0 and 9 along with mixed blocks 4, 7 and 8
+}
+
+void concat_test(const std::string& sav_path)
+{
+  // The second file lists INFO and FORMAT headers in reverse, so its dictionary IDs differ from the output's.
+  std::string path_a = std::string(SAVVYT_SAV_FILE_HARD) + ".concat_a.sav";
+  std::string path_b = std::string(SAVVYT_SAV_FILE_HARD) + ".concat_b.sav";
+  std::string out_path = std::string(SAVVYT_SAV_FILE_HARD) + ".concat.sav";
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    std::vector<std::pair<std::string, std::string>> headers_b;
+    std::vector<std::pair<std::string, std::string>> reversed;
+    for (const auto& h : input.headers())
+    {
+      if (h.first == "INFO" || h.first == "FORMAT")
+        reversed.insert(reversed.begin(), h);
+      else
+        headers_b.push_back(h);
+    }
+    headers_b.insert(headers_b.end(), reversed.begin(), reversed.end());
+
+    savvy::writer output_a(path_a, savvy::file::format::sav2, input.headers(), input.samples());
+    savvy::writer output_b(path_b, savvy::file::format::sav2, headers_b, input.samples());
+    assert(output_a.dictionary().str_to_int != output_b.dictionary().str_to_int);
+    output_a.set_block_size(4);
+    output_b.set_block_size(4);
+
+    savvy::variant var;
+    for (std::size_t i = 0; input.read(var); ++i)
+      (i < SAVVYT_MARKER_COUNT_HARD / 2 ? output_a : output_b).write(var);
+    assert(output_a.good() && output_b.good() && !input.bad());
+  }
+
+  std::vector<std::string> expected;
+  std::vector<std::pair<std::string, std::string>> expected_headers;
+  for (const std::string& path : {path_a, path_b})
+  {
+    savvy::reader rdr(path);
+    savvy::variant var;
+    while (rdr.read(var))
+      expected.push_back(record_string(var));
+    assert(!rdr.bad());
+
+    for (const auto& h : rdr.headers())
+    {
+      if ((h.first == "INFO" || h.first == "FORMAT") && std::find(expected_headers.begin(), expected_headers.end(), h) == expected_headers.end())
+        expected_headers.push_back(h);
+    }
+  }
+  assert(expected.size() == SAVVYT_MARKER_COUNT_HARD);
+
+  bool concat_ok = run_sav(sav_path, "concat -5 -o \"" + out_path + "\" \"" + path_a + "\" \"" + path_b + "\"");
+  assert(concat_ok);
+
+  savvy::reader rdr(out_path);
+  for (const auto& h : expected_headers)
+    assert(std::find(rdr.headers().begin(), rdr.headers().end(), h) != rdr.headers().end());
+
+  std::vector<std::string> observed;
+  savvy::variant var;
+  while (rdr.read(var))
+    observed.push_back(record_string(var));
+  assert(!rdr.bad());
+  assert(observed == expected);
+
+  // The S1R index is rewritten, so region queries reach records of both inputs.
+  rdr.reset_bounds(savvy::genomic_region("20"));
+  std::size_t cnt = 0;
+  while (rdr.read(var))
+    ++cnt;
+  assert(!rdr.bad());
+  assert(cnt == std::size_t(std::count_if(expected.begin(), expected.end(), [](const std::string& r) { return r.compare(0, 3, "20\t") == 0; })));
+}
+
+void merge_test(const std::string& sav_path)
+{
+  // Samples are split between two files, and the second file only has every other record.
+  std::string path_a = std::string(SAVVYT_SAV_FILE_HARD) + ".merge_a.sav";
+  std::string path_b = std::string(SAVVYT_SAV_FILE_HARD) + ".merge_b.sav";
+  std::string out_path = std::string(SAVVYT_SAV_FILE_HARD) + ".merge.sav";
+  std::vector<std::string> samples_a, samples_b;
+  for (const std::string& path : {path_a, path_b})
+  {
+    savvy::reader input(SAVVYT_VCF_FILE);
+    std::vector<std::string> samples = input.subset_samples(path == path_a ? std::unordered_set<std::string>{"NA00001", "NA00002", "NA00003"} : std::unordered_set<std::string>{"NA00004", "NA00005", "NA00006"});
+    (path == path_a ? samples_a : samples_b) = samples;
+    savvy::writer output(path, savvy::file::format::sav2, input.headers(), samples);
+
+    savvy::variant var;
+    for (std::size_t i = 0; input.read(var); ++i)
+    {
+      if (path == path_a || i % 2 == 0)
+        output.write(var);
+    }
+    assert(output.good() && !input.bad());
+  }
+
+  bool merge_ok = run_sav(sav_path, "merge -o \"" + out_path + "\" \"" + path_a + "\" \"" + path_b + "\"");
+  assert(merge_ok);
+
+  std::vector<std::string> expected_samples = samples_a;
+  expected_samples.insert(expected_samples.end(), samples_b.begin(), samples_b.end());
+
+  savvy::reader rdr_a(path_a);
+  savvy::reader rdr_b(path_b);
+  savvy::reader rdr(out_path);
+  assert(rdr.samples() == expected_samples);
+
+  savvy::variant var_a, var_b, var;
+  bool has_b = rdr_b.read(var_b);
+  std::vector<std::int32_t> gt_a, gt_b, gt, expected_gt;
+  std::size_t cnt = 0;
+  while (rdr_a.read(var_a))
+  {
+    bool read_ok = rdr.read(var);
+    assert(read_ok);
+    assert(var.chromosome() == var_a.chromosome() && var.position() == var_a.position() && var.ref() == var_a.ref() && var.alts() == var_a.alts());
+
+    var_a.get_format("GT", gt_a);
+    expected_gt = gt_a;
+    std::size_t ploidy = gt_a.size() / samples_a.size();
+    if (has_b && var_b.position() == var_a.position() && var_b.chromosome() == var_a.chromosome())
+    {
+      var_b.get_format("GT", gt_b);
+      assert(gt_b.size() == ploidy * samples_b.size());
+      expected_gt.insert(expected_gt.end(), gt_b.begin(), gt_b.end());
+      has_b = rdr_b.read(var_b);
+    }
+    else
+    {
+      // Samples of an input that does not have the site are missing.
+      expected_gt.resize(ploidy * expected_samples.size(), savvy::typed_value::missing_value<std::int32_t>());
+    }
+
+    var.get_format("GT", gt);
+    assert(gt == expected_gt);
+    ++cnt;
+  }
+
+  assert(!has_b && !rdr_a.bad() && !rdr_b.bad());
+  bool extra_record = rdr.read(var);
+  assert(!extra_record && !rdr.bad());
+  assert(cnt == SAVVYT_MARKER_COUNT_HARD);
+}
+
+// Ordering of the original sort comparators, which compared sites directly instead of packed keys.
+class reference_sort_order
+{
+public:
+  reference_sort_order(savvy::s1r::sort_point point, std::unordered_map<std::string, std::size_t> contig_order, bool descending) :
+    contig_order_(std::move(contig_order)),
+    point_(point),
+    descending_(descending)
+  {
+  }
+
+  bool operator()(const savvy::site_info& a, const savvy::site_info& b) const
+  {
+    if (a.chromosome() == b.chromosome())
+      return descending_ ? sort_point(a) > sort_point(b) : sort_point(a) < sort_point(b);
+
+    auto a_res = contig_order_.find(a.chromosome());
+    auto b_res = contig_order_.find(b.chromosome());
+    bool a_known = a_res != contig_order_.end(), b_known = b_res != contig_order_.end();
+    if (a_known && b_known)
+      return descending_ ? a_res->second > b_res->second : a_res->second < b_res->second;
+    if (!a_known && !b_known)
+      return descending_ ? a.chromosome() > b.chromosome() : a.chromosome() < b.chromosome();
+    return descending_ ? b_known : a_known; // Contigs missing from headers go last.
+  }
+private:
+  double sort_point(const savvy::site_info& s) const
+  {
+    std::size_t max_allele_size = s.ref().size();
+    for (auto it = s.alts().begin(); it != s.alts().end(); ++it)
+      max_allele_size = std::max(max_allele_size, it->size());
+
+    if (point_ == savvy::s1r::sort_point::mid)
+      return static_cast<double>(s.position()) + static_cast<double>(max_allele_size) / 2.0;
+    if (point_ == savvy::s1r::sort_point::end)
+      return static_cast<double>(s.position() + max_allele_size);
+    return static_cast<double>(s.position());
+  }
+
+  std::unordered_map<std::string, std::size_t> contig_order_;
+  savvy::s1r::sort_point point_;
+  bool descending_;
+};
+
+// Random site with many position ties and indels of varying length.
+savvy::variant random_sort_site(std::mt19937& rng, const std::vector<std::string>& contigs, std::size_t index)
+{
+  const std::string bases = "ACGT";
+  auto random_allele = [&]()
+  {
+    std::string ret(1 + rng() % 4, 'A');
+    for (auto it = ret.begin(); it != ret.end(); ++it)
+      *it = bases[rng() % bases.size()];
+    return ret;
+  };
+
+  std::vector<std::string> alts(1 + rng() % 2);
+  for (auto it = alts.begin(); it != alts.end(); ++it)
+    *it = random_allele();
+  return savvy::variant(contigs[rng() % contigs.size()], 1 + rng() % 100, random_allele(), alts, "r" + std::to_string(index));
+}
+
+void sort_test(const std::string& sav_path)
+{
+  const std::vector<std::pair<std::string, savvy::s1r::sort_point>> points = {{"beg", savvy::s1r::sort_point::beg}, {"mid", savvy::s1r::sort_point::mid}, {"end", savvy::s1r::sort_point::end}};
+  std::mt19937 rng(1234);
+
+  // Packed keys are compared against the original ordering, including contigs missing from headers, which sav sort
+  // cannot write but which the comparators still have to order. Positions near the 32-bit limit check the key packing.
+  {
+    std::unordered_map<std::string, std::size_t> contig_order = {{"2", 0}, {"1", 1}};
+    std::vector<savvy::variant> sites;
+    for (std::size_t i = 0; i < 2000; ++i)
+      sites.push_back(random_sort_site(rng, {"2", "1", "X", "10", "Y"}, i));
+    sites.emplace_back("1", 0xFFFFFFF0u, "ACGT", std::vector<std::string>{"A"});
+    sites.emplace_back("1", 0xFFFFFFF1u, "A", std::vector<std::string>{"ACGTACGT"});
+    sites.emplace_back("X", 0xFFFFFFF1u, "A", std::vector<std::string>{"C"});
+
+    for (const auto& p : points)
+    {
+      for (bool descending : {false, true})
+      {
+        sort_key_builder make_key(p.second, contig_order);
+        std::vector<sort_key> keys;
+        for (std::size_t i = 0; i < sites.size(); ++i)
+          keys.push_back(make_key(sites[i], i));
+        if (descending)
+          std::sort(keys.begin(), keys.end(), greater_than_comparator());
+        else
+          std::sort(keys.begin(), keys.end(), less_than_comparator());
+
+        std::vector<std::size_t> expected(sites.size());
+        std::iota(expected.begin(), expected.end(), 0);
+        reference_sort_order ref(p.second, contig_order, descending);
+        std::stable_sort(expected.begin(), expected.end(), [&](std::size_t a, std::size_t b) { return ref(sites[a], sites[b]); });
+
+        for (std::size_t i = 0; i < keys.size(); ++i)
+          assert(keys[i].index == expected[i]);
+      }
+    }
+  }
+
+  // Header order of contigs differs from name order. Record IDs identify ties, so the output must match a stable sort.
+  std::string in_path = std::string(SAVVYT_SAV_FILE_HARD) + ".sort_in.sav";
+  std::vector<savvy::variant> input_sites;
+  {
+    std::vector<std::pair<std::string, std::string>> headers = {
+      {"fileformat", "VCFv4.2"},
+      {"contig", "<ID=2,length=1000>"},
+      {"contig", "<ID=1,length=1000>"}};
+    savvy::writer output(in_path, savvy::file::format::sav2, headers, {"S1"});
+    for (std::size_t i = 0; i < 3000; ++i)
+    {
+      input_sites.push_back(random_sort_site(rng, {"2", "1"}, i));
+      output.write(input_sites.back());
+    }
+    assert(output.good());
+  }
+
+  std::unordered_map<std::string, std::size_t> contig_order = {{"2", 0}, {"1", 1}};
+  for (const auto& p : points)
+  {
+    for (bool descending : {false, true})
+    {
+      std::vector<std::size_t> order(input_sites.size());
+      std::iota(order.begin(), order.end(), 0);
+      reference_sort_order ref(p.second, contig_order, descending);
+      std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return ref(input_sites[a], input_sites[b]); });
+
+      std::vector<std::string> expected;
+      for (auto it = order.begin(); it != order.end(); ++it)
+        expected.push_back(input_sites[*it].id());
+
+      // A 1K memory limit holds a few records per run, so there are more runs than max_merge_width and
+      // reduce_runs merges them in an extra pass.
+      for (const std::string& mem_args : {"", "-m 1K -t 4 "})
+      {
+        std::string out_path = in_path + ".sorted.sav";
+        bool sort_ok = run_sav(sav_path, "sort " + mem_args + "-p " + p.first + " -d " + (descending ? "desc" : "asc") + " -o \"" + out_path + "\" \"" + in_path + "\"");
+        assert(sort_ok);
+
+        std::vector<std::string> observed;
+        savvy::reader rdr(out_path);
+        savvy::variant var;
+        while (rdr.read(var))
+          observed.push_back(var.id());
+        assert(!rdr.bad());
+        assert(observed == expected);
+      }
+    }
+  }
+}
+
+// Parses --per-sample-out files into counts keyed by sample ID.
+std::map<std::string, std::vector<std::size_t>> read_per_sample_output(const std::string& path)
+{
+  std::map<std::string, std::vector<std::size_t>> ret;
+  std::ifstream ifs(path);
+  std::string line;
+  while (std::getline(ifs, line))
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream ss(line);
+    std::string sample_id;
+    ss >> sample_id;
+    std::vector<std::size_t>& counts = ret[sample_id];
+    std::size_t cnt;
+    while (ss >> cnt)
+      counts.push_back(cnt);
+  }
+  return ret;
+}
+
+void stat_test(const std::string& sav_path)
+{
+  // S5 has missing alleles and S6 is haploid. Samples with any missing or end-of-vector allele are not counted.
+  const std::vector<std::string> samples = {"S1", "S2", "S3", "S4", "S5", "S6"};
+  const std::vector<std::string> annotations = {"", "A|synonymous|G1", "A|missense&splice_region|G1", "A|synonymous|G1,A|missense|G2", "A|stop_retained&synonymous|G1"};
+  const std::int8_t missing = savvy::typed_value::missing_value<std::int8_t>();
+  const std::int8_t end_of_vector = savvy::typed_value::end_of_vector_value<std::int8_t>();
+  std::string path = std::string(SAVVYT_SAV_FILE_HARD) + ".stat.sav";
+  {
+    std::vector<std::pair<std::string, std::string>> headers = {
+      {"fileformat", "VCFv4.2"},
+      {"contig", "<ID=1,length=100000>"},
+      {"INFO", "<ID=ANN,Number=.,Type=String,Description=\"Annotation\">"},
+      {"FORMAT", "<ID=GT,Number=1,Type=String,Description=\"Genotype\">"}};
+    savvy::writer output(path, savvy::file::format::sav2, headers, samples);
+    output.set_block_size(16); // Gives parallel_for_each_shard several shards.
+
+    std::mt19937 rng(42);
+    std::vector<std::int8_t> gt(samples.size() * 2);
+    for (std::size_t i = 0; i < 400; ++i)
+    {
+      savvy::variant var("1", 100 * (i + 1), "A", {i % 3 ? "T" : "TG"});
+      const std::string& ann = annotations[rng() % annotations.size()];
+      if (ann.size())
+        var.set_info("ANN", ann);
+
+      for (std::size_t j = 0; j < gt.size(); ++j)
+        gt[j] = rng() % 4 == 0 ? 1 : 0;
+      gt[8] = rng() % 3 == 0 ? missing : gt[8];
+      gt[9] = rng() % 5 == 0 ? missing : gt[9];
+      gt[11] = end_of_vector;
+      var.set_format("GT", gt);
+      output.write(var);
+    }
+    assert(output.good());
+  }
+
+  // Dense reference computed from the whole GT vector of every record.
+  std::map<std::string, std::vector<std::size_t>> expected;
+  for (const auto& id : samples)
+    expected[id].assign(6, 0);
+  {
+    savvy::reader rdr(path);
+    savvy::variant var;
+    std::vector<std::int8_t> geno;
+    std::string ann;
+    while (rdr.read(var))
+    {
+      bool is_snp = var.ref().size() == 1 && var.alts()[0].size() == 1;
+      bool has_ann = var.get_info("ANN", ann);
+      bool is_nonsyn = has_ann && ann.find("missense") != std::string::npos;
+      bool is_syn = has_ann && !is_nonsyn && ann.find("synonymous") != std::string::npos;
+
+      bool has_gt = var.get_format("GT", geno);
+      assert(has_gt && geno.size() == samples.size() * 2);
+      for (std::size_t j = 0; j < samples.size(); ++j)
+      {
+        if (geno[2 * j] < 0 || geno[2 * j + 1] < 0)
+          continue;
+        std::size_t g = geno[2 * j] + geno[2 * j + 1];
+        if (!g)
+          continue;
+
+        std::vector<std::size_t>& counts = expected[samples[j]]; // n_het, n_hom, n_snp, n_indel, n_syn, n_nonsyn
+        ++counts[g == 1 ? 0 : 1];
+        counts[is_snp ? 2 : 3] += g;
+        if (is_syn)
+          counts[4] += g;
+        if (is_nonsyn)
+          counts[5] += g;
+      }
+    }
+    assert(!rdr.bad());
+  }
+  assert(expected["S6"] == std::vector<std::size_t>(6, 0));
+  assert(expected["S1"][0] && expected["S1"][1] && expected["S1"][3] && expected["S1"][4] && expected["S1"][5]);
+
+  // Single-threaded reads go through stat_accumulator::add directly, and -t 4 goes through parallel_for_each_shard.
+  for (const std::string& thread_args : {"", "-t 4 "})
+  {
+    std::string per_sample_path = path + ".per_sample.tsv";
+    std::remove(per_sample_path.c_str());
+    bool stat_ok = run_sav(sav_path, "stat " + thread_args + "--per-sample-out \"" + per_sample_path + "\" \"" + path + "\" > /dev/null");
+    assert(stat_ok);
+    assert(read_per_sample_output(per_sample_path) == expected);
+  }
+}
+
 void sav_random_access_test(const std::string& fmt_field)
 {
   savvy::reader rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
@@ -692,6 +2014,31 @@ void sav_random_access_test(const std::string& fmt_field)
   assert(!rdr.read(anno));
 }
 
+void multi_region_test(const std::string& fmt_field)
+{
+  // The last region overlaps the third, so its record should be tagged with the earlier region.
+  std::vector<savvy::genomic_region> regions = {{"18", 2234600, 2234700}, {"20", 1234600, 1234700}, {"20", 1234701, 2234567}, {"20", 1234767, 1234767}};
+  std::vector<std::pair<std::uint32_t, std::size_t>> expected = {{2234668, 0}, {2234679, 0}, {2234687, 0}, {2234697, 0}, {1234667, 1}, {1234767, 2}, {2230237, 2}, {2234567, 2}};
+
+  for (std::size_t threads : {1, 2})
+  {
+    savvy::reader rdr(fmt_field == "GT" ? SAVVYT_SAV_FILE_HARD : SAVVYT_SAV_FILE_DOSE);
+    rdr.set_threads(threads);
+    assert(rdr.reset_bounds(regions).good());
+
+    savvy::variant var;
+    std::vector<std::pair<std::uint32_t, std::size_t>> observed;
+    while (rdr.read(var))
+    {
+      assert(var.chromosome() == regions[rdr.region_index()].chromosome());
+      observed.emplace_back(var.position(), rdr.region_index());
+    }
+
+    assert(!rdr.bad());
+    assert(observed == expected);
+  }
+}
+
 void generic_reader_test(const std::string& path, const std::string& fmt_field, std::size_t expected_markers)
 {
   savvy::reader rdr(path);
@@ -746,7 +2093,23 @@ int main(int argc, char** argv)
     std::cout << "- convert-file" << std::endl;
     std::cout << "- generic-reader" << std::endl;
     std::cout << "- random-access" << std::endl;
+    std::cout << "- multi-region" << std::endl;
+    std::cout << "- parallel-scan" << std::endl;
+    std::cout << "- concat" << std::endl;
+    std::cout << "- merge" << std::endl;
+    std::cout << "- sort" << std::endl;
+    std::cout << "- stat" << std::endl;
     std::cout << "- subset" << std::endl;
+    std::cout << "- threaded-read" << std::endl;
+    std::cout << "- threaded-write" << std::endl;
+    std::cout << "- vcf-write" << std::endl;
+    std::cout << "- csi" << std::endl;
+    std::cout << "- interned-keys" << std::endl;
+    std::cout << "- lazy-format" << std::endl;
+    std::cout << "- projection" << std::endl;
+    std::cout << "- subset-decode" << std::endl;
+    std::cout << "- sparse-conversion" << std::endl;
+    std::cout << "- read-matrix" << std::endl;
     std::cout << "- varint" << std::endl;
     std::cin >> cmd;
   }
@@ -779,6 +2142,63 @@ int main(int argc, char** argv)
     sav_random_access_test("GT");
     sav_random_access_test("HDS");
   }
+  else if (cmd == "multi-region")
+  {
+    if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test("GT");
+    if (!file_exists(SAVVYT_SAV_FILE_DOSE)) convert_file_test("HDS");
+
+    multi_region_test("GT");
+    multi_region_test("HDS");
+  }
+  else if (cmd == "parallel-scan")
+  {
+    parallel_scan_test();
+  }
+  else if (cmd == "block-stats")
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Path to sav executable required" << std::endl;
+      return EXIT_FAILURE;
+    }
+    block_stats_test(argv[2]);
+  }
+  else if (cmd == "concat")
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Path to sav executable required" << std::endl;
+      return EXIT_FAILURE;
+    }
+    concat_test(argv[2]);
+  }
+  else if (cmd == "merge")
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Path to sav executable required" << std::endl;
+      return EXIT_FAILURE;
+    }
+    merge_test(argv[2]);
+  }
+  else if (cmd == "sort")
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Path to sav executable required" << std::endl;
+      return EXIT_FAILURE;
+    }
+    sort_test(argv[2]);
+  }
+  else if (cmd == "stat")
+  {
+    if (argc < 3)
+    {
+      std::cerr << "Path to sav executable required" << std::endl;
+      return EXIT_FAILURE;
+    }
+    stat_test(argv[2]);
+  }
   else if (cmd == "subset")
   {
     if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test("GT");
@@ -786,6 +2206,65 @@ int main(int argc, char** argv)
     subset_test<savvy::reader>(SAVVYT_VCF_FILE, "GT");
     subset_test<savvy::reader>(SAVVYT_SAV_FILE_HARD, "GT");
   }
+  else if (cmd == "threaded-read")
+  {
+    if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test("GT");
+    if (!file_exists(SAVVYT_SAV_FILE_DOSE)) convert_file_test("HDS");
+
+    threaded_read_test("GT");
+    threaded_read_test("HDS");
+  }
+  else if (cmd == "threaded-write")
+  {
+    threaded_write_test();
+  }
+  else if (cmd == "csi")
+  {
+    csi_test();
+  }
+  else if (cmd == "vcf-write")
+  {
+    if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test("GT");
+    if (!file_exists(SAVVYT_SAV_FILE_DOSE)) convert_file_test("HDS");
+
+    vcf_write_test("GT");
+    vcf_write_test("HDS");
+  }
+  else if (cmd == "interned-keys")
+  {
+    interned_key_test();
+  }
+  else if (cmd == "lazy-format")
+  {
+    lazy_format_test();
+  }
+  else if (cmd == "projection")
+  {
+    projection_test();
+  }
+  else if (cmd == "subset-decode")
+  {
+    subset_decode_test();
+  }
+  else if (cmd == "sparse-conversion")
+  {
+    sparse_conversion_test<std::int8_t>(1);
+    sparse_conversion_test<std::int16_t>(-300);
+    sparse_conversion_test<std::int32_t>(70000);
+    sparse_conversion_test<float>(0.5f);
+  }
+  else if (cmd == "read-matrix")
+  {
+    if (!file_exists(SAVVYT_SAV_FILE_HARD)) convert_file_test("GT");
+    if (!file_exists(SAVVYT_SAV_FILE_DOSE)) convert_file_test("HDS");
+
+    read_matrix_test("GT");
+    read_matrix_test("HDS");
+  }
+  else if (cmd == "vcf-parser")
+  {
+    vcf_parser_test();
+  }
   else if (cmd == "varint")
   {
     varint_test();